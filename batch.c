@@ -0,0 +1,60 @@
+#include <libwasm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int main(int argc, const char* argv[]) {
+    Config config = {0};
+    Batch batch = {0};
+
+    argv++;
+    if (argc > 2 && !strcmp(*argv, "-j")) {
+        config.threads = atoi(argv[1]);
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc < 2) {
+        printf("Usage: batch [-j threads] file1 file2 ... fileN\n");
+        return 1;
+    }
+
+    uint32_t n = argc - 1;
+    BatchItem* items = calloc(n, sizeof(BatchItem));
+    if (!items) 
+        return 1;
+
+    for (uint32_t i = 0; i < n; i++) 
+        items[i].name = argv[i];
+
+    int s = createBatch(&batch, &config, items, n);
+    if (s) {
+        printf("Error: %s\n", errString(s));
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    loadBatch(&batch);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (items[i].status) {
+            printf("%s: Error: %s\n", items[i].name, errString(items[i].status));
+            failed++;
+        }
+        else {
+            Module* mod = getModuleFromReader(&items[i].reader);
+            printf("%s: %lu functions, %lu globals\n", items[i].name, mod->nfuncs, mod->nglobals);
+        }
+    }
+
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    printf("Loaded %u of %u modules in %.3f ms\n", n - failed, n, ms);
+
+    destroyBatch(&batch);
+    free(items);
+    return failed != 0;
+}
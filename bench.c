@@ -0,0 +1,883 @@
+#include <libwasm.h>
+#include <read_utils.h>
+#include "precompiled-hashes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Repeat each measurement until it has run for at least this long
+#define MIN_SECONDS 0.5
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static uint64_t iterate(struct InstructionIterator* it) {
+    uint64_t n = 0;
+    const Instruction* instr;
+    while ((instr = nextInstruction(it)))
+        n += instr->opcode != WASM_OP_NOP;
+
+    return n;
+}
+
+// Decoding into instructions and going over both forms of every body
+static int benchDecode(Module* mod, const char* name) {
+    Arena arena;
+    if (createArena(&arena, 0))
+        return 1;
+
+    uint64_t ninstrs = 0, bytes = 0, runs = 0;
+    double start = now(), elapsed;
+    do {
+        resetArena(&arena);
+        for (uint32_t i = 0; i < mod->nfuncs; i++) {
+            Code* code;
+            DecodedCode decoded;
+            if (getFunctionCode(mod, i, &code) || !code)
+                continue;
+
+            int s = decodeCode(code, &arena, &decoded);
+            if (s) {
+                printf("%s: function %u: Error: %s\n", name, i, errString(s));
+                destroyArena(&arena);
+                return 1;
+            }
+
+            ninstrs += decoded.ninstrs;
+            bytes += code->codeSize;
+        }
+
+        runs++;
+        elapsed = now() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    printf("%s: decode %.1f M instructions/s, %.1f MB/s (%lu instructions in %lu bytes)\n",
+           name, ninstrs / elapsed / 1e6, bytes / elapsed / 1e6, ninstrs / runs, bytes / runs);
+
+    // Keep one decoded copy around to compare iterating over both forms
+    resetArena(&arena);
+    uint32_t ncode = 0;
+    DecodedCode* all = malloc(sizeof(DecodedCode) * (mod->nfuncs + 1));
+    Code** codes = malloc(sizeof(Code*) * (mod->nfuncs + 1));
+    for (uint32_t i = 0; all && codes && i < mod->nfuncs; i++) {
+        if (getFunctionCode(mod, i, &codes[ncode]) || !codes[ncode])
+            continue;
+
+        if (!decodeCode(codes[ncode], &arena, &all[ncode]))
+            ncode++;
+    }
+
+    for (int form = 0; form < 2; form++) {
+        uint64_t n = 0;
+        start = now();
+        do {
+            for (uint32_t i = 0; i < ncode; i++) {
+                struct InstructionIterator it;
+                if (form)
+                    iterateDecodedCode(&it, &all[i]);
+                else
+                    iterateCode(&it, codes[i]);
+
+                n += iterate(&it);
+            }
+
+            elapsed = now() - start;
+        } while (elapsed < MIN_SECONDS);
+
+        printf("%s: iterate %s %.1f M instructions/s\n", name, (form) ? "decoded" : "raw    ", n / elapsed / 1e6);
+    }
+
+    free(all);
+    free(codes);
+    destroyArena(&arena);
+    return 0;
+}
+
+// validateModule() on fresh parses of the module, which links it and type
+// checks every body, then validateFunction() on every body of this one.
+// Both are per byte of code
+static int benchValidate(Module* mod, const char* name) {
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < mod->nfuncs; i++) {
+        Code* code;
+        if (!getFunctionCode(mod, i, &code) && code)
+            bytes += code->codeSize;
+    }
+
+    uint64_t runs = 0;
+    double elapsed = 0;
+    do {
+        Config config = {0};
+        Reader reader = {0};
+        int s = createReaderFromBuffer(&reader, &config, mod->_source, mod->_sourceSize);
+        if (!s)
+            s = parseModule(&reader);
+
+        // parseModule() validated it already, do it over
+        if (!s) {
+            getModuleFromReader(&reader)->_validated = 0;
+            getModuleFromReader(&reader)->_linked = 0;
+        }
+
+        double start = now();
+        if (!s)
+            s = validateModule(getModuleFromReader(&reader));
+        elapsed += now() - start;
+        destroyReader(&reader);
+        if (s) {
+            printf("%s: Error: %s\n", name, errString(s));
+            return 1;
+        }
+
+        runs++;
+    } while (elapsed < MIN_SECONDS);
+
+    printf("%s: validateModule %.1f MB/s", name, bytes * runs / elapsed / 1e6);
+
+    runs = 0;
+    double start = now();
+    do {
+        for (uint32_t i = 0; i < mod->nfuncs; i++) {
+            int s = validateFunction(mod, i);
+            if (s) {
+                printf("\n%s: function %u: Error: %s\n", name, i, errString(s));
+                return 1;
+            }
+        }
+
+        runs++;
+        elapsed = now() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    printf(", validateFunction %.1f MB/s (%lu bytes of code)\n", bytes * runs / elapsed / 1e6, bytes);
+    return 0;
+}
+
+// Milliseconds for parseModule() on the module's bytes under flags,
+// averaged over as many parses as fit in MIN_SECONDS
+static int timeParse(Module* mod, uint32_t flags, uint32_t threads, double* ms) {
+    uint64_t runs = 0;
+    double elapsed = 0;
+    do {
+        Config config = {0};
+        Reader reader = {0};
+        config.flags = flags;
+        config.threads = threads;
+        int s = createReaderFromBuffer(&reader, &config, mod->_source, mod->_sourceSize);
+
+        double start = now();
+        if (!s)
+            s = parseModule(&reader);
+        elapsed += now() - start;
+        destroyReader(&reader);
+        if (s)
+            return s;
+
+        runs++;
+    } while (elapsed < MIN_SECONDS);
+
+    *ms = elapsed / runs * 1e3;
+    return WASM_SUCCESS;
+}
+
+// parseModule() with the Code section decoded one body at a time, then
+// under WASM_CONFIG_PARALLEL_CODE on more and more threads. It takes tens
+// of thousands of bodies before the threads have enough to share,
+//   python3 testing/kernels.py /tmp/k.wasm 10000 big.wasm
+// writes 60000 of them
+static int benchParse(Module* mod, const char* name) {
+    static const uint32_t threads[] = { 1, 2, 4, 8 };
+
+    double sequential;
+    int s = timeParse(mod, 0, 0, &sequential);
+    if (s) {
+        printf("%s: Error: %s\n", name, errString(s));
+        return 1;
+    }
+
+    printf("%s: parse %lu functions, sequential %.3f ms", name, mod->nfuncs, sequential);
+    for (uint32_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        double ms;
+        s = timeParse(mod, WASM_CONFIG_PARALLEL_CODE, threads[i], &ms);
+        if (s) {
+            printf("\n%s: %u threads: Error: %s\n", name, threads[i], errString(s));
+            return 1;
+        }
+
+        printf(", %u thread%s %.3f ms (%.2fx)", threads[i], (threads[i] > 1) ? "s" : "", ms, sequential / ms);
+    }
+
+    printf("\n");
+    return 0;
+}
+
+/*
+ * What "bench interp" measures everything against: a switch over the
+ * bytes of the body the way a first interpreter would be written. Every
+ * immediate is decoded again each time it runs and branches out of a
+ * block scan forward for its end. Memory, globals and the table are the
+ * instance's. Only what the kernels use is known, the rest fails with
+ * WASM_INVALID_OPCODE
+ */
+#define NAIVE_LABELS 64
+#define NAIVE_DEPTH  1024
+
+struct NaiveLabel {
+    uint32_t  pc;     // just past the blocktype, where a loop starts again
+    uint8_t   loop;
+    uint8_t   arity;
+    uint64_t* height; // of the operand stack when the block was entered
+};
+
+static uint64_t naiveLEB(const uint8_t* code, uint32_t* pc, int sign) {
+    uint64_t ret = 0;
+    uint32_t shift = 0;
+    uint8_t d;
+    do {
+        d = code[(*pc)++];
+        if (shift < 64)
+            ret |= (uint64_t) (d & 0x7F) << shift;
+        shift += 7;
+    } while (d & 0x80);
+
+    if (sign && shift < 64 && (d & 0x40))
+        ret |= ~0ULL << shift;
+    return ret;
+}
+
+// Moves pc past the immediates of op
+static void naiveSkip(const uint8_t* code, uint32_t* pc, uint8_t op) {
+    switch (op) {
+        case WASM_OP_BLOCK ... WASM_OP_IF:
+        case WASM_OP_MEMORY_SIZE:
+        case WASM_OP_MEMORY_GROW:
+            (*pc)++;
+            break;
+
+        case WASM_OP_BR_TABLE: {
+            uint64_t n = naiveLEB(code, pc, 0);
+            for (uint64_t i = 0; i <= n; i++)
+                naiveLEB(code, pc, 0);
+            break;
+        }
+
+        case WASM_OP_CALL_INDIRECT:
+            naiveLEB(code, pc, 0);
+            (*pc)++;
+            break;
+
+        case WASM_OP_I32_LOAD ... WASM_OP_I64_STORE32:
+            naiveLEB(code, pc, 0);
+            // fallthrough
+        case WASM_OP_BR:
+        case WASM_OP_BR_IF:
+        case WASM_OP_CALL:
+        case WASM_OP_LOCAL_GET ... WASM_OP_GLOBAL_SET:
+        case WASM_OP_I32_CONST:
+        case WASM_OP_I64_CONST:
+        case 0xFC:
+            naiveLEB(code, pc, 0);
+            break;
+
+        case WASM_OP_F32_CONST: *pc += 4; break;
+        case WASM_OP_F64_CONST: *pc += 8; break;
+    }
+}
+
+// From just inside a block to just past its end, or past its else when
+// stopAtElse is set and it has one. Returns the opcode it stopped at
+static uint8_t naiveSkipBlock(const uint8_t* code, uint32_t* pc, int stopAtElse) {
+    uint32_t depth = 0;
+    while (1) {
+        uint8_t op = code[(*pc)++];
+        if (op == WASM_OP_BLOCK || op == WASM_OP_LOOP || op == WASM_OP_IF)
+            depth++;
+        else if (op == WASM_OP_END && !depth--)
+            return op;
+        else if (op == WASM_OP_ELSE && !depth && stopAtElse)
+            return op;
+
+        naiveSkip(code, pc, op);
+    }
+}
+
+static double naiveF64(uint64_t v) {
+    double d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+static uint64_t naiveBits(double d) {
+    uint64_t v;
+    memcpy(&v, &d, sizeof(v));
+    return v;
+}
+
+// Calls function idx, whose arguments are the last values on sp. Its
+// result replaces them
+static int naiveCall(Instance* instance, uint32_t idx, uint64_t** spp, uint64_t* limit, uint32_t depth) {
+    Module* mod = instance->module;
+    struct TypeSectionType* type = mod->functions[idx].signature;
+    Code* code = mod->functions[idx].code;
+    if (!code)
+        return WASM_TRAP_UNBOUND_IMPORT;
+
+    // Every instruction pushes at most one value
+    uint64_t* locals = *spp - type->paramsLen;
+    uint64_t* sp = *spp;
+    if (depth >= NAIVE_DEPTH || sp + code->localSize + code->codeSize > limit)
+        return WASM_TRAP_STACK_OVERFLOW;
+
+    for (uint32_t i = 0; i < code->localSize; i++)
+        *sp++ = 0;
+
+    const uint8_t* bytes = code->expr;
+    struct NaiveLabel labels[NAIVE_LABELS];
+    uint32_t nlabels = 1, pc = 0;
+    labels[0] = (struct NaiveLabel) { 0, 0, type->ret != 0, sp };
+
+#define I32(v)  ((uint32_t) (v))
+#define S32(v)  ((int32_t) (v))
+#define S64(v)  ((int64_t) (v))
+#define BIN(type, get, expr) { type y = get(*--sp); type x = get(sp[-1]); sp[-1] = (expr); break; }
+#define UN(type, get, expr)  { type x = get(sp[-1]); sp[-1] = (expr); break; }
+#define LOAD(type, size)                                                   \
+    {                                                                      \
+        naiveLEB(bytes, &pc, 0);                                           \
+        uint64_t addr = I32(sp[-1]) + naiveLEB(bytes, &pc, 0);             \
+        if (addr + size > instance->memorySize)                            \
+            return WASM_TRAP_OUT_OF_BOUNDS;                                \
+        type v;                                                            \
+        memcpy(&v, instance->memory + addr, size);                         \
+        sp[-1] = (uint64_t) v;                                             \
+        break;                                                             \
+    }
+#define STORE(type, size)                                                  \
+    {                                                                      \
+        naiveLEB(bytes, &pc, 0);                                           \
+        uint64_t offset = naiveLEB(bytes, &pc, 0);                         \
+        type v = (type) *--sp;                                             \
+        uint64_t addr = I32(*--sp) + offset;                               \
+        if (addr + size > instance->memorySize)                            \
+            return WASM_TRAP_OUT_OF_BOUNDS;                                \
+        memcpy(instance->memory + addr, &v, size);                         \
+        break;                                                             \
+    }
+
+    while (1) {
+        uint8_t op = bytes[pc++];
+        switch (op) {
+            case WASM_OP_UNREACHABLE:
+                return WASM_TRAP_UNREACHABLE;
+
+            case WASM_OP_NOP:
+                break;
+
+            case WASM_OP_BLOCK:
+            case WASM_OP_LOOP:
+            case WASM_OP_IF: {
+                uint8_t blocktype = bytes[pc++];
+                if (nlabels == NAIVE_LABELS)
+                    return WASM_TRAP_STACK_OVERFLOW;
+
+                if (op == WASM_OP_IF && !I32(*--sp)) {
+                    // Without an else there is nothing left of the if
+                    if (naiveSkipBlock(bytes, &pc, 1) == WASM_OP_END)
+                        break;
+                }
+
+                labels[nlabels++] = (struct NaiveLabel) { pc, op == WASM_OP_LOOP, blocktype != 0x40, sp };
+                break;
+            }
+
+            case WASM_OP_ELSE:
+                // The then branch ran to its end
+                naiveSkipBlock(bytes, &pc, 0);
+                nlabels--;
+                break;
+
+            case WASM_OP_END:
+                if (--nlabels)
+                    break;
+                // fallthrough
+            case WASM_OP_RETURN:
+                if (type->ret)
+                    locals[0] = sp[-1];
+                *spp = locals + (type->ret != 0);
+                return WASM_SUCCESS;
+
+            case WASM_OP_BR_IF:
+                if (!I32(*--sp)) {
+                    naiveLEB(bytes, &pc, 0);
+                    break;
+                }
+                // fallthrough
+            case WASM_OP_BR:
+            case WASM_OP_BR_TABLE: {
+                uint64_t label = naiveLEB(bytes, &pc, 0);
+                if (op == WASM_OP_BR_TABLE) {
+                    uint32_t i = I32(*--sp);
+                    for (uint64_t j = 0; j <= label; j++) {
+                        uint64_t l = naiveLEB(bytes, &pc, 0);
+                        if (j == i || j == label) {
+                            label = l;
+                            break;
+                        }
+                    }
+                }
+
+                struct NaiveLabel* target = &labels[nlabels - 1 - label];
+                if (target->loop) {
+                    sp = target->height;
+                    pc = target->pc;
+                    nlabels -= label;
+                    break;
+                }
+
+                if (target->arity)
+                    *target->height = sp[-1];
+                sp = target->height + target->arity;
+                nlabels -= label + 1;
+
+                // Out of the function itself
+                if (!nlabels) {
+                    if (target->arity)
+                        locals[0] = *target->height;
+                    *spp = locals + target->arity;
+                    return WASM_SUCCESS;
+                }
+
+                pc = target->pc;
+                naiveSkipBlock(bytes, &pc, 0);
+                break;
+            }
+
+            case WASM_OP_CALL: {
+                int s = naiveCall(instance, naiveLEB(bytes, &pc, 0), &sp, limit, depth + 1);
+                if (s)
+                    return s;
+                break;
+            }
+
+            case WASM_OP_CALL_INDIRECT: {
+                uint64_t typeidx = naiveLEB(bytes, &pc, 0);
+                pc++;
+                uint32_t i = I32(*--sp);
+                if (i >= instance->tableSize || instance->table[i] == UINT32_MAX)
+                    return WASM_TRAP_UNDEFINED_ELEMENT;
+
+                struct TypeSectionType* want = &instance->_types[typeidx];
+                struct TypeSectionType* got = mod->functions[instance->table[i]].signature;
+                if (want != got && (want->paramsLen != got->paramsLen || want->ret != got->ret ||
+                    memcmp(want->params, got->params, want->paramsLen)))
+                    return WASM_TRAP_SIGNATURE_MISMATCH;
+
+                int s = naiveCall(instance, instance->table[i], &sp, limit, depth + 1);
+                if (s)
+                    return s;
+                break;
+            }
+
+            case WASM_OP_DROP:
+                sp--;
+                break;
+
+            case WASM_OP_SELECT: {
+                uint32_t c = I32(*--sp);
+                sp--;
+                if (!c)
+                    sp[-1] = sp[0];
+                break;
+            }
+
+            case WASM_OP_LOCAL_GET: *sp++ = locals[naiveLEB(bytes, &pc, 0)]; break;
+            case WASM_OP_LOCAL_SET: locals[naiveLEB(bytes, &pc, 0)] = *--sp; break;
+            case WASM_OP_LOCAL_TEE: locals[naiveLEB(bytes, &pc, 0)] = sp[-1]; break;
+            case WASM_OP_GLOBAL_GET: *sp++ = instance->globals[naiveLEB(bytes, &pc, 0)]; break;
+            case WASM_OP_GLOBAL_SET: instance->globals[naiveLEB(bytes, &pc, 0)] = *--sp; break;
+
+            case WASM_OP_I32_LOAD:  LOAD(uint32_t, 4)
+            case WASM_OP_I64_LOAD:  LOAD(uint64_t, 8)
+            case WASM_OP_F64_LOAD:  LOAD(uint64_t, 8)
+            case WASM_OP_I32_STORE: STORE(uint32_t, 4)
+            case WASM_OP_I64_STORE: STORE(uint64_t, 8)
+            case WASM_OP_F64_STORE: STORE(uint64_t, 8)
+
+            case WASM_OP_MEMORY_SIZE:
+                pc++;
+                *sp++ = instance->memorySize / 65536;
+                break;
+
+            case WASM_OP_I32_CONST: *sp++ = I32(naiveLEB(bytes, &pc, 1)); break;
+            case WASM_OP_I64_CONST: *sp++ = naiveLEB(bytes, &pc, 1); break;
+            case WASM_OP_F64_CONST: memcpy(sp++, bytes + pc, 8); pc += 8; break;
+
+            case WASM_OP_I32_EQZ: UN(uint32_t, I32, x == 0)
+            case WASM_OP_I32_EQ:   BIN(uint32_t, I32, x == y)
+            case WASM_OP_I32_NE:   BIN(uint32_t, I32, x != y)
+            case WASM_OP_I32_LT_S: BIN(int32_t, S32, x < y)
+            case WASM_OP_I32_LT_U: BIN(uint32_t, I32, x < y)
+            case WASM_OP_I32_GT_S: BIN(int32_t, S32, x > y)
+            case WASM_OP_I32_GT_U: BIN(uint32_t, I32, x > y)
+            case WASM_OP_I32_LE_S: BIN(int32_t, S32, x <= y)
+            case WASM_OP_I32_LE_U: BIN(uint32_t, I32, x <= y)
+            case WASM_OP_I32_GE_S: BIN(int32_t, S32, x >= y)
+            case WASM_OP_I32_GE_U: BIN(uint32_t, I32, x >= y)
+            case WASM_OP_I64_EQZ: UN(uint64_t, , x == 0)
+            case WASM_OP_I64_EQ:   BIN(uint64_t, , x == y)
+            case WASM_OP_I64_NE:   BIN(uint64_t, , x != y)
+            case WASM_OP_I64_LT_S: BIN(int64_t, S64, x < y)
+            case WASM_OP_I64_LT_U: BIN(uint64_t, , x < y)
+            case WASM_OP_I64_GT_S: BIN(int64_t, S64, x > y)
+            case WASM_OP_I64_GT_U: BIN(uint64_t, , x > y)
+            case WASM_OP_F64_EQ: BIN(double, naiveF64, x == y)
+            case WASM_OP_F64_NE: BIN(double, naiveF64, x != y)
+            case WASM_OP_F64_LT: BIN(double, naiveF64, x < y)
+            case WASM_OP_F64_GT: BIN(double, naiveF64, x > y)
+
+            case WASM_OP_I32_ADD: BIN(uint32_t, I32, I32(x + y))
+            case WASM_OP_I32_SUB: BIN(uint32_t, I32, I32(x - y))
+            case WASM_OP_I32_MUL: BIN(uint32_t, I32, I32(x * y))
+            case WASM_OP_I32_AND: BIN(uint32_t, I32, x & y)
+            case WASM_OP_I32_OR:  BIN(uint32_t, I32, x | y)
+            case WASM_OP_I32_XOR: BIN(uint32_t, I32, x ^ y)
+            case WASM_OP_I32_SHL: BIN(uint32_t, I32, I32(x << (y & 31)))
+            case WASM_OP_I32_SHR_S: BIN(int32_t, S32, I32(x >> (y & 31)))
+            case WASM_OP_I32_SHR_U: BIN(uint32_t, I32, x >> (y & 31))
+            case WASM_OP_I32_DIV_U:
+            case WASM_OP_I32_REM_U: {
+                uint32_t y = I32(*--sp), x = I32(sp[-1]);
+                if (!y)
+                    return WASM_TRAP_DIVIDE_BY_ZERO;
+                sp[-1] = (op == WASM_OP_I32_DIV_U) ? x / y : x % y;
+                break;
+            }
+
+            case WASM_OP_I64_ADD: BIN(uint64_t, , x + y)
+            case WASM_OP_I64_SUB: BIN(uint64_t, , x - y)
+            case WASM_OP_I64_MUL: BIN(uint64_t, , x * y)
+            case WASM_OP_I64_AND: BIN(uint64_t, , x & y)
+            case WASM_OP_I64_SHL: BIN(uint64_t, , x << (y & 63))
+            case WASM_OP_I64_SHR_U: BIN(uint64_t, , x >> (y & 63))
+            case WASM_OP_I64_DIV_U:
+            case WASM_OP_I64_REM_U: {
+                uint64_t y = *--sp, x = sp[-1];
+                if (!y)
+                    return WASM_TRAP_DIVIDE_BY_ZERO;
+                sp[-1] = (op == WASM_OP_I64_DIV_U) ? x / y : x % y;
+                break;
+            }
+
+            case WASM_OP_F64_ADD: BIN(double, naiveF64, naiveBits(x + y))
+            case WASM_OP_F64_SUB: BIN(double, naiveF64, naiveBits(x - y))
+            case WASM_OP_F64_MUL: BIN(double, naiveF64, naiveBits(x * y))
+            case WASM_OP_F64_DIV: BIN(double, naiveF64, naiveBits(x / y))
+
+            case WASM_OP_I32_WRAP_I64:     UN(uint64_t, , I32(x))
+            case WASM_OP_I64_EXTEND_I32_S: UN(int32_t, S32, (uint64_t) (int64_t) x)
+            case WASM_OP_I64_EXTEND_I32_U: UN(uint32_t, I32, x)
+            case WASM_OP_F64_CONVERT_I32_S: UN(int32_t, S32, naiveBits(x))
+            case WASM_OP_F64_CONVERT_I32_U: UN(uint32_t, I32, naiveBits(x))
+            case WASM_OP_F64_CONVERT_I64_S: UN(int64_t, S64, naiveBits(x))
+            case WASM_OP_F64_CONVERT_I64_U: UN(uint64_t, , naiveBits(x))
+
+            default:
+                return WASM_INVALID_OPCODE;
+        }
+    }
+
+#undef I32
+#undef S32
+#undef S64
+#undef BIN
+#undef UN
+#undef LOAD
+#undef STORE
+}
+
+// timeCalls() for the naive interpreter, on an instance for its memory,
+// globals and table
+static int timeNaive(Module* mod, uint32_t idx, double* seconds, uint64_t* result) {
+    Instance instance;
+    struct WasmInstanceConfig config = { .flags = WASM_INSTANCE_SWITCH };
+    int s = createInstance(&instance, mod, &config);
+    if (s)
+        return s;
+
+    uint64_t* stack = malloc(sizeof(uint64_t) * WASM_DEFAULT_STACK_SLOTS);
+    uint64_t* sp = stack;
+    s = (stack) ? naiveCall(&instance, idx, &sp, stack + WASM_DEFAULT_STACK_SLOTS, 0) : WASM_OUT_OF_MEMORY;
+
+    uint64_t calls = 0;
+    double start = now(), elapsed = 0;
+    while (!s && elapsed < MIN_SECONDS) {
+        sp = stack;
+        s = naiveCall(&instance, idx, &sp, stack + WASM_DEFAULT_STACK_SLOTS, 0);
+        calls++;
+        elapsed = now() - start;
+    }
+
+    *seconds = (calls) ? elapsed / calls : 0;
+    *result = (stack) ? stack[0] : 0;
+    free(stack);
+    destroyInstance(&instance);
+    return s;
+}
+
+// Seconds per call of function idx and what it returned, run under the
+// dispatch flags selects, compiling what is called jitThreshold times
+// under WASM_INSTANCE_JIT. *ops is how many ops the interpreter ran per
+// call, 0 unless the library was built with -DWASM_COUNT_DISPATCH
+static int timeCalls(Module* mod, uint32_t idx, uint32_t flags, uint32_t jitThreshold, double* seconds, uint64_t* result, uint64_t* ops) {
+    Instance instance;
+    struct WasmInstanceConfig config = { .flags = flags, .jitThreshold = jitThreshold };
+    int s = createInstance(&instance, mod, &config);
+    if (s)
+        return s;
+
+    // The first call translates the function
+    uint64_t slots[1] = {0};
+    s = callFunction(&instance, idx, slots);
+
+    uint64_t calls = 0;
+    double start = now(), elapsed = 0;
+    while (!s && elapsed < MIN_SECONDS) {
+        s = callFunction(&instance, idx, slots);
+        calls++;
+        elapsed = now() - start;
+    }
+
+    *seconds = (calls) ? elapsed / calls : 0;
+    *result = slots[0];
+    *ops = instance.dispatches / (calls + 1);
+    destroyInstance(&instance);
+    return s;
+}
+
+// What "bench interp" runs every kernel under, against the first
+static const struct {
+    const char* name;
+    uint32_t    flags;
+    uint32_t    jitThreshold;
+    int         naive;
+} interpModes[] = {
+    { "naive",     0,                                           0, 1 },
+    { "switch",    WASM_INSTANCE_SWITCH,                        0, 0 },
+    { "threaded",  0,                                           0, 0 },
+    { "registers", WASM_INSTANCE_REGISTERS,                     0, 0 },
+    { "jit",       WASM_INSTANCE_JIT | WASM_INSTANCE_REGISTERS, 1, 0 },
+    { "tiered",    WASM_INSTANCE_JIT | WASM_INSTANCE_REGISTERS, 0, 0 },
+};
+
+// Every bench_ export that takes nothing, under each of interpModes. All
+// of them have to agree on what it returns
+static int benchInterp(Module* mod, const char* name) {
+    struct Section* exports;
+    if (getSection(mod, WASM_HASH_Export, &exports) || !exports) {
+        printf("%s: no exports to run\n", name);
+        return 1;
+    }
+
+    uint32_t nmodes = sizeof(interpModes) / sizeof(interpModes[0]);
+    for (uint32_t i = 0; i < exports->flags; i++) {
+        Export* e = &exports->exports[i];
+        if (e->type != WASM_TYPEIDX || e->nameLen < 6 || memcmp(e->name, "bench_", 6) ||
+            e->index >= mod->nfuncs || mod->functions[e->index].signature->paramsLen)
+            continue;
+
+        printf("%s: %-20.*s", name, e->nameLen, e->name);
+        double baseline = 0;
+        uint64_t expected = 0;
+        for (uint32_t m = 0; m < nmodes; m++) {
+            double seconds;
+            uint64_t result, ops = 0;
+            int s = (interpModes[m].naive) ? timeNaive(mod, e->index, &seconds, &result) :
+                    timeCalls(mod, e->index, interpModes[m].flags, interpModes[m].jitThreshold, &seconds, &result, &ops);
+            if (s) {
+                printf("\n%s: %.*s: Error: %s\n", name, e->nameLen, e->name, errString(s));
+                return 1;
+            }
+
+            if (m && result != expected) {
+                printf("\n%s: %.*s returned %lu under %s but %lu under %s\n", name, e->nameLen, e->name,
+                       expected, interpModes[0].name, result, interpModes[m].name);
+                return 1;
+            }
+
+            if (!m) {
+                baseline = seconds;
+                expected = result;
+                printf(" %s %8.3f ms", interpModes[m].name, seconds * 1e3);
+            }
+            else
+                printf(", %s %8.3f ms (%.2fx)", interpModes[m].name, seconds * 1e3, baseline / seconds);
+
+            // Compiled code is not counted, a JIT mode's count would only
+            // be whatever ran before it
+            if (ops && !(interpModes[m].flags & WASM_INSTANCE_JIT))
+                printf(" %.1fM ops", ops / 1e6);
+        }
+
+        printf("\n");
+    }
+
+    return 0;
+}
+
+/*
+ * "bench leb" needs no module: fetchU32() against the byte at a time loop
+ * it had before fetchLEB(), over LEB128 values of two mixes. The first is
+ * 70% one byte values, about what indices and counts in code come to, the
+ * second is 32-bit values drawn evenly, most of which take five bytes
+ */
+#define LEB_VALUES (4 * 1024 * 1024)
+
+__attribute__((noinline)) static uint32_t oldFetchU32(struct WasmModuleReader* reader) {
+    uint8_t* data = reader->_data;
+    uint8_t bits[] = {0, 0, 0, 0, 0};
+    for (int i = 0; i <= 4; i++) {
+        if (reader->offset >= reader->size) {
+            reader->offset = UINT32_MAX;
+            return 0;
+        }
+
+        uint8_t d = *(data + reader->offset);
+        reader->offset += 1;
+        bits[i] = d & 127;
+        if (!(d & 0x80))
+            break;
+    }
+
+    return ((uint32_t) bits[4] << 28) | (bits[3] << 21) | (bits[2] << 14) | (bits[1] << 7) | bits[0];
+}
+
+static uint32_t lebRandom(uint64_t* state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t) (*state >> 32);
+}
+
+// Mix 0 is mostly short values, mix 1 evenly drawn ones
+static uint32_t lebValue(uint64_t* state, int mix) {
+    uint32_t r = lebRandom(state);
+    if (mix)
+        return r;
+
+    uint32_t pick = r % 100;
+    r = lebRandom(state);
+    if (pick < 70)
+        return r & 0x7F;
+    if (pick < 90)
+        return r & 0x3FFF;
+    if (pick < 97)
+        return r & 0x1FFFFF;
+    return r;
+}
+
+// Also sums one pass over the values, for the two to be compared
+static double timeLEB(uint8_t* buf, uint32_t size, int old, uint64_t* sum) {
+    uint64_t runs = 0;
+    double start = now(), elapsed;
+    do {
+        struct WasmModuleReader reader = { .size = size, .offset = 0, ._data = buf };
+        uint64_t pass = 0;
+        for (uint32_t i = 0; i < LEB_VALUES; i++)
+            pass += (old) ? oldFetchU32(&reader) : fetchU32(&reader);
+
+        *sum = pass;
+        runs++;
+        elapsed = now() - start;
+    } while (elapsed < MIN_SECONDS);
+
+    return LEB_VALUES * runs / elapsed / 1e6;
+}
+
+static int benchLEB(void) {
+    static const char* mixes[] = { "70% one byte", "evenly drawn" };
+    uint8_t* buf = malloc(LEB_VALUES * 5);
+    if (!buf)
+        return 1;
+
+    for (int mix = 0; mix < 2; mix++) {
+        uint64_t state = 1;
+        uint32_t size = 0;
+        for (uint32_t i = 0; i < LEB_VALUES; i++) {
+            uint32_t v = lebValue(&state, mix);
+            do {
+                buf[size++] = (v & 0x7F) | ((v >> 7) ? 0x80 : 0);
+                v >>= 7;
+            } while (v);
+        }
+
+        uint64_t oldSum, newSum;
+        double before = timeLEB(buf, size, 1, &oldSum);
+        double after = timeLEB(buf, size, 0, &newSum);
+        if (oldSum != newSum) {
+            printf("leb %s: fetchU32() and the old loop disagree\n", mixes[mix]);
+            free(buf);
+            return 1;
+        }
+
+        printf("leb %s: %.1f bytes per value, old %.1f M values/s, fetchU32 %.1f M values/s (%.2fx)\n",
+               mixes[mix], (double) size / LEB_VALUES, before, after, after / before);
+    }
+
+    free(buf);
+    return 0;
+}
+
+static const struct {
+    const char* name;
+    int       (*run)(Module* mod, const char* name);
+} benchmarks[] = {
+    { "parse",    benchParse },
+    { "decode",   benchDecode },
+    { "validate", benchValidate },
+    { "interp",   benchInterp },
+};
+
+int main(int argc, const char* argv[]) {
+    uint32_t nbench = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    uint32_t which = nbench;
+    for (uint32_t i = 0; argc > 1 && i < nbench; i++) {
+        if (!strcmp(argv[1], benchmarks[i].name))
+            which = i;
+    }
+
+    if (argc == 2 && !strcmp(argv[1], "leb"))
+        return benchLEB();
+
+    if (argc < 3 || which == nbench) {
+        printf("Usage: bench leb\n"
+               "       bench parse|decode|validate|interp file1 file2 ... fileN\n");
+        return 1;
+    }
+
+    for (int i = 2; i < argc; i++) {
+        Config config = {0};
+        Reader reader = {0};
+        config.name = argv[i];
+
+        int s = createReader(&reader, &config);
+        if (!s)
+            s = parseModule(&reader);
+        if (!s)
+            s = validateModule(getModuleFromReader(&reader));
+
+        if (s) {
+            printf("%s: Error: %s\n", argv[i], errString(s));
+            destroyReader(&reader);
+            return 1;
+        }
+
+        s = benchmarks[which].run(getModuleFromReader(&reader), argv[i]);
+        destroyReader(&reader);
+        if (s)
+            return 1;
+    }
+
+    return 0;
+}
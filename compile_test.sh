@@ -1,6 +1,6 @@
 #!/usr/bin/bash
 if [ "$1" == "all" ]; then
-	for file in testing/*
+	for file in testing/*.c
 	do
 		clang -target wasm32-unknown-none $file -Wl,--allow-undefined -nostdlib -nostdinc -o .$file.wasm -mcpu=mvp
 	done
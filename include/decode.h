@@ -0,0 +1,245 @@
+#ifndef __DECODE_H__
+#define __DECODE_H__
+
+#include "libwasm.h"
+#include "read_utils.h"
+#include "log.h"
+#include <string.h>
+
+// Reading single instructions out of a code expression, shared by the
+// decoder and the validator so both take exactly the same bytes apart
+
+// What follows an opcode in the code section
+enum {
+    IMM_INVALID = 0, // not an opcode we know
+    IMM_NONE,
+    IMM_BLOCKTYPE,
+    IMM_LABEL,
+    IMM_BR_TABLE,
+    IMM_INDEX,
+    IMM_CALL_INDIRECT,
+    IMM_MEMARG,
+    IMM_MEMORY,
+    IMM_I32,
+    IMM_I64,
+    IMM_F32,
+    IMM_F64,
+    IMM_PREFIX,
+};
+
+// IMM_* for every opcode byte, defined in decode.c
+extern const uint8_t instructionImmediates[256];
+
+// Number of 0xFC prefixed opcodes we know, see opcodes.h
+#define PREFIXED_OPCODES 8
+
+// What an instruction with no immediates that matter to typing takes
+// off the stack and puts back, 0 where there is nothing. b is popped
+// before a. Defined in typecheck.c for every opcode that has one
+struct Signature {
+    uint8_t a;
+    uint8_t b;
+    uint8_t result;
+    uint8_t align; // largest alignment of a memory access, as a power of 2
+};
+
+extern const struct Signature opcodeSignatures[256];
+extern const struct Signature prefixedSignatures[PREFIXED_OPCODES];
+
+// Blocks without results or with a single one, type indexes would be multi value
+#define CHECK_IF_VALID_BLOCKTYPE(x) ((x) == 0x40 || ((x) >= 0x7C && (x) <= 0x7F))
+
+// Nearly every opcode and index is a single byte, those are read here
+// without a call into read_utils. Also used for other single byte immediates
+static inline uint8_t fetchOpcode(struct WasmModuleReader* reader) {
+    if ((uint64_t) reader->offset + 1 < reader->size)
+        return ((uint8_t*) reader->_data)[reader->offset++];
+
+    return fetchRawU8(reader);
+}
+
+// read_utils may look at the byte after the end it is given, which is
+// still inside the module for a section but not for a body on its own.
+// Numbers that could reach the end of the body are read here instead
+static inline uint64_t fetchTail(struct WasmModuleReader* reader, uint32_t maxBytes, int sign) {
+    uint8_t* data = reader->_data;
+    uint64_t ret = 0;
+    uint32_t shift = 0;
+
+    for (uint32_t i = 0; i < maxBytes; i++) {
+        if ((uint64_t) reader->offset + 1 >= reader->size) {
+            reader->offset = UINT32_MAX;
+            return 0;
+        }
+
+        uint8_t d = data[reader->offset++];
+        if (shift < 64)
+            ret |= (uint64_t) (d & 0x7F) << shift;
+        shift += 7;
+
+        if (!(d & 0x80))
+            break;
+    }
+
+    if (sign && shift < 64 && ((ret >> (shift - 1)) & 1))
+        ret |= ~0ULL << shift;
+
+    return ret;
+}
+
+// The most bytes a leb128 number of 32 and 64 bits takes up
+#define MAX_LEB_32 5
+#define MAX_LEB_64 10
+
+#define NEAR_END(reader, n) ((uint64_t) (reader)->offset + (n) >= (reader)->size)
+
+static inline uint32_t fetchIndex(struct WasmModuleReader* reader) {
+    if ((uint64_t) reader->offset + 1 < reader->size) {
+        uint8_t d = ((uint8_t*) reader->_data)[reader->offset];
+        if (!(d & 0x80)) {
+            reader->offset++;
+            return d;
+        }
+    }
+
+    return NEAR_END(reader, MAX_LEB_32) ? fetchTail(reader, MAX_LEB_32, 0) : fetchU32(reader);
+}
+
+static inline int32_t fetchConst32(struct WasmModuleReader* reader) {
+    // Small constants fit in one byte, sign extended from its 7th bit
+    if ((uint64_t) reader->offset + 1 < reader->size) {
+        uint8_t d = ((uint8_t*) reader->_data)[reader->offset];
+        if (!(d & 0x80)) {
+            reader->offset++;
+            return (int32_t) ((uint32_t) d << 25) >> 25;
+        }
+    }
+
+    return NEAR_END(reader, MAX_LEB_32) ? (int32_t) fetchTail(reader, MAX_LEB_32, 1) : fetchI32(reader);
+}
+
+static inline int64_t fetchConst64(struct WasmModuleReader* reader) {
+    return NEAR_END(reader, MAX_LEB_64) ? (int64_t) fetchTail(reader, MAX_LEB_64, 1) : fetchI64(reader);
+}
+
+static inline const uint8_t* fetchBytes(struct WasmModuleReader* reader, uint32_t n) {
+    uint32_t offset = reader->offset;
+    skip(reader, n);
+    return (reader->offset == UINT32_MAX) ? NULL : (uint8_t*) reader->_data + offset;
+}
+
+// Decodes the instruction at reader->offset. Whatever refers to other
+// instructions is left at UINT32_MAX for decodeCode() to fill in
+static inline __attribute__((always_inline)) int decodeInstruction(struct WasmModuleReader* reader, struct Instruction* instr) {
+    uint8_t op = fetchOpcode(reader);
+    instr->opcode = op;
+    instr->_pad = 0;
+    instr->a = 0;
+    instr->b = 0;
+
+    switch (instructionImmediates[op]) {
+        case IMM_NONE:
+            if (op == WASM_OP_ELSE || op == WASM_OP_END) {
+                instr->a = UINT32_MAX;
+                instr->b = UINT32_MAX;
+            }
+            break;
+
+        case IMM_BLOCKTYPE:
+            instr->a = fetchOpcode(reader);
+            instr->b = (op == WASM_OP_IF) ? UINT64_MAX : UINT32_MAX;
+            if (reader->offset != UINT32_MAX && !CHECK_IF_VALID_BLOCKTYPE(instr->a)) {
+                error("Block type 0x%x is not a valtype or empty", instr->a);
+                return WASM_INVALID_TYPEVAL;
+            }
+            break;
+
+        case IMM_LABEL:
+            instr->a = fetchIndex(reader);
+            instr->b = UINT32_MAX;
+            break;
+
+        case IMM_BR_TABLE:
+            instr->a = fetchIndex(reader);
+            instr->b = reader->offset;
+            // The labels themselves are read again by whoever needs them
+            for (uint64_t i = 0; i <= instr->a && reader->offset != UINT32_MAX; i++)
+                fetchIndex(reader);
+            break;
+
+        case IMM_INDEX:
+            instr->a = fetchIndex(reader);
+            break;
+
+        case IMM_CALL_INDIRECT:
+            instr->a = fetchIndex(reader);
+            instr->b = fetchIndex(reader);
+            break;
+
+        case IMM_MEMARG:
+            instr->a = fetchIndex(reader);
+            instr->b = fetchIndex(reader);
+            break;
+
+        case IMM_MEMORY:
+            // A memory index in waiting, there is only memory 0 for now
+            instr->a = fetchOpcode(reader);
+            if (reader->offset != UINT32_MAX && instr->a) {
+                error("memory.size and memory.grow take a reserved 0 byte, not 0x%x", instr->a);
+                return WASM_INVALID_MEMORY_INDEX;
+            }
+            break;
+
+        case IMM_I32:
+            instr->a = (uint32_t) fetchConst32(reader);
+            break;
+
+        case IMM_I64:
+            instr->b = (uint64_t) fetchConst64(reader);
+            break;
+
+        case IMM_F32: {
+            const uint8_t* p = fetchBytes(reader, sizeof(uint32_t));
+            if (p)
+                memcpy(&instr->a, p, sizeof(uint32_t));
+            break;
+        }
+
+        case IMM_F64: {
+            const uint8_t* p = fetchBytes(reader, sizeof(uint64_t));
+            if (p)
+                memcpy(&instr->b, p, sizeof(uint64_t));
+            break;
+        }
+
+        case IMM_PREFIX: {
+            uint32_t sub = fetchIndex(reader);
+            if (reader->offset != UINT32_MAX && sub >= PREFIXED_OPCODES) {
+                error("Unknown opcode 0xFC 0x%x", sub);
+                return WASM_INVALID_OPCODE;
+            }
+
+            instr->opcode = 0xFC00 | sub;
+            break;
+        }
+
+        default:
+            error("Unknown opcode 0x%x", op);
+            return WASM_INVALID_OPCODE;
+    }
+
+    if (reader->offset == UINT32_MAX) {
+        error("Code expression is truncated");
+        return WASM_INVALID_EXPR;
+    }
+
+    return WASM_SUCCESS;
+}
+
+static inline void codeReader(struct WasmModuleReader* reader, const uint8_t* expr, uint32_t offset, uint32_t size) {
+    reader->_data = (void*) expr;
+    reader->offset = offset;
+    reader->size = size + 1;
+}
+
+#endif
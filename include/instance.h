@@ -0,0 +1,221 @@
+#ifndef __INSTANCE_H__
+#define __INSTANCE_H__
+
+#include "libwasm.h"
+#include "opcodes.h"
+#include <math.h>
+#include <string.h>
+
+// Ops the interpreter runs. Most are the wasm opcode they come from, with
+// these in the opcodes nothing uses:
+//   if            jumps to a unless the popped condition is set
+//   br, br_if     jumps to a, leaving the stack as it is
+//   OP_BR_MOVE    jumps to a, moving the top b & 1 values down to fp + (b >> 1)
+//   OP_BR_IF_MOVE the same if the popped condition is set
+//   br_table      a = labels without the default, b = the first BranchTarget of them
+//   return        the function's own end and every branch to it
+//   OP_HOT_LOOP   the start of loop a under WASM_INSTANCE_JIT, counts towards
+//                 compiling the function and runs the rest of it as machine code once it is
+// Register code names its operands and result as slots from fp instead,
+// see RegisterOp
+enum {
+	OP_TRUNC_SAT = 0xC5, // + the second byte of the 0xFC prefixed opcode
+	OP_BR_MOVE   = OP_TRUNC_SAT + 8,
+	OP_BR_IF_MOVE,
+	OP_HOT_LOOP,         // the loop is y in register code
+	OP_COPY,             // register code only, r = x
+	OP_IMM,              // register code only, + an integer binary opcode - WASM_OP_I32_EQ
+	OP_MAX       = OP_IMM + WASM_OP_I64_ROTR - WASM_OP_I32_EQ + 1
+};
+
+// One pre-decoded instruction. i64 and f64 constants are a | b << 32,
+// loads and stores have their offset in a, calls their function or type
+// index and local and global instructions their index
+struct Op {
+	const void* handler; // address of its code in the threaded interpreter, the op under the switch
+	uint32_t    a;
+	uint32_t    b;
+};
+
+// One op of register code, where values are slots from fp: locals first,
+// then operands by their height. Numeric ops and loads put x op y in r,
+// the ones in OP_IMM have y itself as their right operand, sign extended.
+// The rest:
+//   i64.const     r = x | y << 32, for every constant
+//   stores        x = address, y = offset, r = the value
+//   local.get/set/tee are not there, OP_COPY is what is left of them
+//   global.get/set r = global y, global y = x
+//   select        r = x unless y is set
+//   if            jumps to y unless x is set
+//   br            jumps to y, OP_BR_MOVE after r = x
+//   br_if         jumps to y if x is set, OP_BR_IF_MOVE to the BranchTarget y
+//   br_table      x is the index, r the labels without the default, y the first BranchTarget
+//   call          y = function, arguments from r on. call_indirect has its index in x
+//   return        x is the result
+struct RegisterOp {
+	const void* handler;
+	uint32_t    r;
+	uint32_t    x;
+	uint32_t    y;
+};
+
+// Where one label of a br_table goes, height and arity as in OP_BR_MOVE.
+// In register code height is the slot the value goes to and source the
+// one it comes from
+struct BranchTarget {
+	uint32_t op;
+	uint32_t height;
+	uint32_t arity;
+	uint32_t source;
+};
+
+struct CompiledFunction {
+	union {
+		struct Op*         code;
+		struct RegisterOp* registerCode; // under WASM_INSTANCE_REGISTERS
+	};
+	struct BranchTarget*    targets;
+	struct TypeSectionType* type;
+	uint32_t                nops;
+	uint32_t                nlocals;   // params included
+	uint32_t                frameSize; // slots of locals and the most operands there can be
+	uint32_t                index;
+	uint32_t                hotness;   // calls and loop iterations, until it reaches the instance's _jitThreshold
+	const void*             machine;   // entry of its machine code, NULL until the JIT compiles it
+	const void**            loops;     // where the machine code takes over each loop from the interpreter
+};
+
+// What a call from wasm has to get back to
+struct CallFrame {
+	const void*              ip; // a struct Op or a struct RegisterOp
+	uint64_t*                fp;
+	struct CompiledFunction* fn;
+};
+
+// Translates function idx of the instance's module, once
+int compileFunction(struct WasmInstance* instance, uint32_t idx, struct CompiledFunction** fn);
+
+// Runs fn with its locals at fp, the arguments already in place. The
+// result is left in fp[0]
+int runFunction(struct WasmInstance* instance, struct CompiledFunction* fn, uint64_t* fp);
+
+// Handlers of the threaded interpreter by op, for register code or stack
+// code. NULL where it is not built
+const void* const* threadedHandlers(int registers);
+
+// memory.grow, the pages there were before or -1 when it cannot grow
+int64_t growMemory(struct WasmInstance* instance, uint32_t delta);
+
+// Runs a host import, slots as for WasmHostFunction
+int callHost(struct WasmInstance* instance, uint32_t idx, uint64_t* slots);
+
+// Sets up instance->_jit, left NULL where there is no JIT
+int  createJit(struct WasmInstance* instance);
+void destroyJit(struct WasmInstance* instance);
+
+// Compiles fn to machine code. When it cannot the interpreter keeps
+// running it
+int jitFunction(struct WasmInstance* instance, struct CompiledFunction* fn);
+
+// Runs fn's machine code with its frame at fp, from the start or from the
+// start of loop, UINT32_MAX for the function's own start
+int runMachineCode(struct WasmInstance* instance, struct CompiledFunction* fn, uint64_t* fp, uint32_t loop);
+
+// Counts a call or a loop iteration of fn towards WASM_INSTANCE_JIT's
+// threshold, compiling it on the one that reaches it. Whether fn has
+// machine code to run now
+static inline int isHot(struct WasmInstance* instance, struct CompiledFunction* fn) {
+	if (!fn->machine && instance->_jit && ++fn->hotness == instance->_jitThreshold)
+		jitFunction(instance, fn);
+
+	return fn->machine != NULL;
+}
+
+// call_indirect compares types structurally, two modules' indexes can differ
+static inline int sameType(struct TypeSectionType* a, struct TypeSectionType* b) {
+	return a == b || (a->ret == b->ret && a->paramsLen == b->paramsLen && !memcmp(a->params, b->params, a->paramsLen));
+}
+
+// Values live in 64-bit slots, floats as their bits
+static inline float f32(uint64_t v) {
+	uint32_t bits = (uint32_t) v;
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static inline double f64(uint64_t v) {
+	double d;
+	memcpy(&d, &v, sizeof(d));
+	return d;
+}
+
+static inline uint64_t fromF32(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+static inline uint64_t fromF64(double d) {
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	return bits;
+}
+
+// fmin() and fmax() return the other operand for a NaN and may pick
+// either zero, wasm wants the NaN and -0 being less than +0
+static inline double wasmMin(double a, double b) {
+	if (a != a || b != b)
+		return a + b;
+	if (a == b)
+		return signbit(a) ? a : b;
+	return (a < b) ? a : b;
+}
+
+static inline double wasmMax(double a, double b) {
+	if (a != a || b != b)
+		return a + b;
+	if (a == b)
+		return signbit(a) ? b : a;
+	return (a > b) ? a : b;
+}
+
+// Saturating truncations, NaN goes to 0 and everything else to the
+// nearest value there is
+static inline uint32_t satI32(double x) {
+	if (x != x)
+		return 0;
+	if (x <= -2147483649.0)
+		return (uint32_t) INT32_MIN;
+	if (x >= 2147483648.0)
+		return INT32_MAX;
+	return (uint32_t) (int32_t) x;
+}
+
+static inline uint32_t satU32(double x) {
+	if (x != x || x <= -1.0)
+		return 0;
+	if (x >= 4294967296.0)
+		return UINT32_MAX;
+	return (uint32_t) x;
+}
+
+static inline uint64_t satI64(double x) {
+	if (x != x)
+		return 0;
+	if (x < -9223372036854775808.0)
+		return (uint64_t) INT64_MIN;
+	if (x >= 9223372036854775808.0)
+		return INT64_MAX;
+	return (uint64_t) (int64_t) x;
+}
+
+static inline uint64_t satU64(double x) {
+	if (x != x || x <= -1.0)
+		return 0;
+	if (x >= 18446744073709551616.0)
+		return UINT64_MAX;
+	return (uint64_t) x;
+}
+
+#endif
@@ -2,10 +2,19 @@
 #define __LIBWASM_H__
 
 #include <stdint.h>
+#include <stddef.h>
 #include "precompiled-hashes.h"
+#include "opcodes.h"
 
 struct WasmModule;
 struct WasmConfig;
+struct WasmArena;
+struct LazySections;
+struct SectionIndex;
+struct NameLookup;
+struct CacheEntry;
+struct ModuleCacheState;
+struct CheckContext;
 
 struct WasmModuleReader {
 	struct WasmModule* thisModule;
@@ -13,12 +22,66 @@ struct WasmModuleReader {
 	uint32_t           size;
 	uint32_t           offset;
 	void*              _data;
+	uint32_t           _storage; // how _data is held, one of WASM_STORAGE_*
+	struct WasmArena*  _arena;   // the module's arena if the reader created it
 };
 
+// values for WasmModuleReader._storage
+enum {
+	WASM_STORAGE_HEAP,  // _data was malloc()ed by the reader
+	WASM_STORAGE_MMAP,  // _data is a read-only mapping of the module file
+	WASM_STORAGE_BORROWED, // _data belongs to the caller of createReaderFromBuffer()
+	WASM_STORAGE_STREAM,   // _data is a WasmStreamReader's growable buffer
+};
+
+// Push-style reader for modules that arrive in chunks. Every section is
+// parsed as soon as all of its bytes have been fed in.
+struct WasmStreamReader {
+	struct WasmModuleReader reader;
+	uint32_t capacity;  // bytes allocated for reader._data
+	uint32_t parsed;    // bytes of the module parsed so far
+	uint32_t nsections; // sections parsed so far
+	// Called after each section is parsed, may be set before or after createStreamReader()
+	void   (*progress)(struct WasmStreamReader* stream, void* userdata);
+	void*    userdata;
+	uint32_t _sectionCapacity;
+	int      _state;
+	int      _status;
+};
+
+// One module of a WasmBatch
+struct WasmBatchItem {
+	const char* name;   // the module's path, or just its name when data is set
+	const void* data;   // the module's bytes, or NULL to read it from name
+	uint32_t    size;
+	int         status; // what loading it returned
+	struct WasmModuleReader reader; // the module, until destroyBatch() unless discarding
+};
+
+// Loads many modules at once on a pool of threads. Each thread loads into
+// a reader and arena of its own and takes work from the others once it
+// runs out, so a few large modules do not hold up the rest. Lazy modules
+// get an arena each instead, see WasmConfig.arena
+struct WasmBatch {
+	struct WasmBatchItem* items;
+	uint32_t              nitems;
+	// Called on the loading thread once each module is done, successfully
+	// or not. May be set before or after createBatch()
+	void                (*done)(struct WasmBatch* batch, struct WasmBatchItem* item);
+	void*                 userdata;
+	// Release each module as soon as done() returns, letting its thread 
+	// reuse the memory for the next one
+	uint8_t               discard;
+	struct batch_worker*  _workers;
+	uint32_t              _nworkers;
+};
+
+// Turns a module back into its binary form. config->name, if set, is the
+// file the module is also written to
 struct WasmModuleWriter {
-	struct WasmModule* thisModule;
+	struct WasmModule* thisModule; // the module written last
 	struct WasmConfig* config;
-	uint32_t           size;
+	uint32_t           size;       // of the encoded module
     	uint32_t           offset;
 	void*              _data;
 };
@@ -30,6 +93,79 @@ struct WasmConfig {
 	uint32_t    maxBuiltinSectionSize;
 	uint32_t    flags;
 	const char* name;
+	uint32_t    threads; // worker threads for the parallel modes, 0 means one per online CPU
+	// When set, all module memory comes from this arena instead of one the
+	// reader creates. It stays the caller's: destroyReader() does not touch 
+	// it and the module lives until the arena is reset or destroyed.
+	// Under WASM_CONFIG_LAZY and WASM_CONFIG_LAZY_CODE the module keeps
+	// allocating from it after parseModule(), holding only its own lock,
+	// so such modules may only share an arena when used on one thread
+	struct WasmArena* arena;
+};
+
+// Bump allocator that all parsed module data lives in,
+// everything in it is released at once
+struct ArenaBlock;
+struct WasmArena {
+	struct ArenaBlock* blocks;
+	uint32_t           blockSize;
+};
+
+#define WASM_ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+// values for WasmConfig.flags, these may be OR'ed together
+enum {
+	// mmap() the module file read-only and parse straight out of the mapping
+	// instead of copying it into a heap buffer
+	WASM_CONFIG_MMAP = 1 << 0,
+	// createReaderFromBuffer() takes ownership of the buffer, which must have
+	// been malloc()ed, and destroyReader() frees it. Without this flag the
+	// buffer is borrowed and must outlive the reader
+	WASM_CONFIG_TAKE_BUFFER = 1 << 1,
+	// parseModule() hands sections out to up to WasmConfig.threads threads
+	WASM_CONFIG_PARALLEL_SECTIONS = 1 << 2,
+	// parseCodeSection() decodes function bodies on up to WasmConfig.threads threads
+	WASM_CONFIG_PARALLEL_CODE = 1 << 3,
+	// Code bodies, data segments, init expressions and import/export/function
+	// names point into the module's bytes instead of being copied out. They 
+	// stay valid until destroyReader() and names are NOT NUL terminated,
+	// use their lengths. Stream readers ignore this as their buffer moves
+	WASM_CONFIG_VIEWS = 1 << 4,
+	// parseModule() only builds and checks the section directory, each 
+	// section is parsed the first time findSectionByHash() or getSection()
+	// asks for it, from any number of threads. The module's bytes are kept
+	// until destroyReader() and validateModule() must be called before
+	// functions, tables, memories or globals are used. Stream readers 
+	// ignore this
+	WASM_CONFIG_LAZY = 1 << 5,
+	// parseCodeSection() only records where each function body starts and
+	// getFunctionCode() decodes a body the first time it is asked for, 
+	// Function.code stays NULL until then. Stream readers ignore this
+	WASM_CONFIG_LAZY_CODE = 1 << 6,
+	// Writers encode every builtin section from its parsed form instead of
+	// only those marked WASM_SECTION_CHANGED. Custom sections are still 
+	// copied as their contents are not kept
+	WASM_CONFIG_REENCODE = 1 << 7,
+};
+
+// Hands out one shared module per distinct module contents, so the same
+// bytes are only parsed once no matter how often or under which name they
+// are loaded. Modules are validated before they are handed out. Modules 
+// nobody uses stay cached until all cached modules take up more than 
+// budget bytes, counting both their bytes and the arena they were parsed 
+// into as of when they were loaded, the least recently used go first.
+struct WasmModuleCache {
+	size_t                   budget;
+	struct WasmConfig        config; // every module is parsed under a copy of this
+	struct ModuleCacheState* _state;
+};
+
+struct WasmCacheStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	size_t   bytes;   // source bytes plus module arenas of everything cached
+	uint32_t modules;
 };
 
 struct Section;
@@ -38,6 +174,23 @@ struct GlobalSectionGlobal;
 struct Table;
 struct Memory;
 
+// Where one section lives in the module's bytes
+struct SectionEntry {
+	uint32_t offset; // start of the section's contents, past its id and size
+	uint32_t size;
+	uint64_t hash;   // what findSectionByHash() matches, known before the section is parsed
+	int32_t  next;   // the next section with the same hash, -1 if there is none
+	uint8_t  id;
+	uint8_t  edit;   // one of WASM_SECTION_*, tells a WasmModuleWriter what to do with it
+};
+
+// values for SectionEntry.edit
+enum {
+	WASM_SECTION_UNCHANGED, // writers copy the section's bytes as they are
+	WASM_SECTION_CHANGED,   // writers encode the parsed section, set this after editing it. Builtin sections only
+	WASM_SECTION_REMOVED,   // writers leave the section out
+};
+
 struct WasmModule {
 	const char*                   name;
 	uint64_t                      hash;
@@ -49,19 +202,42 @@ struct WasmModule {
 	struct   GlobalSectionGlobal* globals;
 	struct   Table*               tables;
 	struct   Memory*              memories;
+	struct   WasmArena*           arena;     // everything below is allocated from here
+	struct   SectionEntry*        directory; // one entry per section, in file order, matching sections[]
+	uint32_t                      nsections;
+	uint32_t                      _directoryCapacity;
+	struct   LazySections*        _lazy;     // parsing state of each section under WASM_CONFIG_LAZY
+	struct   SectionIndex*        _index;    // finds sections by hash, see findSectionByHash()
+	struct   CacheEntry*          _cached;   // set for modules owned by a WasmModuleCache
+	struct   CheckContext*        _check;    // what bodies are type checked against, see validateCode()
+	const    uint8_t*             _source;   // the bytes the module was loaded from, see dumpModule()
+	uint32_t                      _sourceSize;
+	uint8_t                       _validated; // validateModule() succeeded, what createInstance() needs
+	uint8_t                       _linked;    // functions, tables, memories and globals are filled in
 };
 
 typedef struct WasmModuleReader Reader;
 typedef struct WasmModuleWriter Writer;
+typedef struct WasmStreamReader StreamReader;
+typedef struct WasmBatch        Batch;
+typedef struct WasmBatchItem    BatchItem;
+typedef struct WasmModuleCache  ModuleCache;
+typedef struct WasmArena        Arena;
 typedef struct WasmModule       Module;
 typedef struct WasmConfig       Config;
 typedef struct Section          Section;
 
 #define NULL_STRING_HASH 0xBADBADBADUL
 uint64_t hash(const char* s);
+uint64_t hashN(const char* s, uint32_t len);
+// A fast hash of arbitrary bytes, used to tell modules apart by content
+uint64_t hashBytes(const void* data, size_t len);
 
 // WasmModuleReader functions
 int    createReader(struct WasmModuleReader* init, struct WasmConfig* config);
+// Parse a module already in memory, config->name is optional here
+// and is only used as the module's name
+int    createReaderFromBuffer(struct WasmModuleReader* init, struct WasmConfig* config, const void* data, uint32_t size);
 int    parseModule(struct WasmModuleReader* reader);
 struct WasmModule* getModuleFromReader(struct WasmModuleReader* init);
 
@@ -69,12 +245,60 @@ struct WasmModule* getModuleFromReader(struct WasmModuleReader* init);
 // Always use destroyReader() explicitly to free these resources
 void   destroyReader(struct WasmModuleReader* obj);
 
+// WasmArena functions
+// A blockSize of 0 picks WASM_ARENA_DEFAULT_BLOCK_SIZE
+int    createArena(struct WasmArena* arena, uint32_t blockSize);
+void*  arenaAlloc(struct WasmArena* arena, size_t size);
+// Frees everything allocated so far but keeps a block around for reuse
+void   resetArena(struct WasmArena* arena);
+void   destroyArena(struct WasmArena* arena);
+// Bytes of all blocks the arena holds, used or not
+size_t arenaSize(struct WasmArena* arena);
+
+// WasmStreamReader functions
+// Feed the module in as it arrives and call finishStreamReader() once all
+// of it is in, which validates the module. Once any of these fail the stream
+// is dead and keeps returning the same error. 
+// getModuleFromReader(&stream->reader) returns the module
+int    createStreamReader(struct WasmStreamReader* init, struct WasmConfig* config);
+int    feedStreamReader(struct WasmStreamReader* stream, const void* chunk, uint32_t len);
+int    finishStreamReader(struct WasmStreamReader* stream);
+void   destroyStreamReader(struct WasmStreamReader* obj);
+
+// WasmBatch functions
+// Every module is loaded under a copy of config, WasmConfig.name and 
+// WasmConfig.arena are ignored and WasmConfig.threads sets the pool size.
+// loadBatch() fills in each item's status and returns the status of the 
+// first item that failed
+int    createBatch(struct WasmBatch* init, struct WasmConfig* config, struct WasmBatchItem* items, uint32_t n);
+int    loadBatch(struct WasmBatch* batch);
+void   destroyBatch(struct WasmBatch* batch);
+
+// WasmModuleCache functions
+// Cached modules are shared between everyone that loads the same bytes and
+// must not be changed. They have no name unless their name section gives
+// them one. Every successful loadCachedModule() must be paired with a 
+// releaseCachedModule(), all of them before destroyModuleCache()
+int    createModuleCache(struct WasmModuleCache* init, struct WasmConfig* config, size_t budget);
+int    loadCachedModule(struct WasmModuleCache* cache, const void* data, uint32_t size, struct WasmModule** module);
+void   releaseCachedModule(struct WasmModuleCache* cache, struct WasmModule* module);
+void   getCacheStats(struct WasmModuleCache* cache, struct WasmCacheStats* stats);
+void   destroyModuleCache(struct WasmModuleCache* cache);
+
 // WasmModuleWriter functions
+// Modules are written from their section directory, which needs the bytes
+// they were parsed from: modules loaded from a dump cannot be written. 
+// Sections that changed are encoded again, consecutive unchanged sections
+// are copied from the module's bytes in one go
 int    createWriter(struct WasmModuleWriter* init, struct WasmConfig* config);
+int    writeModule(struct WasmModuleWriter* writer, struct WasmModule* module);
 struct WasmModule* getModuleFromWriter(struct WasmModuleWriter* init);
+// The encoded module, writer->size bytes of it, valid until the next 
+// writeModule() or destroyWriter()
+const void* getDataFromWriter(struct WasmModuleWriter* writer);
 
-// NOTE: Do not free a struct WasmModule* by yourself
-// Always use destroyWriter() explicitly to free these resources
+// NOTE: The module still belongs to its reader, destroyWriter() only 
+// frees the encoded module
 void   destroyWriter(struct WasmModuleWriter* obj);
 
 #define WASM_MAGIC   0x6D736100
@@ -114,6 +338,11 @@ enum {
     	WASM_TRUNCATED_SECTION,
 	WASM_INVALID_LIMIT_TYPE,
 	WASM_INTERNAL_ERROR,
+	WASM_INVALID_DUMP,
+	WASM_STALE_DUMP,
+	WASM_INVALID_OPCODE,
+	WASM_UNBALANCED_BLOCK,
+	WASM_INVALID_LABEL,
 	WASM_MAX_ERROR,
 };
 
@@ -122,9 +351,33 @@ enum {
 	WASM_NO_TYPE = WASM_MAX_ERROR + 1,
 	WASM_FUNCTION_CODE_MISMATCH,
 	WASM_INVALID_TYPE_INDEX,
+	WASM_TYPE_MISMATCH,
+	WASM_STACK_UNDERFLOW,
+	WASM_UNUSED_VALUES,
+	WASM_INVALID_LOCAL_INDEX,
+	WASM_INVALID_GLOBAL_INDEX,
+	WASM_IMMUTABLE_GLOBAL,
+	WASM_INVALID_FUNCTION_INDEX,
+	WASM_INVALID_ALIGNMENT,
+	WASM_NO_MEMORY,
+	WASM_NO_TABLE,
 	WASM_MAX_VALIDATION_ERROR
 };
 
+// Traps, returned by callFunction() and by createInstance() for the start function
+enum {
+	WASM_TRAP_UNREACHABLE = WASM_MAX_VALIDATION_ERROR + 1,
+	WASM_TRAP_OUT_OF_BOUNDS,
+	WASM_TRAP_DIVIDE_BY_ZERO,
+	WASM_TRAP_INTEGER_OVERFLOW,
+	WASM_TRAP_INVALID_CONVERSION,
+	WASM_TRAP_UNDEFINED_ELEMENT,
+	WASM_TRAP_SIGNATURE_MISMATCH,
+	WASM_TRAP_STACK_OVERFLOW,
+	WASM_TRAP_UNBOUND_IMPORT,
+	WASM_MAX_TRAP
+};
+
 const char* errString(int err);
 
 struct TypeSectionType {
@@ -150,8 +403,12 @@ struct ImportSectionImport {
 	uint64_t    hashName;
 	char*       module;
 	uint64_t    hashModule;
-	uint32_t    index;
+	uint32_t    index;     // the type index of a function
+	uint32_t    nameLen;
+	uint32_t    moduleLen;
 	uint8_t     type;
+	uint8_t     valtype;   // the value type of a global
+	uint8_t     mut;       // whether a global is mutable
 };
 
 typedef struct ImportSectionImport Import;
@@ -160,6 +417,7 @@ struct ExportSectionExport {
 	char*       name;
 	uint64_t    hashName;
 	uint32_t    index;
+	uint32_t    nameLen;
 	uint8_t     type;
 };
 
@@ -208,6 +466,7 @@ typedef struct ElementSectionElement Element;
 
 typedef struct Function {
 	char*    name;
+	uint32_t nameLen;
 	uint64_t hash;
 	struct TypeSectionType* signature;
 	struct CodeSectionCode* code;
@@ -226,9 +485,11 @@ typedef struct Table {
 } Table;
 
 struct NameSectionName {
-	char*     moduleName;
+	char*     moduleName; // always NUL terminated, even in view mode
+	uint32_t  moduleNameLen;
 	uint32_t* indexes;
 	char**    functionNames;
+	uint32_t* functionNameLens;
 };
 
 typedef struct NameSectionName Name;
@@ -252,12 +513,348 @@ struct Section {
 		void*  custom;  // Unknown custom section
 	};
 	uint32_t       flags;
-
+	union {
+		uint32_t*          _bodies; // Code section under WASM_CONFIG_LAZY_CODE: offset of each body
+		struct NameLookup* _lookup; // Import and Export sections: finds entries by name
+	};
 };
 
+// Links sections into functions, tables, memories and globals and type
+// checks every function body. Bodies under WASM_CONFIG_LAZY_CODE are
+// checked when getFunctionCode() decodes them instead. parseModule() 
+// already does this unless under WASM_CONFIG_LAZY, and once a module is 
+// valid calling it again returns straight away
 int validateModule(struct WasmModule* module);
+// Type checks the body of function idx of a validated module again,
+// nothing to check for imported functions
+int validateFunction(struct WasmModule* module, uint32_t idx);
 int findSectionByHash(struct WasmModule* mod, const uint64_t hash);
+// Index of the next section after prev with the same hash, for modules that
+// have several custom sections of the same name. prev must have come from
+// findSectionByHash() or an earlier call to this
+int findNextSectionByHash(struct WasmModule* mod, int prev);
+// Like findSectionByHash() but hands back the section itself and the
+// error that parsing it ran into. *section is NULL if there is none
+int getSection(struct WasmModule* mod, const uint64_t hash, struct Section** section);
+// The body of function idx, decoding and type checking it first under
+// WASM_CONFIG_LAZY_CODE. Needs a validated module, *code is NULL for
+// imported functions
+int getFunctionCode(struct WasmModule* mod, uint32_t idx, struct CodeSectionCode** code);
+
+// The export called name of the given kind (WASM_TYPEIDX, WASM_TABLETYPE, ...)
+// or NULL if there is none
+struct ExportSectionExport* findExport(struct WasmModule* mod, const char* name, uint8_t kind);
+// The first import of name from moduleName or NULL if there is none
+struct ImportSectionImport* findImport(struct WasmModule* mod, const char* moduleName, const char* name);
+
+// One instruction with its immediates decoded. What a and b hold depends
+// on the opcode:
+//   block, loop      a = blocktype, b = index of their end
+//   if               a = blocktype, b = index of its end << 32 | index of its else,
+//                    which is the end again if there is no else
+//   else             a = index of its if, b = index of their end
+//   end              a = index of the instruction it closes, UINT32_MAX for the function's
+//   br, br_if        a = label, b = index of the instruction that opened the label,
+//                    UINT32_MAX for the function itself
+//   br_table         a = number of labels without the default, b = where they
+//                    start in DecodedCode.labels, the default comes last
+//   call             a = function index
+//   call_indirect    a = type index, b = table index
+//   local.*, global.*  a = index
+//   loads, stores    a = alignment, b = offset
+//   memory.size/grow a = memory index
+//   i32/f32.const    a = value, f32 as its bits
+//   i64/f64.const    b = value, f64 as its bits
+// The indexes of other instructions are only known to decodeCode(), when
+// iterating over raw bytes they are UINT32_MAX and br_table's b is the 
+// offset of its labels in the expression
+struct Instruction {
+	uint16_t opcode; // 0xFC prefixed opcodes are 0xFC00 | their second byte
+	uint16_t _pad;
+	uint32_t a;
+	uint64_t b;
+};
+
+typedef struct Instruction Instruction;
+
+// A function body turned into fixed size instructions
+struct DecodedCode {
+	struct Instruction* instrs;
+	uint32_t*           labels;   // of every br_table
+	uint32_t            ninstrs;
+	uint32_t            nlabels;
+	uint32_t            maxDepth; // most blocks open at once, the function's own included
+};
+
+typedef struct DecodedCode DecodedCode;
+
+// Goes over the instructions of a body in either form
+struct InstructionIterator {
+	const struct Instruction* _next;   // decoded form
+	const struct Instruction* _end;
+	const uint32_t*           _labels;
+	const uint8_t*            _expr;   // raw form, decoded one at a time into _current
+	uint32_t                  _offset;
+	uint32_t                  _size;
+	struct Instruction        _current;
+	int                       status;  // set once the raw form turns out to be invalid
+};
 
+// Decodes code, allocating from arena. Checks that every opcode is known,
+// that blocks nest and that branches refer to open blocks, nothing more
+int  decodeCode(struct CodeSectionCode* code, struct WasmArena* arena, struct DecodedCode* decoded);
+void iterateCode(struct InstructionIterator* it, struct CodeSectionCode* code);
+void iterateDecodedCode(struct InstructionIterator* it, struct DecodedCode* decoded);
+// The next instruction, NULL at the end of the body or once it->status is set
+const struct Instruction* nextInstruction(struct InstructionIterator* it);
+// Label i of a br_table the iterator just returned, i == instr->a is the default
+uint32_t brTableLabel(struct InstructionIterator* it, const struct Instruction* instr, uint32_t i);
+
+// Writes the module to <module name>.wd
 int dumpModule(struct WasmModule* module);
-int loadDump(struct WasmModule* module, const char* file);
+int dumpModuleTo(struct WasmModule* module, const char* file);
+
+/*
+ * Images hold what a dump does, laid out so that they are used straight
+ * from an mmap() of the file: a WasmImageHeader, a table of contents 
+ * saying where each array of fixed size records lives, the records and
+ * then the bytes they refer to. Records refer to other parts of the image
+ * by 32 bit offsets from its start, never by pointers, so a mapping can
+ * be shared read only between any number of processes. Everything is 
+ * little endian and naturally aligned, arrays start on 8 byte boundaries.
+ * moduleFromImage() gives the same view of a module as loadDump() without
+ * copying any bytes out of the mapping. Unlike a dump, an image also keeps
+ * the Type, Import, Export and Start sections as they were in the module,
+ * which is what validating and running it needs besides the records.
+ */
+#define WASM_IMAGE_MAGIC   0x494D5357 // "WSMI"
+#define WASM_IMAGE_VERSION 2
+
+struct WasmImageHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nsections;  // entries in the table of contents after the header
+	uint32_t size;       // of the whole image
+	uint32_t sourceSize; // of the module the image was made from
+	uint64_t sourceHash; // hashBytes() of that module
+	uint32_t name;       // the module's name, NUL terminated
+	uint32_t nameLen;
+	uint64_t flags;
+};
+
+// values for WasmImageSection.kind
+enum {
+	WASM_IMAGE_FUNCTIONS, // struct WasmImageFunction
+	WASM_IMAGE_GLOBALS,   // struct WasmImageGlobal
+	WASM_IMAGE_MEMORY,    // at most one struct TableSectionTable
+	WASM_IMAGE_DATA,      // struct WasmImageSegment, bytes are the segment's contents
+	WASM_IMAGE_TABLE,     // at most one struct TableSectionTable
+	WASM_IMAGE_ELEMENTS,  // struct WasmImageSegment, bytes are len uint32_t function indexes
+	WASM_IMAGE_SECTIONS,  // struct WasmImageRawSection
+	WASM_IMAGE_MAX_SECTION
+};
+
+// An entry in the table of contents, readers skip kinds they don't know
+struct WasmImageSection {
+	uint32_t kind;
+	uint32_t offset;
+	uint32_t count;
+	uint32_t recordSize;
+};
+
+struct WasmImageFunction {
+	uint64_t hash;
+	uint32_t name;      // NUL terminated, 0 if the function has no name
+	uint32_t nameLen;
+	uint32_t params;
+	uint32_t typeIndex;
+	uint8_t  paramsLen;
+	uint8_t  ret;
+	uint8_t  _pad[2];
+	uint32_t locals;
+	uint32_t localSize;
+	uint32_t expr;
+	uint32_t codeSize;  // 0 for imported functions
+	uint32_t _pad2;
+};
+
+struct WasmImageGlobal {
+	uint32_t expr;
+	uint8_t  exprSize;
+	uint8_t  valtype;
+	uint8_t  mut;
+	uint8_t  _pad;
+};
+
+struct WasmImageSegment {
+	uint32_t expr;
+	uint32_t bytes;
+	uint32_t len;
+	uint8_t  exprSize;
+	uint8_t  _pad[3];
+};
+
+// A section of the module copied as it was, bytes are its contents
+struct WasmImageRawSection {
+	uint32_t bytes;
+	uint32_t len;
+	uint8_t  id;
+	uint8_t  _pad[3];
+};
+
+// A mapped image. The record arrays point into the mapping and have been
+// checked to lie inside it, offsets inside the records are only checked
+// by imageBytes() and imageIndexes()
+struct WasmImage {
+	const struct WasmImageHeader*   header;
+	const struct WasmImageFunction* functions;
+	const struct WasmImageGlobal*   globals;
+	const struct TableSectionTable* memory; // NULL if there is none
+	const struct WasmImageSegment*  data;
+	const struct TableSectionTable* table;  // NULL if there is none
+	const struct WasmImageSegment*  elements;
+	const struct WasmImageRawSection* sections;
+	uint32_t nfuncs;
+	uint32_t nglobals;
+	uint32_t nData;
+	uint32_t nElements;
+	uint32_t nsections;
+	const uint8_t* _map;
+	uint32_t       _size;
+};
+
+typedef struct WasmImage Image;
+
+// Writes the module as an image to file, in a single write
+int writeImage(struct WasmModule* module, const char* file);
+// Maps an image read only. When sourceHash is not 0 the image must have
+// been made from sourceSize bytes with that hashBytes(), WASM_STALE_DUMP
+// otherwise. Nothing but the header is compared, so a host opening the
+// same image again and again hashes its module once
+int openImage(struct WasmImage* image, const char* file, uint64_t sourceHash, uint32_t sourceSize);
+void closeImage(struct WasmImage* image);
+// len bytes at offset in the image, NULL if they are not all inside it
+const uint8_t*  imageBytes(const struct WasmImage* image, uint32_t offset, uint32_t len);
+// Same for an array of count uint32_t, which must also be aligned
+const uint32_t* imageIndexes(const struct WasmImage* image, uint32_t offset, uint32_t count);
+// Fills in module with the functions, globals, memory and table of the
+// image and parses the sections it kept. Its arrays come from arena, 
+// everything else points into the mapping, so the module is only good 
+// until closeImage(). The module comes linked, validateModule() only type
+// checks its bodies before it can be instantiated
+int moduleFromImage(struct WasmModule* module, const struct WasmImage* image, struct WasmArena* arena);
+// Use in place of parseModule() to load the reader's module from a dump 
+// of it. Falls back to parseModule() when the dump is missing, broken or
+// was made from different bytes. Modules loaded from a dump have no 
+// sections, only functions, globals, memories and tables. Without the
+// sections their bodies cannot be type checked, validateModule() returns
+// WASM_INVALID_ARG for them and createInstance() turns them down, so load
+// modules that are to be run with parseModule() or from an image. A
+// module with sections after this came from parseModule()
+int loadDump(struct WasmModuleReader* reader, const char* file);
+
+/*
+ * Instances run validated modules. Each one owns its memory, globals and
+ * table and runs on one thread at a time. Function bodies are translated
+ * into a pre-decoded form the first time they are called, values are
+ * passed around as 64-bit slots: i32 and f32 in the low 32 bits, floats
+ * as their bits.
+ */
+struct WasmInstance;
+
+// Called for imported functions. The arguments are in slots[0..n) and the
+// result, if there is one, goes in slots[0]. Anything but WASM_SUCCESS
+// is a trap that unwinds the whole call back to the host
+typedef int (*WasmHostFunction)(struct WasmInstance* instance, uint64_t* slots, void* data);
+
+// Binds the function import module.name to function
+struct WasmHostImport {
+	const char*      module;
+	const char*      name;
+	WasmHostFunction function;
+	void*            data;
+};
+
+// Gives the global import module.name its value, in the low 32 bits for
+// i32 and f32 like any other slot
+struct WasmGlobalImport {
+	const char* module;
+	const char* name;
+	uint64_t    value;
+};
+
+// values for WasmInstanceConfig.flags
+enum {
+	// Dispatch with a switch even where computed goto is available
+	WASM_INSTANCE_SWITCH        = 1 << 0,
+	// Translate bodies to register code, where operands are named instead
+	// of pushed and popped. Translating takes longer, running far fewer ops
+	WASM_INSTANCE_REGISTERS     = 1 << 1,
+	// Compile functions to machine code once they have been called or gone
+	// around a loop jitThreshold times, the interpreter runs them until then.
+	// Only x86-64 Linux has a JIT, elsewhere this does nothing
+	WASM_INSTANCE_JIT           = 1 << 2,
+	// Keep memory on the heap and check every access against its size, for
+	// address spaces too small for the 8GiB the JIT otherwise reserves per
+	// memory. Machine code leaves accesses past the end of a reserved
+	// memory to fault on its guard pages. Without WASM_INSTANCE_JIT, or
+	// when the reservation fails, memory is on the heap anyway
+	WASM_INSTANCE_BOUNDS_CHECKS = 1 << 3,
+};
+
+struct WasmInstanceConfig {
+	uint32_t flags;
+	uint32_t stackSlots; // locals and operands of every active frame, 0 for the default
+	uint32_t maxDepth;   // most calls active at once, 0 for the default
+	uint32_t nimports;
+	struct WasmHostImport* imports; // imports without one trap with WASM_TRAP_UNBOUND_IMPORT
+	uint32_t jitThreshold; // 0 for the default, 1 compiles every function before its first call
+	uint32_t nglobals;
+	struct WasmGlobalImport* globals; // imported globals without one start out as 0
+};
+
+#define WASM_DEFAULT_STACK_SLOTS   (1 << 20)
+#define WASM_DEFAULT_MAX_DEPTH     (1 << 14)
+#define WASM_DEFAULT_JIT_THRESHOLD 1000
+
+struct WasmInstance {
+	struct WasmModule*        module;
+	uint8_t*                  memory;
+	uint64_t                  memorySize; // in bytes
+	uint32_t                  memoryMax;  // in 64KiB pages
+	uint32_t                  tableSize;
+	uint32_t*                 table;      // function index of each element, UINT32_MAX where there is none
+	uint64_t*                 globals;    // imported globals come first, set from config->globals
+	uint32_t                  nglobals;
+	uint32_t                  flags;
+	uint64_t                  dispatches; // ops the interpreter ran, only counted when built with -DWASM_COUNT_DISPATCH
+	uint32_t                  _stackSlots;
+	uint64_t*                 _stack;
+	uint64_t*                 _top;       // where the next call from the host puts its frame
+	struct CallFrame*         _frames;
+	uint32_t                  _depth;
+	uint32_t                  _maxDepth;
+	struct WasmHostImport*    _imports;   // one per imported function
+	uint32_t                  _nimported;
+	struct CompiledFunction** _compiled;  // one per function, NULL until it is first called
+	struct TypeSectionType*   _types;     // of the module, what call_indirect checks against
+	const void* const*        _handlers;  // label of each op in the threaded interpreter, NULL for the switch
+	struct Jit*               _jit;       // machine code, NULL without WASM_INSTANCE_JIT
+	uint32_t                  _jitThreshold;
+	uint64_t                  _reserved;  // address space behind memory, 0 when it is on the heap
+	struct WasmArena          _arena;     // compiled functions
+	struct WasmArena          _scratch;   // reset for every function compiled
+};
+
+typedef struct WasmInstance Instance;
+
+// Sets up memory, globals and the table of a validated module, binds
+// config->imports and config->globals and runs the start function.
+// config may be NULL.
+// Modules validateModule() has not accepted are WASM_INVALID_ARG, which
+// includes every module loaded from a dump
+int  createInstance(struct WasmInstance* instance, struct WasmModule* module, struct WasmInstanceConfig* config);
+// Calls function idx with its arguments in slots, its result is left in slots[0]
+int  callFunction(struct WasmInstance* instance, uint32_t idx, uint64_t* slots);
+void destroyInstance(struct WasmInstance* instance);
 #endif
@@ -0,0 +1,195 @@
+#ifndef __OPCODES_H__
+#define __OPCODES_H__
+
+// Opcodes of the instructions libwasm knows, the MVP along with sign
+// extension and the 0xFC prefixed saturating truncations. Prefixed
+// opcodes are 0xFC00 | their second byte, as in Instruction.opcode
+enum {
+	WASM_OP_UNREACHABLE         = 0x00,
+	WASM_OP_NOP                 = 0x01,
+	WASM_OP_BLOCK               = 0x02,
+	WASM_OP_LOOP                = 0x03,
+	WASM_OP_IF                  = 0x04,
+	WASM_OP_ELSE                = 0x05,
+	WASM_OP_END                 = 0x0B,
+	WASM_OP_BR                  = 0x0C,
+	WASM_OP_BR_IF               = 0x0D,
+	WASM_OP_BR_TABLE            = 0x0E,
+	WASM_OP_RETURN              = 0x0F,
+	WASM_OP_CALL                = 0x10,
+	WASM_OP_CALL_INDIRECT       = 0x11,
+	WASM_OP_DROP                = 0x1A,
+	WASM_OP_SELECT              = 0x1B,
+	WASM_OP_LOCAL_GET           = 0x20,
+	WASM_OP_LOCAL_SET           = 0x21,
+	WASM_OP_LOCAL_TEE           = 0x22,
+	WASM_OP_GLOBAL_GET          = 0x23,
+	WASM_OP_GLOBAL_SET          = 0x24,
+	WASM_OP_I32_LOAD            = 0x28,
+	WASM_OP_I64_LOAD            = 0x29,
+	WASM_OP_F32_LOAD            = 0x2A,
+	WASM_OP_F64_LOAD            = 0x2B,
+	WASM_OP_I32_LOAD8_S         = 0x2C,
+	WASM_OP_I32_LOAD8_U         = 0x2D,
+	WASM_OP_I32_LOAD16_S        = 0x2E,
+	WASM_OP_I32_LOAD16_U        = 0x2F,
+	WASM_OP_I64_LOAD8_S         = 0x30,
+	WASM_OP_I64_LOAD8_U         = 0x31,
+	WASM_OP_I64_LOAD16_S        = 0x32,
+	WASM_OP_I64_LOAD16_U        = 0x33,
+	WASM_OP_I64_LOAD32_S        = 0x34,
+	WASM_OP_I64_LOAD32_U        = 0x35,
+	WASM_OP_I32_STORE           = 0x36,
+	WASM_OP_I64_STORE           = 0x37,
+	WASM_OP_F32_STORE           = 0x38,
+	WASM_OP_F64_STORE           = 0x39,
+	WASM_OP_I32_STORE8          = 0x3A,
+	WASM_OP_I32_STORE16         = 0x3B,
+	WASM_OP_I64_STORE8          = 0x3C,
+	WASM_OP_I64_STORE16         = 0x3D,
+	WASM_OP_I64_STORE32         = 0x3E,
+	WASM_OP_MEMORY_SIZE         = 0x3F,
+	WASM_OP_MEMORY_GROW         = 0x40,
+	WASM_OP_I32_CONST           = 0x41,
+	WASM_OP_I64_CONST           = 0x42,
+	WASM_OP_F32_CONST           = 0x43,
+	WASM_OP_F64_CONST           = 0x44,
+	WASM_OP_I32_EQZ             = 0x45,
+	WASM_OP_I32_EQ              = 0x46,
+	WASM_OP_I32_NE              = 0x47,
+	WASM_OP_I32_LT_S            = 0x48,
+	WASM_OP_I32_LT_U            = 0x49,
+	WASM_OP_I32_GT_S            = 0x4A,
+	WASM_OP_I32_GT_U            = 0x4B,
+	WASM_OP_I32_LE_S            = 0x4C,
+	WASM_OP_I32_LE_U            = 0x4D,
+	WASM_OP_I32_GE_S            = 0x4E,
+	WASM_OP_I32_GE_U            = 0x4F,
+	WASM_OP_I64_EQZ             = 0x50,
+	WASM_OP_I64_EQ              = 0x51,
+	WASM_OP_I64_NE              = 0x52,
+	WASM_OP_I64_LT_S            = 0x53,
+	WASM_OP_I64_LT_U            = 0x54,
+	WASM_OP_I64_GT_S            = 0x55,
+	WASM_OP_I64_GT_U            = 0x56,
+	WASM_OP_I64_LE_S            = 0x57,
+	WASM_OP_I64_LE_U            = 0x58,
+	WASM_OP_I64_GE_S            = 0x59,
+	WASM_OP_I64_GE_U            = 0x5A,
+	WASM_OP_F32_EQ              = 0x5B,
+	WASM_OP_F32_NE              = 0x5C,
+	WASM_OP_F32_LT              = 0x5D,
+	WASM_OP_F32_GT              = 0x5E,
+	WASM_OP_F32_LE              = 0x5F,
+	WASM_OP_F32_GE              = 0x60,
+	WASM_OP_F64_EQ              = 0x61,
+	WASM_OP_F64_NE              = 0x62,
+	WASM_OP_F64_LT              = 0x63,
+	WASM_OP_F64_GT              = 0x64,
+	WASM_OP_F64_LE              = 0x65,
+	WASM_OP_F64_GE              = 0x66,
+	WASM_OP_I32_CLZ             = 0x67,
+	WASM_OP_I32_CTZ             = 0x68,
+	WASM_OP_I32_POPCNT          = 0x69,
+	WASM_OP_I32_ADD             = 0x6A,
+	WASM_OP_I32_SUB             = 0x6B,
+	WASM_OP_I32_MUL             = 0x6C,
+	WASM_OP_I32_DIV_S           = 0x6D,
+	WASM_OP_I32_DIV_U           = 0x6E,
+	WASM_OP_I32_REM_S           = 0x6F,
+	WASM_OP_I32_REM_U           = 0x70,
+	WASM_OP_I32_AND             = 0x71,
+	WASM_OP_I32_OR              = 0x72,
+	WASM_OP_I32_XOR             = 0x73,
+	WASM_OP_I32_SHL             = 0x74,
+	WASM_OP_I32_SHR_S           = 0x75,
+	WASM_OP_I32_SHR_U           = 0x76,
+	WASM_OP_I32_ROTL            = 0x77,
+	WASM_OP_I32_ROTR            = 0x78,
+	WASM_OP_I64_CLZ             = 0x79,
+	WASM_OP_I64_CTZ             = 0x7A,
+	WASM_OP_I64_POPCNT          = 0x7B,
+	WASM_OP_I64_ADD             = 0x7C,
+	WASM_OP_I64_SUB             = 0x7D,
+	WASM_OP_I64_MUL             = 0x7E,
+	WASM_OP_I64_DIV_S           = 0x7F,
+	WASM_OP_I64_DIV_U           = 0x80,
+	WASM_OP_I64_REM_S           = 0x81,
+	WASM_OP_I64_REM_U           = 0x82,
+	WASM_OP_I64_AND             = 0x83,
+	WASM_OP_I64_OR              = 0x84,
+	WASM_OP_I64_XOR             = 0x85,
+	WASM_OP_I64_SHL             = 0x86,
+	WASM_OP_I64_SHR_S           = 0x87,
+	WASM_OP_I64_SHR_U           = 0x88,
+	WASM_OP_I64_ROTL            = 0x89,
+	WASM_OP_I64_ROTR            = 0x8A,
+	WASM_OP_F32_ABS             = 0x8B,
+	WASM_OP_F32_NEG             = 0x8C,
+	WASM_OP_F32_CEIL            = 0x8D,
+	WASM_OP_F32_FLOOR           = 0x8E,
+	WASM_OP_F32_TRUNC           = 0x8F,
+	WASM_OP_F32_NEAREST         = 0x90,
+	WASM_OP_F32_SQRT            = 0x91,
+	WASM_OP_F32_ADD             = 0x92,
+	WASM_OP_F32_SUB             = 0x93,
+	WASM_OP_F32_MUL             = 0x94,
+	WASM_OP_F32_DIV             = 0x95,
+	WASM_OP_F32_MIN             = 0x96,
+	WASM_OP_F32_MAX             = 0x97,
+	WASM_OP_F32_COPYSIGN        = 0x98,
+	WASM_OP_F64_ABS             = 0x99,
+	WASM_OP_F64_NEG             = 0x9A,
+	WASM_OP_F64_CEIL            = 0x9B,
+	WASM_OP_F64_FLOOR           = 0x9C,
+	WASM_OP_F64_TRUNC           = 0x9D,
+	WASM_OP_F64_NEAREST         = 0x9E,
+	WASM_OP_F64_SQRT            = 0x9F,
+	WASM_OP_F64_ADD             = 0xA0,
+	WASM_OP_F64_SUB             = 0xA1,
+	WASM_OP_F64_MUL             = 0xA2,
+	WASM_OP_F64_DIV             = 0xA3,
+	WASM_OP_F64_MIN             = 0xA4,
+	WASM_OP_F64_MAX             = 0xA5,
+	WASM_OP_F64_COPYSIGN        = 0xA6,
+	WASM_OP_I32_WRAP_I64        = 0xA7,
+	WASM_OP_I32_TRUNC_F32_S     = 0xA8,
+	WASM_OP_I32_TRUNC_F32_U     = 0xA9,
+	WASM_OP_I32_TRUNC_F64_S     = 0xAA,
+	WASM_OP_I32_TRUNC_F64_U     = 0xAB,
+	WASM_OP_I64_EXTEND_I32_S    = 0xAC,
+	WASM_OP_I64_EXTEND_I32_U    = 0xAD,
+	WASM_OP_I64_TRUNC_F32_S     = 0xAE,
+	WASM_OP_I64_TRUNC_F32_U     = 0xAF,
+	WASM_OP_I64_TRUNC_F64_S     = 0xB0,
+	WASM_OP_I64_TRUNC_F64_U     = 0xB1,
+	WASM_OP_F32_CONVERT_I32_S   = 0xB2,
+	WASM_OP_F32_CONVERT_I32_U   = 0xB3,
+	WASM_OP_F32_CONVERT_I64_S   = 0xB4,
+	WASM_OP_F32_CONVERT_I64_U   = 0xB5,
+	WASM_OP_F32_DEMOTE_F64      = 0xB6,
+	WASM_OP_F64_CONVERT_I32_S   = 0xB7,
+	WASM_OP_F64_CONVERT_I32_U   = 0xB8,
+	WASM_OP_F64_CONVERT_I64_S   = 0xB9,
+	WASM_OP_F64_CONVERT_I64_U   = 0xBA,
+	WASM_OP_F64_PROMOTE_F32     = 0xBB,
+	WASM_OP_I32_REINTERPRET_F32 = 0xBC,
+	WASM_OP_I64_REINTERPRET_F64 = 0xBD,
+	WASM_OP_F32_REINTERPRET_I32 = 0xBE,
+	WASM_OP_F64_REINTERPRET_I64 = 0xBF,
+	WASM_OP_I32_EXTEND8_S       = 0xC0,
+	WASM_OP_I32_EXTEND16_S      = 0xC1,
+	WASM_OP_I64_EXTEND8_S       = 0xC2,
+	WASM_OP_I64_EXTEND16_S      = 0xC3,
+	WASM_OP_I64_EXTEND32_S      = 0xC4,
+	WASM_OP_I32_TRUNC_SAT_F32_S = 0xFC00,
+	WASM_OP_I32_TRUNC_SAT_F32_U = 0xFC01,
+	WASM_OP_I32_TRUNC_SAT_F64_S = 0xFC02,
+	WASM_OP_I32_TRUNC_SAT_F64_U = 0xFC03,
+	WASM_OP_I64_TRUNC_SAT_F32_S = 0xFC04,
+	WASM_OP_I64_TRUNC_SAT_F32_U = 0xFC05,
+	WASM_OP_I64_TRUNC_SAT_F64_S = 0xFC06,
+	WASM_OP_I64_TRUNC_SAT_F64_U = 0xFC07,
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define __SECTION_H__
 
 #include "libwasm.h"
+#include <pthread.h>
 
 enum {
 	WASM_CUSTOM_SECTION = 0,
@@ -22,12 +23,80 @@ enum {
 #define CHECK_ERROR_CODE(ptr) (ptr)
 
 struct ParseSectionParams {
-	uint8_t*        data;
-	uint32_t        offset;
-	uint32_t        size;
-	struct Section* section;
+	uint8_t*           data;
+	uint32_t           offset;
+	uint32_t           size;
+	struct Section*    section;
+	struct WasmConfig* config;
+	struct WasmArena*  arena;   // everything the parser allocates comes from here
+	uint8_t            views;   // point into data instead of copying out of it, see WASM_CONFIG_VIEWS
+	uint8_t            lazyCode; // only index code bodies, see WASM_CONFIG_LAZY_CODE
 };
 
+// Number of threads to use for njobs independent jobs under config
+uint32_t workerCount(struct WasmConfig* config, uint32_t njobs);
+
+// Moves all of from's memory into into, leaving from empty. 
+// Lets worker threads fill private arenas that the module then owns
+void mergeArena(struct WasmArena* into, struct WasmArena* from);
+
+// values for LazySections.state
+enum {
+	WASM_SECTION_UNPARSED,
+	WASM_SECTION_PARSED,
+	WASM_SECTION_FAILED
+};
+
+// What a WASM_CONFIG_LAZY or WASM_CONFIG_LAZY_CODE module needs to 
+// parse its sections or code bodies later on
+struct LazySections {
+	pthread_mutex_t   lock;   // recursive, validateModule() holds it while it loads sections
+	uint8_t*          state;  // one of WASM_SECTION_* per section
+	int*              status; // what parsing each section returned
+	uint8_t*          data;   // the module's bytes
+	struct WasmConfig config;
+	uint8_t           views;
+	uint8_t           lazyCode;
+};
+
+// Parses section i of a lazy module if that has not happened yet,
+// does nothing for other modules
+int loadSection(struct WasmModule* module, uint32_t i);
+
+// Decodes body i of a code section that was only indexed into section->code[i]
+int parseIndexedCodeBody(struct ParseSectionParams* params, uint32_t i);
+
+// The hash of the section's name, read out of the name of custom sections
+uint64_t sectionHash(uint8_t* data, struct SectionEntry* entry);
+
+// The id of the builtin section called hash, WASM_CUSTOM_SECTION for anything else
+uint8_t builtinSectionId(uint64_t hash);
+
+// Open addressing table of entry indexes in an Import or Export section
+// keyed by their name hashes. Slots hold index + 1, 0 is a free slot
+struct NameLookup {
+	uint32_t* slots;
+	uint32_t  mask;
+};
+
+// A lookup table for n entries, NULL if there is no memory for it
+struct NameLookup* createLookup(struct WasmArena* arena, uint32_t n);
+void insertLookup(struct NameLookup* lookup, uint64_t key, uint32_t i);
+
+// The key imports are found by
+uint64_t importKey(uint64_t hashModule, uint64_t hashName);
+
+// Adds directory entry i to the module's section index
+int indexSection(struct WasmModule* module, uint32_t i);
+
+// Type checks the initializers of globals and segments and every function
+// body that has been decoded, bodies of WASM_CONFIG_LAZY_CODE modules are
+// checked by getFunctionCode() instead
+int validateCode(struct WasmModule* module);
+
+// Type checks code, the body of function idx of a linked module
+int validateFunctionCode(struct WasmModule* module, uint32_t idx, struct CodeSectionCode* code);
+
 typedef int (*parseFnList)(struct ParseSectionParams*);
 extern const parseFnList parseSectionList[];
 #endif
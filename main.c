@@ -1,5 +1,7 @@
 #include <libwasm.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 int main(int argc, const char* argv[]) {
     Config config = {0};
@@ -19,22 +21,38 @@ int main(int argc, const char* argv[]) {
             return 1;
         }
 
-        s = parseModule(&reader);
+        // Use the dump from an earlier run if there is one
+        char* dump = malloc(strlen(*argv) + 4);
+        if (!dump) {
+            destroyReader(&reader);
+            return 1;
+        }
+
+        sprintf(dump, "%s.wd", *argv);
+        s = loadDump(&reader, dump);
         if (s) {
             printf("Error: %s\n", errString(s));
+            free(dump);
+            destroyReader(&reader);
             return 1;
         }
         
         Module* mod = getModuleFromReader(&reader);
         printf("Successfully loaded module = %s\n", mod->name);
-        if (dumpModule(mod)) 
+
+        // Modules from a dump have no sections, only a module loadDump() 
+        // had to parse because the dump was missing or stale needs one
+        if (mod->sections) 
+            s = dumpModuleTo(mod, dump);
+        free(dump);
+        if (s) {
+            destroyReader(&reader);
             return 1;
+        }
+
         destroyReader(&reader);
         argv++;
     }
 
-    Module m;
-    if (loadDump(&m, "hello.c.wasm.wd"))
-	    return 1;
     return 0;
 }
@@ -0,0 +1,135 @@
+#include <libwasm.h>
+#include <section.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+// Every allocation is rounded up to this so that anything placed in
+// the arena is suitably aligned for the structures we keep there
+#define ARENA_ALIGNMENT 16
+#define ARENA_ROUND(x)  (((x) + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1))
+
+struct ArenaBlock {
+	struct ArenaBlock* next;
+	size_t             size;
+	size_t             used;
+	// Keeps data[] aligned to ARENA_ALIGNMENT
+	size_t             _pad;
+	uint8_t            data[];
+};
+
+static struct ArenaBlock* newBlock(size_t size) {
+	struct ArenaBlock* block = malloc(sizeof(struct ArenaBlock) + size);
+	if (!block)
+		return NULL;
+
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+int createArena(struct WasmArena* arena, uint32_t blockSize) {
+	if (!arena)
+		return WASM_ARGUMENT_NULL;
+
+	arena->blockSize = (blockSize) ? ARENA_ROUND(blockSize) : WASM_ARENA_DEFAULT_BLOCK_SIZE;
+	arena->blocks = newBlock(arena->blockSize);
+	if (!arena->blocks)
+		return WASM_OUT_OF_MEMORY;
+
+	return WASM_SUCCESS;
+}
+
+void* arenaAlloc(struct WasmArena* arena, size_t size) {
+	size = ARENA_ROUND(size);
+
+	// The first block in the list is the one we bump allocate from
+	struct ArenaBlock* head = arena->blocks;
+	if (head && head->size - head->used >= size) {
+		void* ret = head->data + head->used;
+		head->used += size;
+		return ret;
+	}
+
+	// Anything larger than a quarter block gets a block of its own, placed
+	// behind the head so that the space left in the head is not wasted
+	if (head && size > arena->blockSize / 4) {
+		struct ArenaBlock* block = newBlock(size);
+		if (!block)
+			return NULL;
+
+		block->used = size;
+		block->next = head->next;
+		head->next = block;
+		return block->data;
+	}
+
+	struct ArenaBlock* block = newBlock((size > arena->blockSize) ? size : arena->blockSize);
+	if (!block)
+		return NULL;
+
+	block->used = size;
+	block->next = head;
+	arena->blocks = block;
+	return block->data;
+}
+
+void resetArena(struct WasmArena* arena) {
+	// Keep one block around so that reusing the arena does not go
+	// back to malloc() for small modules
+	struct ArenaBlock* keep = NULL;
+	struct ArenaBlock* block = arena->blocks;
+	while (block) {
+		struct ArenaBlock* next = block->next;
+		if (!keep && block->size == arena->blockSize) {
+			keep = block;
+			keep->used = 0;
+			keep->next = NULL;
+		}
+		else
+			free(block);
+
+		block = next;
+	}
+
+	arena->blocks = keep;
+}
+
+void destroyArena(struct WasmArena* arena) {
+	struct ArenaBlock* block = arena->blocks;
+	while (block) {
+		struct ArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+
+	arena->blocks = NULL;
+}
+
+size_t arenaSize(struct WasmArena* arena) {
+	size_t size = 0;
+	for (struct ArenaBlock* block = arena->blocks; block; block = block->next)
+		size += sizeof(struct ArenaBlock) + block->size;
+
+	return size;
+}
+
+void mergeArena(struct WasmArena* into, struct WasmArena* from) {
+	if (!from->blocks)
+		return;
+
+	// Splice from's blocks in behind our head so we keep allocating
+	// from the same block as before
+	struct ArenaBlock* tail = from->blocks;
+	while (tail->next)
+		tail = tail->next;
+
+	if (into->blocks) {
+		tail->next = into->blocks->next;
+		into->blocks->next = from->blocks;
+	}
+	else
+		into->blocks = from->blocks;
+
+	from->blocks = NULL;
+}
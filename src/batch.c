@@ -0,0 +1,192 @@
+#include <libwasm.h>
+#include <section.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// The items a worker still has to load, head in the upper and tail in the 
+// lower half. The owner takes from the head while others steal from the 
+// tail, both with a CAS on the whole range
+struct batch_range {
+    uint64_t range;
+} __attribute__((aligned(64))); // Keep every worker's range on its own cache line
+
+#define RANGE(head, tail) (((uint64_t)(head) << 32) | (tail))
+#define HEAD(range)       ((uint32_t)((range) >> 32))
+#define TAIL(range)       ((uint32_t)(range))
+
+struct batch_worker {
+    struct WasmBatch*  batch;
+    struct batch_range queue;
+    // Modules loaded by this worker live here unless they are lazy, see 
+    // WasmConfig.arena
+    struct WasmArena   arena;
+    // Every worker loads under a copy of the config as createReader() 
+    // writes to it
+    struct WasmConfig  config;
+    pthread_t          thread;
+    uint32_t           index;
+};
+
+static int takeOwn(struct batch_worker* worker, uint32_t* item) {
+    uint64_t range = __atomic_load_n(&worker->queue.range, __ATOMIC_ACQUIRE);
+    while (HEAD(range) < TAIL(range)) {
+        if (__atomic_compare_exchange_n(&worker->queue.range, &range, RANGE(HEAD(range) + 1, TAIL(range)), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *item = HEAD(range);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Moves the back half of someone else's items over to worker. Returns 0
+// once everybody is out of work.
+static int steal(struct batch_worker* worker) {
+    struct WasmBatch* batch = worker->batch;
+    for (uint32_t k = 1; k < batch->_nworkers; k++) {
+        struct batch_worker* victim = &batch->_workers[(worker->index + k) % batch->_nworkers];
+        uint64_t range = __atomic_load_n(&victim->queue.range, __ATOMIC_ACQUIRE);
+        while (HEAD(range) < TAIL(range)) {
+            uint32_t take = (TAIL(range) - HEAD(range) + 1) / 2;
+            uint32_t split = TAIL(range) - take;
+            if (__atomic_compare_exchange_n(&victim->queue.range, &range, RANGE(HEAD(range), split), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                // Our own range is empty, nobody can be taking from it
+                __atomic_store_n(&worker->queue.range, RANGE(split, split + take), __ATOMIC_RELEASE);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void loadItem(struct batch_worker* worker, struct WasmBatchItem* item) {
+    struct WasmBatch* batch = worker->batch;
+    worker->config.name = item->name;
+
+    if (item->data) 
+        item->status = createReaderFromBuffer(&item->reader, &worker->config, item->data, item->size);
+    else 
+        item->status = createReader(&item->reader, &worker->config);
+
+    if (!item->status) 
+        item->status = parseModule(&item->reader);
+
+    if (batch->done) 
+        batch->done(batch, item);
+
+    // Failed modules are of no use to anybody
+    if (item->status || batch->discard) {
+        if (item->reader.thisModule) 
+            destroyReader(&item->reader);
+
+        item->reader.thisModule = NULL;
+    }
+
+    // Nothing we loaded is alive any more, start over at the front of 
+    // the arena
+    if (batch->discard) 
+        resetArena(&worker->arena);
+}
+
+static void* batchWorker(void* arg) {
+    struct batch_worker* worker = arg;
+    struct WasmBatch* batch = worker->batch;
+
+    do {
+        uint32_t i;
+        while (takeOwn(worker, &i)) 
+            loadItem(worker, &batch->items[i]);
+    } while (steal(worker));
+
+    return NULL;
+}
+
+int createBatch(struct WasmBatch* init, struct WasmConfig* config, struct WasmBatchItem* items, uint32_t n) {
+    if (!init || !config || (!items && n)) 
+        return WASM_ARGUMENT_NULL;
+
+    init->items = items;
+    init->nitems = n;
+    init->_nworkers = workerCount(config, n);
+    init->_workers = aligned_alloc(_Alignof(struct batch_worker), sizeof(struct batch_worker) * init->_nworkers);
+    if (!init->_workers) 
+        return WASM_OUT_OF_MEMORY;
+
+    for (uint32_t i = 0; i < init->_nworkers; i++) {
+        struct batch_worker* worker = &init->_workers[i];
+        if (createArena(&worker->arena, WASM_ARENA_DEFAULT_BLOCK_SIZE)) {
+            while (i--) 
+                destroyArena(&init->_workers[i].arena);
+
+            free(init->_workers);
+            init->_workers = NULL;
+            return WASM_OUT_OF_MEMORY;
+        }
+
+        worker->batch = init;
+        worker->index = i;
+        worker->config = *config;
+        // Lazy modules keep allocating after they are loaded, each under 
+        // its own lock only, so they cannot share an arena
+        worker->config.arena = (config->flags & (WASM_CONFIG_LAZY | WASM_CONFIG_LAZY_CODE)) ? NULL : &worker->arena;
+        worker->queue.range = RANGE(0, 0);
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        memset(&items[i].reader, 0, sizeof(struct WasmModuleReader));
+        items[i].status = WASM_SUCCESS;
+    }
+
+    return WASM_SUCCESS;
+}
+
+int loadBatch(struct WasmBatch* batch) {
+    if (!batch || !batch->_workers) 
+        return WASM_ARGUMENT_NULL;
+
+    // Everybody starts out with an equal share
+    uint32_t share = batch->nitems / batch->_nworkers;
+    uint32_t extra = batch->nitems % batch->_nworkers;
+    for (uint32_t i = 0, start = 0; i < batch->_nworkers; i++) {
+        uint32_t len = share + (i < extra);
+        batch->_workers[i].queue.range = RANGE(start, start + len);
+        start += len;
+    }
+
+    // The calling thread is worker 0, whatever a worker that fails to 
+    // start would have done gets stolen by the others
+    uint32_t started = 1;
+    for (; started < batch->_nworkers; started++) {
+        if (pthread_create(&batch->_workers[started].thread, NULL, batchWorker, &batch->_workers[started])) 
+            break;
+    }
+
+    // Worker 0 only returns once there is nothing left to steal, which
+    // includes the items of workers that never started
+    batchWorker(&batch->_workers[0]);
+    for (uint32_t i = 1; i < started; i++) 
+        pthread_join(batch->_workers[i].thread, NULL);
+
+    for (uint32_t i = 0; i < batch->nitems; i++) {
+        if (batch->items[i].status) 
+            return batch->items[i].status;
+    }
+
+    return WASM_SUCCESS;
+}
+
+void destroyBatch(struct WasmBatch* batch) {
+    for (uint32_t i = 0; i < batch->nitems; i++) {
+        if (batch->items[i].reader.thisModule) 
+            destroyReader(&batch->items[i].reader);
+    }
+
+    for (uint32_t i = 0; i < batch->_nworkers && batch->_workers; i++) 
+        destroyArena(&batch->_workers[i].arena);
+
+    free(batch->_workers);
+    batch->_workers = NULL;
+    batch->_nworkers = 0;
+}
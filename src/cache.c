@@ -0,0 +1,306 @@
+#include <libwasm.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define  INITIAL_CACHE_BUCKETS 64 // Must be a power of 2
+
+// One distinct module, along with its own copy of the bytes it came from
+struct CacheEntry {
+    uint64_t                hash;
+    uint32_t                size;
+    size_t                  bytes; // counted against the budget, source and arena
+    uint32_t                refs;
+    struct CacheEntry*      next;  // next entry in the same bucket
+    struct CacheEntry*      newer; // neighbours in the LRU list
+    struct CacheEntry*      older;
+    struct WasmConfig       config;
+    struct WasmModuleReader reader;
+};
+
+struct ModuleCacheState {
+    pthread_mutex_t     lock;
+    struct CacheEntry** buckets;
+    uint32_t            nbuckets;
+    uint32_t            nentries;
+    struct CacheEntry*  newest;
+    struct CacheEntry*  oldest;
+    size_t              bytes;
+    uint64_t            hits;
+    uint64_t            misses;
+    uint64_t            evictions;
+};
+
+int createModuleCache(struct WasmModuleCache* init, struct WasmConfig* config, size_t budget) {
+    if (!init || !config) 
+        return WASM_ARGUMENT_NULL;
+
+    struct ModuleCacheState* state = calloc(1, sizeof(struct ModuleCacheState));
+    if (!state) 
+        return WASM_OUT_OF_MEMORY;
+
+    state->nbuckets = INITIAL_CACHE_BUCKETS;
+    state->buckets = calloc(state->nbuckets, sizeof(struct CacheEntry*));
+    if (!state->buckets || pthread_mutex_init(&state->lock, NULL)) {
+        free(state->buckets);
+        free(state);
+        return WASM_OUT_OF_MEMORY;
+    }
+
+    init->budget = budget;
+    init->config = *config;
+    // Every entry owns the copy of the bytes its module was parsed from,
+    // and a module shared by many names has none of them
+    init->config.flags |= WASM_CONFIG_TAKE_BUFFER;
+    init->config.name = NULL;
+    // Entries are freed one by one, they can't share an arena
+    init->config.arena = NULL;
+    init->_state = state;
+    return WASM_SUCCESS;
+}
+
+static void destroyEntry(struct CacheEntry* entry) {
+    destroyReader(&entry->reader);
+    free(entry);
+}
+
+// All of the following expect the cache's lock to be held
+
+static struct CacheEntry* findEntry(struct ModuleCacheState* state, uint64_t hash, const void* data, uint32_t size) {
+    struct CacheEntry* entry = state->buckets[hash & (state->nbuckets - 1)];
+    for (; entry; entry = entry->next) {
+        // Equal hashes are only very likely equal bytes
+        if (entry->hash == hash && entry->size == size && !memcmp(entry->reader._data, data, size)) 
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void unlinkLRU(struct ModuleCacheState* state, struct CacheEntry* entry) {
+    if (entry->newer) 
+        entry->newer->older = entry->older;
+    else 
+        state->newest = entry->older;
+
+    if (entry->older) 
+        entry->older->newer = entry->newer;
+    else 
+        state->oldest = entry->newer;
+}
+
+static void pushLRU(struct ModuleCacheState* state, struct CacheEntry* entry) {
+    entry->older = state->newest;
+    entry->newer = NULL;
+    if (state->newest) 
+        state->newest->newer = entry;
+    else 
+        state->oldest = entry;
+
+    state->newest = entry;
+}
+
+static void growBuckets(struct ModuleCacheState* state) {
+    uint32_t nbuckets = state->nbuckets * 2;
+    struct CacheEntry** buckets = calloc(nbuckets, sizeof(struct CacheEntry*));
+
+    // Longer chains are slower but still correct
+    if (!buckets) 
+        return;
+
+    for (uint32_t i = 0; i < state->nbuckets; i++) {
+        struct CacheEntry* entry = state->buckets[i];
+        while (entry) {
+            struct CacheEntry* next = entry->next;
+            entry->next = buckets[entry->hash & (nbuckets - 1)];
+            buckets[entry->hash & (nbuckets - 1)] = entry;
+            entry = next;
+        }
+    }
+
+    free(state->buckets);
+    state->buckets = buckets;
+    state->nbuckets = nbuckets;
+}
+
+static void insertEntry(struct ModuleCacheState* state, struct CacheEntry* entry) {
+    if (state->nentries >= state->nbuckets) 
+        growBuckets(state);
+
+    uint32_t bucket = entry->hash & (state->nbuckets - 1);
+    entry->next = state->buckets[bucket];
+    state->buckets[bucket] = entry;
+    pushLRU(state, entry);
+    state->nentries++;
+    state->bytes += entry->bytes;
+}
+
+static void removeEntry(struct ModuleCacheState* state, struct CacheEntry* entry) {
+    struct CacheEntry** link = &state->buckets[entry->hash & (state->nbuckets - 1)];
+    while (*link != entry) 
+        link = &(*link)->next;
+
+    *link = entry->next;
+    unlinkLRU(state, entry);
+    state->nentries--;
+    state->bytes -= entry->bytes;
+}
+
+// Takes unused modules out of the cache, oldest first, until it fits its
+// budget again. They are handed back in a list to be freed once the lock
+// has been dropped
+static struct CacheEntry* evict(struct WasmModuleCache* cache) {
+    struct ModuleCacheState* state = cache->_state;
+    struct CacheEntry* evicted = NULL;
+    struct CacheEntry* entry = state->oldest;
+    while (entry && state->bytes > cache->budget) {
+        struct CacheEntry* newer = entry->newer;
+        if (!entry->refs) {
+            removeEntry(state, entry);
+            entry->next = evicted;
+            evicted = entry;
+            state->evictions++;
+        }
+
+        entry = newer;
+    }
+
+    return evicted;
+}
+
+static void destroyEvicted(struct CacheEntry* evicted) {
+    while (evicted) {
+        struct CacheEntry* next = evicted->next;
+        destroyEntry(evicted);
+        evicted = next;
+    }
+}
+
+int loadCachedModule(struct WasmModuleCache* cache, const void* data, uint32_t size, struct WasmModule** module) {
+    if (!cache || !module || (!data && size)) 
+        return WASM_ARGUMENT_NULL;
+
+    struct ModuleCacheState* state = cache->_state;
+    uint64_t hash = hashBytes(data, size);
+
+    pthread_mutex_lock(&state->lock);
+    struct CacheEntry* entry = findEntry(state, hash, data, size);
+    if (entry) {
+        entry->refs++;
+        unlinkLRU(state, entry);
+        pushLRU(state, entry);
+        state->hits++;
+        pthread_mutex_unlock(&state->lock);
+        *module = getModuleFromReader(&entry->reader);
+        return WASM_SUCCESS;
+    }
+
+    state->misses++;
+    pthread_mutex_unlock(&state->lock);
+
+    // Parse without holding the lock so that other modules can be 
+    // loaded meanwhile
+    entry = malloc(sizeof(struct CacheEntry));
+    void* copy = malloc(size ? size : 1);
+    if (!entry || !copy) {
+        free(entry);
+        free(copy);
+        return WASM_OUT_OF_MEMORY;
+    }
+
+    memcpy(copy, data, size);
+    entry->hash = hash;
+    entry->size = size;
+    entry->refs = 1;
+    entry->config = cache->config;
+
+    int status = createReaderFromBuffer(&entry->reader, &entry->config, copy, size);
+    if (status) {
+        free(copy);
+        free(entry);
+        return status;
+    }
+
+    // Nobody else sees the module before it is valid, so none of them
+    // link it at the same time. Lazy modules are the only ones that 
+    // parseModule() leaves unvalidated
+    status = parseModule(&entry->reader);
+    if (!status) 
+        status = validateModule(entry->reader.thisModule);
+    if (status) {
+        destroyEntry(entry);
+        return status;
+    }
+
+    entry->reader.thisModule->_cached = entry;
+    entry->bytes = size + arenaSize(entry->reader.thisModule->arena);
+
+    // Somebody else may have loaded the same bytes while we were parsing
+    pthread_mutex_lock(&state->lock);
+    struct CacheEntry* existing = findEntry(state, hash, data, size);
+    struct CacheEntry* evicted = NULL;
+    if (existing) {
+        existing->refs++;
+        unlinkLRU(state, existing);
+        pushLRU(state, existing);
+    }
+    else {
+        insertEntry(state, entry);
+        evicted = evict(cache);
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    destroyEvicted(evicted);
+    if (existing) {
+        destroyEntry(entry);
+        entry = existing;
+    }
+
+    *module = getModuleFromReader(&entry->reader);
+    return WASM_SUCCESS;
+}
+
+void releaseCachedModule(struct WasmModuleCache* cache, struct WasmModule* module) {
+    if (!cache || !module || !module->_cached) 
+        return;
+
+    struct ModuleCacheState* state = cache->_state;
+    struct CacheEntry* evicted = NULL;
+
+    pthread_mutex_lock(&state->lock);
+    if (!--module->_cached->refs) 
+        evicted = evict(cache);
+    pthread_mutex_unlock(&state->lock);
+
+    destroyEvicted(evicted);
+}
+
+void getCacheStats(struct WasmModuleCache* cache, struct WasmCacheStats* stats) {
+    struct ModuleCacheState* state = cache->_state;
+
+    pthread_mutex_lock(&state->lock);
+    stats->hits = state->hits;
+    stats->misses = state->misses;
+    stats->evictions = state->evictions;
+    stats->bytes = state->bytes;
+    stats->modules = state->nentries;
+    pthread_mutex_unlock(&state->lock);
+}
+
+void destroyModuleCache(struct WasmModuleCache* cache) {
+    struct ModuleCacheState* state = cache->_state;
+    if (!state) 
+        return;
+
+    struct CacheEntry* entry = state->oldest;
+    while (entry) {
+        struct CacheEntry* newer = entry->newer;
+        destroyEntry(entry);
+        entry = newer;
+    }
+
+    pthread_mutex_destroy(&state->lock);
+    free(state->buckets);
+    free(state);
+    cache->_state = NULL;
+}
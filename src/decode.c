@@ -0,0 +1,252 @@
+#include <libwasm.h>
+#include <decode.h>
+#include <stdlib.h>
+#include <string.h>
+
+// What follows each opcode byte, see decode.h
+const uint8_t instructionImmediates[256] = {
+    [WASM_OP_UNREACHABLE]                        = IMM_NONE,
+    [WASM_OP_NOP]                                = IMM_NONE,
+    [WASM_OP_BLOCK]                              = IMM_BLOCKTYPE,
+    [WASM_OP_LOOP]                               = IMM_BLOCKTYPE,
+    [WASM_OP_IF]                                 = IMM_BLOCKTYPE,
+    [WASM_OP_ELSE]                               = IMM_NONE,
+    [WASM_OP_END]                                = IMM_NONE,
+    [WASM_OP_BR]                                 = IMM_LABEL,
+    [WASM_OP_BR_IF]                              = IMM_LABEL,
+    [WASM_OP_BR_TABLE]                           = IMM_BR_TABLE,
+    [WASM_OP_RETURN]                             = IMM_NONE,
+    [WASM_OP_CALL]                               = IMM_INDEX,
+    [WASM_OP_CALL_INDIRECT]                      = IMM_CALL_INDIRECT,
+    [WASM_OP_DROP]                               = IMM_NONE,
+    [WASM_OP_SELECT]                             = IMM_NONE,
+    [WASM_OP_LOCAL_GET ... WASM_OP_GLOBAL_SET]   = IMM_INDEX,
+    [WASM_OP_I32_LOAD ... WASM_OP_I64_STORE32]   = IMM_MEMARG,
+    [WASM_OP_MEMORY_SIZE]                        = IMM_MEMORY,
+    [WASM_OP_MEMORY_GROW]                        = IMM_MEMORY,
+    [WASM_OP_I32_CONST]                          = IMM_I32,
+    [WASM_OP_I64_CONST]                          = IMM_I64,
+    [WASM_OP_F32_CONST]                          = IMM_F32,
+    [WASM_OP_F64_CONST]                          = IMM_F64,
+    [WASM_OP_I32_EQZ ... WASM_OP_I64_EXTEND32_S] = IMM_NONE,
+    [0xFC]                                       = IMM_PREFIX,
+};
+
+// Blocks on the stack while decoding that fit without going to malloc()
+#define INLINE_DEPTH 64
+
+// First pass over a body, finds out how much decoding it takes up
+static int countInstructions(struct CodeSectionCode* code, struct DecodedCode* decoded) {
+    struct WasmModuleReader reader;
+    codeReader(&reader, code->expr, 0, code->codeSize);
+
+    struct Instruction instr;
+    uint32_t depth = 1; // the function's own block
+    decoded->ninstrs = 0;
+    decoded->nlabels = 0;
+    decoded->maxDepth = 1;
+
+    while (depth) {
+        if (reader.offset >= code->codeSize) {
+            error("Code expression ends inside a block");
+            return WASM_INVALID_EXPR;
+        }
+
+        int n = decodeInstruction(&reader, &instr);
+        if (n)
+            return n;
+
+        decoded->ninstrs++;
+        switch (instr.opcode) {
+            case WASM_OP_BLOCK:
+            case WASM_OP_LOOP:
+            case WASM_OP_IF:
+                if (++depth > decoded->maxDepth)
+                    decoded->maxDepth = depth;
+                break;
+
+            case WASM_OP_END:
+                depth--;
+                break;
+
+            case WASM_OP_BR_TABLE:
+                decoded->nlabels += instr.a + 1;
+                break;
+        }
+    }
+
+    if (reader.offset != code->codeSize) {
+        error("Code expression goes on after the function's end");
+        return WASM_UNBALANCED_BLOCK;
+    }
+
+    return WASM_SUCCESS;
+}
+
+// The instruction that opened label, UINT32_MAX for the function itself
+static int labelTarget(uint32_t* open, uint32_t depth, uint32_t label, uint32_t* target) {
+    if (label > depth) {
+        error("Branch to label %u with only %u blocks open", label, depth + 1);
+        return WASM_INVALID_LABEL;
+    }
+
+    *target = (label == depth) ? UINT32_MAX : open[depth - 1 - label];
+    return WASM_SUCCESS;
+}
+
+// Second pass, links blocks to their else and end and branches to their blocks
+static int linkInstructions(struct CodeSectionCode* code, struct DecodedCode* decoded, uint32_t* open) {
+    struct WasmModuleReader reader;
+    codeReader(&reader, code->expr, 0, code->codeSize);
+
+    struct Instruction* instrs = decoded->instrs;
+    uint32_t depth = 0; // blocks open besides the function's
+    uint32_t nlabels = 0;
+
+    for (uint32_t i = 0; i < decoded->ninstrs; i++) {
+        struct Instruction* instr = &instrs[i];
+        decodeInstruction(&reader, instr); // already checked by countInstructions()
+
+        int status = WASM_SUCCESS;
+        switch (instr->opcode) {
+            case WASM_OP_BLOCK:
+            case WASM_OP_LOOP:
+            case WASM_OP_IF:
+                open[depth++] = i;
+                break;
+
+            case WASM_OP_ELSE: {
+                // Low half of an if's b is its else
+                struct Instruction* opener = (depth) ? &instrs[open[depth - 1]] : NULL;
+                if (!opener || opener->opcode != WASM_OP_IF || (uint32_t) opener->b != UINT32_MAX) {
+                    error("else without an if");
+                    return WASM_UNBALANCED_BLOCK;
+                }
+
+                instr->a = open[depth - 1];
+                opener->b = (opener->b & ~(uint64_t) UINT32_MAX) | i;
+                break;
+            }
+
+            case WASM_OP_END: {
+                if (!depth)
+                    break; // the function's end, the last instruction
+
+                uint32_t o = open[--depth];
+                struct Instruction* opener = &instrs[o];
+                instr->a = o;
+                if (opener->opcode == WASM_OP_IF) {
+                    uint32_t e = (uint32_t) opener->b;
+                    if (e != UINT32_MAX)
+                        instrs[e].b = i;
+                    else
+                        e = i;
+
+                    opener->b = ((uint64_t) i << 32) | e;
+                }
+                else
+                    opener->b = i;
+                break;
+            }
+
+            case WASM_OP_BR:
+            case WASM_OP_BR_IF: {
+                uint32_t target = UINT32_MAX;
+                status = labelTarget(open, depth, instr->a, &target);
+                instr->b = target;
+                break;
+            }
+
+            case WASM_OP_BR_TABLE: {
+                struct WasmModuleReader labels;
+                codeReader(&labels, code->expr, instr->b, code->codeSize);
+                for (uint32_t j = 0; j <= instr->a && !status; j++) {
+                    uint32_t target = UINT32_MAX;
+                    decoded->labels[nlabels + j] = fetchIndex(&labels);
+                    status = labelTarget(open, depth, decoded->labels[nlabels + j], &target);
+                }
+
+                instr->b = nlabels;
+                nlabels += instr->a + 1;
+                break;
+            }
+        }
+
+        if (status)
+            return status;
+    }
+
+    return WASM_SUCCESS;
+}
+
+int decodeCode(struct CodeSectionCode* code, struct WasmArena* arena, struct DecodedCode* decoded) {
+    if (!code || !arena || !decoded)
+        return WASM_ARGUMENT_NULL;
+
+    int status = countInstructions(code, decoded);
+    if (status)
+        return status;
+
+    decoded->instrs = arenaAlloc(arena, sizeof(struct Instruction) * decoded->ninstrs);
+    decoded->labels = (decoded->nlabels) ? arenaAlloc(arena, sizeof(uint32_t) * decoded->nlabels) : NULL;
+    if (!decoded->instrs || (decoded->nlabels && !decoded->labels))
+        return WASM_OUT_OF_MEMORY;
+
+    uint32_t inlineOpen[INLINE_DEPTH];
+    uint32_t* open = inlineOpen;
+    if (decoded->maxDepth > INLINE_DEPTH) {
+        open = malloc(sizeof(uint32_t) * decoded->maxDepth);
+        if (!open)
+            return WASM_OUT_OF_MEMORY;
+    }
+
+    status = linkInstructions(code, decoded, open);
+    if (open != inlineOpen)
+        free(open);
+
+    return status;
+}
+
+void iterateCode(struct InstructionIterator* it, struct CodeSectionCode* code) {
+    memset(it, 0, sizeof(*it));
+    it->_expr = code->expr;
+    it->_size = code->codeSize;
+}
+
+void iterateDecodedCode(struct InstructionIterator* it, struct DecodedCode* decoded) {
+    memset(it, 0, sizeof(*it));
+    it->_next = decoded->instrs;
+    it->_end = decoded->instrs + decoded->ninstrs;
+    it->_labels = decoded->labels;
+}
+
+const struct Instruction* nextInstruction(struct InstructionIterator* it) {
+    if (!it->_expr)
+        return (it->_next < it->_end) ? it->_next++ : NULL;
+
+    if (it->status || it->_offset >= it->_size)
+        return NULL;
+
+    struct WasmModuleReader reader;
+    codeReader(&reader, it->_expr, it->_offset, it->_size);
+    it->status = decodeInstruction(&reader, &it->_current);
+    if (it->status)
+        return NULL;
+
+    it->_offset = reader.offset;
+    return &it->_current;
+}
+
+uint32_t brTableLabel(struct InstructionIterator* it, const struct Instruction* instr, uint32_t i) {
+    if (!it->_expr)
+        return it->_labels[instr->b + i];
+
+    // The raw form has to go past the labels before it
+    struct WasmModuleReader reader;
+    codeReader(&reader, it->_expr, instr->b, it->_size);
+    uint32_t label = fetchIndex(&reader);
+    for (uint32_t j = 0; j < i; j++)
+        label = fetchIndex(&reader);
+
+    return label;
+}
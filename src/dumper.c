@@ -1,238 +1,553 @@
 #include <libwasm.h>
+#include <section.h>
 #include <log.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
-extern int errno;
+#include <stdio.h>
 
 static const uint32_t DUMP_MAGIC = 0x0BADF00D;
-static const uint16_t DUMP_VERSION = 0x0001;
+static const uint16_t DUMP_VERSION = 0x0002;
 static const char* UNNAMED_MODULE = "<UNNAMED>";
 static const char* UNNAMED_FUNC = "<UNNAMED-FUNCTION>";
 static const char* DUMP_EXT = ".wd";
 
 /*
-#define write(ptr, file) \
-    if (!fwrite(ptr, sizeof(*ptr), 1, file)) { \
-        error("Writing value to dumping file failed"); \
-        perror("Reason: "); \
-        return WASM_FILE_ACCESS_ERROR; \
+ * Layout of a dump, all numbers are little endian and unaligned:
+ *
+ *  u32 magic, u16 version
+ *  u64 hashBytes() of the module the dump was made from, u32 its size
+ *  u32 length of the module name including its NUL, the name
+ *  u64 flags, u64 nglobals, u64 nfuncs
+ *  for each function:
+ *      NUL terminated name, u64 hash
+ *      u8 ret, u8 paramsLen, params, u32 type index
+ *      u32 localSize, locals, u32 codeSize, expr (both 0 for imports)
+ *  for each global: u8 valtype, u8 mut, u8 exprSize, expr
+ *  u32 1 if there is a memory, then u32 min, u32 max, u32 nData
+ *      and for each segment: u8 exprSize, expr, u32 len, bytes
+ *  u32 1 if there is a table, then u32 min, u32 max, u32 nElement
+ *      and for each element: u8 exprSize, expr, u32 len, u32 funcidx[len]
+ */
+
+// A dump is put together twice, first without a buffer to find out its
+// exact size and then into a buffer of that size, which is written out in
+// one go. The same code doing both means the two can never disagree
+struct DumpBuffer {
+    uint8_t* buf;
+    uint64_t size;
+};
+
+static void putBytes(struct DumpBuffer* out, const void* src, uint32_t n) {
+    if (out->buf && n) 
+        memcpy(out->buf + out->size, src, n);
+
+    out->size += n;
+}
+
+static void putU8(struct DumpBuffer* out, uint8_t v) {
+    putBytes(out, &v, 1);
+}
+
+static void putU16(struct DumpBuffer* out, uint16_t v) {
+    uint8_t b[2] = { v, v >> 8 };
+    putBytes(out, b, sizeof(b));
+}
+
+static void putU32(struct DumpBuffer* out, uint32_t v) {
+    uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+    putBytes(out, b, sizeof(b));
+}
+
+static void putU64(struct DumpBuffer* out, uint64_t v) {
+    putU32(out, v);
+    putU32(out, v >> 32);
+}
+
+// Also puts the NUL terminator, which names don't have in view mode
+static void putString(struct DumpBuffer* out, const char* s, uint32_t len) {
+    putBytes(out, s, len);
+    putU8(out, 0);
+}
+
+static int serializeModule(struct WasmModule* module, struct DumpBuffer* out) {
+    const char* name = (module->name) ? module->name : UNNAMED_MODULE;
+    uint32_t nameLen = strlen(name);
+
+    putU32(out, DUMP_MAGIC);
+    putU16(out, DUMP_VERSION);
+    // Hashing the module once is enough, the sizing pass doesn't need it
+    putU64(out, (out->buf) ? hashBytes(module->_source, module->_sourceSize) : 0);
+    putU32(out, module->_sourceSize);
+    putU32(out, nameLen + 1);
+    putString(out, name, nameLen);
+    putU64(out, module->flags);
+    putU64(out, module->nglobals);
+    putU64(out, module->nfuncs);
+
+    for (uint32_t i = 0; i < module->nfuncs; i++) {
+        struct Function* function = &module->functions[i];
+        if (function->name) 
+            putString(out, function->name, function->nameLen);
+        else 
+            putString(out, UNNAMED_FUNC, strlen(UNNAMED_FUNC));
+
+        putU64(out, function->hash);
+        putU8(out, function->signature->ret);
+        putU8(out, function->signature->paramsLen);
+        putBytes(out, function->signature->params, function->signature->paramsLen);
+        putU32(out, function->signature->idx);
+
+        // Bodies may not have been decoded yet
+        struct CodeSectionCode* code;
+        int n = getFunctionCode(module, i, &code);
+        if (n) 
+            return n;
+
+        if (code) {
+            putU32(out, code->localSize);
+            putBytes(out, code->locals, code->localSize);
+            putU32(out, code->codeSize);
+            putBytes(out, code->expr, code->codeSize);
+        }
+        else {
+            putU32(out, 0); // 0 localsize
+            putU32(out, 0); // 0 codesize
+        }
+    }
+
+    for (uint32_t i = 0; i < module->nglobals; i++) {
+        putU8(out, module->globals[i].valtype);
+        putU8(out, module->globals[i].mut);
+        putU8(out, module->globals[i].exprSize);
+        putBytes(out, module->globals[i].expr, module->globals[i].exprSize);
+    }
+
+    struct Memory* memories = module->memories;
+    putU32(out, memories && memories->memory);
+    if (memories && memories->memory) {
+        putU32(out, memories->memory->min);
+        putU32(out, memories->memory->max);
+        putU32(out, memories->nData);
+        for (uint32_t i = 0; i < memories->nData; i++) {
+            putU8(out, memories->init[i].exprSize);
+            putBytes(out, memories->init[i].expr, memories->init[i].exprSize);
+            putU32(out, memories->init[i].len);
+            putBytes(out, memories->init[i].bytes, memories->init[i].len);
+        }
+    }
+
+    struct Table* tables = module->tables;
+    putU32(out, tables && tables->table);
+    if (tables && tables->table) {
+        putU32(out, tables->table->min);
+        putU32(out, tables->table->max);
+        putU32(out, tables->nElement);
+        for (uint32_t i = 0; i < tables->nElement; i++) {
+            putU8(out, tables->init[i].exprSize);
+            putBytes(out, tables->init[i].expr, tables->init[i].exprSize);
+            putU32(out, tables->init[i].len);
+            for (uint32_t j = 0; j < tables->init[i].len; j++) 
+                putU32(out, tables->init[i].funcidx[j]);
+        }
+    }
+
+    // The loader reads dumps into a buffer no larger than this
+    if (out->size > UINT32_MAX) {
+        error("Module is too large to dump");
+        return WASM_MODULE_TOO_LARGE;
     }
 
-// Also write the nul terminator along with name
-#define write_string(ptr, file){  \
-    int len = strlen(ptr); \
-    if (!fwrite(ptr, sizeof(char), (len + 1), file)) {\
-        error("Writing string to dumping file failed"); \
-        perror("Reason: "); \
-        return WASM_FILE_ACCESS_ERROR; \
-    }}
-
-// Only for writing uint8_t buffers
-#define write_buf(ptr, n, file) \
-    if (!fwrite(ptr, n, 1, file)) { \
-        error("Writing buffer to dumping file failed"); \
-        perror("Reason: "); \
-        return WASM_FILE_ACCESS_ERROR; \
-    } 
-*/
-
-// These are unsafe macros that don't check errors
-// The above macors are safe but for some reason fwrite return a wrong number of
-// bytes written despite writing everything
-// FIXME: Unsafe workaround
-#define write(ptr, file) \
-    fwrite(ptr, sizeof(*ptr), 1, file);
-
-#define write_string(ptr, file){  \
-    int len = strlen(ptr); \
-    fwrite(ptr, sizeof(char), (len + 1), file);\
-}
-
-#define write_buf(ptr, n, file) \
-    fwrite(ptr, n, 1, file)
+    return WASM_SUCCESS;
+}
 
 int dumpModule(struct WasmModule* module) {
+    if (!module) {
+        error("Module is null");
+        return WASM_ARGUMENT_NULL;
+    }
+
     const char* _name;
 
     if (module->name) 
         _name = module->name;
     else
         _name = UNNAMED_MODULE;
-    
-    int l = strlen(_name);
-    char* name = malloc(l + 4);
-    memset(name, '\0', l);
-    memcpy(name, _name, l);
-    strcat(name, DUMP_EXT);
-    info("Dumping file = %s", name);
-
-    FILE* file = fopen(name, "w");
-    if (!file) {
-        error("Failed to open dumping file for writing");
-        return WASM_FILE_ACCESS_ERROR;
-    }
 
-    l += 4;
+    char* name = malloc(strlen(_name) + strlen(DUMP_EXT) + 1);
+    if (!name) 
+        return WASM_OUT_OF_MEMORY;
 
-    write(&DUMP_MAGIC, file);
-    write(&DUMP_VERSION, file);
-    write(&l, file);
-    info("L = %d", l);
-    write_string(name, file);
-    write(&module->flags, file);
-    write(&module->nglobals, file);
-    write(&module->nfuncs, file);
-    info("Flags = %lu nglobals = %lu nfuncs = %lu", module->flags, module->nglobals, module->nfuncs);
+    sprintf(name, "%s%s", _name, DUMP_EXT);
+    int status = dumpModuleTo(module, name);
+    free(name);
+    return status;
+}
 
-    for (int i = 0; i < module->nfuncs; i++) {
-        if (module->functions[i].name) {
-            write_string(module->functions[i].name, file);
-        }
-        else 
-            write_string(UNNAMED_FUNC, file);
-
-        write(&module->functions[i].hash, file);
-        write(&module->functions[i].signature->ret, file);
-        write(&module->functions[i].signature->paramsLen, file);
-        write_buf(module->functions[i].signature->params, module->functions[i].signature->paramsLen, file);
-        write(&module->functions[i].signature->idx, file);
-
-        if (module->functions[i].code) {
-            write(&module->functions[i].code->localSize, file);
-            write_buf(&module->functions[i].code->locals, module->functions[i].code->localSize, file);
-            write(&module->functions[i].code->codeSize, file);
-            write_buf(&module->functions[i].code->expr, module->functions[i].code->codeSize, file);
-        }
-        else {
-            int l = 0;
-            write(&l, file); // 0 localsize
-            write(&l, file); // 0 codesize
-        }
+int dumpModuleTo(struct WasmModule* module, const char* fname) {
+    if (!module || !fname) {
+        error("Module or dump file is null");
+        return WASM_ARGUMENT_NULL;
     }
 
-    write(&module->nglobals, file);
-    for (int i = 0; i < module->nglobals; i++) {
-        write(&module->globals[i].valtype, file);
-        write(&module->globals[i].mut, file);
-        write(&module->globals[i].exprSize, file);
-        write_buf(module->globals[i].expr, module->globals[i].exprSize, file);
+    // Without the module's bytes the dump could never be checked against them
+    if (!module->_source) {
+        error("Module has no source to dump against");
+        return WASM_INVALID_ARG;
     }
 
-    if (module->memories) {
-        int t = 1;
-        write(&t, file);
-        write(&module->memories->memory->min, file);
-        write(&module->memories->memory->max, file);
-        write(&module->memories->nData, file);
-        for (int i = 0; i < module->memories->nData; i++) {
-            write(&module->memories->init[i].exprSize, file);
-            write_buf(module->memories->init[i].expr, module->memories->init[i].exprSize, file);
-            write(&module->memories->init[i].len, file);
-            write_buf(module->memories->init[i].bytes, module->memories->init[i].len, file);
-        }
+    struct DumpBuffer out = { .buf = NULL, .size = 0 };
+    int status = serializeModule(module, &out);
+    if (status) 
+        return status;
+
+    out.buf = malloc(out.size);
+    if (!out.buf) 
+        return WASM_OUT_OF_MEMORY;
+
+    uint64_t size = out.size;
+    out.size = 0;
+    status = serializeModule(module, &out);
+    if (status) {
+        free(out.buf);
+        return status;
     }
-    else {
-        int t = 0;
-        write(&t, file);
+
+    info("Dumping file = %s", fname);
+    info("Flags = %lu nglobals = %lu nfuncs = %lu", module->flags, module->nglobals, module->nfuncs);
+
+    int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error("Failed to open dumping file for writing");
+        free(out.buf);
+        return WASM_FILE_ACCESS_ERROR;
     }
 
-    if (module->tables) {
-        int t = 1;
-        write(&t, file);
-        write(&module->tables->table->min, file);
-        write(&module->tables->table->max, file);
-        write(&module->tables->nElement, file);
-        for (int i = 0; i < module->tables->nElement; i++) {
-            write(&module->tables->init[i].exprSize, file);
-            write_buf(module->tables->init[i].expr, module->tables->init[i].exprSize, file);
-            write(&module->tables->init[i].len, file);
-            // Multiply by 4 as size of each funcidx is 4
-            write_buf(module->tables->init[i].funcidx, module->tables->init[i].len * 4, file);
+    // write() may stop short of everything, it is only an error once it
+    // fails or makes no progress
+    uint8_t* p = out.buf;
+    while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) 
+            continue;
+
+        if (n <= 0) {
+            status = WASM_FILE_ACCESS_ERROR;
+            break;
         }
-    }
-    else {
-        int t = 0;
-        write(&t, file);
+
+        p += n;
+        size -= n;
     }
 
-    fclose(file);
-    
-    return WASM_SUCCESS;
+    if (close(fd) && !status) 
+        status = WASM_FILE_ACCESS_ERROR;
+
+    // A partly written dump is left behind, loadDump() rejects it
+    if (status) 
+        error("Writing dumping file %s failed: %s", fname, strerror(errno));
+
+    free(out.buf);
+    return status;
 }
 
-static uint8_t getU8(uint8_t* buf, uint32_t* offset) {
-	*offset += 1;
-	return buf[*offset - 1];
+// Reading a dump never trusts it more than a module: every read goes
+// through take(), which fails once the dump runs out
+struct DumpCursor {
+	uint8_t* buf;
+	uint32_t size;
+	uint32_t offset;
+	int      failed;
+};
+
+static uint8_t* take(struct DumpCursor* cur, uint32_t n) {
+	if (cur->failed || (uint64_t) cur->offset + n > cur->size) {
+		cur->failed = 1;
+		return NULL;
+	}
+
+	cur->offset += n;
+	return cur->buf + cur->offset - n;
+}
+
+static uint8_t getU8(struct DumpCursor* cur) {
+	uint8_t* p = take(cur, 1);
+	return (p) ? p[0] : 0;
 }
 
-static uint16_t getU16(uint8_t* buf, uint32_t* offset) {
-	*offset += 2;
-	return (((uint16_t) buf[*offset - 1]) << 8 | buf[*offset - 2]);
+static uint16_t getU16(struct DumpCursor* cur) {
+	uint8_t* p = take(cur, 2);
+	if (!p) 
+		return 0;
+
+	return (((uint16_t) p[1]) << 8 | p[0]);
 }
 
-static uint32_t getU32(uint8_t* buf, uint32_t* offset) {
-	*offset += 4;
-	return (((uint32_t) buf[*offset - 1]) << 24 | 
-			((uint32_t) buf[*offset - 2]) << 16 |
-			((uint32_t) buf[*offset - 3]) << 8  |
-			((uint32_t) buf[*offset - 4]));
+static uint32_t getU32(struct DumpCursor* cur) {
+	uint8_t* p = take(cur, 4);
+	if (!p) 
+		return 0;
+
+	return (((uint32_t) p[3]) << 24 | 
+			((uint32_t) p[2]) << 16 |
+			((uint32_t) p[1]) << 8  |
+			((uint32_t) p[0]));
 }
 
-static uint64_t getU64(uint8_t* buf, uint32_t* offset) {
-	*offset += 4;
-	return (((uint64_t) buf[*offset - 1]) << 56 | 
-			((uint64_t) buf[*offset - 2]) << 48 |
-			((uint64_t) buf[*offset - 3]) << 40 |
-			((uint64_t) buf[*offset - 4]) << 32 |
-            ((uint64_t) buf[*offset - 5]) << 24 |
-            ((uint64_t) buf[*offset - 6]) << 16 |
-            ((uint64_t) buf[*offset - 7]) << 8  |
-            ((uint64_t) buf[*offset - 8]));
+static uint64_t getU64(struct DumpCursor* cur) {
+	uint64_t lo = getU32(cur);
+	uint64_t hi = getU32(cur);
+	return (hi << 32) | lo;
 }
 
+// A NUL terminated string inside the dump
+static char* getString(struct DumpCursor* cur) {
+	if (cur->failed) 
+		return NULL;
 
-int loadDump(struct WasmModule* module, const char* fname) {
-	if (!module) {
-		error("Module is null");
-		return WASM_ARGUMENT_NULL;
+	uint8_t* end = memchr(cur->buf + cur->offset, 0, cur->size - cur->offset);
+	if (!end) {
+		cur->failed = 1;
+		return NULL;
 	}
-	
-	FILE* file = fopen(fname, "r");
+
+	return (char*) take(cur, end - (cur->buf + cur->offset) + 1);
+}
+
+// Arrays of 32 bit numbers are not aligned in the dump so they get copied
+static uint32_t* getU32Array(struct DumpCursor* cur, struct WasmArena* arena, uint32_t n) {
+	uint8_t* p = take(cur, (uint64_t) n * 4 > UINT32_MAX ? UINT32_MAX : n * 4);
+	if (!p) 
+		return NULL;
+
+	uint32_t* ret = arenaAlloc(arena, sizeof(uint32_t) * n);
+	if (ret) 
+		memcpy(ret, p, sizeof(uint32_t) * n);
+	else 
+		cur->failed = 1;
+
+	return ret;
+}
+
+static void* dumpAlloc(struct DumpCursor* cur, struct WasmArena* arena, uint64_t size) {
+	// Nothing in a dump can describe more than the dump itself holds
+	void* ret = (size > (uint64_t) cur->size * 64) ? NULL : arenaAlloc(arena, size);
+	if (!ret) 
+		cur->failed = 1;
+
+	return ret;
+}
+
+// Everything points into buf, which lives in arena along with the rest
+static int readDumpContents(struct WasmModule* module, struct WasmArena* arena, struct DumpCursor* cur) {
+	uint32_t nameLen = getU32(cur);
+	char* name = (char*) take(cur, nameLen);
+	if (!name || !nameLen || name[nameLen - 1]) 
+		return WASM_INVALID_DUMP;
+
+	uint64_t flags = getU64(cur);
+	uint64_t nglobals = getU64(cur);
+	uint64_t nfuncs = getU64(cur);
+	if (cur->failed || nfuncs > UINT32_MAX || nglobals > UINT32_MAX) 
+		return WASM_INVALID_DUMP;
+
+	struct Function* functions = dumpAlloc(cur, arena, sizeof(struct Function) * nfuncs);
+	struct TypeSectionType* types = dumpAlloc(cur, arena, sizeof(struct TypeSectionType) * nfuncs);
+	struct CodeSectionCode* code = dumpAlloc(cur, arena, sizeof(struct CodeSectionCode) * nfuncs);
+	if (cur->failed) 
+		return WASM_INVALID_DUMP;
+
+	for (uint32_t i = 0; i < nfuncs && !cur->failed; i++) {
+		struct Function* function = &functions[i];
+		function->name = getString(cur);
+		if (function->name && function->name[0] == UNNAMED_FUNC[0] && !strcmp(function->name, UNNAMED_FUNC)) 
+			function->name = NULL;
+
+		function->nameLen = (function->name) ? strlen(function->name) : 0;
+		function->hash = getU64(cur);
+
+		function->signature = &types[i];
+		types[i].ret = getU8(cur);
+		types[i].paramsLen = getU8(cur);
+		types[i].params = take(cur, types[i].paramsLen);
+		types[i].idx = getU32(cur);
+
+		uint32_t localSize = getU32(cur);
+		uint8_t* locals = take(cur, localSize);
+		uint32_t codeSize = getU32(cur);
+		uint8_t* expr = take(cur, codeSize);
+
+		// Every body has at least its end, only imports have none
+		function->code = NULL;
+		if (codeSize) {
+			function->code = &code[i];
+			code[i].localSize = localSize;
+			code[i].locals = (localSize) ? locals : NULL;
+			code[i].codeSize = codeSize;
+			code[i].expr = expr;
+		}
+	}
+
+	struct GlobalSectionGlobal* globals = dumpAlloc(cur, arena, sizeof(struct GlobalSectionGlobal) * nglobals);
+	for (uint32_t i = 0; i < nglobals && !cur->failed; i++) {
+		globals[i].valtype = getU8(cur);
+		globals[i].mut = getU8(cur);
+		globals[i].exprSize = getU8(cur);
+		globals[i].expr = take(cur, globals[i].exprSize);
+	}
+
+	struct Memory* memories = dumpAlloc(cur, arena, sizeof(struct Memory));
+	if (memories) 
+		memset(memories, 0, sizeof(struct Memory));
+
+	if (!cur->failed && getU32(cur)) {
+		memories->memory = dumpAlloc(cur, arena, sizeof(struct TableSectionTable));
+		uint32_t min = getU32(cur);
+		uint32_t max = getU32(cur);
+		memories->nData = getU32(cur);
+		memories->init = dumpAlloc(cur, arena, sizeof(struct DataSectionData) * memories->nData);
+		if (!cur->failed) {
+			memories->memory->min = min;
+			memories->memory->max = max;
+		}
+
+		for (uint32_t i = 0; i < memories->nData && !cur->failed; i++) {
+			struct DataSectionData* data = &memories->init[i];
+			data->exprSize = getU8(cur);
+			data->expr = take(cur, data->exprSize);
+			data->len = getU32(cur);
+			data->bytes = take(cur, data->len);
+		}
+	}
+
+	struct Table* tables = dumpAlloc(cur, arena, sizeof(struct Table));
+	if (tables) 
+		memset(tables, 0, sizeof(struct Table));
+
+	if (!cur->failed && getU32(cur)) {
+		tables->table = dumpAlloc(cur, arena, sizeof(struct TableSectionTable));
+		uint32_t min = getU32(cur);
+		uint32_t max = getU32(cur);
+		tables->nElement = getU32(cur);
+		tables->init = dumpAlloc(cur, arena, sizeof(struct ElementSectionElement) * tables->nElement);
+		if (!cur->failed) {
+			tables->table->min = min;
+			tables->table->max = max;
+		}
+
+		for (uint32_t i = 0; i < tables->nElement && !cur->failed; i++) {
+			struct ElementSectionElement* element = &tables->init[i];
+			element->exprSize = getU8(cur);
+			element->expr = take(cur, element->exprSize);
+			element->len = getU32(cur);
+			element->funcidx = getU32Array(cur, arena, element->len);
+		}
+	}
+
+	if (cur->failed || cur->offset != cur->size) 
+		return WASM_INVALID_DUMP;
+
+	// Only now that all of it checks out does the module change
+	if (strcmp(name, UNNAMED_MODULE)) {
+		module->name = name;
+		module->hash = hash(name);
+	}
+
+	module->flags = flags;
+	module->nfuncs = nfuncs;
+	module->functions = functions;
+	module->nglobals = nglobals;
+	module->globals = (nglobals) ? globals : NULL;
+	module->memories = memories;
+	module->tables = tables;
+	module->sections = NULL;
+	module->nsections = 0;
+	// Without the type and import sections the bodies cannot be type
+	// checked again, so there is nothing to instantiate either
+	module->_validated = 0;
+	return WASM_SUCCESS;
+}
+
+static int readDump(struct WasmModuleReader* reader, struct WasmArena* arena, const char* fname) {
+	struct WasmModule* module = reader->thisModule;
+
+	FILE* file = fopen(fname, "rb");
 	if (!file) {
-		error("File %s cannot be accessed", fname);
+		info("Dump %s cannot be accessed", fname);
 		return WASM_FILE_ACCESS_ERROR;
 	}
 
 	fseek(file, 0, SEEK_END);
-	uint32_t size = ftell(file);
+	long size = ftell(file);
 	fseek(file, 0, SEEK_SET);
+	if (size < 0 || size > UINT32_MAX) {
+		fclose(file);
+		return WASM_INVALID_DUMP;
+	}
+
+	// The dump is read in one go and the module points straight into it
+	uint8_t* buf = arenaAlloc(arena, size ? size : 1);
+	if (!buf) {
+		fclose(file);
+		return WASM_OUT_OF_MEMORY;
+	}
+
+	if (fread(buf, 1, size, file) != (size_t) size) {
+		fclose(file);
+		return WASM_FILE_READ_ERROR;
+	}
 
-	uint8_t* buf = malloc(size * sizeof(char));
-	fread(buf, size, 1, file);
 	fclose(file);
-	uint32_t offset = 0;
 
-	if (getU32(buf, &offset) != DUMP_MAGIC) {
+	struct DumpCursor cur = { .buf = buf, .size = size, .offset = 0, .failed = 0 };
+	if (getU32(&cur) != DUMP_MAGIC) {
 		error("Not a dump file");
 		return WASM_FILE_INVALID_MAGIC;
 	}
 
-	if (getU16(buf, &offset) != DUMP_VERSION) {
+	if (getU16(&cur) != DUMP_VERSION) {
 		error("Not the current dump file version");
 		return WASM_FILE_INVALID_VERSION;
 	}
 
-    int len = getU32(buf, &offset);
-    module->name = (char*) (buf + offset);
-    offset += len;
+	uint64_t sourceHash = getU64(&cur);
+	uint32_t sourceSize = getU32(&cur);
+	if (cur.failed) 
+		return WASM_INVALID_DUMP;
 
-    module->flags = getU32(buf, &offset);
-    offset += 4;
-    module->nglobals = getU32(buf, &offset);
-    offset += 4;
-    module->nfuncs = getU32(buf, &offset);
-    info("Flags = %d globals = %d funcs = %d", module->flags, module->nglobals, module->nfuncs);
-	return WASM_SUCCESS;
+	if (sourceSize != reader->size || sourceHash != hashBytes(reader->_data, reader->size)) {
+		info("Dump %s was made from a different module", fname);
+		return WASM_STALE_DUMP;
+	}
+
+	return readDumpContents(module, arena, &cur);
+}
+
+int loadDump(struct WasmModuleReader* reader, const char* fname) {
+	if (!reader || !reader->thisModule || !fname) {
+		error("Reader or dump file is null");
+		return WASM_ARGUMENT_NULL;
+	}
+
+	// The dump goes into an arena of its own until it has all checked
+	// out, a dump that cannot be used leaves nothing behind
+	struct WasmArena arena;
+	int status = createArena(&arena, 0);
+	if (status) 
+		return status;
+
+	if (!readDump(reader, &arena, fname)) {
+		mergeArena(reader->thisModule->arena, &arena);
+		reader->thisModule->_source = reader->_data;
+		reader->thisModule->_sourceSize = reader->size;
+		return WASM_SUCCESS;
+	}
+
+	destroyArena(&arena);
+
+	warn("Dump %s cannot be used, parsing the module instead", fname);
+	return parseModule(reader);
 }
@@ -31,18 +31,42 @@ static const char* error_to_string[] = {
     [WASM_INIT_TOO_LONG] = "Init expression for global/data sections cannot be longer than 15 bytes\n",
     [WASM_TOO_MANY_MEMORIES] = "Each module can have only 1 memory\n",
     [WASM_INVALID_GLOBAL_MUTABILITY] = "Globals can have mutability flags equal to 0 or 1\n",
-    [WASM_INVALID_MEMORY_INDEX] = "Only memory index 0 can be referenced from data sections\n",
+    [WASM_INVALID_MEMORY_INDEX] = "Only memory index 0 can be referenced\n",
     [WASM_INVALID_TABLE_INDEX] = "Only table index 0 can be referenced from element sections\n",
     [WASM_NO_TYPE] = "Function and/or code section is present but types secrion is absent\n",
     [WASM_FUNCTION_CODE_MISMATCH] = "Number of function indices does not match with number of code bodies\n",
     [WASM_INVALID_TYPE_INDEX] = "Index into type section is invalid\n",
     [WASM_INVALID_LIMIT_TYPE] = "Limit type is not 0(min) or 1 (min-max)\n",
-    [WASM_INTERNAL_ERROR] = "Internal error: Possible bug detected\n"
+    [WASM_INTERNAL_ERROR] = "Internal error: Possible bug detected\n",
+    [WASM_INVALID_DUMP] = "Dump file is truncated or malformed\n",
+    [WASM_STALE_DUMP] = "Dump file was made from a different module\n",
+    [WASM_INVALID_OPCODE] = "Code expression has an unknown opcode\n",
+    [WASM_UNBALANCED_BLOCK] = "Blocks in a code expression are not properly nested\n",
+    [WASM_INVALID_LABEL] = "Branch to a label that is not open\n",
+    [WASM_TYPE_MISMATCH] = "Instruction operand or block result has the wrong type\n",
+    [WASM_STACK_UNDERFLOW] = "Instruction pops more values than its block has pushed\n",
+    [WASM_UNUSED_VALUES] = "Block or function ends with values left over on the stack\n",
+    [WASM_INVALID_LOCAL_INDEX] = "Index into function locals is invalid\n",
+    [WASM_INVALID_GLOBAL_INDEX] = "Index into globals is invalid\n",
+    [WASM_IMMUTABLE_GLOBAL] = "global.set of a global that is not mutable\n",
+    [WASM_INVALID_FUNCTION_INDEX] = "Call to a function index that does not exist\n",
+    [WASM_INVALID_ALIGNMENT] = "Memory access alignment is larger than its natural alignment\n",
+    [WASM_NO_MEMORY] = "Memory instruction or data segment in a module without a memory\n",
+    [WASM_NO_TABLE] = "call_indirect or element segment in a module without a table\n",
+    [WASM_TRAP_UNREACHABLE] = "Trap: unreachable executed\n",
+    [WASM_TRAP_OUT_OF_BOUNDS] = "Trap: memory access out of bounds\n",
+    [WASM_TRAP_DIVIDE_BY_ZERO] = "Trap: integer divide by zero\n",
+    [WASM_TRAP_INTEGER_OVERFLOW] = "Trap: integer overflow\n",
+    [WASM_TRAP_INVALID_CONVERSION] = "Trap: invalid conversion to integer\n",
+    [WASM_TRAP_UNDEFINED_ELEMENT] = "Trap: call_indirect to an undefined table element\n",
+    [WASM_TRAP_SIGNATURE_MISMATCH] = "Trap: call_indirect to a function of another type\n",
+    [WASM_TRAP_STACK_OVERFLOW] = "Trap: call stack exhausted\n",
+    [WASM_TRAP_UNBOUND_IMPORT] = "Trap: call to an import nothing was bound to\n"
 };
 
 
 const char* errString(int err) {
-    if (err >= WASM_MAX_VALIDATION_ERROR || err < 0)
+    if (err >= WASM_MAX_TRAP || err < 0)
         return "Unknown error code\n";
 
     return error_to_string[err];
@@ -1,4 +1,5 @@
 #include <libwasm.h>
+#include <string.h>
 
 #define FNV1A_OFFSET_BASIS 0xCBF29CE484222325UL
 #define FNV1A_PRIME        0x00000100000001B3UL
@@ -16,4 +17,52 @@ uint64_t hash(const char* s) {
     }
 
     return ret;
-}
\ No newline at end of file
+}
+
+// Same as hash() but for strings that aren't NUL terminated
+uint64_t hashN(const char* s, uint32_t len) {
+    if (!s)
+        return NULL_STRING_HASH;
+
+    uint64_t ret = FNV1A_OFFSET_BASIS;
+    for (uint32_t i = 0; i < len; i++) {
+        ret ^= s[i];
+        ret *= FNV1A_PRIME;
+    }
+
+    return ret;
+}
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Mixes a whole word at a time, FNV's byte at a time loop is far too slow
+// for entire modules. Not meant to hold up against anyone choosing inputs
+uint64_t hashBytes(const void* data, size_t len) {
+    const uint8_t* p = data;
+    uint64_t ret = FNV1A_OFFSET_BASIS ^ (len * 0x9E3779B97F4A7C15UL);
+
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        ret ^= rotl(word * 0x87C37B91114253D5UL, 31) * 0x4CF5AD432745937FUL;
+        ret = rotl(ret, 27) * 5 + 0x52DCE729;
+        p += 8;
+        len -= 8;
+    }
+
+    if (len) {
+        uint64_t word = 0;
+        memcpy(&word, p, len);
+        ret ^= rotl(word * 0x87C37B91114253D5UL, 31) * 0x4CF5AD432745937FUL;
+    }
+
+    // Spread every input bit over the whole result
+    ret ^= ret >> 33;
+    ret *= 0xFF51AFD7ED558CCDUL;
+    ret ^= ret >> 33;
+    ret *= 0xC4CEB9FE1A85EC53UL;
+    ret ^= ret >> 33;
+    return ret;
+}
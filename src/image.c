@@ -0,0 +1,607 @@
+#include <libwasm.h>
+#include <section.h>
+#include <log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Record arrays start on this boundary, which suits every record we have
+#define IMAGE_ALIGNMENT 8
+#define IMAGE_ALIGN(x, a) (((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+
+static const uint32_t recordSizes[WASM_IMAGE_MAX_SECTION] = {
+    [WASM_IMAGE_FUNCTIONS] = sizeof(struct WasmImageFunction),
+    [WASM_IMAGE_GLOBALS]   = sizeof(struct WasmImageGlobal),
+    [WASM_IMAGE_MEMORY]    = sizeof(struct TableSectionTable),
+    [WASM_IMAGE_DATA]      = sizeof(struct WasmImageSegment),
+    [WASM_IMAGE_TABLE]     = sizeof(struct TableSectionTable),
+    [WASM_IMAGE_ELEMENTS]  = sizeof(struct WasmImageSegment),
+    [WASM_IMAGE_SECTIONS]  = sizeof(struct WasmImageRawSection),
+};
+
+// The sections kept in an image, everything else it has records for
+static int keptSection(uint8_t id) {
+    return id == WASM_TYPE_SECTION || id == WASM_IMPORT_SECTION || id == WASM_EXPORT_SECTION || id == WASM_START_SECTION;
+}
+
+// Building an image runs twice over the module, first with no buffer to
+// find out how large it is and then to fill in a buffer of exactly that
+// size, so the two can never disagree about where anything goes
+struct ImageBuilder {
+    uint8_t* buf;
+    uint64_t end;
+};
+
+// Copies len bytes to the end of the image and returns where they went
+static uint32_t place(struct ImageBuilder* b, const void* src, uint32_t len, uint32_t align, uint8_t nul) {
+    b->end = IMAGE_ALIGN(b->end, align);
+    uint64_t offset = b->end;
+    b->end += len + nul;
+
+    // Offsets past 4GB only happen while sizing, which then fails
+    if (!b->buf)
+        return (uint32_t) offset;
+
+    if (len)
+        memcpy(b->buf + offset, src, len);
+    if (nul)
+        b->buf[offset + len] = 0;
+
+    return (uint32_t) offset;
+}
+
+static void* record(struct ImageBuilder* b, struct WasmImageSection* toc, uint32_t kind, uint32_t i) {
+    return b->buf + toc[kind].offset + (uint64_t) i * toc[kind].recordSize;
+}
+
+static int buildImage(struct WasmModule* module, struct ImageBuilder* b) {
+    struct Memory* memories = module->memories;
+    struct Table* tables = module->tables;
+
+    struct WasmImageSection toc[WASM_IMAGE_MAX_SECTION] = {0};
+    toc[WASM_IMAGE_FUNCTIONS].count = module->nfuncs;
+    toc[WASM_IMAGE_GLOBALS].count = module->nglobals;
+    toc[WASM_IMAGE_MEMORY].count = (memories && memories->memory) ? 1 : 0;
+    toc[WASM_IMAGE_DATA].count = (memories) ? memories->nData : 0;
+    toc[WASM_IMAGE_TABLE].count = (tables && tables->table) ? 1 : 0;
+    toc[WASM_IMAGE_ELEMENTS].count = (tables) ? tables->nElement : 0;
+    for (uint32_t i = 0; i < module->nsections; i++)
+        toc[WASM_IMAGE_SECTIONS].count += keptSection(module->directory[i].id);
+
+    b->end = sizeof(struct WasmImageHeader) + sizeof(toc);
+    for (uint32_t i = 0; i < WASM_IMAGE_MAX_SECTION; i++) {
+        b->end = IMAGE_ALIGN(b->end, IMAGE_ALIGNMENT);
+        toc[i].kind = i;
+        toc[i].offset = b->end;
+        toc[i].recordSize = recordSizes[i];
+        b->end += (uint64_t) toc[i].count * recordSizes[i];
+    }
+
+    struct WasmImageHeader header = {
+        .magic = WASM_IMAGE_MAGIC,
+        .version = WASM_IMAGE_VERSION,
+        .nsections = WASM_IMAGE_MAX_SECTION,
+        .sourceSize = module->_sourceSize,
+        .sourceHash = (b->buf) ? hashBytes(module->_source, module->_sourceSize) : 0,
+        .flags = module->flags,
+    };
+
+    if (module->name) {
+        header.nameLen = strlen(module->name);
+        header.name = place(b, module->name, header.nameLen, 1, 1);
+    }
+
+    for (uint32_t i = 0; i < module->nfuncs; i++) {
+        struct Function* function = &module->functions[i];
+        struct WasmImageFunction f = { .hash = function->hash };
+
+        // Names are not NUL terminated in view mode, they are in the image
+        if (function->name) {
+            f.nameLen = function->nameLen;
+            f.name = place(b, function->name, function->nameLen, 1, 1);
+        }
+
+        if (function->signature) {
+            f.typeIndex = function->signature->idx;
+            f.ret = function->signature->ret;
+            f.paramsLen = function->signature->paramsLen;
+            f.params = place(b, function->signature->params, f.paramsLen, 1, 0);
+        }
+
+        // Bodies may not have been decoded yet
+        struct CodeSectionCode* code;
+        int n = getFunctionCode(module, i, &code);
+        if (n)
+            return n;
+
+        if (code) {
+            f.localSize = code->localSize;
+            f.locals = place(b, code->locals, code->localSize, 1, 0);
+            f.codeSize = code->codeSize;
+            f.expr = place(b, code->expr, code->codeSize, 1, 0);
+        }
+
+        if (b->buf)
+            memcpy(record(b, toc, WASM_IMAGE_FUNCTIONS, i), &f, sizeof(f));
+    }
+
+    for (uint32_t i = 0; i < module->nglobals; i++) {
+        struct GlobalSectionGlobal* global = &module->globals[i];
+        struct WasmImageGlobal g = {
+            .exprSize = global->exprSize,
+            .valtype = global->valtype,
+            .mut = global->mut,
+        };
+
+        g.expr = place(b, global->expr, global->exprSize, 1, 0);
+        if (b->buf)
+            memcpy(record(b, toc, WASM_IMAGE_GLOBALS, i), &g, sizeof(g));
+    }
+
+    if (b->buf && toc[WASM_IMAGE_MEMORY].count)
+        memcpy(record(b, toc, WASM_IMAGE_MEMORY, 0), memories->memory, sizeof(struct TableSectionTable));
+
+    for (uint32_t i = 0; i < toc[WASM_IMAGE_DATA].count; i++) {
+        struct DataSectionData* data = &memories->init[i];
+        struct WasmImageSegment s = { .len = data->len, .exprSize = data->exprSize };
+
+        s.expr = place(b, data->expr, data->exprSize, 1, 0);
+        s.bytes = place(b, data->bytes, data->len, 1, 0);
+        if (b->buf)
+            memcpy(record(b, toc, WASM_IMAGE_DATA, i), &s, sizeof(s));
+    }
+
+    if (b->buf && toc[WASM_IMAGE_TABLE].count)
+        memcpy(record(b, toc, WASM_IMAGE_TABLE, 0), tables->table, sizeof(struct TableSectionTable));
+
+    for (uint32_t i = 0; i < toc[WASM_IMAGE_ELEMENTS].count; i++) {
+        struct ElementSectionElement* element = &tables->init[i];
+        struct WasmImageSegment s = { .len = element->len, .exprSize = element->exprSize };
+
+        s.expr = place(b, element->expr, element->exprSize, 1, 0);
+        // Kept aligned so imageIndexes() can hand out the array in place
+        s.bytes = place(b, element->funcidx, element->len * sizeof(uint32_t), sizeof(uint32_t), 0);
+        if (b->buf)
+            memcpy(record(b, toc, WASM_IMAGE_ELEMENTS, i), &s, sizeof(s));
+    }
+
+    for (uint32_t i = 0, k = 0; i < module->nsections; i++) {
+        struct SectionEntry* entry = &module->directory[i];
+        if (!keptSection(entry->id))
+            continue;
+
+        // The module's bytes are what gets copied, not the parsed section
+        if (entry->edit != WASM_SECTION_UNCHANGED) {
+            error("Section %u has been edited, write the module out first", i);
+            return WASM_INVALID_ARG;
+        }
+
+        struct WasmImageRawSection r = { .len = entry->size, .id = entry->id };
+        r.bytes = place(b, module->_source + entry->offset, entry->size, 1, 0);
+        if (b->buf)
+            memcpy(record(b, toc, WASM_IMAGE_SECTIONS, k), &r, sizeof(r));
+
+        k++;
+    }
+
+    if (b->end > UINT32_MAX) {
+        error("Module is too large for an image");
+        return WASM_MODULE_TOO_LARGE;
+    }
+
+    header.size = b->end;
+    if (b->buf) {
+        memcpy(b->buf, &header, sizeof(header));
+        memcpy(b->buf + sizeof(header), toc, sizeof(toc));
+    }
+
+    return WASM_SUCCESS;
+}
+
+static int writeAll(int fd, const uint8_t* buf, size_t size) {
+    while (size) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return WASM_FILE_ACCESS_ERROR;
+
+        buf += n;
+        size -= n;
+    }
+
+    return WASM_SUCCESS;
+}
+
+int writeImage(struct WasmModule* module, const char* fname) {
+    if (!module || !fname) {
+        error("Module or image file is null");
+        return WASM_ARGUMENT_NULL;
+    }
+
+    // Without the module's bytes the image could never be checked against them
+    if (!module->_source) {
+        error("Module has no source to make an image from");
+        return WASM_INVALID_ARG;
+    }
+
+    struct ImageBuilder b = { .buf = NULL };
+    int n = buildImage(module, &b);
+    if (n)
+        return n;
+
+    // Zeroed so that padding is the same in every image
+    b.buf = calloc(1, b.end);
+    if (!b.buf)
+        return WASM_OUT_OF_MEMORY;
+
+    n = buildImage(module, &b);
+    if (n) {
+        free(b.buf);
+        return n;
+    }
+
+    // Other processes may have the old image mapped and would fault if it
+    // was truncated under them, so the new one replaces it by a rename()
+    char* tmp = malloc(strlen(fname) + 32);
+    if (!tmp) {
+        free(b.buf);
+        return WASM_OUT_OF_MEMORY;
+    }
+
+    sprintf(tmp, "%s.%ld.tmp", fname, (long) getpid());
+    info("Writing image = %s", fname);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error("Failed to open image file for writing");
+        free(tmp);
+        free(b.buf);
+        return WASM_FILE_ACCESS_ERROR;
+    }
+
+    n = writeAll(fd, b.buf, b.end);
+    if (close(fd) && !n)
+        n = WASM_FILE_ACCESS_ERROR;
+    if (!n && rename(tmp, fname))
+        n = WASM_FILE_ACCESS_ERROR;
+
+    if (n) {
+        error("Writing image %s failed", fname);
+        unlink(tmp);
+    }
+
+    free(tmp);
+    free(b.buf);
+    return n;
+}
+
+// Checks everything an accessor relies on without looking at the records,
+// so opening an image costs the same however large it is
+static int checkImage(struct WasmImage* image, uint64_t sourceHash, uint32_t sourceSize) {
+    const struct WasmImageHeader* header = image->header;
+    if (header->magic != WASM_IMAGE_MAGIC) {
+        error("Not an image file");
+        return WASM_FILE_INVALID_MAGIC;
+    }
+
+    if (header->version != WASM_IMAGE_VERSION) {
+        error("Not the current image file version");
+        return WASM_FILE_INVALID_VERSION;
+    }
+
+    uint64_t tocEnd = sizeof(*header) + (uint64_t) header->nsections * sizeof(struct WasmImageSection);
+    if (header->size != image->_size || tocEnd > image->_size)
+        return WASM_INVALID_DUMP;
+
+    if (header->name) {
+        const uint8_t* name = imageBytes(image, header->name, header->nameLen + 1ULL > UINT32_MAX ? UINT32_MAX : header->nameLen + 1);
+        if (!name || name[header->nameLen])
+            return WASM_INVALID_DUMP;
+    }
+
+    if (sourceHash && (header->sourceSize != sourceSize || header->sourceHash != sourceHash)) {
+        info("Image was made from a different module");
+        return WASM_STALE_DUMP;
+    }
+
+    const struct WasmImageSection* toc = (const struct WasmImageSection*) (header + 1);
+    const void* arrays[WASM_IMAGE_MAX_SECTION] = {0};
+    uint32_t counts[WASM_IMAGE_MAX_SECTION] = {0};
+
+    for (uint32_t i = 0; i < header->nsections; i++) {
+        // Sections added by later versions are skipped
+        uint32_t kind = toc[i].kind;
+        if (kind >= WASM_IMAGE_MAX_SECTION)
+            continue;
+
+        if (arrays[kind] || toc[i].recordSize != recordSizes[kind] || toc[i].offset % IMAGE_ALIGNMENT ||
+            (uint64_t) toc[i].offset + (uint64_t) toc[i].count * toc[i].recordSize > image->_size ||
+            toc[i].offset < tocEnd)
+            return WASM_INVALID_DUMP;
+
+        if ((kind == WASM_IMAGE_MEMORY || kind == WASM_IMAGE_TABLE) && toc[i].count > 1)
+            return WASM_INVALID_DUMP;
+
+        arrays[kind] = image->_map + toc[i].offset;
+        counts[kind] = toc[i].count;
+    }
+
+    image->functions = arrays[WASM_IMAGE_FUNCTIONS];
+    image->nfuncs = counts[WASM_IMAGE_FUNCTIONS];
+    image->globals = arrays[WASM_IMAGE_GLOBALS];
+    image->nglobals = counts[WASM_IMAGE_GLOBALS];
+    image->memory = (counts[WASM_IMAGE_MEMORY]) ? arrays[WASM_IMAGE_MEMORY] : NULL;
+    image->data = arrays[WASM_IMAGE_DATA];
+    image->nData = counts[WASM_IMAGE_DATA];
+    image->table = (counts[WASM_IMAGE_TABLE]) ? arrays[WASM_IMAGE_TABLE] : NULL;
+    image->elements = arrays[WASM_IMAGE_ELEMENTS];
+    image->nElements = counts[WASM_IMAGE_ELEMENTS];
+    image->sections = arrays[WASM_IMAGE_SECTIONS];
+    image->nsections = counts[WASM_IMAGE_SECTIONS];
+    return WASM_SUCCESS;
+}
+
+int openImage(struct WasmImage* image, const char* fname, uint64_t sourceHash, uint32_t sourceSize) {
+    if (!image || !fname) {
+        error("Image or image file is null");
+        return WASM_ARGUMENT_NULL;
+    }
+
+    memset(image, 0, sizeof(*image));
+
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        info("Image %s cannot be accessed", fname);
+        return WASM_FILE_ACCESS_ERROR;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return WASM_FILE_ACCESS_ERROR;
+    }
+
+    if (st.st_size < (off_t) sizeof(struct WasmImageHeader) || st.st_size > UINT32_MAX) {
+        close(fd);
+        return WASM_INVALID_DUMP;
+    }
+
+    // Shared and read only, every process using the image uses the same pages
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        error("Failed to map image %s", fname);
+        return WASM_FILE_READ_ERROR;
+    }
+
+    image->_map = map;
+    image->_size = st.st_size;
+    image->header = map;
+
+    int n = checkImage(image, sourceHash, sourceSize);
+    if (n)
+        closeImage(image);
+
+    return n;
+}
+
+void closeImage(struct WasmImage* image) {
+    if (!image || !image->_map)
+        return;
+
+    munmap((void*) image->_map, image->_size);
+    memset(image, 0, sizeof(*image));
+}
+
+const uint8_t* imageBytes(const struct WasmImage* image, uint32_t offset, uint32_t len) {
+    if ((uint64_t) offset + len > image->_size)
+        return NULL;
+
+    return image->_map + offset;
+}
+
+const uint32_t* imageIndexes(const struct WasmImage* image, uint32_t offset, uint32_t count) {
+    if (offset % sizeof(uint32_t) || (uint64_t) offset + (uint64_t) count * sizeof(uint32_t) > image->_size)
+        return NULL;
+
+    return (const uint32_t*) (image->_map + offset);
+}
+
+// The arrays of the view come from arena, everything they point to is
+// in the mapping. Offsets taken from records are checked here, once
+static void* viewAlloc(struct WasmArena* arena, uint64_t count, size_t size, int* failed) {
+    if (!count)
+        return NULL;
+
+    void* ret = arenaAlloc(arena, count * size);
+    if (!ret)
+        *failed = 1;
+
+    return ret;
+}
+
+static uint8_t* viewBytes(const struct WasmImage* image, uint32_t offset, uint32_t len, int* failed) {
+    const uint8_t* ret = imageBytes(image, offset, len);
+    if (!ret)
+        *failed = 1;
+
+    return (uint8_t*) ret;
+}
+
+// Parses the sections the image kept into module, the way a reader
+// would have parsed them out of the module's bytes
+static int parseKeptSections(struct WasmModule* module, const struct WasmImage* image) {
+    uint32_t n = image->nsections;
+    module->directory = arenaAlloc(module->arena, sizeof(struct SectionEntry) * n);
+    module->sections = arenaAlloc(module->arena, sizeof(struct Section) * n);
+    if (!module->directory || !module->sections)
+        return WASM_OUT_OF_MEMORY;
+
+    memset(module->sections, 0, sizeof(struct Section) * n);
+    module->_directoryCapacity = n;
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        const struct WasmImageRawSection* r = &image->sections[i];
+        struct SectionEntry* entry = &module->directory[i];
+
+        // Each at most once, and nothing that has records of its own
+        if (!keptSection(r->id) || (seen & (1u << r->id)) || !imageBytes(image, r->bytes, r->len))
+            return WASM_INVALID_DUMP;
+
+        seen |= 1u << r->id;
+
+        entry->offset = r->bytes;
+        entry->size = r->len;
+        entry->id = r->id;
+        entry->edit = WASM_SECTION_UNCHANGED;
+        entry->hash = sectionHash((uint8_t*) image->_map, entry);
+        module->nsections = i + 1;
+        int status = indexSection(module, i);
+        if (status)
+            return status;
+
+        // Names and the like point into the mapping, which is never written
+        struct ParseSectionParams params = {
+            .data = (uint8_t*) image->_map,
+            .offset = r->bytes,
+            .size = r->len,
+            .section = &module->sections[i],
+            .arena = module->arena,
+            .views = 1,
+        };
+
+        status = parseSectionList[r->id](&params);
+        if (status)
+            return status;
+    }
+
+    module->flags = n;
+    return WASM_SUCCESS;
+}
+
+// f's signature out of the Type section, NULL if it does not match
+static struct TypeSectionType* imageSignature(struct Section* types, const struct WasmImageFunction* f) {
+    if (!types || f->typeIndex >= types->flags)
+        return NULL;
+
+    struct TypeSectionType* type = &types->types[f->typeIndex];
+    if (type->ret != f->ret || type->paramsLen != f->paramsLen)
+        return NULL;
+
+    return type;
+}
+
+int moduleFromImage(struct WasmModule* module, const struct WasmImage* image, struct WasmArena* arena) {
+    if (!module || !image || !image->_map || !arena) {
+        error("Module, image or arena is null");
+        return WASM_ARGUMENT_NULL;
+    }
+
+    const struct WasmImageHeader* header = image->header;
+    memset(module, 0, sizeof(*module));
+    module->arena = arena;
+
+    int status = parseKeptSections(module, image);
+    if (status)
+        return (status == WASM_OUT_OF_MEMORY) ? status : WASM_INVALID_DUMP;
+
+    int typeidx = findSectionByHash(module, WASM_HASH_Type);
+    struct Section* types = (typeidx == -1) ? NULL : &module->sections[typeidx];
+
+    // Imported functions come first and have no body, every other one has
+    int impidx = findSectionByHash(module, WASM_HASH_Import);
+    uint32_t imported = 0;
+    for (uint32_t i = 0; impidx != -1 && i < module->sections[impidx].flags; i++)
+        imported += module->sections[impidx].imports[i].type == WASM_TYPEIDX;
+
+    int failed = 0;
+    struct Function* functions = viewAlloc(arena, image->nfuncs, sizeof(struct Function), &failed);
+    struct CodeSectionCode* code = viewAlloc(arena, image->nfuncs, sizeof(struct CodeSectionCode), &failed);
+    for (uint32_t i = 0; i < image->nfuncs && !failed; i++) {
+        const struct WasmImageFunction* f = &image->functions[i];
+        struct Function* function = &functions[i];
+
+        // Names were written NUL terminated
+        function->name = (f->name) ? (char*) viewBytes(image, f->name, f->nameLen + 1ULL > UINT32_MAX ? UINT32_MAX : f->nameLen + 1, &failed) : NULL;
+        function->nameLen = f->nameLen;
+        function->hash = f->hash;
+        function->signature = imageSignature(types, f);
+        if (!function->signature || (i < imported) != !f->codeSize)
+            failed = 1;
+
+        function->code = NULL;
+        if (f->codeSize) {
+            function->code = &code[i];
+            code[i].localSize = f->localSize;
+            code[i].locals = (f->localSize) ? viewBytes(image, f->locals, f->localSize, &failed) : NULL;
+            code[i].codeSize = f->codeSize;
+            code[i].expr = viewBytes(image, f->expr, f->codeSize, &failed);
+        }
+    }
+
+    if (image->nfuncs < imported)
+        failed = 1;
+
+    struct GlobalSectionGlobal* globals = viewAlloc(arena, image->nglobals, sizeof(struct GlobalSectionGlobal), &failed);
+    for (uint32_t i = 0; i < image->nglobals && !failed; i++) {
+        globals[i].valtype = image->globals[i].valtype;
+        globals[i].mut = image->globals[i].mut;
+        globals[i].exprSize = image->globals[i].exprSize;
+        globals[i].expr = viewBytes(image, image->globals[i].expr, image->globals[i].exprSize, &failed);
+    }
+
+    struct Memory* memories = viewAlloc(arena, 1, sizeof(struct Memory), &failed);
+    struct Table* tables = viewAlloc(arena, 1, sizeof(struct Table), &failed);
+    if (!memories || !tables)
+        return WASM_OUT_OF_MEMORY;
+
+    memset(memories, 0, sizeof(*memories));
+    memset(tables, 0, sizeof(*tables));
+
+    memories->memory = (struct TableSectionTable*) image->memory;
+    memories->nData = image->nData;
+    memories->init = viewAlloc(arena, image->nData, sizeof(struct DataSectionData), &failed);
+    for (uint32_t i = 0; i < image->nData && !failed; i++) {
+        struct DataSectionData* data = &memories->init[i];
+        data->exprSize = image->data[i].exprSize;
+        data->expr = viewBytes(image, image->data[i].expr, data->exprSize, &failed);
+        data->len = image->data[i].len;
+        data->bytes = viewBytes(image, image->data[i].bytes, data->len, &failed);
+    }
+
+    tables->table = (struct TableSectionTable*) image->table;
+    tables->nElement = image->nElements;
+    tables->init = viewAlloc(arena, image->nElements, sizeof(struct ElementSectionElement), &failed);
+    for (uint32_t i = 0; i < image->nElements && !failed; i++) {
+        struct ElementSectionElement* element = &tables->init[i];
+        element->exprSize = image->elements[i].exprSize;
+        element->expr = viewBytes(image, image->elements[i].expr, element->exprSize, &failed);
+        element->len = image->elements[i].len;
+        element->funcidx = (uint32_t*) imageIndexes(image, image->elements[i].bytes, element->len);
+        if (!element->funcidx && element->len)
+            failed = 1;
+    }
+
+    if (failed)
+        return WASM_INVALID_DUMP;
+
+    if (header->name) {
+        module->name = (const char*) image->_map + header->name;
+        module->hash = hash(module->name);
+    }
+
+    module->nfuncs = image->nfuncs;
+    module->functions = functions;
+    module->nglobals = image->nglobals;
+    module->globals = globals;
+    module->memories = memories;
+    module->tables = tables;
+    module->_linked = 1;
+    return WASM_SUCCESS;
+}
@@ -0,0 +1,419 @@
+#include "precompiled-hashes.h"
+#include <libwasm.h>
+#include <section.h>
+#include <instance.h>
+#include <decode.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Only machine code relies on guard pages, so only where there is a JIT
+#if defined(__linux__) && defined(__x86_64__)
+#include <sys/mman.h>
+#define GUARD_PAGES
+#endif
+
+#define PAGE_SIZE (64 * 1024)
+#define MAX_PAGES (64 * 1024)
+
+// Address space behind a memory under guard pages. A 32-bit address plus
+// a 32-bit offset cannot reach past it, so whatever is not grown into
+// faults instead of needing a check
+#define GUARD_RESERVE ((8ULL << 30) + PAGE_SIZE)
+
+// Value of the constant expression that initialises a global or places a
+// segment, only constants and imported globals can appear in one
+static int evalConst(struct WasmInstance* instance, uint8_t* expr, uint32_t size, uint64_t* value) {
+    struct WasmModuleReader reader;
+    struct Instruction instr;
+    codeReader(&reader, expr, 0, size);
+
+    int status = decodeInstruction(&reader, &instr);
+    if (status)
+        return status;
+
+    switch (instr.opcode) {
+        case WASM_OP_I32_CONST:
+        case WASM_OP_F32_CONST:
+            *value = instr.a;
+            break;
+
+        case WASM_OP_I64_CONST:
+        case WASM_OP_F64_CONST:
+            *value = instr.b;
+            break;
+
+        case WASM_OP_GLOBAL_GET:
+            if (instr.a >= instance->nglobals)
+                return WASM_INVALID_GLOBAL_INDEX;
+
+            *value = instance->globals[instr.a];
+            break;
+
+        default:
+            error("Opcode 0x%x is not allowed in a constant expression", instr.opcode);
+            return WASM_INVALID_EXPR;
+    }
+
+    if (reader.offset >= size || fetchOpcode(&reader) != WASM_OP_END) {
+        error("Constant expression has more than one instruction");
+        return WASM_INVALID_EXPR;
+    }
+
+    return WASM_SUCCESS;
+}
+
+static int sameName(const char* a, const char* b, uint32_t len) {
+    return strlen(b) == len && !memcmp(a, b, len);
+}
+
+// Imported functions come first in the function index space, imported
+// globals first in the global one. Memories and tables cannot be provided
+// by the host so modules importing them are not run
+static int bindImports(struct WasmInstance* instance, struct WasmInstanceConfig* config, uint32_t* nglobals) {
+    struct WasmModule* module = instance->module;
+    int impidx = findSectionByHash(module, WASM_HASH_Import);
+    *nglobals = 0;
+    if (impidx == -1)
+        return WASM_SUCCESS;
+
+    struct Section* imports = &module->sections[impidx];
+    uint32_t nfuncs = 0;
+    for (uint32_t i = 0; i < imports->flags; i++) {
+        switch (imports->imports[i].type) {
+            case WASM_TYPEIDX:    nfuncs++; break;
+            case WASM_GLOBALTYPE: (*nglobals)++; break;
+            default:
+                error("Import %.*s.%.*s is a memory or table, only functions and globals can be imported",
+                      imports->imports[i].moduleLen, imports->imports[i].module,
+                      imports->imports[i].nameLen, imports->imports[i].name);
+                return WASM_INVALID_IMPORT_TYPE;
+        }
+    }
+
+    instance->_imports = calloc(nfuncs + 1, sizeof(struct WasmHostImport));
+    if (!instance->_imports)
+        return WASM_OUT_OF_MEMORY;
+
+    instance->_nimported = nfuncs;
+    for (uint32_t i = 0, f = 0; i < imports->flags; i++) {
+        struct ImportSectionImport* import = &imports->imports[i];
+        if (import->type != WASM_TYPEIDX)
+            continue;
+
+        for (uint32_t j = 0; config && j < config->nimports; j++) {
+            struct WasmHostImport* host = &config->imports[j];
+            if (sameName(import->module, host->module, import->moduleLen) && sameName(import->name, host->name, import->nameLen)) {
+                instance->_imports[f] = *host;
+                break;
+            }
+        }
+
+        f++;
+    }
+
+    return WASM_SUCCESS;
+}
+
+// Imported globals are set first, by name from config->globals, so the
+// module's own initializers can read them
+static int initGlobals(struct WasmInstance* instance, struct WasmInstanceConfig* config, uint32_t imported) {
+    struct WasmModule* module = instance->module;
+    instance->nglobals = imported + module->nglobals;
+    instance->globals = calloc(instance->nglobals + 1, sizeof(uint64_t));
+    if (!instance->globals)
+        return WASM_OUT_OF_MEMORY;
+
+    int impidx = findSectionByHash(module, WASM_HASH_Import);
+    for (uint32_t i = 0, g = 0; imported && i < module->sections[impidx].flags; i++) {
+        struct ImportSectionImport* import = &module->sections[impidx].imports[i];
+        if (import->type != WASM_GLOBALTYPE)
+            continue;
+
+        for (uint32_t j = 0; config && j < config->nglobals; j++) {
+            struct WasmGlobalImport* host = &config->globals[j];
+            if (sameName(import->module, host->module, import->moduleLen) && sameName(import->name, host->name, import->nameLen)) {
+                // i32 and f32 slots have nothing in their upper half
+                int narrow = import->valtype == 0x7F || import->valtype == 0x7D;
+                instance->globals[g] = (narrow) ? (uint32_t) host->value : host->value;
+                break;
+            }
+        }
+
+        g++;
+    }
+
+    for (uint32_t i = 0; i < module->nglobals; i++) {
+        int status = evalConst(instance, module->globals[i].expr, module->globals[i].exprSize, &instance->globals[imported + i]);
+        if (status)
+            return status;
+    }
+
+    return WASM_SUCCESS;
+}
+
+// Reserves GUARD_RESERVE bytes and makes the first size of them usable.
+// Leaves memory on the heap where that cannot be done, and for the
+// interpreter, which checks every access whatever happens
+static void reserveMemory(struct WasmInstance* instance, uint64_t size) {
+#ifdef GUARD_PAGES
+    if (!(instance->flags & WASM_INSTANCE_JIT) || (instance->flags & WASM_INSTANCE_BOUNDS_CHECKS))
+        return;
+
+    uint8_t* memory = mmap(NULL, GUARD_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        warn("No address space for guard pages, memory accesses are checked instead");
+        return;
+    }
+
+    if (size && mprotect(memory, size, PROT_READ | PROT_WRITE)) {
+        munmap(memory, GUARD_RESERVE);
+        return;
+    }
+
+    instance->memory = memory;
+    instance->_reserved = GUARD_RESERVE;
+#else
+    (void) instance;
+    (void) size;
+#endif
+}
+
+static int initMemory(struct WasmInstance* instance) {
+    struct Memory* memories = instance->module->memories;
+    if (!memories || !memories->memory)
+        return WASM_SUCCESS;
+
+    struct TableSectionTable* limits = memories->memory;
+    if (limits->min > MAX_PAGES) {
+        error("Memory of %u pages is larger than 4GiB", limits->min);
+        return WASM_OUT_OF_MEMORY;
+    }
+
+    instance->memoryMax = (limits->max < MAX_PAGES) ? limits->max : MAX_PAGES;
+    instance->memorySize = (uint64_t) limits->min * PAGE_SIZE;
+    reserveMemory(instance, instance->memorySize);
+    if (!instance->memory)
+        instance->memory = calloc(instance->memorySize + 1, 1);
+    if (!instance->memory)
+        return WASM_OUT_OF_MEMORY;
+
+    for (uint32_t i = 0; i < memories->nData; i++) {
+        struct DataSectionData* data = &memories->init[i];
+        uint64_t offset;
+        int status = evalConst(instance, data->expr, data->exprSize, &offset);
+        if (status)
+            return status;
+
+        if ((uint64_t) (uint32_t) offset + data->len > instance->memorySize) {
+            error("Data segment %u does not fit in memory", i);
+            return WASM_TRAP_OUT_OF_BOUNDS;
+        }
+
+        memcpy(instance->memory + (uint32_t) offset, data->bytes, data->len);
+    }
+
+    return WASM_SUCCESS;
+}
+
+static int initTable(struct WasmInstance* instance) {
+    struct WasmModule* module = instance->module;
+    struct Table* tables = module->tables;
+    if (!tables || !tables->table)
+        return WASM_SUCCESS;
+
+    instance->tableSize = tables->table->min;
+    instance->table = malloc(sizeof(uint32_t) * ((uint64_t) instance->tableSize + 1));
+    if (!instance->table)
+        return WASM_OUT_OF_MEMORY;
+
+    memset(instance->table, 0xFF, sizeof(uint32_t) * instance->tableSize);
+    for (uint32_t i = 0; i < tables->nElement; i++) {
+        struct ElementSectionElement* element = &tables->init[i];
+        uint64_t offset;
+        int status = evalConst(instance, element->expr, element->exprSize, &offset);
+        if (status)
+            return status;
+
+        if ((uint64_t) (uint32_t) offset + element->len > instance->tableSize) {
+            error("Element segment %u does not fit in the table", i);
+            return WASM_TRAP_UNDEFINED_ELEMENT;
+        }
+
+        for (uint32_t j = 0; j < element->len; j++) {
+            if (element->funcidx[j] >= module->nfuncs)
+                return WASM_INVALID_FUNCTION_INDEX;
+
+            instance->table[(uint32_t) offset + j] = element->funcidx[j];
+        }
+    }
+
+    return WASM_SUCCESS;
+}
+
+static int runStart(struct WasmInstance* instance) {
+    struct WasmModule* module = instance->module;
+    int startidx = findSectionByHash(module, WASM_HASH_Start);
+    if (startidx == -1)
+        return WASM_SUCCESS;
+
+    uint64_t start = module->sections[startidx].start;
+    if (start >= module->nfuncs)
+        return WASM_INVALID_FUNCTION_INDEX;
+
+    struct TypeSectionType* type = module->functions[start].signature;
+    if (type->paramsLen || type->ret) {
+        error("Start function %lu takes or returns values", start);
+        return WASM_TYPE_MISMATCH;
+    }
+
+    uint64_t slots[1];
+    return callFunction(instance, start, slots);
+}
+
+int createInstance(struct WasmInstance* instance, struct WasmModule* module, struct WasmInstanceConfig* config) {
+    if (!instance || !module)
+        return WASM_ARGUMENT_NULL;
+
+    // Translating bodies relies on them having been type checked
+    if (!module->_validated)
+        return WASM_INVALID_ARG;
+
+    memset(instance, 0, sizeof(*instance));
+    instance->module = module;
+    instance->flags = (config) ? config->flags : 0;
+    instance->_stackSlots = (config && config->stackSlots) ? config->stackSlots : WASM_DEFAULT_STACK_SLOTS;
+    instance->_maxDepth = (config && config->maxDepth) ? config->maxDepth : WASM_DEFAULT_MAX_DEPTH;
+    instance->_handlers = (instance->flags & WASM_INSTANCE_SWITCH) ? NULL : threadedHandlers(instance->flags & WASM_INSTANCE_REGISTERS);
+    instance->_jitThreshold = (config && config->jitThreshold) ? config->jitThreshold : WASM_DEFAULT_JIT_THRESHOLD;
+
+    int typeidx = findSectionByHash(module, WASM_HASH_Type);
+    instance->_types = (typeidx == -1) ? NULL : module->sections[typeidx].types;
+
+    int status = createArena(&instance->_arena, 0);
+    if (!status)
+        status = createArena(&instance->_scratch, 0);
+    if (status) {
+        destroyArena(&instance->_arena);
+        return status;
+    }
+
+    uint32_t importedGlobals = 0;
+    status = bindImports(instance, config, &importedGlobals);
+    if (!status)
+        status = initGlobals(instance, config, importedGlobals);
+    if (!status)
+        status = initMemory(instance);
+    if (!status)
+        status = initTable(instance);
+
+    if (!status) {
+        instance->_stack = malloc(sizeof(uint64_t) * instance->_stackSlots);
+        instance->_frames = malloc(sizeof(struct CallFrame) * instance->_maxDepth);
+        instance->_compiled = calloc(module->nfuncs + 1, sizeof(struct CompiledFunction*));
+        instance->_top = instance->_stack;
+        if (!instance->_stack || !instance->_frames || !instance->_compiled)
+            status = WASM_OUT_OF_MEMORY;
+    }
+
+    if (!status && (instance->flags & WASM_INSTANCE_JIT))
+        status = createJit(instance);
+    if (!status)
+        status = runStart(instance);
+
+    if (status)
+        destroyInstance(instance);
+
+    return status;
+}
+
+int64_t growMemory(struct WasmInstance* instance, uint32_t delta) {
+    uint64_t pages = instance->memorySize / PAGE_SIZE;
+    if (pages + delta > instance->memoryMax)
+        return -1;
+
+    uint64_t size = (pages + delta) * PAGE_SIZE;
+#ifdef GUARD_PAGES
+    // Reserved memory never moves, what it grows into is already zero
+    if (instance->_reserved) {
+        if (size > instance->memorySize &&
+            mprotect(instance->memory + instance->memorySize, size - instance->memorySize, PROT_READ | PROT_WRITE))
+            return -1;
+
+        instance->memorySize = size;
+        return pages;
+    }
+#endif
+
+    uint8_t* memory = realloc(instance->memory, size + 1);
+    if (!memory)
+        return -1;
+
+    memset(memory + instance->memorySize, 0, size - instance->memorySize);
+    instance->memory = memory;
+    instance->memorySize = size;
+    return pages;
+}
+
+int callHost(struct WasmInstance* instance, uint32_t idx, uint64_t* slots) {
+    struct WasmHostImport* import = &instance->_imports[idx];
+    if (!import->function) {
+        error("Import %u was called but nothing is bound to it", idx);
+        return WASM_TRAP_UNBOUND_IMPORT;
+    }
+
+    return import->function(instance, slots, import->data);
+}
+
+int callFunction(struct WasmInstance* instance, uint32_t idx, uint64_t* slots) {
+    if (!instance || !slots)
+        return WASM_ARGUMENT_NULL;
+
+    struct WasmModule* module = instance->module;
+    if (idx >= module->nfuncs)
+        return WASM_INVALID_ARG;
+
+    struct TypeSectionType* type = module->functions[idx].signature;
+    if (idx < instance->_nimported)
+        return callHost(instance, idx, slots);
+
+    struct CompiledFunction* fn = instance->_compiled[idx];
+    if (!fn) {
+        int status = compileFunction(instance, idx, &fn);
+        if (status)
+            return status;
+    }
+
+    // Host functions may call back in, their frame goes above the caller's
+    uint64_t* fp = instance->_top;
+    if ((uint64_t) (instance->_stack + instance->_stackSlots - fp) < fn->frameSize)
+        return WASM_TRAP_STACK_OVERFLOW;
+
+    memcpy(fp, slots, sizeof(uint64_t) * type->paramsLen);
+    int status = runFunction(instance, fn, fp);
+    if (!status && type->ret)
+        slots[0] = fp[0];
+
+    return status;
+}
+
+void destroyInstance(struct WasmInstance* instance) {
+    if (!instance)
+        return;
+
+#ifdef GUARD_PAGES
+    if (instance->_reserved)
+        munmap(instance->memory, instance->_reserved);
+    else
+#endif
+        free(instance->memory);
+    free(instance->globals);
+    free(instance->table);
+    free(instance->_stack);
+    free(instance->_frames);
+    free(instance->_imports);
+    free(instance->_compiled);
+    destroyJit(instance);
+    destroyArena(&instance->_arena);
+    destroyArena(&instance->_scratch);
+    memset(instance, 0, sizeof(*instance));
+}
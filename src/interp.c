@@ -0,0 +1,161 @@
+#include <libwasm.h>
+#include <instance.h>
+#include <math.h>
+#include <string.h>
+
+#define PAGE_SIZE (64 * 1024)
+
+// Ops both kinds of code have handlers for
+#define OPS(X) \
+    X(WASM_OP_UNREACHABLE) X(WASM_OP_IF) X(WASM_OP_BR) X(WASM_OP_BR_IF) X(WASM_OP_BR_TABLE) \
+    X(WASM_OP_RETURN) X(WASM_OP_CALL) X(WASM_OP_CALL_INDIRECT) X(WASM_OP_SELECT) \
+    X(WASM_OP_GLOBAL_GET) X(WASM_OP_GLOBAL_SET) X(WASM_OP_I32_LOAD) X(WASM_OP_I64_LOAD) \
+    X(WASM_OP_F32_LOAD) X(WASM_OP_F64_LOAD) X(WASM_OP_I32_LOAD8_S) X(WASM_OP_I32_LOAD8_U) \
+    X(WASM_OP_I32_LOAD16_S) X(WASM_OP_I32_LOAD16_U) X(WASM_OP_I64_LOAD8_S) X(WASM_OP_I64_LOAD8_U) \
+    X(WASM_OP_I64_LOAD16_S) X(WASM_OP_I64_LOAD16_U) X(WASM_OP_I64_LOAD32_S) X(WASM_OP_I64_LOAD32_U) \
+    X(WASM_OP_I32_STORE) X(WASM_OP_I64_STORE) X(WASM_OP_F32_STORE) X(WASM_OP_F64_STORE) \
+    X(WASM_OP_I32_STORE8) X(WASM_OP_I32_STORE16) X(WASM_OP_I64_STORE8) X(WASM_OP_I64_STORE16) \
+    X(WASM_OP_I64_STORE32) X(WASM_OP_MEMORY_SIZE) X(WASM_OP_MEMORY_GROW) X(WASM_OP_I32_CONST) \
+    X(WASM_OP_I64_CONST) X(WASM_OP_F32_CONST) X(WASM_OP_F64_CONST) X(WASM_OP_I32_EQZ) \
+    X(WASM_OP_I32_EQ) X(WASM_OP_I32_NE) X(WASM_OP_I32_LT_S) X(WASM_OP_I32_LT_U) X(WASM_OP_I32_GT_S) \
+    X(WASM_OP_I32_GT_U) X(WASM_OP_I32_LE_S) X(WASM_OP_I32_LE_U) X(WASM_OP_I32_GE_S) \
+    X(WASM_OP_I32_GE_U) X(WASM_OP_I64_EQZ) X(WASM_OP_I64_EQ) X(WASM_OP_I64_NE) X(WASM_OP_I64_LT_S) \
+    X(WASM_OP_I64_LT_U) X(WASM_OP_I64_GT_S) X(WASM_OP_I64_GT_U) X(WASM_OP_I64_LE_S) \
+    X(WASM_OP_I64_LE_U) X(WASM_OP_I64_GE_S) X(WASM_OP_I64_GE_U) X(WASM_OP_F32_EQ) X(WASM_OP_F32_NE) \
+    X(WASM_OP_F32_LT) X(WASM_OP_F32_GT) X(WASM_OP_F32_LE) X(WASM_OP_F32_GE) X(WASM_OP_F64_EQ) \
+    X(WASM_OP_F64_NE) X(WASM_OP_F64_LT) X(WASM_OP_F64_GT) X(WASM_OP_F64_LE) X(WASM_OP_F64_GE) \
+    X(WASM_OP_I32_CLZ) X(WASM_OP_I32_CTZ) X(WASM_OP_I32_POPCNT) X(WASM_OP_I32_ADD) \
+    X(WASM_OP_I32_SUB) X(WASM_OP_I32_MUL) X(WASM_OP_I32_DIV_S) X(WASM_OP_I32_DIV_U) \
+    X(WASM_OP_I32_REM_S) X(WASM_OP_I32_REM_U) X(WASM_OP_I32_AND) X(WASM_OP_I32_OR) \
+    X(WASM_OP_I32_XOR) X(WASM_OP_I32_SHL) X(WASM_OP_I32_SHR_S) X(WASM_OP_I32_SHR_U) \
+    X(WASM_OP_I32_ROTL) X(WASM_OP_I32_ROTR) X(WASM_OP_I64_CLZ) X(WASM_OP_I64_CTZ) \
+    X(WASM_OP_I64_POPCNT) X(WASM_OP_I64_ADD) X(WASM_OP_I64_SUB) X(WASM_OP_I64_MUL) \
+    X(WASM_OP_I64_DIV_S) X(WASM_OP_I64_DIV_U) X(WASM_OP_I64_REM_S) X(WASM_OP_I64_REM_U) \
+    X(WASM_OP_I64_AND) X(WASM_OP_I64_OR) X(WASM_OP_I64_XOR) X(WASM_OP_I64_SHL) X(WASM_OP_I64_SHR_S) \
+    X(WASM_OP_I64_SHR_U) X(WASM_OP_I64_ROTL) X(WASM_OP_I64_ROTR) X(WASM_OP_F32_ABS) \
+    X(WASM_OP_F32_NEG) X(WASM_OP_F32_CEIL) X(WASM_OP_F32_FLOOR) X(WASM_OP_F32_TRUNC) \
+    X(WASM_OP_F32_NEAREST) X(WASM_OP_F32_SQRT) X(WASM_OP_F32_ADD) X(WASM_OP_F32_SUB) \
+    X(WASM_OP_F32_MUL) X(WASM_OP_F32_DIV) X(WASM_OP_F32_MIN) X(WASM_OP_F32_MAX) \
+    X(WASM_OP_F32_COPYSIGN) X(WASM_OP_F64_ABS) X(WASM_OP_F64_NEG) X(WASM_OP_F64_CEIL) \
+    X(WASM_OP_F64_FLOOR) X(WASM_OP_F64_TRUNC) X(WASM_OP_F64_NEAREST) X(WASM_OP_F64_SQRT) \
+    X(WASM_OP_F64_ADD) X(WASM_OP_F64_SUB) X(WASM_OP_F64_MUL) X(WASM_OP_F64_DIV) X(WASM_OP_F64_MIN) \
+    X(WASM_OP_F64_MAX) X(WASM_OP_F64_COPYSIGN) X(WASM_OP_I32_WRAP_I64) X(WASM_OP_I32_TRUNC_F32_S) \
+    X(WASM_OP_I32_TRUNC_F32_U) X(WASM_OP_I32_TRUNC_F64_S) X(WASM_OP_I32_TRUNC_F64_U) \
+    X(WASM_OP_I64_EXTEND_I32_S) X(WASM_OP_I64_EXTEND_I32_U) X(WASM_OP_I64_TRUNC_F32_S) \
+    X(WASM_OP_I64_TRUNC_F32_U) X(WASM_OP_I64_TRUNC_F64_S) X(WASM_OP_I64_TRUNC_F64_U) \
+    X(WASM_OP_F32_CONVERT_I32_S) X(WASM_OP_F32_CONVERT_I32_U) X(WASM_OP_F32_CONVERT_I64_S) \
+    X(WASM_OP_F32_CONVERT_I64_U) X(WASM_OP_F32_DEMOTE_F64) X(WASM_OP_F64_CONVERT_I32_S) \
+    X(WASM_OP_F64_CONVERT_I32_U) X(WASM_OP_F64_CONVERT_I64_S) X(WASM_OP_F64_CONVERT_I64_U) \
+    X(WASM_OP_F64_PROMOTE_F32) X(WASM_OP_I32_REINTERPRET_F32) X(WASM_OP_I64_REINTERPRET_F64) \
+    X(WASM_OP_F32_REINTERPRET_I32) X(WASM_OP_F64_REINTERPRET_I64) X(WASM_OP_I32_EXTEND8_S) \
+    X(WASM_OP_I32_EXTEND16_S) X(WASM_OP_I64_EXTEND8_S) X(WASM_OP_I64_EXTEND16_S) \
+    X(WASM_OP_I64_EXTEND32_S) X(WASM_OP_I32_TRUNC_SAT_F32_S) X(WASM_OP_I32_TRUNC_SAT_F32_U) \
+    X(WASM_OP_I32_TRUNC_SAT_F64_S) X(WASM_OP_I32_TRUNC_SAT_F64_U) X(WASM_OP_I64_TRUNC_SAT_F32_S) \
+    X(WASM_OP_I64_TRUNC_SAT_F32_U) X(WASM_OP_I64_TRUNC_SAT_F64_S) X(WASM_OP_I64_TRUNC_SAT_F64_U) \
+    X(OP_BR_MOVE) X(OP_BR_IF_MOVE) X(OP_HOT_LOOP)
+
+// Ops only stack code has
+#define STACK_OPS(X) \
+    X(WASM_OP_DROP) X(WASM_OP_LOCAL_GET) X(WASM_OP_LOCAL_SET) X(WASM_OP_LOCAL_TEE)
+
+// Ops only register code has, besides the immediate forms
+#define REGISTER_OPS(X) X(OP_COPY)
+
+// Integer binary ops with an immediate form in register code, see OP_IMM
+#define IMMEDIATE_OPS(X) \
+    X(WASM_OP_I32_EQ) X(WASM_OP_I32_NE) X(WASM_OP_I32_LT_S) X(WASM_OP_I32_LT_U) X(WASM_OP_I32_GT_S) \
+    X(WASM_OP_I32_GT_U) X(WASM_OP_I32_LE_S) X(WASM_OP_I32_LE_U) X(WASM_OP_I32_GE_S) \
+    X(WASM_OP_I32_GE_U) X(WASM_OP_I64_EQ) X(WASM_OP_I64_NE) X(WASM_OP_I64_LT_S) X(WASM_OP_I64_LT_U) \
+    X(WASM_OP_I64_GT_S) X(WASM_OP_I64_GT_U) X(WASM_OP_I64_LE_S) X(WASM_OP_I64_LE_U) \
+    X(WASM_OP_I64_GE_S) X(WASM_OP_I64_GE_U) X(WASM_OP_I32_ADD) X(WASM_OP_I32_SUB) X(WASM_OP_I32_MUL) \
+    X(WASM_OP_I32_AND) X(WASM_OP_I32_OR) X(WASM_OP_I32_XOR) X(WASM_OP_I32_SHL) X(WASM_OP_I32_SHR_S) \
+    X(WASM_OP_I32_SHR_U) X(WASM_OP_I32_ROTL) X(WASM_OP_I32_ROTR) X(WASM_OP_I64_ADD) \
+    X(WASM_OP_I64_SUB) X(WASM_OP_I64_MUL) X(WASM_OP_I64_AND) X(WASM_OP_I64_OR) X(WASM_OP_I64_XOR) \
+    X(WASM_OP_I64_SHL) X(WASM_OP_I64_SHR_S) X(WASM_OP_I64_SHR_U) X(WASM_OP_I64_ROTL) \
+    X(WASM_OP_I64_ROTR)
+
+// Where the switch puts an op, the 0xFC prefixed ones come after the others
+#define OPCODE(op) (((op) > 0xFF) ? OP_TRUNC_SAT + ((op) & 0xFF) : (op))
+
+static inline uint32_t rotl32(uint32_t x, uint32_t n) {
+    n &= 31;
+    return (x << n) | (x >> ((32 - n) & 31));
+}
+
+static inline uint32_t rotr32(uint32_t x, uint32_t n) {
+    n &= 31;
+    return (x >> n) | (x << ((32 - n) & 31));
+}
+
+static inline uint64_t rotl64(uint64_t x, uint64_t n) {
+    n &= 63;
+    return (x << n) | (x >> ((64 - n) & 63));
+}
+
+static inline uint64_t rotr64(uint64_t x, uint64_t n) {
+    n &= 63;
+    return (x >> n) | (x << ((64 - n) & 63));
+}
+
+#if defined(__GNUC__) && !defined(WASM_NO_THREADED)
+static const void* const* threadedLabels;
+static const void* const* threadedRegisterLabels;
+
+#define THREADED
+#define RUN    runThreaded
+#define LABELS threadedLabels
+#include "run.inc"
+#undef RUN
+#undef LABELS
+
+#define REGISTERS
+#define RUN    runThreadedRegisters
+#define LABELS threadedRegisterLabels
+#include "run.inc"
+#undef RUN
+#undef LABELS
+#undef REGISTERS
+#undef THREADED
+#define THREADED_BUILT
+#endif
+
+#define RUN runSwitch
+#include "run.inc"
+#undef RUN
+
+#define REGISTERS
+#define RUN runSwitchRegisters
+#include "run.inc"
+#undef RUN
+#undef REGISTERS
+
+const void* const* threadedHandlers(int registers) {
+#ifdef THREADED_BUILT
+    if (registers) {
+        if (!threadedRegisterLabels)
+            runThreadedRegisters(NULL, NULL, NULL);
+
+        return threadedRegisterLabels;
+    }
+
+    if (!threadedLabels)
+        runThreaded(NULL, NULL, NULL);
+
+    return threadedLabels;
+#else
+    return NULL;
+#endif
+}
+
+int runFunction(struct WasmInstance* instance, struct CompiledFunction* fn, uint64_t* fp) {
+    if (isHot(instance, fn))
+        return runMachineCode(instance, fn, fp, UINT32_MAX);
+
+    int registers = instance->flags & WASM_INSTANCE_REGISTERS;
+#ifdef THREADED_BUILT
+    if (instance->_handlers)
+        return (registers) ? runThreadedRegisters(instance, fn, fp) : runThreaded(instance, fn, fp);
+#endif
+
+    return (registers) ? runSwitchRegisters(instance, fn, fp) : runSwitch(instance, fn, fp);
+}
@@ -0,0 +1,1854 @@
+#define _GNU_SOURCE // REG_RIP
+#include <libwasm.h>
+#include <instance.h>
+#include <decode.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// Machine code for x86-64 made straight from the decoded body, one
+// instruction at a time. Frames are the interpreter's: locals from fp,
+// then operands by their height, so either can take over from the other
+// at a call or at the start of a loop. Only the value on top of the
+// operand stack, and sometimes the one under it, are kept out of their
+// slots. While it runs these registers are pinned:
+//   rbx  fp
+//   r12  the instance
+//   r13  memory
+//   r14  memorySize
+//   r15  the Jit's entries, what a call to each function goes to
+// Functions are called with rbx already at their frame and return a
+// status in eax, their result is in fp[0]. A trap goes back up through
+// every caller, there is nothing to unwind but the native stack. Under
+// guard pages memory accesses are not checked, one that faults goes
+// straight back to the innermost enter with WASM_TRAP_OUT_OF_BOUNDS
+
+// Address space kept for machine code, pages are only used as they fill up
+#define CODE_RESERVE (256UL << 20)
+
+struct Jit {
+    uint8_t*     code;
+    size_t       used;
+    size_t       pageSize;
+    const void** entries;    // per function: its machine code, a stub into the interpreter or the host
+    uint32_t*    signatures; // per function, the first type that is the same as its own
+    int        (*enter)(struct WasmInstance* instance, uint64_t* fp, const void* target);
+    void*        unwind;      // the stack pointer in the innermost enter
+    const void*  outOfBounds; // where a fault on a guard page of memory carries on
+    int          guarded;     // memory has guard pages and faults on them are handled
+};
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { XMM0, XMM1 };
+
+// Condition codes
+enum { CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A, CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G };
+#define ALWAYS -1
+
+// ALU ops as the /n of their immediate forms
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+
+// Shifts and rotates by the /n of theirs
+enum { SH_ROL = 0, SH_ROR = 1, SH_SHL = 4, SH_SHR = 5, SH_SAR = 7 };
+
+struct Emitter {
+    uint8_t* code;
+    size_t   size;
+    size_t   capacity;
+    int      failed;
+};
+
+static void byte(struct Emitter* e, uint8_t b) {
+    if (e->size == e->capacity) {
+        size_t capacity = (e->capacity) ? e->capacity * 2 : 4096;
+        uint8_t* code = realloc(e->code, capacity);
+        if (!code) {
+            e->failed = 1;
+            e->size = 0;
+            return;
+        }
+
+        e->code = code;
+        e->capacity = capacity;
+    }
+
+    e->code[e->size++] = b;
+}
+
+static void u32(struct Emitter* e, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        byte(e, v >> (i * 8));
+}
+
+static void u64(struct Emitter* e, uint64_t v) {
+    u32(e, (uint32_t) v);
+    u32(e, v >> 32);
+}
+
+static void patch32(struct Emitter* e, size_t at, uint32_t v) {
+    if (!e->failed)
+        memcpy(e->code + at, &v, sizeof(v));
+}
+
+// The r/m operand of an instruction, a register or memory at
+// base + index * (1 << scale) + disp
+struct Rm {
+    int8_t  reg;   // -1 for memory
+    int8_t  base;
+    int8_t  index; // -1 for none
+    uint8_t scale;
+    int32_t disp;
+};
+
+static struct Rm R(int reg) {
+    return (struct Rm) { reg, 0, -1, 0, 0 };
+}
+
+static struct Rm M(int base, int32_t disp) {
+    return (struct Rm) { -1, base, -1, 0, disp };
+}
+
+static struct Rm MI(int base, int index, int scale, int32_t disp) {
+    return (struct Rm) { -1, base, index, scale, disp };
+}
+
+// prefix is the 0x66, 0xF2 or 0xF3 in front of the REX, 0 for none. Two
+// byte opcodes are 0x0Fxx
+static void insn(struct Emitter* e, uint8_t prefix, int w, uint32_t opcode, int reg, struct Rm rm) {
+    if (prefix)
+        byte(e, prefix);
+
+    int base = (rm.reg >= 0) ? rm.reg : rm.base;
+    int index = (rm.reg < 0 && rm.index >= 0) ? rm.index : 0;
+    uint8_t rex = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+    if (rex != 0x40)
+        byte(e, rex);
+    if (opcode > 0xFF)
+        byte(e, opcode >> 8);
+    byte(e, opcode);
+
+    if (rm.reg >= 0) {
+        byte(e, 0xC0 | (reg & 7) << 3 | (rm.reg & 7));
+        return;
+    }
+
+    // rbp and r13 have no form without a displacement, rsp and r12 need a SIB
+    int mod = (rm.disp == 0 && (rm.base & 7) != RBP) ? 0 : (rm.disp >= -128 && rm.disp <= 127) ? 1 : 2;
+    if (rm.index >= 0 || (rm.base & 7) == RSP) {
+        byte(e, mod << 6 | (reg & 7) << 3 | 4);
+        byte(e, rm.scale << 6 | (((rm.index >= 0) ? rm.index : RSP) & 7) << 3 | (rm.base & 7));
+    } else {
+        byte(e, mod << 6 | (reg & 7) << 3 | (rm.base & 7));
+    }
+
+    if (mod == 1)
+        byte(e, (uint8_t) rm.disp);
+    else if (mod == 2)
+        u32(e, rm.disp);
+}
+
+static int fits8(int64_t v) {
+    return v >= -128 && v <= 127;
+}
+
+static int fits32(int64_t v) {
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+// Leaves the flags alone, unlike xor for 0
+static void movImm(struct Emitter* e, int reg, uint64_t v) {
+    if (v <= UINT32_MAX) {
+        if (reg & 8)
+            byte(e, 0x41);
+        byte(e, 0xB8 + (reg & 7));
+        u32(e, (uint32_t) v);
+    } else if (fits32((int64_t) v)) {
+        insn(e, 0, 1, 0xC7, 0, R(reg));
+        u32(e, (uint32_t) v);
+    } else {
+        byte(e, 0x48 | ((reg & 8) >> 3));
+        byte(e, 0xB8 + (reg & 7));
+        u64(e, v);
+    }
+}
+
+static void movLoad(struct Emitter* e, int w, int reg, struct Rm rm) {
+    insn(e, 0, w, 0x8B, reg, rm);
+}
+
+static void movStore(struct Emitter* e, int w, struct Rm rm, int reg) {
+    insn(e, 0, w, 0x89, reg, rm);
+}
+
+static void lea(struct Emitter* e, int reg, struct Rm rm) {
+    insn(e, 0, 1, 0x8D, reg, rm);
+}
+
+// op r/m, imm for the ALU_* ops
+static void aluImm(struct Emitter* e, int w, int op, struct Rm rm, int32_t v) {
+    insn(e, 0, w, fits8(v) ? 0x83 : 0x81, op, rm);
+    if (fits8(v))
+        byte(e, (uint8_t) v);
+    else
+        u32(e, (uint32_t) v);
+}
+
+// op reg, r/m for the ALU_* ops
+static void alu(struct Emitter* e, int w, int op, int reg, struct Rm rm) {
+    insn(e, 0, w, op * 8 + 3, reg, rm);
+}
+
+static void setcc(struct Emitter* e, int cc, int reg) {
+    insn(e, 0, 0, 0x0F90 | cc, 0, R(reg));
+    insn(e, 0, 0, 0x0FB6, reg, R(reg));
+}
+
+// The sign of rax or eax into all of rdx or edx, cqo or cdq
+static void signExtend(struct Emitter* e, int w) {
+    if (w)
+        byte(e, 0x48);
+    byte(e, 0x99);
+}
+
+// bt* rax, 63, n is 6 for btr and 7 for btc
+static void bitOp(struct Emitter* e, int n) {
+    insn(e, 0, 1, 0x0FBA, n, R(RAX));
+    byte(e, 63);
+}
+
+static void shiftImm(struct Emitter* e, int w, int n, int reg, uint8_t count) {
+    insn(e, 0, w, 0xC1, n, R(reg));
+    byte(e, count);
+}
+
+static void push(struct Emitter* e, int reg) {
+    if (reg & 8)
+        byte(e, 0x41);
+    byte(e, 0x50 + (reg & 7));
+}
+
+static void pop(struct Emitter* e, int reg) {
+    if (reg & 8)
+        byte(e, 0x41);
+    byte(e, 0x58 + (reg & 7));
+}
+
+static void callAbsolute(struct Emitter* e, const void* target) {
+    movImm(e, RAX, (uintptr_t) target);
+    insn(e, 0, 0, 0xFF, 2, R(RAX));
+}
+
+// sub rsp, 8 and add rsp, 8, what keeps calls out of wasm code aligned
+static void alignStack(struct Emitter* e) {
+    aluImm(e, 1, ALU_SUB, R(RSP), 8);
+}
+
+static void unalignStack(struct Emitter* e) {
+    aluImm(e, 1, ALU_ADD, R(RSP), 8);
+}
+
+static void reloadMemory(struct Emitter* e) {
+    movLoad(e, 1, R13, M(R12, offsetof(struct WasmInstance, memory)));
+    movLoad(e, 1, R14, M(R12, offsetof(struct WasmInstance, memorySize)));
+}
+
+// Functions the machine code calls for what takes too much of it, every
+// one of them is what the interpreter does
+static uint64_t popcnt32(uint64_t x) { return __builtin_popcount((uint32_t) x); }
+static uint64_t popcnt64(uint64_t x) { return __builtin_popcountll(x); }
+static uint64_t ceil32(uint64_t x)    { return fromF32(ceilf(f32(x))); }
+static uint64_t floor32(uint64_t x)   { return fromF32(floorf(f32(x))); }
+static uint64_t trunc32(uint64_t x)   { return fromF32(truncf(f32(x))); }
+static uint64_t nearest32(uint64_t x) { return fromF32(rintf(f32(x))); }
+static uint64_t ceil64(uint64_t x)    { return fromF64(ceil(f64(x))); }
+static uint64_t floor64(uint64_t x)   { return fromF64(floor(f64(x))); }
+static uint64_t trunc64(uint64_t x)   { return fromF64(trunc(f64(x))); }
+static uint64_t nearest64(uint64_t x) { return fromF64(rint(f64(x))); }
+static uint64_t min32(uint64_t x, uint64_t y) { return fromF32((float) wasmMin(f32(x), f32(y))); }
+static uint64_t max32(uint64_t x, uint64_t y) { return fromF32((float) wasmMax(f32(x), f32(y))); }
+static uint64_t min64(uint64_t x, uint64_t y) { return fromF64(wasmMin(f64(x), f64(y))); }
+static uint64_t max64(uint64_t x, uint64_t y) { return fromF64(wasmMax(f64(x), f64(y))); }
+static uint64_t convert32U(uint64_t x) { return fromF32((float) x); }
+static uint64_t convert64U(uint64_t x) { return fromF64((double) x); }
+static uint64_t satI32F32(uint64_t x) { return satI32(f32(x)); }
+static uint64_t satU32F32(uint64_t x) { return satU32(f32(x)); }
+static uint64_t satI32F64(uint64_t x) { return satI32(f64(x)); }
+static uint64_t satU32F64(uint64_t x) { return satU32(f64(x)); }
+static uint64_t satI64F32(uint64_t x) { return satI64(f32(x)); }
+static uint64_t satU64F32(uint64_t x) { return satU64(f32(x)); }
+static uint64_t satI64F64(uint64_t x) { return satI64(f64(x)); }
+static uint64_t satU64F64(uint64_t x) { return satU64(f64(x)); }
+
+// Trapping truncations, in place
+#define TRUNC(name, get, lo, hi, type, result) \
+    static int name(uint64_t* slot) { \
+        double x = get(*slot); \
+        if (x != x) \
+            return WASM_TRAP_INVALID_CONVERSION; \
+        if (!(x > (lo) && x < (hi))) \
+            return WASM_TRAP_INTEGER_OVERFLOW; \
+        *slot = (result) (type) x; \
+        return WASM_SUCCESS; \
+    }
+
+TRUNC(truncI32F32, f32, -2147483649.0, 2147483648.0, int32_t, uint32_t)
+TRUNC(truncU32F32, f32, -1.0, 4294967296.0, uint32_t, uint32_t)
+TRUNC(truncI32F64, f64, -2147483649.0, 2147483648.0, int32_t, uint32_t)
+TRUNC(truncU32F64, f64, -1.0, 4294967296.0, uint32_t, uint32_t)
+TRUNC(truncI64F32, f32, -9223372036854777856.0, 9223372036854775808.0, int64_t, uint64_t)
+TRUNC(truncU64F32, f32, -1.0, 18446744073709551616.0, uint64_t, uint64_t)
+TRUNC(truncI64F64, f64, -9223372036854777856.0, 9223372036854775808.0, int64_t, uint64_t)
+TRUNC(truncU64F64, f64, -1.0, 18446744073709551616.0, uint64_t, uint64_t)
+
+#undef TRUNC
+
+static const void* unaryHelper(uint32_t op) {
+    switch (op) {
+        case WASM_OP_I32_POPCNT:  return popcnt32;
+        case WASM_OP_I64_POPCNT:  return popcnt64;
+        case WASM_OP_F32_CEIL:    return ceil32;
+        case WASM_OP_F32_FLOOR:   return floor32;
+        case WASM_OP_F32_TRUNC:   return trunc32;
+        case WASM_OP_F32_NEAREST: return nearest32;
+        case WASM_OP_F64_CEIL:    return ceil64;
+        case WASM_OP_F64_FLOOR:   return floor64;
+        case WASM_OP_F64_TRUNC:   return trunc64;
+        case WASM_OP_F64_NEAREST: return nearest64;
+        case WASM_OP_F32_CONVERT_I64_U: return convert32U;
+        case WASM_OP_F64_CONVERT_I64_U: return convert64U;
+        case WASM_OP_I32_TRUNC_SAT_F32_S: return satI32F32;
+        case WASM_OP_I32_TRUNC_SAT_F32_U: return satU32F32;
+        case WASM_OP_I32_TRUNC_SAT_F64_S: return satI32F64;
+        case WASM_OP_I32_TRUNC_SAT_F64_U: return satU32F64;
+        case WASM_OP_I64_TRUNC_SAT_F32_S: return satI64F32;
+        case WASM_OP_I64_TRUNC_SAT_F32_U: return satU64F32;
+        case WASM_OP_I64_TRUNC_SAT_F64_S: return satI64F64;
+        case WASM_OP_I64_TRUNC_SAT_F64_U: return satU64F64;
+    }
+
+    return NULL;
+}
+
+static const void* binaryHelper(uint32_t op) {
+    switch (op) {
+        case WASM_OP_F32_MIN: return min32;
+        case WASM_OP_F32_MAX: return max32;
+        case WASM_OP_F64_MIN: return min64;
+        case WASM_OP_F64_MAX: return max64;
+    }
+
+    return NULL;
+}
+
+static const void* truncHelper(uint32_t op) {
+    switch (op) {
+        case WASM_OP_I32_TRUNC_F32_S: return truncI32F32;
+        case WASM_OP_I32_TRUNC_F32_U: return truncU32F32;
+        case WASM_OP_I32_TRUNC_F64_S: return truncI32F64;
+        case WASM_OP_I32_TRUNC_F64_U: return truncU32F64;
+        case WASM_OP_I64_TRUNC_F32_S: return truncI64F32;
+        case WASM_OP_I64_TRUNC_F32_U: return truncU64F32;
+        case WASM_OP_I64_TRUNC_F64_S: return truncI64F64;
+        case WASM_OP_I64_TRUNC_F64_U: return truncU64F64;
+    }
+
+    return NULL;
+}
+
+// Where the top of the operand stack is while compiling. The value under
+// it can be in rax as well when the top is a constant or a local, every
+// other one is in its slot
+enum { TOP_SLOT, TOP_RAX, TOP_CONST, TOP_LOCAL, TOP_FLAGS };
+
+// A jump to somewhere not compiled yet, rel32 at at
+struct Fixup {
+    uint32_t at;
+    uint32_t next; // the next one going to the same place, UINT32_MAX for none
+};
+
+#define NO_FIXUPS UINT32_MAX
+
+struct JitBlock {
+    uint32_t height;
+    uint32_t label;     // the start of a loop
+    uint32_t ends;      // jumps to the end
+    uint32_t elses;     // the if's jump past its then
+    uint8_t  arity;
+    uint8_t  loop;
+    uint8_t  reachable; // whether the code it was opened in could run
+    uint8_t  function;
+};
+
+#define NTRAPS (WASM_TRAP_UNBOUND_IMPORT - WASM_TRAP_UNREACHABLE + 1)
+
+struct Compiler {
+    struct Emitter           e;
+    struct WasmInstance*     instance;
+    struct CompiledFunction* fn;
+    struct DecodedCode       decoded;
+    struct JitBlock*         blocks;
+    uint32_t                 nblocks;
+    uint32_t                 height;
+    uint32_t*                loops;  // landing pad of each loop, UINT32_MAX in dead code
+    uint32_t                 nloops;
+    struct Fixup*            fixups;
+    uint32_t                 nfixups;
+    uint32_t                 capacity;
+    uint32_t                 traps[NTRAPS];
+    uint32_t                 exits; // jumps out with a status already in eax
+    uint32_t                 overflow;
+
+    uint8_t                  top;
+    uint8_t                  below;
+    uint8_t                  cc;
+    uint32_t                 local;
+    uint64_t                 constant;
+};
+
+static int32_t slot(struct Compiler* c, uint32_t height) {
+    return (int32_t) (c->fn->nlocals + height) * 8;
+}
+
+static struct Rm slotRm(struct Compiler* c, uint32_t height) {
+    return M(RBX, slot(c, height));
+}
+
+static struct Rm localRm(uint32_t local) {
+    return M(RBX, (int32_t) local * 8);
+}
+
+// jmp or jcc to a place not known yet, the rel32 is patched by land()
+static uint32_t jumpForward(struct Compiler* c, int cc) {
+    if (cc == ALWAYS) {
+        byte(&c->e, 0xE9);
+    } else {
+        byte(&c->e, 0x0F);
+        byte(&c->e, 0x80 | cc);
+    }
+    uint32_t at = c->e.size;
+    u32(&c->e, 0);
+    return at;
+}
+
+static void land(struct Compiler* c, uint32_t at, uint32_t target) {
+    patch32(&c->e, at, target - (at + 4));
+}
+
+static void jumpBack(struct Compiler* c, int cc, uint32_t target) {
+    int64_t rel = (int64_t) target - (int64_t) (c->e.size + 2);
+    if (fits8(rel)) {
+        byte(&c->e, (cc == ALWAYS) ? 0xEB : 0x70 | cc);
+        byte(&c->e, (uint8_t) rel);
+        return;
+    }
+
+    land(c, jumpForward(c, cc), target);
+}
+
+static void jumpList(struct Compiler* c, int cc, uint32_t* list) {
+    uint32_t at = jumpForward(c, cc);
+    if (c->nfixups == c->capacity) {
+        uint32_t capacity = (c->capacity) ? c->capacity * 2 : 64;
+        struct Fixup* fixups = realloc(c->fixups, sizeof(struct Fixup) * capacity);
+        if (!fixups) {
+            c->e.failed = 1;
+            return;
+        }
+
+        c->fixups = fixups;
+        c->capacity = capacity;
+    }
+
+    c->fixups[c->nfixups] = (struct Fixup) { at, *list };
+    *list = c->nfixups++;
+}
+
+static void bindList(struct Compiler* c, uint32_t list, uint32_t target) {
+    for (; list != NO_FIXUPS; list = c->fixups[list].next)
+        land(c, c->fixups[list].at, target);
+}
+
+static void trapIf(struct Compiler* c, int cc, int code) {
+    jumpList(c, cc, &c->traps[code - WASM_TRAP_UNREACHABLE]);
+}
+
+// The top value into reg, the state stays as it is. reg is not rax
+// when the value under the top is there
+static void topTo(struct Compiler* c, int reg) {
+    switch (c->top) {
+        case TOP_SLOT:  movLoad(&c->e, 1, reg, slotRm(c, c->height - 1)); break;
+        case TOP_RAX:   if (reg != RAX) movLoad(&c->e, 1, reg, R(RAX)); break;
+        case TOP_CONST: movImm(&c->e, reg, c->constant); break;
+        case TOP_LOCAL: movLoad(&c->e, 1, reg, localRm(c->local)); break;
+        case TOP_FLAGS: setcc(&c->e, c->cc, reg); break;
+    }
+}
+
+// The top value into the slot at height
+static void storeTop(struct Compiler* c, uint32_t height) {
+    if (c->top == TOP_SLOT && height == c->height - 1)
+        return;
+
+    if (c->top == TOP_RAX) {
+        movStore(&c->e, 1, slotRm(c, height), RAX);
+    } else if (c->top == TOP_CONST && fits32((int64_t) c->constant)) {
+        insn(&c->e, 0, 1, 0xC7, 0, slotRm(c, height));
+        u32(&c->e, (uint32_t) c->constant);
+    } else {
+        topTo(c, RCX);
+        movStore(&c->e, 1, slotRm(c, height), RCX);
+    }
+}
+
+static void spillBelow(struct Compiler* c) {
+    if (c->below)
+        movStore(&c->e, 1, slotRm(c, c->height - 2), RAX);
+    c->below = 0;
+}
+
+// Every value into its slot. Only moves, the flags are left alone
+static void flush(struct Compiler* c) {
+    spillBelow(c);
+    if (c->height)
+        storeTop(c, c->height - 1);
+    c->top = TOP_SLOT;
+}
+
+static void toRax(struct Compiler* c) {
+    spillBelow(c);
+    topTo(c, RAX);
+    c->top = TOP_RAX;
+}
+
+// Forgets the top value, whatever it was for has been emitted
+static void drop(struct Compiler* c) {
+    c->height--;
+    c->top = (c->below) ? TOP_RAX : TOP_SLOT;
+    c->below = 0;
+}
+
+// Makes room for a constant or local on top, which keeps the value under
+// it in rax
+static void pushDeferred(struct Compiler* c, uint8_t top) {
+    spillBelow(c);
+    if (c->height && c->top != TOP_SLOT) {
+        toRax(c);
+        c->below = 1;
+    }
+
+    c->height++;
+    c->top = top;
+}
+
+static void pushConst(struct Compiler* c, uint64_t v) {
+    pushDeferred(c, TOP_CONST);
+    c->constant = v;
+}
+
+// After code that leaves its result in rax, everything else flushed
+static void pushRax(struct Compiler* c) {
+    c->height++;
+    c->top = TOP_RAX;
+}
+
+// The right operand of a binary op, the left one goes in rax
+enum { OPERAND_IMM, OPERAND_MEM, OPERAND_RCX };
+
+struct Operand {
+    uint8_t kind;
+    int32_t value; // the immediate or where it is from rbx
+};
+
+static struct Rm operandRm(struct Operand rhs) {
+    return (rhs.kind == OPERAND_MEM) ? M(RBX, rhs.value) : R(RCX);
+}
+
+// Pops both operands, the result is expected in rax. Immediates are only
+// used when asked for, sign extended from 32 bits in 64-bit ops
+static struct Operand binaryOperands(struct Compiler* c, int w, int imm) {
+    struct Operand rhs = { OPERAND_RCX, 0 };
+    switch (c->top) {
+        case TOP_CONST:
+            if (imm && (!w || fits32((int64_t) c->constant)))
+                rhs = (struct Operand) { OPERAND_IMM, (int32_t) c->constant };
+            else
+                movImm(&c->e, RCX, c->constant);
+            break;
+
+        case TOP_LOCAL:
+            rhs = (struct Operand) { OPERAND_MEM, (int32_t) c->local * 8 };
+            break;
+
+        case TOP_SLOT:
+            rhs = (struct Operand) { OPERAND_MEM, slot(c, c->height - 1) };
+            break;
+
+        default:
+            topTo(c, RCX);
+            break;
+    }
+
+    if (!c->below)
+        movLoad(&c->e, 1, RAX, slotRm(c, c->height - 2));
+
+    c->height--;
+    c->top = TOP_RAX;
+    c->below = 0;
+    return rhs;
+}
+
+static void operandToRcx(struct Compiler* c, int w, struct Operand* rhs) {
+    if (rhs->kind == OPERAND_MEM)
+        movLoad(&c->e, w, RCX, operandRm(*rhs));
+    else if (rhs->kind == OPERAND_IMM)
+        movImm(&c->e, RCX, (w) ? (uint64_t) (int64_t) rhs->value : (uint32_t) rhs->value);
+    rhs->kind = OPERAND_RCX;
+}
+
+// What is on top after a comparison. Left in the flags when the next
+// instruction branches on it or turns it around
+static void flagsResult(struct Compiler* c, uint32_t i, int cc) {
+    switch (c->decoded.instrs[i + 1].opcode) {
+        case WASM_OP_BR_IF:
+        case WASM_OP_IF:
+        case WASM_OP_I32_EQZ:
+            c->top = TOP_FLAGS;
+            c->cc = cc;
+            return;
+    }
+
+    setcc(&c->e, cc, RAX);
+    c->top = TOP_RAX;
+}
+
+// Pops a condition for a branch, what it takes is the cc returned
+static int condition(struct Compiler* c) {
+    int cc = CC_NE;
+    switch (c->top) {
+        case TOP_FLAGS: cc = c->cc; break;
+        case TOP_SLOT:  aluImm(&c->e, 0, ALU_CMP, slotRm(c, c->height - 1), 0); break;
+        case TOP_LOCAL: aluImm(&c->e, 0, ALU_CMP, localRm(c->local), 0); break;
+        case TOP_RAX:   insn(&c->e, 0, 0, 0x85, RAX, R(RAX)); break;
+        case TOP_CONST:
+            movImm(&c->e, RCX, (uint32_t) c->constant);
+            insn(&c->e, 0, 0, 0x85, RCX, R(RCX));
+            break;
+    }
+
+    drop(c);
+    return cc;
+}
+
+// What is under the result does not matter any more, rax can be reused
+static void returnValue(struct Compiler* c) {
+    if (c->fn->type->ret) {
+        topTo(c, RAX);
+        movStore(&c->e, 1, M(RBX, 0), RAX);
+    }
+
+    insn(&c->e, 0, 0, 0x33, RAX, R(RAX));
+    unalignStack(&c->e);
+    byte(&c->e, 0xC3);
+}
+
+// What a branch to b has to do first: the values under its height in
+// their slots and its result in the one at its height. Nothing is emitted
+// when dry, whether anything would be is returned
+static int branchMoves(struct Compiler* c, struct JitBlock* b, int dry) {
+    uint32_t arity = (b->loop) ? 0 : b->arity;
+    int moves = 0;
+    if (c->below && c->height - 2 < b->height) {
+        moves = 1;
+        if (!dry)
+            movStore(&c->e, 1, slotRm(c, c->height - 2), RAX);
+    }
+
+    uint32_t to = (arity) ? b->height : c->height - 1;
+    if (c->height && (arity || c->height - 1 < b->height) && !(c->top == TOP_SLOT && to == c->height - 1)) {
+        moves = 1;
+        if (!dry)
+            storeTop(c, to);
+    }
+
+    return moves;
+}
+
+static void jumpToBlock(struct Compiler* c, struct JitBlock* b, int cc) {
+    if (b->loop)
+        jumpBack(c, cc, b->label);
+    else
+        jumpList(c, cc, &b->ends);
+}
+
+static void branch(struct Compiler* c, uint32_t label) {
+    struct JitBlock* b = &c->blocks[c->nblocks - 1 - label];
+    if (b->function) {
+        returnValue(c);
+        return;
+    }
+
+    branchMoves(c, b, 0);
+    jumpToBlock(c, b, ALWAYS);
+}
+
+static void branchIf(struct Compiler* c, uint32_t label) {
+    struct JitBlock* b = &c->blocks[c->nblocks - 1 - label];
+    int cc = condition(c);
+    if (!b->function && !branchMoves(c, b, 1)) {
+        jumpToBlock(c, b, cc);
+        return;
+    }
+
+    uint32_t skip = jumpForward(c, cc ^ 1);
+    branch(c, label);
+    land(c, skip, c->e.size);
+}
+
+static void branchTable(struct Compiler* c, struct Instruction* instr) {
+    uint32_t n = instr->a;
+    const uint32_t* labels = &c->decoded.labels[instr->b];
+    topTo(c, RCX);
+    insn(&c->e, 0, 0, 0x8B, RCX, R(RCX));
+    drop(c);
+
+    // Past the last label is the default
+    movImm(&c->e, RDX, n);
+    alu(&c->e, 0, ALU_CMP, RCX, R(RDX));
+    insn(&c->e, 0, 0, 0x0F40 | CC_A, RCX, R(RDX));
+    // lea rdx, [rip + the table], its entries are from there
+    byte(&c->e, 0x48);
+    byte(&c->e, 0x8D);
+    byte(&c->e, 0x15);
+    uint32_t table = c->e.size;
+    u32(&c->e, 0);
+    insn(&c->e, 0, 1, 0x63, RCX, MI(RDX, RCX, 2, 0));
+    alu(&c->e, 1, ALU_ADD, RCX, R(RDX));
+    insn(&c->e, 0, 0, 0xFF, 4, R(RCX));
+
+    uint32_t start = c->e.size;
+    patch32(&c->e, table, start - (table + 4));
+    for (uint32_t j = 0; j <= n; j++)
+        u32(&c->e, 0);
+
+    for (uint32_t j = 0; j <= n; j++) {
+        patch32(&c->e, start + j * 4, c->e.size - start);
+        branch(c, labels[j]);
+    }
+}
+
+// Loads and stores by opcode: the size, the opcode loading it into eax
+// or rax and the w of that
+static const struct {
+    uint8_t  size;
+    uint8_t  w;
+    uint16_t opcode;
+} accesses[] = {
+    [WASM_OP_I32_LOAD - WASM_OP_I32_LOAD]     = { 4, 0, 0x8B },
+    [WASM_OP_I64_LOAD - WASM_OP_I32_LOAD]     = { 8, 1, 0x8B },
+    [WASM_OP_F32_LOAD - WASM_OP_I32_LOAD]     = { 4, 0, 0x8B },
+    [WASM_OP_F64_LOAD - WASM_OP_I32_LOAD]     = { 8, 1, 0x8B },
+    [WASM_OP_I32_LOAD8_S - WASM_OP_I32_LOAD]  = { 1, 0, 0x0FBE },
+    [WASM_OP_I32_LOAD8_U - WASM_OP_I32_LOAD]  = { 1, 0, 0x0FB6 },
+    [WASM_OP_I32_LOAD16_S - WASM_OP_I32_LOAD] = { 2, 0, 0x0FBF },
+    [WASM_OP_I32_LOAD16_U - WASM_OP_I32_LOAD] = { 2, 0, 0x0FB7 },
+    [WASM_OP_I64_LOAD8_S - WASM_OP_I32_LOAD]  = { 1, 1, 0x0FBE },
+    [WASM_OP_I64_LOAD8_U - WASM_OP_I32_LOAD]  = { 1, 0, 0x0FB6 },
+    [WASM_OP_I64_LOAD16_S - WASM_OP_I32_LOAD] = { 2, 1, 0x0FBF },
+    [WASM_OP_I64_LOAD16_U - WASM_OP_I32_LOAD] = { 2, 0, 0x0FB7 },
+    [WASM_OP_I64_LOAD32_S - WASM_OP_I32_LOAD] = { 4, 1, 0x63 },
+    [WASM_OP_I64_LOAD32_U - WASM_OP_I32_LOAD] = { 4, 0, 0x8B },
+    [WASM_OP_I32_STORE - WASM_OP_I32_LOAD]    = { 4, 0, 0x89 },
+    [WASM_OP_I64_STORE - WASM_OP_I32_LOAD]    = { 8, 1, 0x89 },
+    [WASM_OP_F32_STORE - WASM_OP_I32_LOAD]    = { 4, 0, 0x89 },
+    [WASM_OP_F64_STORE - WASM_OP_I32_LOAD]    = { 8, 1, 0x89 },
+    [WASM_OP_I32_STORE8 - WASM_OP_I32_LOAD]   = { 1, 0, 0x88 },
+    [WASM_OP_I32_STORE16 - WASM_OP_I32_LOAD]  = { 2, 0, 0x89 },
+    [WASM_OP_I64_STORE8 - WASM_OP_I32_LOAD]   = { 1, 0, 0x88 },
+    [WASM_OP_I64_STORE16 - WASM_OP_I32_LOAD]  = { 2, 0, 0x89 },
+    [WASM_OP_I64_STORE32 - WASM_OP_I32_LOAD]  = { 4, 0, 0x89 },
+};
+
+// The address is in ecx. Leaves rdx at the end of the access, which is
+// checked against memorySize, and returns where it is. Reserved memory
+// has guard pages to catch what is out of bounds instead
+static struct Rm address(struct Compiler* c, uint32_t offset, uint32_t size) {
+    if (c->instance->_jit->guarded) {
+        if (offset <= INT32_MAX)
+            return MI(R13, RCX, 0, (int32_t) offset);
+
+        movImm(&c->e, RDX, offset);
+        alu(&c->e, 1, ALU_ADD, RDX, R(RCX));
+        return MI(R13, RDX, 0, 0);
+    }
+
+    uint64_t end = (uint64_t) offset + size;
+    if (end <= INT32_MAX) {
+        lea(&c->e, RDX, M(RCX, (int32_t) end));
+    } else {
+        movImm(&c->e, RDX, end);
+        alu(&c->e, 1, ALU_ADD, RDX, R(RCX));
+    }
+
+    alu(&c->e, 1, ALU_CMP, RDX, R(R14));
+    trapIf(c, CC_A, WASM_TRAP_OUT_OF_BOUNDS);
+    return MI(R13, RDX, 0, -(int32_t) size);
+}
+
+static void load(struct Compiler* c, uint32_t op, uint32_t offset) {
+    spillBelow(c);
+    topTo(c, RCX);
+    insn(&c->e, 0, 0, 0x8B, RCX, R(RCX));
+    struct Rm rm = address(c, offset, accesses[op - WASM_OP_I32_LOAD].size);
+    insn(&c->e, 0, accesses[op - WASM_OP_I32_LOAD].w, accesses[op - WASM_OP_I32_LOAD].opcode, RAX, rm);
+    c->top = TOP_RAX;
+}
+
+static void store(struct Compiler* c, uint32_t op, uint32_t offset) {
+    if (c->below) {
+        insn(&c->e, 0, 0, 0x8B, RCX, R(RAX));
+        topTo(c, RAX);
+    } else {
+        topTo(c, RAX);
+        movLoad(&c->e, 0, RCX, slotRm(c, c->height - 2));
+    }
+
+    uint32_t size = accesses[op - WASM_OP_I32_LOAD].size;
+    struct Rm rm = address(c, offset, size);
+    insn(&c->e, (size == 2) ? 0x66 : 0, accesses[op - WASM_OP_I32_LOAD].w, accesses[op - WASM_OP_I32_LOAD].opcode, RAX, rm);
+    c->height -= 2;
+    c->top = TOP_SLOT;
+    c->below = 0;
+}
+
+static void callHelper(struct Compiler* c, const void* helper, uint32_t nargs) {
+    flush(c);
+    movLoad(&c->e, 1, RDI, slotRm(c, c->height - nargs));
+    if (nargs > 1)
+        movLoad(&c->e, 1, RSI, slotRm(c, c->height - 1));
+    callAbsolute(&c->e, helper);
+    c->height -= nargs;
+    pushRax(c);
+}
+
+static void checkStatus(struct Compiler* c) {
+    insn(&c->e, 0, 0, 0x85, RAX, R(RAX));
+    jumpList(c, CC_NE, &c->exits);
+}
+
+static void call(struct Compiler* c, struct Jit* jit, uint32_t op, struct Instruction* instr) {
+    struct WasmInstance* instance = c->instance;
+    int indirect = op == WASM_OP_CALL_INDIRECT;
+    struct TypeSectionType* type = (indirect) ? &instance->_types[instr->a] : instance->module->functions[instr->a].signature;
+    flush(c);
+    uint32_t args = c->height - indirect - type->paramsLen;
+
+    if (indirect) {
+        // The first function of the same type is what both sides compare
+        uint32_t canonical = instr->a;
+        for (uint32_t j = 0; j < instr->a; j++) {
+            if (sameType(&instance->_types[j], type)) {
+                canonical = j;
+                break;
+            }
+        }
+
+        movLoad(&c->e, 0, RCX, slotRm(c, c->height - 1));
+        aluImm(&c->e, 0, ALU_CMP, R(RCX), (int32_t) instance->tableSize);
+        trapIf(c, CC_AE, WASM_TRAP_UNDEFINED_ELEMENT);
+        movImm(&c->e, RDX, (uintptr_t) instance->table);
+        movLoad(&c->e, 0, RCX, MI(RDX, RCX, 2, 0));
+        aluImm(&c->e, 0, ALU_CMP, R(RCX), (int32_t) instance->module->nfuncs);
+        trapIf(c, CC_AE, WASM_TRAP_UNDEFINED_ELEMENT);
+        movImm(&c->e, RDX, (uintptr_t) jit->signatures);
+        aluImm(&c->e, 0, ALU_CMP, MI(RDX, RCX, 2, 0), (int32_t) canonical);
+        trapIf(c, CC_NE, WASM_TRAP_SIGNATURE_MISMATCH);
+    }
+
+    // Host calls take no frame of their own
+    int frame = indirect || instr->a >= instance->_nimported;
+    struct Rm depth = M(R12, offsetof(struct WasmInstance, _depth));
+    if (frame) {
+        movLoad(&c->e, 0, RAX, depth);
+        alu(&c->e, 0, ALU_CMP, RAX, M(R12, offsetof(struct WasmInstance, _maxDepth)));
+        trapIf(c, CC_AE, WASM_TRAP_STACK_OVERFLOW);
+        insn(&c->e, 0, 0, 0xFF, 0, R(RAX));
+        movStore(&c->e, 0, depth, RAX);
+    }
+
+    int32_t frameAt = slot(c, args);
+    if (frameAt)
+        lea(&c->e, RBX, M(RBX, frameAt));
+    insn(&c->e, 0, 0, 0xFF, 2, (indirect) ? MI(R15, RCX, 3, 0) : M(R15, (int32_t) instr->a * 8));
+    if (frameAt)
+        lea(&c->e, RBX, M(RBX, -frameAt));
+    if (frame)
+        insn(&c->e, 0, 0, 0xFF, 1, depth);
+    checkStatus(c);
+
+    c->height = args + (type->ret != 0);
+    c->top = TOP_SLOT;
+}
+
+static const uint8_t compares[10] = { CC_E, CC_NE, CC_L, CC_B, CC_G, CC_A, CC_LE, CC_BE, CC_GE, CC_AE };
+
+// i32 and i64 numeric ops, op is the i32 one
+static void integer(struct Compiler* c, uint32_t i, uint32_t op, int w) {
+    switch (op) {
+        case WASM_OP_I32_EQZ:
+            if (c->top == TOP_FLAGS) {
+                flagsResult(c, i, c->cc ^ 1);
+                return;
+            }
+
+            spillBelow(c);
+            if (c->top == TOP_RAX)
+                insn(&c->e, 0, w, 0x85, RAX, R(RAX));
+            else if (c->top == TOP_SLOT)
+                aluImm(&c->e, w, ALU_CMP, slotRm(c, c->height - 1), 0);
+            else if (c->top == TOP_LOCAL)
+                aluImm(&c->e, w, ALU_CMP, localRm(c->local), 0);
+            else {
+                c->constant = (w) ? c->constant == 0 : (uint32_t) c->constant == 0;
+                return;
+            }
+            flagsResult(c, i, CC_E);
+            return;
+
+        case WASM_OP_I32_EQ ... WASM_OP_I32_GE_U: {
+            struct Operand rhs = binaryOperands(c, w, 1);
+            if (rhs.kind == OPERAND_IMM)
+                aluImm(&c->e, w, ALU_CMP, R(RAX), rhs.value);
+            else
+                alu(&c->e, w, ALU_CMP, RAX, operandRm(rhs));
+            flagsResult(c, i, compares[op - WASM_OP_I32_EQ]);
+            return;
+        }
+
+        case WASM_OP_I32_CLZ:
+            // bsr leaves ZF set for 0, which has -1 as its highest bit
+            toRax(c);
+            movImm(&c->e, RCX, (w) ? UINT64_MAX : UINT32_MAX);
+            insn(&c->e, 0, w, 0x0FBD, RAX, R(RAX));
+            insn(&c->e, 0, w, 0x0F40 | CC_E, RAX, R(RCX));
+            insn(&c->e, 0, w, 0xF7, 3, R(RAX));
+            aluImm(&c->e, w, ALU_ADD, R(RAX), (w) ? 63 : 31);
+            return;
+
+        case WASM_OP_I32_CTZ:
+            toRax(c);
+            movImm(&c->e, RCX, (w) ? 64 : 32);
+            insn(&c->e, 0, w, 0x0FBC, RAX, R(RAX));
+            insn(&c->e, 0, w, 0x0F40 | CC_E, RAX, R(RCX));
+            return;
+
+        case WASM_OP_I32_ADD:
+        case WASM_OP_I32_SUB:
+        case WASM_OP_I32_AND:
+        case WASM_OP_I32_OR:
+        case WASM_OP_I32_XOR: {
+            static const uint8_t ops[] = {
+                [WASM_OP_I32_ADD - WASM_OP_I32_ADD] = ALU_ADD, [WASM_OP_I32_SUB - WASM_OP_I32_ADD] = ALU_SUB,
+                [WASM_OP_I32_AND - WASM_OP_I32_ADD] = ALU_AND, [WASM_OP_I32_OR - WASM_OP_I32_ADD] = ALU_OR,
+                [WASM_OP_I32_XOR - WASM_OP_I32_ADD] = ALU_XOR,
+            };
+            struct Operand rhs = binaryOperands(c, w, 1);
+            if (rhs.kind == OPERAND_IMM)
+                aluImm(&c->e, w, ops[op - WASM_OP_I32_ADD], R(RAX), rhs.value);
+            else
+                alu(&c->e, w, ops[op - WASM_OP_I32_ADD], RAX, operandRm(rhs));
+            return;
+        }
+
+        case WASM_OP_I32_MUL: {
+            struct Operand rhs = binaryOperands(c, w, 1);
+            if (rhs.kind != OPERAND_IMM) {
+                insn(&c->e, 0, w, 0x0FAF, RAX, operandRm(rhs));
+            } else if (fits8(rhs.value)) {
+                insn(&c->e, 0, w, 0x6B, RAX, R(RAX));
+                byte(&c->e, (uint8_t) rhs.value);
+            } else {
+                insn(&c->e, 0, w, 0x69, RAX, R(RAX));
+                u32(&c->e, (uint32_t) rhs.value);
+            }
+            return;
+        }
+
+        case WASM_OP_I32_SHL ... WASM_OP_I32_ROTR: {
+            static const uint8_t shifts[] = { SH_SHL, SH_SAR, SH_SHR, SH_ROL, SH_ROR };
+            struct Operand rhs = binaryOperands(c, w, 1);
+            int n = shifts[op - WASM_OP_I32_SHL];
+            if (rhs.kind == OPERAND_IMM) {
+                // The count is masked like wasm does
+                shiftImm(&c->e, w, n, RAX, rhs.value & ((w) ? 63 : 31));
+            } else {
+                operandToRcx(c, w, &rhs);
+                insn(&c->e, 0, w, 0xD3, n, R(RAX));
+            }
+            return;
+        }
+
+        case WASM_OP_I32_DIV_S ... WASM_OP_I32_REM_U: {
+            int sign = op == WASM_OP_I32_DIV_S || op == WASM_OP_I32_REM_S;
+            int rem = op == WASM_OP_I32_REM_S || op == WASM_OP_I32_REM_U;
+            uint64_t y = (w) ? c->constant : (uint32_t) c->constant;
+            uint64_t minusOne = (w) ? UINT64_MAX : UINT32_MAX;
+            int known = c->top == TOP_CONST;
+            struct Operand rhs = binaryOperands(c, w, 0);
+            operandToRcx(c, w, &rhs);
+            if (!known || !y) {
+                insn(&c->e, 0, w, 0x85, RCX, R(RCX));
+                trapIf(c, CC_E, WASM_TRAP_DIVIDE_BY_ZERO);
+            }
+
+            // The smallest number divided by -1 does not fit, which wasm
+            // traps on and x86 faults on for the remainder as well
+            uint32_t done = UINT32_MAX;
+            if (sign && (!known || y == minusOne)) {
+                aluImm(&c->e, w, ALU_CMP, R(RCX), -1);
+                uint32_t normal = jumpForward(c, CC_NE);
+                if (rem) {
+                    insn(&c->e, 0, 0, 0x33, RDX, R(RDX));
+                    done = jumpForward(c, ALWAYS);
+                } else {
+                    if (w) {
+                        movImm(&c->e, RDX, (uint64_t) INT64_MIN);
+                        alu(&c->e, 1, ALU_CMP, RAX, R(RDX));
+                    } else {
+                        aluImm(&c->e, 0, ALU_CMP, R(RAX), INT32_MIN);
+                    }
+                    trapIf(c, CC_E, WASM_TRAP_INTEGER_OVERFLOW);
+                }
+                land(c, normal, c->e.size);
+            }
+
+            if (sign)
+                signExtend(&c->e, w);
+            else
+                insn(&c->e, 0, 0, 0x33, RDX, R(RDX));
+            insn(&c->e, 0, w, 0xF7, (sign) ? 7 : 6, R(RCX));
+            if (done != UINT32_MAX)
+                land(c, done, c->e.size);
+            if (rem)
+                movLoad(&c->e, w, RAX, R(RDX));
+            return;
+        }
+    }
+}
+
+// f32 and f64 ops that go through xmm0 and xmm1, op is the f32 one. The
+// prefix picks the width of each SSE instruction
+static void floating(struct Compiler* c, uint32_t i, uint32_t op, int w) {
+    uint8_t prefix = (w) ? 0xF2 : 0xF3;
+    switch (op) {
+        case WASM_OP_F32_ADD:
+        case WASM_OP_F32_SUB:
+        case WASM_OP_F32_MUL:
+        case WASM_OP_F32_DIV: {
+            static const uint8_t ops[] = { 0x58, 0x5C, 0x59, 0x5E };
+            struct Operand rhs = binaryOperands(c, w, 0);
+            insn(&c->e, 0x66, w, 0x0F6E, XMM0, R(RAX));
+            if (rhs.kind == OPERAND_RCX) {
+                insn(&c->e, 0x66, w, 0x0F6E, XMM1, R(RCX));
+                insn(&c->e, prefix, 0, 0x0F00 | ops[op - WASM_OP_F32_ADD], XMM0, R(XMM1));
+            } else {
+                insn(&c->e, prefix, 0, 0x0F00 | ops[op - WASM_OP_F32_ADD], XMM0, operandRm(rhs));
+            }
+            insn(&c->e, 0x66, w, 0x0F7E, XMM0, R(RAX));
+            return;
+        }
+
+        case WASM_OP_F32_SQRT:
+            toRax(c);
+            insn(&c->e, 0x66, w, 0x0F6E, XMM0, R(RAX));
+            insn(&c->e, prefix, 0, 0x0F51, XMM0, R(XMM0));
+            insn(&c->e, 0x66, w, 0x0F7E, XMM0, R(RAX));
+            return;
+
+        case WASM_OP_F32_ABS:
+            toRax(c);
+            if (w)
+                bitOp(&c->e, 6);
+            else
+                aluImm(&c->e, 0, ALU_AND, R(RAX), INT32_MAX);
+            return;
+
+        case WASM_OP_F32_NEG:
+            toRax(c);
+            if (w)
+                bitOp(&c->e, 7);
+            else
+                aluImm(&c->e, 0, ALU_XOR, R(RAX), INT32_MIN);
+            return;
+
+        case WASM_OP_F32_COPYSIGN: {
+            struct Operand rhs = binaryOperands(c, w, 0);
+            operandToRcx(c, w, &rhs);
+            if (w) {
+                bitOp(&c->e, 6);
+                shiftImm(&c->e, 1, SH_SHR, RCX, 63);
+                shiftImm(&c->e, 1, SH_SHL, RCX, 63);
+            } else {
+                aluImm(&c->e, 0, ALU_AND, R(RAX), INT32_MAX);
+                aluImm(&c->e, 0, ALU_AND, R(RCX), INT32_MIN);
+            }
+            alu(&c->e, w, ALU_OR, RAX, R(RCX));
+            return;
+        }
+
+        case WASM_OP_F32_EQ ... WASM_OP_F32_GE: {
+            // Unordered sets ZF, PF and CF, lt and le compare the other way
+            // around so that above is false for it
+            struct Operand rhs = binaryOperands(c, w, 0);
+            insn(&c->e, 0x66, w, 0x0F6E, XMM0, R(RAX));
+            if (rhs.kind == OPERAND_RCX)
+                insn(&c->e, 0x66, w, 0x0F6E, XMM1, R(RCX));
+            else
+                insn(&c->e, prefix, 0, 0x0F10, XMM1, operandRm(rhs));
+
+            int swap = op == WASM_OP_F32_LT || op == WASM_OP_F32_LE;
+            insn(&c->e, (w) ? 0x66 : 0, 0, 0x0F2E, (swap) ? XMM1 : XMM0, R((swap) ? XMM0 : XMM1));
+            switch (op) {
+                case WASM_OP_F32_EQ:
+                case WASM_OP_F32_NE:
+                    insn(&c->e, 0, 0, 0x0F90 | ((op == WASM_OP_F32_EQ) ? CC_E : CC_NE), 0, R(RAX));
+                    insn(&c->e, 0, 0, 0x0F90 | ((op == WASM_OP_F32_EQ) ? CC_NP : CC_P), 0, R(RCX));
+                    insn(&c->e, 0, 0, (op == WASM_OP_F32_EQ) ? 0x22 : 0x0A, RAX, R(RCX));
+                    insn(&c->e, 0, 0, 0x0FB6, RAX, R(RAX));
+                    return;
+
+                case WASM_OP_F32_LT:
+                case WASM_OP_F32_GT:
+                    flagsResult(c, i, CC_A);
+                    return;
+
+                default:
+                    flagsResult(c, i, CC_AE);
+                    return;
+            }
+        }
+    }
+}
+
+// Everything else: conversions and what works on a single value in rax
+static void convert(struct Compiler* c, uint32_t op) {
+    toRax(c);
+    switch (op) {
+        case WASM_OP_I32_WRAP_I64:
+        case WASM_OP_I64_EXTEND_I32_U:
+            insn(&c->e, 0, 0, 0x8B, RAX, R(RAX));
+            break;
+
+        case WASM_OP_I64_EXTEND_I32_S:
+        case WASM_OP_I64_EXTEND32_S:
+            insn(&c->e, 0, 1, 0x63, RAX, R(RAX));
+            break;
+
+        case WASM_OP_I32_EXTEND8_S:  insn(&c->e, 0, 0, 0x0FBE, RAX, R(RAX)); break;
+        case WASM_OP_I32_EXTEND16_S: insn(&c->e, 0, 0, 0x0FBF, RAX, R(RAX)); break;
+        case WASM_OP_I64_EXTEND8_S:  insn(&c->e, 0, 1, 0x0FBE, RAX, R(RAX)); break;
+        case WASM_OP_I64_EXTEND16_S: insn(&c->e, 0, 1, 0x0FBF, RAX, R(RAX)); break;
+
+        // Unsigned i32 is converted from its zero extended i64
+        case WASM_OP_F32_CONVERT_I32_S:
+        case WASM_OP_F32_CONVERT_I32_U:
+        case WASM_OP_F32_CONVERT_I64_S:
+        case WASM_OP_F64_CONVERT_I32_S:
+        case WASM_OP_F64_CONVERT_I32_U:
+        case WASM_OP_F64_CONVERT_I64_S: {
+            int to64 = op >= WASM_OP_F64_CONVERT_I32_S;
+            int from64 = op != WASM_OP_F32_CONVERT_I32_S && op != WASM_OP_F64_CONVERT_I32_S;
+            if (op == WASM_OP_F32_CONVERT_I32_U || op == WASM_OP_F64_CONVERT_I32_U)
+                insn(&c->e, 0, 0, 0x8B, RAX, R(RAX));
+            insn(&c->e, 0, 0, 0x0F57, XMM0, R(XMM0));
+            insn(&c->e, (to64) ? 0xF2 : 0xF3, from64, 0x0F2A, XMM0, R(RAX));
+            insn(&c->e, 0x66, to64, 0x0F7E, XMM0, R(RAX));
+            break;
+        }
+
+        case WASM_OP_F32_DEMOTE_F64:
+            insn(&c->e, 0x66, 1, 0x0F6E, XMM0, R(RAX));
+            insn(&c->e, 0xF2, 0, 0x0F5A, XMM0, R(XMM0));
+            insn(&c->e, 0x66, 0, 0x0F7E, XMM0, R(RAX));
+            break;
+
+        case WASM_OP_F64_PROMOTE_F32:
+            insn(&c->e, 0x66, 0, 0x0F6E, XMM0, R(RAX));
+            insn(&c->e, 0xF3, 0, 0x0F5A, XMM0, R(XMM0));
+            insn(&c->e, 0x66, 1, 0x0F7E, XMM0, R(RAX));
+            break;
+
+        // The bits are the same
+        case WASM_OP_I32_REINTERPRET_F32:
+        case WASM_OP_I64_REINTERPRET_F64:
+        case WASM_OP_F32_REINTERPRET_I32:
+        case WASM_OP_F64_REINTERPRET_I64:
+            break;
+    }
+}
+
+static void openBlock(struct Compiler* c, struct Instruction* instr, int loop, int reachable) {
+    c->blocks[c->nblocks++] = (struct JitBlock) {
+        .height = c->height, .label = c->e.size, .ends = NO_FIXUPS, .elses = NO_FIXUPS,
+        .arity = instr->a != 0x40, .loop = loop, .reachable = reachable,
+    };
+}
+
+static void compileInstruction(struct Compiler* c, struct Jit* jit, uint32_t i) {
+    struct WasmInstance* instance = c->instance;
+    struct Instruction* instr = &c->decoded.instrs[i];
+    uint32_t op = instr->opcode;
+
+    switch (op) {
+        case WASM_OP_NOP:
+            break;
+
+        case WASM_OP_UNREACHABLE:
+            trapIf(c, ALWAYS, WASM_TRAP_UNREACHABLE);
+            break;
+
+        case WASM_OP_BLOCK:
+            flush(c);
+            openBlock(c, instr, 0, 1);
+            break;
+
+        case WASM_OP_LOOP:
+            flush(c);
+            openBlock(c, instr, 1, 1);
+            c->loops[c->nloops++] = c->e.size;
+            break;
+
+        case WASM_OP_IF: {
+            int cc = condition(c);
+            flush(c);
+            openBlock(c, instr, 0, 1);
+            jumpList(c, cc ^ 1, &c->blocks[c->nblocks - 1].elses);
+            break;
+        }
+
+        case WASM_OP_ELSE: {
+            struct JitBlock* b = &c->blocks[c->nblocks - 1];
+            flush(c);
+            jumpList(c, ALWAYS, &b->ends);
+            bindList(c, b->elses, c->e.size);
+            b->elses = NO_FIXUPS;
+            c->height = b->height;
+            break;
+        }
+
+        case WASM_OP_END: {
+            struct JitBlock* b = &c->blocks[c->nblocks - 1];
+            if (b->function) {
+                returnValue(c);
+                break;
+            }
+
+            flush(c);
+            bindList(c, b->ends, c->e.size);
+            bindList(c, b->elses, c->e.size);
+            c->nblocks--;
+            break;
+        }
+
+        case WASM_OP_BR:
+            branch(c, instr->a);
+            break;
+
+        case WASM_OP_BR_IF:
+            branchIf(c, instr->a);
+            break;
+
+        case WASM_OP_BR_TABLE:
+            branchTable(c, instr);
+            break;
+
+        case WASM_OP_RETURN:
+            returnValue(c);
+            break;
+
+        case WASM_OP_CALL:
+        case WASM_OP_CALL_INDIRECT:
+            call(c, jit, op, instr);
+            break;
+
+        case WASM_OP_DROP:
+            drop(c);
+            break;
+
+        case WASM_OP_SELECT:
+            flush(c);
+            movLoad(&c->e, 1, RAX, slotRm(c, c->height - 3));
+            aluImm(&c->e, 0, ALU_CMP, slotRm(c, c->height - 1), 0);
+            insn(&c->e, 0, 1, 0x0F40 | CC_E, RAX, slotRm(c, c->height - 2));
+            c->height -= 3;
+            pushRax(c);
+            break;
+
+        case WASM_OP_LOCAL_GET:
+            pushDeferred(c, TOP_LOCAL);
+            c->local = instr->a;
+            break;
+
+        case WASM_OP_LOCAL_SET:
+        case WASM_OP_LOCAL_TEE:
+            if (c->top == TOP_FLAGS)
+                toRax(c);
+            if (c->top == TOP_RAX) {
+                movStore(&c->e, 1, localRm(instr->a), RAX);
+            } else if (c->top == TOP_CONST && fits32((int64_t) c->constant)) {
+                insn(&c->e, 0, 1, 0xC7, 0, localRm(instr->a));
+                u32(&c->e, (uint32_t) c->constant);
+            } else {
+                topTo(c, RCX);
+                movStore(&c->e, 1, localRm(instr->a), RCX);
+                if (c->top != TOP_CONST) {
+                    c->top = TOP_LOCAL;
+                    c->local = instr->a;
+                }
+            }
+
+            if (op == WASM_OP_LOCAL_SET)
+                drop(c);
+            break;
+
+        case WASM_OP_GLOBAL_GET:
+            flush(c);
+            movImm(&c->e, RAX, (uintptr_t) &instance->globals[instr->a]);
+            movLoad(&c->e, 1, RAX, M(RAX, 0));
+            pushRax(c);
+            break;
+
+        case WASM_OP_GLOBAL_SET:
+            toRax(c);
+            movImm(&c->e, RCX, (uintptr_t) &instance->globals[instr->a]);
+            movStore(&c->e, 1, M(RCX, 0), RAX);
+            drop(c);
+            break;
+
+        case WASM_OP_I32_LOAD ... WASM_OP_I64_LOAD32_U:
+            load(c, op, (uint32_t) instr->b);
+            break;
+
+        case WASM_OP_I32_STORE ... WASM_OP_I64_STORE32:
+            store(c, op, (uint32_t) instr->b);
+            break;
+
+        case WASM_OP_MEMORY_SIZE:
+            flush(c);
+            movLoad(&c->e, 1, RAX, R(R14));
+            shiftImm(&c->e, 1, SH_SHR, RAX, 16);
+            pushRax(c);
+            break;
+
+        case WASM_OP_MEMORY_GROW:
+            flush(c);
+            movLoad(&c->e, 1, RDI, R(R12));
+            movLoad(&c->e, 0, RSI, slotRm(c, c->height - 1));
+            callAbsolute(&c->e, growMemory);
+            insn(&c->e, 0, 0, 0x8B, RAX, R(RAX));
+            reloadMemory(&c->e);
+            c->height--;
+            pushRax(c);
+            break;
+
+        case WASM_OP_I32_CONST:
+        case WASM_OP_F32_CONST:
+            pushConst(c, (uint32_t) instr->a);
+            break;
+
+        case WASM_OP_I64_CONST:
+        case WASM_OP_F64_CONST:
+            pushConst(c, instr->b);
+            break;
+
+        case WASM_OP_I32_EQZ:
+        case WASM_OP_I32_EQ ... WASM_OP_I32_GE_U:
+        case WASM_OP_I32_CLZ:
+        case WASM_OP_I32_CTZ:
+        case WASM_OP_I32_ADD ... WASM_OP_I32_ROTR:
+            integer(c, i, op, 0);
+            break;
+
+        case WASM_OP_I64_EQZ ... WASM_OP_I64_GE_U:
+            integer(c, i, op - WASM_OP_I64_EQZ + WASM_OP_I32_EQZ, 1);
+            break;
+
+        case WASM_OP_I64_CLZ:
+        case WASM_OP_I64_CTZ:
+        case WASM_OP_I64_ADD ... WASM_OP_I64_ROTR:
+            integer(c, i, op - WASM_OP_I64_CLZ + WASM_OP_I32_CLZ, 1);
+            break;
+
+        case WASM_OP_F32_EQ ... WASM_OP_F32_GE:
+            floating(c, i, op, 0);
+            break;
+
+        case WASM_OP_F64_EQ ... WASM_OP_F64_GE:
+            floating(c, i, op - WASM_OP_F64_EQ + WASM_OP_F32_EQ, 1);
+            break;
+
+        case WASM_OP_F32_ABS ... WASM_OP_F32_COPYSIGN:
+            if (unaryHelper(op))
+                callHelper(c, unaryHelper(op), 1);
+            else if (binaryHelper(op))
+                callHelper(c, binaryHelper(op), 2);
+            else
+                floating(c, i, op, 0);
+            break;
+
+        case WASM_OP_F64_ABS ... WASM_OP_F64_COPYSIGN:
+            if (unaryHelper(op))
+                callHelper(c, unaryHelper(op), 1);
+            else if (binaryHelper(op))
+                callHelper(c, binaryHelper(op), 2);
+            else
+                floating(c, i, op - WASM_OP_F64_ABS + WASM_OP_F32_ABS, 1);
+            break;
+
+        default:
+            if (unaryHelper(op)) {
+                callHelper(c, unaryHelper(op), 1);
+            } else if (truncHelper(op)) {
+                flush(c);
+                lea(&c->e, RDI, slotRm(c, c->height - 1));
+                callAbsolute(&c->e, truncHelper(op));
+                checkStatus(c);
+            } else {
+                convert(c, op);
+            }
+            break;
+    }
+}
+
+// Whether the code after instruction i can run, as in compileFunction()
+static int reachableAfter(uint32_t op) {
+    return op != WASM_OP_UNREACHABLE && op != WASM_OP_BR && op != WASM_OP_BR_TABLE && op != WASM_OP_RETURN;
+}
+
+static void compileBody(struct Compiler* c, struct Jit* jit) {
+    struct CompiledFunction* fn = c->fn;
+    struct Emitter* e = &c->e;
+    uint32_t params = fn->type->paramsLen;
+
+    // The frame has to fit on the value stack
+    lea(e, RCX, M(RBX, (int32_t) fn->frameSize * 8));
+    movImm(e, RDX, (uintptr_t) (c->instance->_stack + c->instance->_stackSlots));
+    alu(e, 1, ALU_CMP, RCX, R(RDX));
+    jumpList(c, CC_A, &c->overflow);
+    alignStack(e);
+
+    if (fn->nlocals - params > 8) {
+        lea(e, RDI, M(RBX, (int32_t) params * 8));
+        movImm(e, RCX, fn->nlocals - params);
+        insn(e, 0, 0, 0x33, RAX, R(RAX));
+        byte(e, 0xF3);
+        byte(e, 0x48);
+        byte(e, 0xAB);
+    } else {
+        for (uint32_t l = params; l < fn->nlocals; l++) {
+            insn(e, 0, 1, 0xC7, 0, localRm(l));
+            u32(e, 0);
+        }
+    }
+
+    c->blocks[c->nblocks++] = (struct JitBlock) {
+        .ends = NO_FIXUPS, .elses = NO_FIXUPS, .arity = fn->type->ret != 0, .reachable = 1, .function = 1,
+    };
+
+    // Dead code is skipped like compileFunction() does, loops in it are
+    // still counted to number them the same
+    int reachable = 1;
+    for (uint32_t i = 0; i < c->decoded.ninstrs && !e->failed; i++) {
+        struct Instruction* instr = &c->decoded.instrs[i];
+        if (reachable) {
+            compileInstruction(c, jit, i);
+            reachable = reachableAfter(instr->opcode);
+            continue;
+        }
+
+        switch (instr->opcode) {
+            case WASM_OP_BLOCK:
+            case WASM_OP_LOOP:
+            case WASM_OP_IF:
+                openBlock(c, instr, instr->opcode == WASM_OP_LOOP, 0);
+                if (instr->opcode == WASM_OP_LOOP)
+                    c->loops[c->nloops++] = UINT32_MAX;
+                break;
+
+            case WASM_OP_ELSE:
+            case WASM_OP_END: {
+                struct JitBlock* b = &c->blocks[c->nblocks - 1];
+                reachable = b->reachable;
+                c->height = b->height;
+                c->top = TOP_SLOT;
+                c->below = 0;
+                if (instr->opcode == WASM_OP_ELSE) {
+                    bindList(c, b->elses, e->size);
+                    b->elses = NO_FIXUPS;
+                    break;
+                }
+
+                c->height += b->arity;
+                if (b->function) {
+                    returnValue(c);
+                    break;
+                }
+
+                bindList(c, b->ends, e->size);
+                bindList(c, b->elses, e->size);
+                c->nblocks--;
+                break;
+            }
+        }
+    }
+
+    // Traps and everything else leaving with a status
+    for (int code = 0; code < NTRAPS; code++) {
+        if (c->traps[code] == NO_FIXUPS)
+            continue;
+
+        bindList(c, c->traps[code], e->size);
+        movImm(e, RAX, WASM_TRAP_UNREACHABLE + code);
+        jumpList(c, ALWAYS, &c->exits);
+    }
+
+    bindList(c, c->exits, e->size);
+    unalignStack(e);
+    byte(e, 0xC3);
+
+    bindList(c, c->overflow, e->size);
+    movImm(e, RAX, WASM_TRAP_STACK_OVERFLOW);
+    byte(e, 0xC3);
+
+    // Where the interpreter comes in at the start of a loop, on the
+    // native stack the way the function's own start leaves it
+    for (uint32_t k = 0; k < c->nloops; k++) {
+        if (c->loops[k] == UINT32_MAX)
+            continue;
+
+        uint32_t label = c->loops[k];
+        c->loops[k] = e->size;
+        alignStack(e);
+        jumpBack(c, ALWAYS, label);
+    }
+}
+
+// Copies code into the reserved region, the pages it goes on are never
+// writable and executable at once
+static const uint8_t* place(struct Jit* jit, struct Emitter* e) {
+    size_t start = (jit->used + 15) & ~(size_t) 15;
+    if (e->failed || start + e->size > CODE_RESERVE)
+        return NULL;
+
+    size_t first = start & ~(jit->pageSize - 1);
+    size_t last = (start + e->size + jit->pageSize - 1) & ~(jit->pageSize - 1);
+    if (mprotect(jit->code + first, last - first, PROT_READ | PROT_WRITE))
+        return NULL;
+
+    memcpy(jit->code + start, e->code, e->size);
+    if (mprotect(jit->code + first, last - first, PROT_READ | PROT_EXEC))
+        return NULL;
+
+    jit->used = start + e->size;
+    return jit->code + start;
+}
+
+int jitFunction(struct WasmInstance* instance, struct CompiledFunction* fn) {
+    struct Jit* jit = instance->_jit;
+    struct CodeSectionCode* code;
+    int status = getFunctionCode(instance->module, fn->index, &code);
+    if (status)
+        return status;
+
+    // Displacements from rbx are 32 bits
+    if (!code || (uint64_t) fn->frameSize * 8 > INT32_MAX)
+        return WASM_INVALID_ARG;
+
+    resetArena(&instance->_scratch);
+    struct Compiler c = { .instance = instance, .fn = fn, .exits = NO_FIXUPS, .overflow = NO_FIXUPS };
+    status = decodeCode(code, &instance->_scratch, &c.decoded);
+    if (status)
+        return status;
+
+    for (int t = 0; t < NTRAPS; t++)
+        c.traps[t] = NO_FIXUPS;
+
+    uint32_t nloops = 0;
+    for (uint32_t i = 0; i < c.decoded.ninstrs; i++)
+        nloops += c.decoded.instrs[i].opcode == WASM_OP_LOOP;
+
+    c.blocks = arenaAlloc(&instance->_scratch, sizeof(struct JitBlock) * c.decoded.maxDepth);
+    c.loops = arenaAlloc(&instance->_scratch, sizeof(uint32_t) * (nloops + 1));
+    const void** loops = (nloops) ? arenaAlloc(&instance->_arena, sizeof(void*) * nloops) : NULL;
+    if (!c.blocks || !c.loops || (nloops && !loops))
+        return WASM_OUT_OF_MEMORY;
+
+    compileBody(&c, jit);
+    const uint8_t* machine = place(jit, &c.e);
+    free(c.e.code);
+    free(c.fixups);
+    if (!machine) {
+        warn("Function %u could not be compiled to machine code", fn->index);
+        return WASM_OUT_OF_MEMORY;
+    }
+
+    for (uint32_t k = 0; k < nloops; k++)
+        loops[k] = (c.loops[k] == UINT32_MAX) ? NULL : machine + c.loops[k];
+
+    fn->loops = loops;
+    fn->machine = machine;
+    jit->entries[fn->index] = machine;
+    return WASM_SUCCESS;
+}
+
+// Calls from machine code to a function that has none yet
+static int callInterpreted(struct WasmInstance* instance, uint64_t* fp, uint32_t idx) {
+    struct CompiledFunction* fn = instance->_compiled[idx];
+    if (!fn) {
+        int status = compileFunction(instance, idx, &fn);
+        if (status)
+            return status;
+    }
+
+    if ((uint64_t) (instance->_stack + instance->_stackSlots - fp) < fn->frameSize)
+        return WASM_TRAP_STACK_OVERFLOW;
+
+    return runFunction(instance, fn, fp);
+}
+
+// The way in from C, the stub every function starts out with and the
+// ones calling the host
+static int createStubs(struct WasmInstance* instance, struct Jit* jit) {
+    struct WasmModule* module = instance->module;
+    struct Emitter e = {0};
+    uint32_t* offsets = malloc(sizeof(uint32_t) * (module->nfuncs + 1));
+    if (!offsets)
+        return WASM_OUT_OF_MEMORY;
+
+    // enter(instance, fp, target), calls target with the registers set up
+    push(&e, RBX);
+    push(&e, R12);
+    push(&e, R13);
+    push(&e, R14);
+    push(&e, R15);
+    movImm(&e, RAX, (uintptr_t) &jit->unwind);
+    movStore(&e, 1, M(RAX, 0), RSP);
+    movLoad(&e, 1, R12, R(RDI));
+    movLoad(&e, 1, RBX, R(RSI));
+    reloadMemory(&e);
+    movImm(&e, R15, (uintptr_t) jit->entries);
+    insn(&e, 0, 0, 0xFF, 2, R(RDX));
+    uint32_t leave = e.size;
+    pop(&e, R15);
+    pop(&e, R14);
+    pop(&e, R13);
+    pop(&e, R12);
+    pop(&e, RBX);
+    byte(&e, 0xC3);
+
+    // The signal handler sends faults on guard pages here
+    uint32_t outOfBounds = e.size;
+    movImm(&e, RAX, (uintptr_t) &jit->unwind);
+    movLoad(&e, 1, RSP, M(RAX, 0));
+    movImm(&e, RAX, WASM_TRAP_OUT_OF_BOUNDS);
+    byte(&e, 0xE9);
+    u32(&e, leave - (e.size + 4));
+
+    // The function index comes in edx
+    uint32_t interpreted = e.size;
+    alignStack(&e);
+    movLoad(&e, 1, RDI, R(R12));
+    movLoad(&e, 1, RSI, R(RBX));
+    callAbsolute(&e, callInterpreted);
+    reloadMemory(&e);
+    unalignStack(&e);
+    byte(&e, 0xC3);
+
+    for (uint32_t f = 0; f < module->nfuncs; f++) {
+        offsets[f] = e.size;
+        if (f >= instance->_nimported) {
+            movImm(&e, RDX, f);
+            byte(&e, 0xE9);
+            u32(&e, interpreted - (e.size + 4));
+            continue;
+        }
+
+        // The host can call back in above the arguments and the result
+        struct TypeSectionType* type = module->functions[f].signature;
+        struct WasmHostImport* import = &instance->_imports[f];
+        lea(&e, RCX, M(RBX, ((type->paramsLen) ? type->paramsLen : 1) * 8));
+        movStore(&e, 1, M(R12, offsetof(struct WasmInstance, _top)), RCX);
+        alignStack(&e);
+        movLoad(&e, 1, RDI, R(R12));
+        if (import->function) {
+            movLoad(&e, 1, RSI, R(RBX));
+            movImm(&e, RDX, (uintptr_t) import->data);
+            callAbsolute(&e, import->function);
+        } else {
+            movImm(&e, RSI, f);
+            movLoad(&e, 1, RDX, R(RBX));
+            callAbsolute(&e, callHost);
+        }
+        reloadMemory(&e);
+        unalignStack(&e);
+        byte(&e, 0xC3);
+    }
+
+    const uint8_t* stubs = place(jit, &e);
+    free(e.code);
+    if (stubs) {
+        jit->enter = (int (*)(struct WasmInstance*, uint64_t*, const void*)) stubs;
+        jit->outOfBounds = stubs + outOfBounds;
+        for (uint32_t f = 0; f < module->nfuncs; f++)
+            jit->entries[f] = stubs + offsets[f];
+    }
+
+    free(offsets);
+    return (stubs) ? WASM_SUCCESS : WASM_OUT_OF_MEMORY;
+}
+
+// The instance whose machine code this thread is running, if any. The
+// fault handler reads it, and the initial-exec model keeps that from going
+// through __tls_get_addr, which can allocate the first time a thread asks
+static __thread struct WasmInstance* running __attribute__((tls_model("initial-exec")));
+static struct sigaction previous;
+static pthread_once_t handlerOnce = PTHREAD_ONCE_INIT;
+static int handling;
+
+// A fault in machine code on a guard page of its memory is an access out
+// of bounds, the rest is for whatever handled SIGSEGV before
+static void onFault(int sig, siginfo_t* info, void* context) {
+    ucontext_t* uc = context;
+    struct WasmInstance* instance = running;
+    if (instance && instance->_jit->guarded) {
+        uint8_t* pc = (uint8_t*) uc->uc_mcontext.gregs[REG_RIP];
+        uint8_t* addr = info->si_addr;
+        struct Jit* jit = instance->_jit;
+        if (pc >= jit->code && pc < jit->code + jit->used &&
+            addr >= instance->memory && addr < instance->memory + instance->_reserved) {
+            uc->uc_mcontext.gregs[REG_RIP] = (greg_t) jit->outOfBounds;
+            return;
+        }
+    }
+
+    if (previous.sa_flags & SA_SIGINFO)
+        previous.sa_sigaction(sig, info, context);
+    else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+        previous.sa_handler(sig);
+    else
+        // Faulting again now kills the process the way it would have
+        sigaction(SIGSEGV, &previous, NULL);
+}
+
+static void installHandler(void) {
+    struct sigaction action = {0};
+    action.sa_sigaction = onFault;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    handling = !sigaction(SIGSEGV, &action, &previous);
+}
+
+int createJit(struct WasmInstance* instance) {
+    struct WasmModule* module = instance->module;
+    struct Jit* jit = calloc(1, sizeof(struct Jit));
+    if (!jit)
+        return WASM_OUT_OF_MEMORY;
+
+    jit->pageSize = sysconf(_SC_PAGESIZE);
+    jit->code = mmap(NULL, CODE_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        // Everything is interpreted instead
+        warn("No address space for machine code, the interpreter runs every function");
+        free(jit);
+        return WASM_SUCCESS;
+    }
+
+    if (instance->_reserved) {
+        pthread_once(&handlerOnce, installHandler);
+        jit->guarded = handling;
+        if (!handling)
+            warn("No SIGSEGV handler, machine code checks memory accesses");
+    }
+
+    jit->entries = malloc(sizeof(void*) * (module->nfuncs + 1));
+    jit->signatures = malloc(sizeof(uint32_t) * (module->nfuncs + 1));
+    instance->_jit = jit;
+    if (!jit->entries || !jit->signatures)
+        return WASM_OUT_OF_MEMORY;
+
+    // call_indirect compares the first type that is the same as the one
+    // expected against this
+    for (uint32_t f = 0; f < module->nfuncs; f++) {
+        struct TypeSectionType* type = module->functions[f].signature;
+        jit->signatures[f] = type->idx;
+        for (uint32_t j = 0; j < type->idx && instance->_types; j++) {
+            if (sameType(&instance->_types[j], type)) {
+                jit->signatures[f] = j;
+                break;
+            }
+        }
+    }
+
+    return createStubs(instance, jit);
+}
+
+int runMachineCode(struct WasmInstance* instance, struct CompiledFunction* fn, uint64_t* fp, uint32_t loop) {
+    struct Jit* jit = instance->_jit;
+    struct WasmInstance* outer = running;
+    void* unwind = jit->unwind;
+    uint32_t depth = instance->_depth;
+    uint64_t* top = instance->_top;
+    running = instance;
+    int status = jit->enter(instance, fp, (loop == UINT32_MAX) ? fn->machine : fn->loops[loop]);
+
+    // A trap leaves these wherever it was
+    running = outer;
+    jit->unwind = unwind;
+    instance->_depth = depth;
+    instance->_top = top;
+    return status;
+}
+
+void destroyJit(struct WasmInstance* instance) {
+    struct Jit* jit = instance->_jit;
+    if (!jit)
+        return;
+
+    munmap(jit->code, CODE_RESERVE);
+    free(jit->entries);
+    free(jit->signatures);
+    free(jit);
+    instance->_jit = NULL;
+}
+
+#else
+
+// Without a JIT WASM_INSTANCE_JIT does nothing, these are never reached
+int createJit(struct WasmInstance* instance) {
+    instance->_jit = NULL;
+    return WASM_SUCCESS;
+}
+
+int jitFunction(struct WasmInstance* instance, struct CompiledFunction* fn) {
+    (void) instance;
+    (void) fn;
+    return WASM_INVALID_ARG;
+}
+
+int runMachineCode(struct WasmInstance* instance, struct CompiledFunction* fn, uint64_t* fp, uint32_t loop) {
+    (void) fp;
+    (void) loop;
+    return runFunction(instance, fn, fp);
+}
+
+void destroyJit(struct WasmInstance* instance) {
+    instance->_jit = NULL;
+}
+
+#endif
@@ -1,149 +1,149 @@
 #include "libwasm.h"
 #include <read_utils.h>
+#include <string.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 
 #define TOP_MASK (1 << 7)
 
-int32_t fetchI32(struct WasmModuleReader* reader) {
-    // the largest size of I32 in leb128 representation is 5 bytes. 
-    // This is because leb128 numbers must always have a 
-    // number of bits which is divisble by 7
-    // For the largest possible I32 we will have 35 bits
-    // which will end up requiring 40 bits (5 bytes) to store
-
+// The top bit of every byte in a 64 bit word
+#define CONTINUATION_BITS 0x8080808080808080ULL
+
+// the largest size of a 32 bit number in leb128 representation is 5 bytes.
+// This is because leb128 numbers must always have a
+// number of bits which is divisble by 7
+// For the largest possible 32 bit number we will have 35 bits
+// which will end up requiring 40 bits (5 bytes) to store
+// The same way a 64 bit number needs at most 70 bits or 10 bytes
+#define MAX_LEB_32 5
+#define MAX_LEB_64 10
+
+// Slow path: one byte at a time, checking bounds on every byte
+// Sets *nbits to the number of value bits read
+static uint64_t fetchChecked(struct WasmModuleReader* reader, uint32_t maxBytes, uint32_t* nbits) {
     uint8_t* data = reader->_data;
-    int32_t  ret = 0;
+    uint64_t ret = 0;
+    uint32_t shift = 0;
 
-    // initialise with 0 because even if some digits are unused
-    // they will not affect the final OR
-    uint8_t bits[] = {0, 0, 0, 0, 0};
-    for (int i = 0; i <= 4; i++, reader->offset++) {
+    for (uint32_t i = 0; i < maxBytes; i++) {
         if (reader->offset >= reader->size)  {
             reader->offset = UINT32_MAX;
+            *nbits = 0;
             return 0;
         }
 
         uint8_t d = *(data + reader->offset);
-        if (!(d & TOP_MASK)) {
-            reader->offset += 1;
-            bits[i] = d & 127;
-            break;
-        }
-
         reader->offset += 1;
-        bits[i] = d & 127; // 127 is the mask needed to extract lower 7 bits
-    }
 
-    ret = (bits[4] << 28) | (bits[3] << 21) | (bits[2] << 14) | (bits[1] << 7) | bits[0];
-    return ret;
-}
-
-uint32_t fetchU32(struct WasmModuleReader* reader) {
-    // the largest size of U32 in leb128 representation is 5 bytes. 
-    // This is because the leb128 numbers must always have a number of bits 
-    // which is divisble by 7.
-    // For the largest possible U32 we will have 35 bits
-    // which will end up requiring 40 bits (5 bytes) to store
+        // 127 is the mask needed to extract lower 7 bits
+        // The 10th byte of a 64 bit number only has 1 bit that fits
+        if (shift < 64)
+            ret |= (uint64_t)(d & 127) << shift;
+        shift += 7;
 
-    uint8_t* data = reader->_data;
-    uint32_t  ret = 0;
-
-    // initialise with 0 because even if some digits are unused
-    // they will not affect the final OR
-    uint8_t bits[] = {0, 0, 0, 0, 0};
-    for (int i = 0; i <= 4; i++) {
-        if (reader->offset >= reader->size)  {
-            reader->offset = UINT32_MAX;
-            return 0;
-        }
-
-        uint8_t d = *(data + reader->offset);
-        if (!(d & TOP_MASK)) {
-            bits[i] = d & 127;
-            reader->offset += 1;
+        if (!(d & TOP_MASK))
             break;
-        }
-
-        reader->offset += 1;
-        bits[i] = d & 127; // 127 is the mask needed to extract lower 7 bits
     }
 
-    ret = (bits[4] << 28) | (bits[3] << 21) | (bits[2] << 14) | (bits[1] << 7) | bits[0];
+    *nbits = shift;
     return ret;
 }
 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// Fast path: load 8 bytes at once, find the last byte of the number from
+// the continuation bits and squeeze the 7 bit groups together without
+// looping. The caller makes sure 8 bytes can be read.
+// Returns 0 if the number does not fit in maxBytes or in 8 bytes, the
+// checked path deals with those
+static inline int fetchWord(struct WasmModuleReader* reader, uint32_t maxBytes, uint64_t* value, uint32_t* nbits) {
+    uint64_t word;
+    memcpy(&word, (uint8_t*)reader->_data + reader->offset, sizeof(word)); // unaligned load
+
+    uint64_t stops = ~word & CONTINUATION_BITS;
+    if (!stops)
+        return 0;
 
-int64_t fetchI64(struct WasmModuleReader* reader) {
-    // the largest size of I64 in leb128 representation is 9 bytes. 
-    // This is because leb128 numbers must always have a 
-    // number of bits which is divisble by 7
-    // For the largest possible I64 we will have 70 bits
-    // which will end up requiring 72 bits (9 bytes) to store
+    uint32_t len = (__builtin_ctzll(stops) >> 3) + 1;
+    if (len > maxBytes)
+        return 0;
 
-    uint8_t* data = reader->_data;
-    int64_t  ret = 0;
+    // Drop the bytes past the end of this number
+    if (len < 8)
+        word &= (1ULL << (len * 8)) - 1;
+
+#ifdef __BMI2__
+    *value = _pext_u64(word, 0x7F7F7F7F7F7F7F7FULL);
+#else
+    // Pairs of groups, then pairs of those, then the two halves
+    word &= 0x7F7F7F7F7F7F7F7FULL;
+    word = (word & 0x007F007F007F007FULL) | ((word & 0x7F007F007F007F00ULL) >> 1);
+    word = (word & 0x00003FFF00003FFFULL) | ((word & 0x3FFF00003FFF0000ULL) >> 2);
+    *value = (word & 0x000000000FFFFFFFULL) | ((word & 0x0FFFFFFF00000000ULL) >> 4);
+#endif
+
+    reader->offset += len;
+    *nbits = len * 7;
+    return 1;
+}
+#endif
 
-    // initialise with 0 because even if some digits are unused
-    // they will not affect the final OR
-    uint8_t bits[] = {0, 0, 0, 0, 0, 0, 0 , 0, 0};
-    for (int i = 0; i < 9; i++, reader->offset++) {
-        if (reader->offset >= reader->size)  {
-            reader->offset = UINT32_MAX;
-            return 0;
-        }
+static inline uint64_t fetchLEB(struct WasmModuleReader* reader, uint32_t maxBytes, uint32_t* nbits) {
+    uint8_t* data = reader->_data;
 
+    if (reader->offset < reader->size) {
+        // Most numbers in a module (counts, indices, types) fit in one byte
         uint8_t d = *(data + reader->offset);
         if (!(d & TOP_MASK)) {
-            bits[i] = d & 127;
             reader->offset += 1;
-            break;
+            *nbits = 7;
+            return d;
         }
 
-        reader->offset += 1;
-        bits[i] = d & 127; // 127 is the mask needed to extract lower 7 bits
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // Section readers set size one past the end of the section so
+        // this keeps all 8 bytes inside it
+        uint64_t value;
+        if (reader->size - reader->offset > 8 && fetchWord(reader, maxBytes, &value, nbits))
+            return value;
+#endif
     }
 
-    ret = (((int64_t)bits[8] << 56) | ((int64_t)bits[7] << 49) | ((int64_t)bits[6] << 42) | ((int64_t)bits[5] << 35)) | 
-            ((bits[4] << 28) | (bits[3] << 21) | (bits[2] << 14) | (bits[1] << 7) | bits[0]); 
-    return ret;
+    return fetchChecked(reader, maxBytes, nbits);
 }
 
-uint64_t fetchU64(struct WasmModuleReader* reader) {
-    // the largest size of U64 in leb128 representation is 9 bytes. 
-    // This is because leb128 numbers must always have a 
-    // number of bits which is divisble by 7
-    // For the largest possible U64 we will have 70 bits
-    // which will end up requiring 72 bits (9 bytes) to store
+// Fills the bits above the nbits that were read with the sign bit
+static inline uint64_t signExtend(uint64_t value, uint32_t nbits) {
+    if (nbits && nbits < 64 && ((value >> (nbits - 1)) & 1))
+        value |= ~0ULL << nbits;
 
-    uint8_t* data = reader->_data;
-    uint64_t  ret = 0;
+    return value;
+}
 
-    // initialise with 0 because even if some digits are unused
-    // they will not affect the final OR
-    uint8_t bits[] = {0, 0, 0, 0, 0, 0, 0 , 0, 0};
-    for (int i = 0; i < 9; i++, reader->offset++) {
-        if (reader->offset >= reader->size)  {
-            reader->offset = UINT32_MAX;
-            return 0;
-        }
+int32_t fetchI32(struct WasmModuleReader* reader) {
+    uint32_t nbits;
+    uint64_t ret = fetchLEB(reader, MAX_LEB_32, &nbits);
+    return (int32_t) signExtend(ret, nbits);
+}
 
-        uint8_t d = *(data + reader->offset);
-        if (!(d & TOP_MASK)) {
-            reader->offset += 1;
-            bits[i] = d & 127;
-            break;
-        }
+uint32_t fetchU32(struct WasmModuleReader* reader) {
+    uint32_t nbits;
+    return (uint32_t) fetchLEB(reader, MAX_LEB_32, &nbits);
+}
 
-        reader->offset += 1;
-        bits[i] = d & 127; // 127 is the mask needed to extract lower 7 bits
-    }
+int64_t fetchI64(struct WasmModuleReader* reader) {
+    uint32_t nbits;
+    uint64_t ret = fetchLEB(reader, MAX_LEB_64, &nbits);
+    return (int64_t) signExtend(ret, nbits);
+}
 
-    ret = (((uint64_t)bits[8] << 56) | ((uint64_t)bits[7] << 49) | ((uint64_t)bits[6] << 42) | ((uint64_t)bits[5] << 35)) | 
-            ((bits[4] << 28) | (bits[3] << 21) | (bits[2] << 14) | (bits[1] << 7) | bits[0]); 
-    return ret;
+uint64_t fetchU64(struct WasmModuleReader* reader) {
+    uint32_t nbits;
+    return fetchLEB(reader, MAX_LEB_64, &nbits);
 }
 
 uint8_t fetchRawU8(struct WasmModuleReader* reader) {
-    if (reader->offset + 1 >= reader->size) {
+    if ((uint64_t) reader->offset + 1 >= reader->size) {
         reader->offset = UINT32_MAX;
         return 0;
     }
@@ -154,7 +154,7 @@ uint8_t fetchRawU8(struct WasmModuleReader* reader) {
 }
 
 uint32_t fetchRawU32(struct WasmModuleReader* reader) {
-    if (reader->offset + 4 >= reader->size) {
+    if ((uint64_t) reader->offset + 4 >= reader->size) {
         reader->offset = UINT32_MAX;
         return 0;
     }
@@ -165,10 +165,10 @@ uint32_t fetchRawU32(struct WasmModuleReader* reader) {
 }
 
 void skip(struct WasmModuleReader* reader, uint32_t off) {
-    if (reader->offset + off >= reader->size) {
+    if ((uint64_t) reader->offset + off >= reader->size) {
         reader->offset = UINT32_MAX;
         return;
-    } 
+    }
 
     reader->offset += off;
 }
@@ -3,8 +3,12 @@
 #include <section.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 
 #define  CHECK_IF_FILE_TRUNCATED(file) { \
     if (file->offset == UINT32_MAX) { \
@@ -17,6 +21,109 @@
 
 static int validateArguments(struct WasmModuleReader* init, struct WasmConfig *config);
 
+static int readModuleFile(struct WasmModuleReader* init, const char* name, uint32_t size) {
+    init->_data = malloc(size);
+    if (!init->_data) 
+        return WASM_OUT_OF_MEMORY;
+
+    FILE* file = fopen(name, "rb");
+    if (!file) {
+        free(init->_data);
+        return WASM_FILE_ACCESS_ERROR;
+    }
+
+    if(fread(init->_data, 1, size, file) != size) {
+        fclose(file);
+        free(init->_data);
+        return WASM_FILE_READ_ERROR;
+    }
+
+    fclose(file);
+    init->_storage = WASM_STORAGE_HEAP;
+    return WASM_SUCCESS;
+}
+
+static int mapModuleFile(struct WasmModuleReader* init, const char* name, uint32_t size) {
+    int fd = open(name, O_RDONLY);
+    if (fd == -1) 
+        return WASM_FILE_ACCESS_ERROR;
+
+    init->_storage = WASM_STORAGE_MMAP;
+
+    // mmap() refuses empty mappings, an empty module simply has no data
+    // and parseModule() will reject it like it would any other short file
+    if (!size) {
+        close(fd);
+        init->_data = NULL;
+        return WASM_SUCCESS;
+    }
+
+    init->_data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping holds its own reference to the file
+    close(fd);
+    if (init->_data == MAP_FAILED) {
+        init->_data = NULL;
+        return WASM_FILE_READ_ERROR;
+    }
+
+    // parseModule() scans the section headers front to back
+    madvise(init->_data, size, MADV_SEQUENTIAL);
+    return WASM_SUCCESS;
+}
+
+static void releaseModuleData(struct WasmModuleReader* obj) {
+    if (!obj->_data) 
+        return;
+
+    if (obj->_storage == WASM_STORAGE_MMAP) 
+        munmap(obj->_data, obj->size);
+    else if (obj->_storage == WASM_STORAGE_HEAP || obj->_storage == WASM_STORAGE_STREAM)
+        free(obj->_data);
+    // WASM_STORAGE_BORROWED data belongs to the caller
+
+    obj->_data = NULL;
+}
+
+static void releaseArena(struct WasmModuleReader* obj) {
+    // A caller supplied arena is left for the caller to reset
+    if (obj->_arena) {
+        destroyArena(obj->_arena);
+        free(obj->_arena);
+        obj->_arena = NULL;
+    }
+}
+
+static int createModule(struct WasmModuleReader* init, struct WasmConfig* config) {
+    struct WasmArena* arena = config->arena;
+    init->_arena = NULL;
+    init->thisModule = NULL;
+
+    if (!arena) {
+        init->_arena = malloc(sizeof(struct WasmArena));
+        if (!init->_arena || createArena(init->_arena, WASM_ARENA_DEFAULT_BLOCK_SIZE)) {
+            free(init->_arena);
+            init->_arena = NULL;
+            releaseModuleData(init);
+            return WASM_OUT_OF_MEMORY;
+        }
+
+        arena = init->_arena;
+    }
+
+    init->thisModule = arenaAlloc(arena, sizeof(struct WasmModule));
+    if (!init->thisModule) {
+        releaseArena(init);
+        releaseModuleData(init);
+        return WASM_OUT_OF_MEMORY;
+    }
+
+    memset(init->thisModule, 0, sizeof(struct WasmModule));
+    init->thisModule->arena = arena;
+    init->thisModule->name = config->name;
+    init->thisModule->hash = hash(config->name);
+    return WASM_SUCCESS;
+}
+
 int createReader(struct WasmModuleReader *init, struct WasmConfig *config) {
     int status;
 
@@ -24,6 +131,9 @@ int createReader(struct WasmModuleReader *init, struct WasmConfig *config) {
     if (status) 
         return status;
 
+    if (!config->name) 
+       return WASM_INVALID_MODULE_NAME;
+
     init->config = config;
     
     struct stat st;
@@ -33,49 +143,353 @@ int createReader(struct WasmModuleReader *init, struct WasmConfig *config) {
     if (st.st_size > config->maxModuleSize) 
         return WASM_MODULE_TOO_LARGE;
 
-    init->_data = malloc(st.st_size);
-    if (!init->_data) 
-        return WASM_OUT_OF_MEMORY;
+    if (config->flags & WASM_CONFIG_MMAP) 
+        status = mapModuleFile(init, config->name, st.st_size);
+    else
+        status = readModuleFile(init, config->name, st.st_size);
 
-    FILE* file = fopen(config->name, "rb");
-    if (!file) {
-        status = WASM_FILE_ACCESS_ERROR;
-        goto free_data;
-    }
+    if (status) 
+        return status;
 
-    if(fread(init->_data, 1, st.st_size, file) != st.st_size) {
-        status = WASM_FILE_READ_ERROR;
-        goto free_data;
-    }
+    init->offset = 0;
+    init->size = st.st_size;
+    return createModule(init, config);
+}
 
-    fclose(file);
+int createReaderFromBuffer(struct WasmModuleReader* init, struct WasmConfig* config, const void* data, uint32_t size) {
+    int status;
+
+    status = validateArguments(init, config);
+    if (status) 
+        return status;
+
+    if (!data && size) 
+        return WASM_ARGUMENT_NULL;
 
+    if (size > config->maxModuleSize) 
+        return WASM_MODULE_TOO_LARGE;
+
+    init->config = config;
+    // The parsers never write to _data so it is safe to drop the const here
+    init->_data = (void*) data;
+    init->_storage = WASM_STORAGE_BORROWED;
     init->offset = 0;
-    init->size = st.st_size;
+    init->size = size;
 
-    init->thisModule = malloc(sizeof(struct WasmModule));
-    if (!init->thisModule) {
-        status = WASM_OUT_OF_MEMORY;
-        goto free_data;
+    // Until we succeed the buffer still belongs to the caller
+    status = createModule(init, config);
+    if (status) 
+        return status;
+
+    if (config->flags & WASM_CONFIG_TAKE_BUFFER) 
+        init->_storage = WASM_STORAGE_HEAP;
+
+    return WASM_SUCCESS;
+}
+
+static void adviseWillNeed(struct WasmModuleReader* reader, uint32_t off, uint32_t len) {
+    // madvise() wants a page aligned start address
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)reader->_data + off) & ~(page - 1);
+    uintptr_t end = (uintptr_t)reader->_data + off + len;
+    madvise((void*)start, end - start, MADV_WILLNEED);
+}
+
+#define  INITIAL_DIRECTORY_SIZE 16 // Enough for every builtin section and a few custom ones
+
+// Records a section in the module's directory, growing it as needed
+static int addSectionEntry(struct WasmModuleReader* reader, uint8_t id, uint32_t offset, uint32_t size) {
+    struct WasmModule* module = reader->thisModule;
+    if (module->nsections == module->_directoryCapacity) {
+        uint32_t capacity = (module->_directoryCapacity) ? module->_directoryCapacity * 2 : INITIAL_DIRECTORY_SIZE;
+        struct SectionEntry* directory = arenaAlloc(module->arena, sizeof(struct SectionEntry) * capacity);
+        if (!directory) 
+            return WASM_OUT_OF_MEMORY;
+
+        // The old directory is released along with the rest of the arena
+        if (module->nsections) 
+            memcpy(directory, module->directory, sizeof(struct SectionEntry) * module->nsections);
+
+        module->directory = directory;
+        module->_directoryCapacity = capacity;
     }
 
-    init->thisModule->name = config->name;
-    init->thisModule->hash = hash(config->name);
+    module->directory[module->nsections].offset = offset;
+    module->directory[module->nsections].size = size;
+    module->directory[module->nsections].id = id;
+    module->directory[module->nsections].edit = WASM_SECTION_UNCHANGED;
+    module->directory[module->nsections].hash = sectionHash(reader->_data, &module->directory[module->nsections]);
+    module->nsections++;
+    return indexSection(module, module->nsections - 1);
+}
+
+// Reads the header of the section at reader->offset and checks it against
+// the configured limits, leaving the offset at the start of its contents
+static int readSectionHeader(struct WasmModuleReader* reader, uint8_t* id, uint32_t* size) {
+    *id = fetchRawU8(reader);
+    if (*id >= WASM_MAX_SECTION)
+        return WASM_INVALID_SECTION_ID;
+    CHECK_IF_FILE_TRUNCATED(reader);
+
+    *size = fetchU32(reader);
+    CHECK_IF_FILE_TRUNCATED(reader);
+
+    if (*id && *size > reader->config->maxBuiltinSectionSize) 
+        return WASM_SECTION_TOO_LARGE;
+
+    if (!*id && *size > reader->config->maxCustomSectionSize)
+        return WASM_CUSTOM_SECTION_TOO_LARGE;
+
     return WASM_SUCCESS;
+}
 
-free_data:
-    free(init->_data);
+static uint8_t useViews(struct WasmModuleReader* reader) {
+    // A stream's buffer moves as it grows so nothing may point into it
+    return (reader->config->flags & WASM_CONFIG_VIEWS) && reader->_storage != WASM_STORAGE_STREAM;
+}
+
+// Lazily decoded bodies need the module's bytes later on, which streams 
+// don't keep in one place
+static uint8_t useLazyCode(struct WasmModuleReader* reader) {
+    return (reader->config->flags & WASM_CONFIG_LAZY_CODE) && reader->_storage != WASM_STORAGE_STREAM;
+}
+
+static int parseSection(struct WasmModuleReader* reader, struct SectionEntry* entry, Section* section, struct WasmArena* arena) {
+    struct ParseSectionParams param = {
+        .data = reader->_data,
+        .offset = entry->offset,
+        .size = entry->size,
+        .section = section,
+        .config = reader->config,
+        .arena = arena,
+        .views = useViews(reader),
+        .lazyCode = useLazyCode(reader)
+    };
+
+    return parseSectionList[entry->id](&param);
+}
+
+// Sets a WASM_CONFIG_LAZY module up to parse its sections on demand.
+// Until then a section only has its hash so that it can be found.
+// WASM_CONFIG_LAZY_CODE modules parse their sections up front and come 
+// here after that, with every section already parsed
+static int prepareLazySections(struct WasmModuleReader* reader, uint8_t initial) {
+    struct WasmModule* module = reader->thisModule;
+    struct LazySections* lazy = arenaAlloc(module->arena, sizeof(struct LazySections));
+    uint8_t* state = arenaAlloc(module->arena, module->nsections);
+    int* status = arenaAlloc(module->arena, sizeof(int) * module->nsections);
+    if (!lazy || !state || !status) 
+        return WASM_OUT_OF_MEMORY;
+
+    // validateModule() loads sections while it holds the lock
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    int n = pthread_mutex_init(&lazy->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (n) 
+        return WASM_OUT_OF_MEMORY;
+
+    memset(state, initial, module->nsections);
+    memset(status, 0, sizeof(int) * module->nsections);
+    if (initial == WASM_SECTION_UNPARSED) {
+        memset(module->sections, 0, sizeof(Section) * module->nsections);
+        for (uint32_t i = 0; i < module->nsections; i++) 
+            module->sections[i].hash = module->directory[i].hash;
+    }
+
+    lazy->state = state;
+    lazy->status = status;
+    lazy->data = reader->_data;
+    // The caller's config need not outlive parseModule()
+    lazy->config = *reader->config;
+    lazy->views = useViews(reader);
+    lazy->lazyCode = useLazyCode(reader);
+    module->_lazy = lazy;
+    return WASM_SUCCESS;
+}
+
+int loadSection(struct WasmModule* module, uint32_t i) {
+    struct LazySections* lazy = module->_lazy;
+    if (!lazy) 
+        return WASM_SUCCESS;
+
+    // A section never goes back to unparsed, so once it is seen parsed
+    // here it can be used without taking the lock
+    if (__atomic_load_n(&lazy->state[i], __ATOMIC_ACQUIRE) == WASM_SECTION_PARSED) 
+        return WASM_SUCCESS;
+
+    pthread_mutex_lock(&lazy->lock);
+    if (lazy->state[i] == WASM_SECTION_UNPARSED) {
+        struct ParseSectionParams param = {
+            .data = lazy->data,
+            .offset = module->directory[i].offset,
+            .size = module->directory[i].size,
+            .section = &module->sections[i],
+            .config = &lazy->config,
+            .arena = module->arena,
+            .views = lazy->views,
+            .lazyCode = lazy->lazyCode
+        };
+
+        lazy->status[i] = parseSectionList[module->directory[i].id](&param);
+        __atomic_store_n(&lazy->state[i], (lazy->status[i]) ? WASM_SECTION_FAILED : WASM_SECTION_PARSED, __ATOMIC_RELEASE);
+    }
+
+    int status = lazy->status[i];
+    pthread_mutex_unlock(&lazy->lock);
     return status;
 }
 
-struct section_offset {
-    uint32_t lo;
-    uint32_t size;
-    uint8_t  type;
+int getFunctionCode(struct WasmModule* module, uint32_t idx, struct CodeSectionCode** code) {
+    if (!module || !code) 
+        return WASM_ARGUMENT_NULL;
+
+    if (idx >= module->nfuncs) 
+        return WASM_INVALID_ARG;
+
+    // Once published a body never changes
+    *code = __atomic_load_n(&module->functions[idx].code, __ATOMIC_ACQUIRE);
+    if (*code || !module->_lazy || !module->_lazy->lazyCode) 
+        return WASM_SUCCESS;
+
+    // Imported functions come first and have no body
+    int codeidx = findSectionByHash(module, WASM_HASH_Code);
+    if (codeidx == -1) 
+        return WASM_SUCCESS;
+
+    Section* section = &module->sections[codeidx];
+    uint32_t imported = module->nfuncs - section->flags;
+    if (idx < imported) 
+        return WASM_SUCCESS;
+
+    struct LazySections* lazy = module->_lazy;
+    int status = WASM_SUCCESS;
+    pthread_mutex_lock(&lazy->lock);
+    if (!module->functions[idx].code) {
+        struct ParseSectionParams param = {
+            .data = lazy->data,
+            .offset = module->directory[codeidx].offset,
+            .size = module->directory[codeidx].size,
+            .section = section,
+            .config = &lazy->config,
+            .arena = module->arena,
+            .views = lazy->views
+        };
+
+        // A body that fails to decode or validate is tried again on the next call
+        status = parseIndexedCodeBody(&param, idx - imported);
+        if (!status) 
+            status = validateFunctionCode(module, idx, &section->code[idx - imported]);
+        if (!status) 
+            __atomic_store_n(&module->functions[idx].code, &section->code[idx - imported], __ATOMIC_RELEASE);
+    }
+
+    *code = module->functions[idx].code;
+    pthread_mutex_unlock(&lazy->lock);
+    return status;
+}
+
+// Sections cover disjoint byte ranges and each parser only writes its own 
+// Section, so they can be handed out to threads without any locking
+struct section_jobs {
+    struct WasmModuleReader* reader;
+    int*                     status;
+    uint32_t                 next;       // next section to hand out
+    uint32_t                 firstError; // lowest section index that failed so far
+};
+
+// Arenas are not thread safe so every worker allocates from its own,
+// these are merged into the module's arena once the workers are done
+struct section_worker {
+    struct section_jobs* jobs;
+    struct WasmArena     arena;
+    pthread_t            thread;
 };
 
+static void* sectionWorker(void* arg) {
+    struct section_worker* worker = arg;
+    struct section_jobs* jobs = worker->jobs;
+    struct WasmModule* module = jobs->reader->thisModule;
+
+    while (1) {
+        uint32_t i = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED);
+        if (i >= module->nsections) 
+            break;
+
+        // Nothing after a failed section can change the result
+        if (i > __atomic_load_n(&jobs->firstError, __ATOMIC_RELAXED)) 
+            continue;
+
+        jobs->status[i] = parseSection(jobs->reader, &module->directory[i], &module->sections[i], &worker->arena);
+        if (!jobs->status[i]) 
+            continue;
+
+        uint32_t seen = __atomic_load_n(&jobs->firstError, __ATOMIC_RELAXED);
+        while (i < seen && !__atomic_compare_exchange_n(&jobs->firstError, &seen, i, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) 
+            ;
+    }
+
+    return NULL;
+}
+
+static int parseSectionsParallel(struct WasmModuleReader* reader) {
+    uint32_t nsecs = reader->thisModule->nsections;
+    struct section_jobs jobs = {
+        .reader = reader,
+        .next = 0,
+        .firstError = UINT32_MAX
+    };
+
+    jobs.status = calloc(nsecs, sizeof(int));
+    if (!jobs.status) 
+        return WASM_OUT_OF_MEMORY;
+
+    uint32_t nthreads = workerCount(reader->config, nsecs);
+    struct section_worker* workers = malloc(sizeof(struct section_worker) * nthreads);
+    if (!workers) {
+        free(jobs.status);
+        return WASM_OUT_OF_MEMORY;
+    }
+
+    struct WasmArena* arena = reader->thisModule->arena;
+    uint32_t started = 0;
+    for (; started < nthreads; started++) {
+        workers[started].jobs = &jobs;
+        if (createArena(&workers[started].arena, arena->blockSize)) 
+            break;
+
+        // The calling thread is worker 0
+        if (started && pthread_create(&workers[started].thread, NULL, sectionWorker, &workers[started])) {
+            destroyArena(&workers[started].arena);
+            break; // Whoever did start picks up the slack
+        }
+    }
+
+    int status = WASM_OUT_OF_MEMORY;
+    if (started) {
+        sectionWorker(&workers[0]);
+        for (uint32_t i = 1; i < started; i++) 
+            pthread_join(workers[i].thread, NULL);
+
+        // Report the error a sequential parse would have reported
+        status = (jobs.firstError == UINT32_MAX) ? WASM_SUCCESS : jobs.status[jobs.firstError];
+    }
+
+    for (uint32_t i = 0; i < started; i++) 
+        mergeArena(arena, &workers[i].arena);
+
+    free(workers);
+    free(jobs.status);
+    return status;
+}
+
 int parseModule(struct WasmModuleReader *reader) {
-    reader->thisModule->flags = 0;
+    struct WasmModule* module = reader->thisModule;
+    module->flags = 0;
+    module->nsections = 0;
+    module->_source = reader->_data;
+    module->_sourceSize = reader->size;
     
     uint32_t magic = fetchRawU32(reader);
     if (magic != WASM_MAGIC) 
@@ -90,75 +504,273 @@ int parseModule(struct WasmModuleReader *reader) {
     if (reader->offset == reader->size)  // To deal with empty files
             return WASM_SUCCESS;
 
-    uint16_t nsecs = 0;
-
      // the offset from where sections start
-    uint16_t section_start_offset = reader->offset;
-
-    // First, a validation pass to check module structural integrity
-    // This makes sure that all sections are really how long they are
-    // and that there are no truncated sections
-    // Also tells us the number of sections we have in the file, allowing us to 
-    // prepare other data structures
+    uint32_t section_start_offset = reader->offset;
 
+    // A single pass over the section headers checks the module's structural
+    // integrity, making sure that all sections are really how long they are
+    // and that there are no truncated sections, while recording where each 
+    // section lives in the module's directory
     while (1) {
-        int id = fetchRawU8(reader);
-	    if (id >= WASM_MAX_SECTION)
-		    return WASM_INVALID_SECTION_ID;
-        CHECK_IF_FILE_TRUNCATED(reader);
-
-        uint32_t section = fetchU32(reader);
-        CHECK_IF_FILE_TRUNCATED(reader);
-
-        if (id && section > reader->config->maxBuiltinSectionSize) 
-            return WASM_SECTION_TOO_LARGE;
+        uint8_t id;
+        uint32_t section;
+        int n = readSectionHeader(reader, &id, &section);
+        if (n) 
+            return n;
 
-        if (!id && section > reader->config->maxCustomSectionSize)
-            return WASM_CUSTOM_SECTION_TOO_LARGE;
+        n = addSectionEntry(reader, id, reader->offset, section);
+        if (n) 
+            return n;
 
-        nsecs++;
         if (reader->offset + section == reader->size)
             break;
 
         skip(reader, section);
+        CHECK_IF_FILE_TRUNCATED(reader);
     }
 
-    reader->thisModule->flags |= nsecs;
-    reader->thisModule->sections = malloc(sizeof(Section) * nsecs);
-    struct section_offset* section_offsets = malloc(sizeof(struct section_offset) * nsecs);
+    module->flags |= module->nsections;
+    module->sections = arenaAlloc(module->arena, sizeof(Section) * module->nsections);
+    if (!module->sections) 
+        return WASM_OUT_OF_MEMORY;
 
+    if (reader->config->flags & WASM_CONFIG_LAZY) {
+        reader->offset = section_start_offset;
+        return prepareLazySections(reader, WASM_SECTION_UNPARSED);
+    }
+
+    // Code bodies are what we touch next and the most of it, let the kernel
+    // start paging it in while the smaller sections before it are parsed
+    if (reader->_storage == WASM_STORAGE_MMAP) {
+        for (uint32_t i = 0; i < module->nsections; i++) {
+            if (module->directory[i].id == WASM_CODE_SECTION) 
+                adviseWillNeed(reader, module->directory[i].offset, module->directory[i].size);
+        }
+    }
+
+    if (reader->config->flags & WASM_CONFIG_PARALLEL_SECTIONS) {
+        int n = parseSectionsParallel(reader);
+        if (n) 
+            return n;
+    }
+    else {
+        for (uint32_t i = 0; i < module->nsections; i++) {
+            int n = parseSection(reader, &module->directory[i], &module->sections[i], module->arena);
+            if (n) 
+                return n;
+        }
+    }
+    
     reader->offset = section_start_offset;
 
-    // Now record the section offsets and their sizes
-    for(int i = 0; i < nsecs; i++) {
-        uint8_t id = fetchRawU8(reader);
-        uint32_t sec_length = fetchU32(reader);
-        section_offsets[i].lo = reader->offset;
-        section_offsets[i].size = sec_length;
-        section_offsets[i].type = id;
-        skip(reader, sec_length);
+    if (useLazyCode(reader)) {
+        int n = prepareLazySections(reader, WASM_SECTION_PARSED);
+        if (n) 
+            return n;
     }
 
-    /*for (int i = 0; i < nsecs; i++) {
-        printf("Start = 0x%x Size = 0x%x Type = %d\n", section_offsets[i].lo, section_offsets[i].size, section_offsets[i].type);
-    } */
+    return validateModule(module);
+}
 
-    for (int i = 0; i < nsecs; i++) {
-        struct ParseSectionParams param = {
-            .data = reader->_data,
-            .offset = section_offsets[i].lo,
-            .size = section_offsets[i].size,
-            .section = &reader->thisModule->sections[i]
-        };
+#define  STREAM_INITIAL_CAPACITY 4096
+#define  STREAM_INITIAL_SECTIONS 16
+
+// values for WasmStreamReader._state
+enum {
+    STREAM_HEADER,
+    STREAM_SECTIONS,
+    STREAM_FINISHED,
+    STREAM_FAILED
+};
+
+int createStreamReader(struct WasmStreamReader* init, struct WasmConfig* config) {
+    int status;
+
+    if (!init) 
+        return WASM_ARGUMENT_NULL;
+
+    status = validateArguments(&init->reader, config);
+    if (status) 
+        return status;
+
+    init->reader.config = config;
+    init->reader._data = malloc(STREAM_INITIAL_CAPACITY);
+    if (!init->reader._data) 
+        return WASM_OUT_OF_MEMORY;
+
+    // See advanceStream() for why the spare byte is zeroed
+    *(uint8_t*)init->reader._data = 0;
+    init->reader._storage = WASM_STORAGE_STREAM;
+    init->reader.offset = 0;
+    init->reader.size = 0;
 
-	int n = parseSectionList[section_offsets[i].type](&param);
-	    if (n) 
-		    return n;
+    init->capacity = STREAM_INITIAL_CAPACITY;
+    init->parsed = 0;
+    init->nsections = 0;
+    init->_sectionCapacity = 0;
+    init->_state = STREAM_HEADER;
+    init->_status = WASM_SUCCESS;
+
+    return createModule(&init->reader, config);
+}
+
+static int failStream(struct WasmStreamReader* stream, int status) {
+    stream->_state = STREAM_FAILED;
+    stream->_status = status;
+    return status;
+}
+
+// Keeps room in module->sections for every section in the directory
+static int growStreamSections(struct WasmStreamReader* stream) {
+    struct WasmModule* module = stream->reader.thisModule;
+    if (module->nsections <= stream->_sectionCapacity) 
+        return WASM_SUCCESS;
+
+    Section* sections = arenaAlloc(module->arena, sizeof(Section) * module->_directoryCapacity);
+    if (!sections) 
+        return WASM_OUT_OF_MEMORY;
+
+    if (stream->_sectionCapacity) 
+        memcpy(sections, module->sections, sizeof(Section) * stream->_sectionCapacity);
+
+    module->sections = sections;
+    stream->_sectionCapacity = module->_directoryCapacity;
+    return WASM_SUCCESS;
+}
+
+// Parse everything that has fully arrived, leaving partial headers and
+// sections for the next call
+static int advanceStream(struct WasmStreamReader* stream) {
+    struct WasmModuleReader* reader = &stream->reader;
+
+    // The fetchXXX() helpers are given a bound one past the received data,
+    // the same way section parsers give them one past the section. The buffer
+    // always holds a zeroed spare byte there, so a fetch that runs off the 
+    // end either fails or lands beyond reader->size and we know to wait
+    // for more data instead of reporting a truncated module.
+    struct WasmModuleReader view = *reader;
+    view.size = reader->size + 1;
+    view.offset = stream->parsed;
+
+    if (stream->_state == STREAM_HEADER) {
+        if (reader->size < 8) 
+            return WASM_SUCCESS;
+
+        if (fetchRawU32(&view) != WASM_MAGIC) 
+            return failStream(stream, WASM_FILE_INVALID_MAGIC);
+
+        if (fetchRawU32(&view) != WASM_VERSION) 
+            return failStream(stream, WASM_FILE_INVALID_VERSION);
+
+        stream->parsed = view.offset;
+        stream->_state = STREAM_SECTIONS;
+    }
+
+    while (stream->parsed < reader->size) {
+        view.offset = stream->parsed;
+
+        // A header cut short by the end of the data is not an error yet,
+        // it just hasn't fully arrived
+        uint8_t id;
+        uint32_t section;
+        int n = readSectionHeader(&view, &id, &section);
+        if (n == WASM_TRUNCATED_FILE || (!n && view.offset > reader->size)) 
+            break;
+
+        if (n) 
+            return failStream(stream, n);
+
+        // The body is still on its way
+        if (reader->size - view.offset < section) 
+            break;
+
+        n = addSectionEntry(reader, id, view.offset, section);
+        if (!n) 
+            n = growStreamSections(stream);
+
+        if (n) 
+            return failStream(stream, n);
+
+        uint32_t i = reader->thisModule->nsections - 1;
+        n = parseSection(reader, &reader->thisModule->directory[i], &reader->thisModule->sections[i], reader->thisModule->arena);
+        if (n) 
+            return failStream(stream, n);
+
+        stream->nsections++;
+        reader->thisModule->flags = stream->nsections;
+        stream->parsed = view.offset + section;
+
+        if (stream->progress) 
+            stream->progress(stream, stream->userdata);
     }
-    
-    reader->offset = section_start_offset;
 
-    return validateModule(reader->thisModule);
+    return WASM_SUCCESS;
+}
+
+int feedStreamReader(struct WasmStreamReader* stream, const void* chunk, uint32_t len) {
+    if (!stream || (!chunk && len)) 
+        return WASM_ARGUMENT_NULL;
+
+    if (stream->_state == STREAM_FAILED) 
+        return stream->_status;
+
+    if (stream->_state == STREAM_FINISHED) 
+        return WASM_INVALID_ARG;
+
+    struct WasmModuleReader* reader = &stream->reader;
+    if ((uint64_t) reader->size + len > reader->config->maxModuleSize) 
+        return failStream(stream, WASM_MODULE_TOO_LARGE);
+
+    // Keep room for the spare byte after the data
+    if ((uint64_t) reader->size + len + 1 > stream->capacity) {
+        uint64_t capacity = stream->capacity;
+        while (capacity < (uint64_t) reader->size + len + 1) 
+            capacity *= 2;
+
+        void* data = realloc(reader->_data, capacity);
+        if (!data) 
+            return failStream(stream, WASM_OUT_OF_MEMORY);
+
+        reader->_data = data;
+        stream->capacity = capacity;
+    }
+
+    memcpy((uint8_t*)reader->_data + reader->size, chunk, len);
+    reader->size += len;
+    *((uint8_t*)reader->_data + reader->size) = 0;
+
+    return advanceStream(stream);
+}
+
+int finishStreamReader(struct WasmStreamReader* stream) {
+    if (!stream) 
+        return WASM_ARGUMENT_NULL;
+
+    if (stream->_state == STREAM_FAILED) 
+        return stream->_status;
+
+    if (stream->_state == STREAM_FINISHED) 
+        return WASM_INVALID_ARG;
+
+    // Anything that has not been parsed by now never will be
+    if (stream->_state == STREAM_HEADER) 
+        return failStream(stream, (stream->reader.size < 4) ? WASM_FILE_INVALID_MAGIC : WASM_FILE_INVALID_VERSION);
+
+    if (stream->parsed != stream->reader.size) 
+        return failStream(stream, WASM_TRUNCATED_FILE);
+
+    stream->_state = STREAM_FINISHED;
+    stream->reader.thisModule->_source = stream->reader._data;
+    stream->reader.thisModule->_sourceSize = stream->reader.size;
+    int status = validateModule(stream->reader.thisModule);
+    if (status) 
+        return failStream(stream, status);
+
+    return WASM_SUCCESS;
+}
+
+void destroyStreamReader(struct WasmStreamReader* obj) {
+    destroyReader(&obj->reader);
 }
 
 struct WasmModule* getModuleFromReader(struct WasmModuleReader* reader) {
@@ -166,11 +778,18 @@ struct WasmModule* getModuleFromReader(struct WasmModuleReader* reader) {
 }
 
 void destroyReader(struct WasmModuleReader *obj) {
-    if (obj->_data) 
-        free(obj->_data);
+    if (obj->thisModule && obj->thisModule->_lazy) 
+        pthread_mutex_destroy(&obj->thisModule->_lazy->lock);
+
+    // A module in the caller's arena outlives its bytes
+    if (obj->thisModule) 
+        obj->thisModule->_source = NULL;
+
+    releaseModuleData(obj);
     
-    if (obj->thisModule)
-        free(obj->thisModule);
+    // Everything the module owns lives in its arena
+    releaseArena(obj);
+    obj->thisModule = NULL;
 }
 
 static int validateArguments(struct WasmModuleReader* init, struct WasmConfig *config) {
@@ -181,9 +800,6 @@ static int validateArguments(struct WasmModuleReader* init, struct WasmConfig *c
     if (!config)
        return WASM_INVALID_ARG;
 
-    if (!config->name) 
-       return WASM_INVALID_MODULE_NAME;
-
     if (!config->maxModuleSize) 
        config->maxModuleSize = DEFAULT_MAX_MODULE_SIZE;
 
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
 #define  CHECK_IF_FILE_TRUNCATED(file) { \
 	if (file.offset == UINT32_MAX) { \
@@ -15,6 +16,13 @@
     } \
 }
 
+#define  CHECK_IF_ALLOCATED(ptr) { \
+	if (!(ptr)) { \
+		error("Out of memory"); \
+		return WASM_OUT_OF_MEMORY; \
+	} \
+}
+
 int internal_error(struct ParseSectionParams* arg) {
 	error("Internal error: Parse function at invalid index called");
 	return WASM_INTERNAL_ERROR;
@@ -61,8 +69,30 @@ int internal_error(struct ParseSectionParams* arg) {
  * 2) a single function may not take more than 255 parameters
  * Deviation from spec: The spec does not enforce a strict limit on method
  * parameters allowing them to be upto 2^32 - 1.
+ * 3) a single function may not declare more than MAX_LOCALS locals
+ * Deviation from spec: The spec allows up to 2^32 - 1, which would have
+ * to be allocated, other engines stop at the same 50000
  */
 #define CHECK_IF_VALID_VALTYPE(x) (((x) >= 0x7C) && ((x) <= 0x7F))
+#define MAX_LOCALS 50000
+
+// Hands back len bytes of the module starting at offset. In view mode 
+// this points straight into the module's bytes, which outlive the module,
+// otherwise they are copied into the arena with a NUL after them so that
+// copied names can still be used as C strings.
+// Callers must have checked that the bytes are really there.
+static uint8_t* copyOrView(struct ParseSectionParams* params, uint32_t offset, uint32_t len) {
+	if (params->views)
+		return params->data + offset;
+
+	uint8_t* ret = arenaAlloc(params->arena, len + 1);
+	if (!ret)
+		return NULL;
+
+	memcpy(ret, params->data + offset, len);
+	ret[len] = '\0';
+	return ret;
+}
 
 static int parseNameSection(struct WasmModuleReader reader, struct ParseSectionParams* params);
 
@@ -85,18 +115,18 @@ int parseCustomSection(struct ParseSectionParams* params) {
 		return WASM_TRUNCATED_SECTION;
 	}
 
-	char* name = malloc(sizeof(char) * nameSize + 1);
+	char* name = arenaAlloc(params->arena, sizeof(char) * nameSize + 1);
+	CHECK_IF_ALLOCATED(name);
 	memcpy(name, (uint8_t*)reader._data + reader.offset, nameSize);
 	skip(&reader, nameSize);
 	name[nameSize] = '\0';
 
 	debug("Found custom section \'%s\'", name);
 
-	uint64_t hashName = hash(name);
+	uint64_t hashName = hashN(name, nameSize);
 	if (hashName == WASM_HASH_name) {
 		params->section->name = "name";
 		params->section->hash = WASM_HASH_name;
-		params->section->flags = 0;
 		parseNameSection(reader, params);
 		return 0; // Ignore the return value
 	}
@@ -118,9 +148,13 @@ static int parseNameSection(struct WasmModuleReader reader, struct ParseSectionP
 	// So simply return if anything is not right
 	debug("Parsing section \'name\'");
 
+	params->section->names = arenaAlloc(params->arena, sizeof(struct NameSectionName));
+	CHECK_IF_ALLOCATED(params->section->names);
+	memset(params->section->names, 0, sizeof(struct NameSectionName));
+	params->section->flags = 0;
+
 	uint8_t id = fetchRawU8(&reader);
 	if (!id) { // This is the module section
-		params->section->names = malloc(sizeof(struct NameSectionName));
 		fetchU32(&reader); // size of the module section immaterial to us as length of the string comes later
 
 		uint32_t size = fetchU32(&reader);
@@ -136,9 +170,12 @@ static int parseNameSection(struct WasmModuleReader reader, struct ParseSectionP
 			return WASM_SUCCESS;
 		}
 
-		params->section->names->moduleName = malloc(sizeof(char) * size + 1);
+		// This becomes WasmModule.name so it is always a copy even in view mode
+		params->section->names->moduleName = arenaAlloc(params->arena, sizeof(char) * size + 1);
+		CHECK_IF_ALLOCATED(params->section->names->moduleName);
 		memcpy(params->section->names->moduleName, (uint8_t*)reader._data + reader.offset, size);
 		params->section->names->moduleName[size] = '\0';
+		params->section->names->moduleNameLen = size;
 
 		debug("Module name = %s", params->section->names->moduleName);
 		skip(&reader, size);
@@ -159,9 +196,12 @@ static int parseNameSection(struct WasmModuleReader reader, struct ParseSectionP
 		debug("Number of pairs in subsection = %u", npairs);
 		CHECK_IF_FILE_TRUNCATED(reader);
 
-		params->section->flags = npairs;
-		params->section->names->indexes = malloc(sizeof(uint32_t) * npairs);
-		params->section->names->functionNames = malloc(sizeof(char*) * npairs);
+		params->section->names->indexes = arenaAlloc(params->arena, sizeof(uint32_t) * npairs);
+		CHECK_IF_ALLOCATED(params->section->names->indexes);
+		params->section->names->functionNames = arenaAlloc(params->arena, sizeof(char*) * npairs);
+		CHECK_IF_ALLOCATED(params->section->names->functionNames);
+		params->section->names->functionNameLens = arenaAlloc(params->arena, sizeof(uint32_t) * npairs);
+		CHECK_IF_ALLOCATED(params->section->names->functionNameLens);
 		for (uint32_t i = 0; i < npairs; i++) {
 			params->section->names->indexes[i] = fetchU32(&reader);
 			CHECK_IF_FILE_TRUNCATED(reader);
@@ -173,13 +213,15 @@ static int parseNameSection(struct WasmModuleReader reader, struct ParseSectionP
 				return WASM_SUCCESS;;
 			}
 
-			params->section->names->functionNames[i] = malloc(sizeof(char) * nameSize + 1);
-			memcpy(params->section->names->functionNames[i], (uint8_t*)reader._data + reader.offset, nameSize);
-			params->section->names->functionNames[i][nameSize] = '\0';
+			params->section->names->functionNames[i] = (char*) copyOrView(params, reader.offset, nameSize);
+			CHECK_IF_ALLOCATED(params->section->names->functionNames[i]);
+			params->section->names->functionNameLens[i] = nameSize;
 			skip(&reader, nameSize);
 			CHECK_IF_FILE_TRUNCATED(reader);
 
-			debug("Id[%u] = %s", i, params->section->names->functionNames[i]);
+			// Only count the pairs we managed to read
+			params->section->flags = i + 1;
+			debug("Id[%u] = %.*s", i, nameSize, params->section->names->functionNames[i]);
 		}
 
 	}
@@ -216,7 +258,8 @@ static int parseTypeSection(struct ParseSectionParams* params) {
 		return WASM_SUCCESS;
 	}
 
-	params->section->types = malloc(sizeof(struct TypeSectionType) * size);
+	params->section->types = arenaAlloc(params->arena, sizeof(struct TypeSectionType) * size);
+	CHECK_IF_ALLOCATED(params->section->types);
 	for (int i = 0; i < size; i++) {
 		params->section->types[i].idx = i;
 		uint8_t rd = fetchRawU8(&reader);
@@ -236,7 +279,8 @@ static int parseTypeSection(struct ParseSectionParams* params) {
 			}
 			
 			params->section->types[i].paramsLen = plen;
-			params->section->types[i].params = malloc(sizeof(uint8_t) * plen);
+			params->section->types[i].params = arenaAlloc(params->arena, sizeof(uint8_t) * plen);
+			CHECK_IF_ALLOCATED(params->section->types[i].params);
 			for (int j = 0; j < plen; j++) {
 				params->section->types[i].params[j] = fetchRawU8(&reader);
 				CHECK_IF_FILE_TRUNCATED(reader);
@@ -314,6 +358,7 @@ static int parseImportSection(struct ParseSectionParams* params) {
 	params->section->name = "Import";
 	params->section->hash = WASM_HASH_Import;
 	params->section->flags = size;
+	params->section->_lookup = NULL;
 
 	if (!size) {
 		warn("Import section present but empty");
@@ -322,7 +367,8 @@ static int parseImportSection(struct ParseSectionParams* params) {
 		return WASM_SUCCESS;
 	}
 
-	params->section->imports = malloc(sizeof(struct ImportSectionImport) * size);
+	params->section->imports = arenaAlloc(params->arena, sizeof(struct ImportSectionImport) * size);
+	CHECK_IF_ALLOCATED(params->section->imports);
 
 	for (int i = 0; i < size; i++) {
 		uint32_t modlen = fetchU32(&reader) + 1; // space for null
@@ -338,10 +384,10 @@ static int parseImportSection(struct ParseSectionParams* params) {
 			return WASM_TRUNCATED_SECTION;
 		}
 
-        params->section->imports[i].module = malloc(sizeof(const char*) * modlen);
-        memcpy(params->section->imports[i].module, (uint8_t*)reader._data + reader.offset, modlen);
-        params->section->imports[i].module[modlen - 1] = '\0';
-		params->section->imports[i].hashModule = hash(params->section->imports[i].module);
+        params->section->imports[i].module = (char*) copyOrView(params, reader.offset, modlen - 1);
+        CHECK_IF_ALLOCATED(params->section->imports[i].module);
+        params->section->imports[i].moduleLen = modlen - 1;
+		params->section->imports[i].hashModule = hashN(params->section->imports[i].module, modlen - 1);
         skip(&reader, modlen - 1);
 		CHECK_IF_FILE_TRUNCATED(reader);
 
@@ -358,10 +404,10 @@ static int parseImportSection(struct ParseSectionParams* params) {
 			return WASM_TRUNCATED_SECTION;
 		}
 
-		params->section->imports[i].name = malloc(sizeof(const char*) * namelen);
-		memcpy(params->section->imports[i].name, (uint8_t*)reader._data + reader.offset, namelen - 1);
-		params->section->imports[i].name[namelen - 1] = '\0';
-		params->section->imports[i].hashName = hash(params->section->imports[i].name);
+		params->section->imports[i].name = (char*) copyOrView(params, reader.offset, namelen - 1);
+		CHECK_IF_ALLOCATED(params->section->imports[i].name);
+		params->section->imports[i].nameLen = namelen - 1;
+		params->section->imports[i].hashName = hashN(params->section->imports[i].name, namelen - 1);
 
         skip(&reader, namelen - 1);
 		CHECK_IF_FILE_TRUNCATED(reader);
@@ -373,10 +419,53 @@ static int parseImportSection(struct ParseSectionParams* params) {
 			return WASM_INVALID_IMPORT_TYPE;
 		}
 
-		params->section->imports[i].index = fetchU32(&reader);
+		// Each kind of import describes itself differently, only a function's
+		// is a single index
+		struct ImportSectionImport* import = &params->section->imports[i];
+		import->index = 0;
+		import->valtype = 0;
+		import->mut = 0;
+		switch (import->type) {
+			case WASM_TYPEIDX:
+				import->index = fetchU32(&reader);
+				break;
+
+			case WASM_TABLETYPE:
+				if (fetchRawU8(&reader) != 0x70) {
+					error("Imported tables can only have function refs (0x70)");
+					return WASM_INVALID_TABLE_ELEMENT_TYPE;
+				}
+				// fallthrough
+			case WASM_MEMTYPE: {
+				uint8_t limtype = fetchRawU8(&reader);
+				if (limtype > 1) {
+					error("Invalid limit type %u", limtype);
+					return WASM_INVALID_LIMIT_TYPE;
+				}
+
+				fetchU32(&reader);
+				if (limtype) 
+					fetchU32(&reader);
+				break;
+			}
+
+			case WASM_GLOBALTYPE:
+				import->valtype = fetchRawU8(&reader);
+				if (!CHECK_IF_VALID_VALTYPE(import->valtype)) {
+					error("Invalid global type %u", import->valtype);
+					return WASM_INVALID_TYPEVAL;
+				}
+
+				import->mut = fetchRawU8(&reader);
+				if (import->mut > 1) {
+					error("Global mutability flag is %u which is invalid in this context", import->mut);
+					return WASM_INVALID_GLOBAL_MUTABILITY;
+				}
+				break;
+		}
 		CHECK_IF_FILE_TRUNCATED(reader);
 
-		debug("Import[%d] %s.%s type = %u index = %d", i, params->section->imports[i].module, params->section->imports[i].name, params->section->imports[i].type, params->section->imports[i].index); 
+		debug("Import[%d] %.*s.%.*s type = %u index = %d", i, params->section->imports[i].moduleLen, params->section->imports[i].module, params->section->imports[i].nameLen, params->section->imports[i].name, params->section->imports[i].type, params->section->imports[i].index); 
 	}
 
 
@@ -385,6 +474,13 @@ static int parseImportSection(struct ParseSectionParams* params) {
 		return WASM_TRAILING_BYTES;
 	}
 
+	params->section->_lookup = createLookup(params->arena, size);
+	if (!params->section->_lookup) 
+		return WASM_OUT_OF_MEMORY;
+
+	for (uint32_t i = 0; i < size; i++) 
+		insertLookup(params->section->_lookup, importKey(params->section->imports[i].hashModule, params->section->imports[i].hashName), i);
+
 	return WASM_SUCCESS;
 }
 
@@ -399,15 +495,18 @@ static int parseFunctionSection(struct ParseSectionParams* params) {
 	debug("Number of entries in function section = %u", size);
 	CHECK_IF_FILE_TRUNCATED(reader);
 
+	params->section->name = "Function";
+	params->section->hash = WASM_HASH_Function;
+	params->section->flags = size;
+
 	if (!size) {
 		warn("Function section present but empty");
+		params->section->custom = NULL;
 		return WASM_SUCCESS;
 	}
 	
-	params->section->name = "Function";
-	params->section->hash = WASM_HASH_Function;
-	params->section->flags = size;
-	params->section->functions = malloc(sizeof(uint32_t) * size);
+	params->section->functions = arenaAlloc(params->arena, sizeof(uint32_t) * size);
+	CHECK_IF_ALLOCATED(params->section->functions);
 
 	for (int i = 0; i < size; i++) {
 		params->section->functions[i] = fetchU32(&reader);
@@ -453,7 +552,8 @@ static int parseTableSection(struct ParseSectionParams* params) {
 	params->section->flags = 1;
 	params->section->name = "Table";
 	params->section->hash = WASM_HASH_Table;
-	params->section->table = malloc(sizeof(struct TableSectionTable));
+	params->section->table = arenaAlloc(params->arena, sizeof(struct TableSectionTable));
+	CHECK_IF_ALLOCATED(params->section->table);
 
 	uint8_t limtype = fetchRawU8(&reader);
 	if (limtype > 1) {
@@ -508,7 +608,8 @@ static int parseMemorySection(struct ParseSectionParams* params) {
 	params->section->flags = 1;
 	params->section->name = "Memory";
 	params->section->hash = WASM_HASH_Memory;
-	params->section->memory = malloc(sizeof(struct TableSectionTable));
+	params->section->memory = arenaAlloc(params->arena, sizeof(struct TableSectionTable));
+	CHECK_IF_ALLOCATED(params->section->memory);
 
 	uint8_t limtype = fetchRawU8(&reader);
 	CHECK_IF_FILE_TRUNCATED(reader);
@@ -558,6 +659,7 @@ static int parseExportSection(struct ParseSectionParams* params) {
 	params->section->name = "Export";
 	params->section->hash = WASM_HASH_Export;
 	params->section->flags = size;
+	params->section->_lookup = NULL;
 
 	if (!size) {
 		params->section->flags = 0;
@@ -565,7 +667,8 @@ static int parseExportSection(struct ParseSectionParams* params) {
 		return WASM_SUCCESS;
 	}
 
-	params->section->exports = malloc(sizeof(struct ExportSectionExport) * size);
+	params->section->exports = arenaAlloc(params->arena, sizeof(struct ExportSectionExport) * size);
+	CHECK_IF_ALLOCATED(params->section->exports);
 
 	for (int i = 0; i < size; i++) {
 		uint32_t namelen = fetchU32(&reader) + 1; // space for null
@@ -581,10 +684,10 @@ static int parseExportSection(struct ParseSectionParams* params) {
 			return WASM_TRUNCATED_SECTION;
 		}
 
-		params->section->exports[i].name = malloc(sizeof(const char*) * namelen);
-		memcpy(params->section->exports[i].name, (uint8_t*)reader._data + reader.offset, namelen);
-		params->section->exports[i].name[namelen - 1] = '\0';
-		params->section->exports[i].hashName = hash(params->section->exports[i].name);
+		params->section->exports[i].name = (char*) copyOrView(params, reader.offset, namelen - 1);
+		CHECK_IF_ALLOCATED(params->section->exports[i].name);
+		params->section->exports[i].nameLen = namelen - 1;
+		params->section->exports[i].hashName = hashN(params->section->exports[i].name, namelen - 1);
         	skip(&reader, namelen - 1);
 		CHECK_IF_FILE_TRUNCATED(reader);
 
@@ -598,7 +701,7 @@ static int parseExportSection(struct ParseSectionParams* params) {
 		params->section->exports[i].index = fetchU32(&reader);
 		CHECK_IF_FILE_TRUNCATED(reader);
 
-		debug("Export[%d] %s 0x%x", i, params->section->exports[i].name, params->section->exports[i].index);
+		debug("Export[%d] %.*s 0x%x", i, params->section->exports[i].nameLen, params->section->exports[i].name, params->section->exports[i].index);
 	}
 
 	if (reader.offset + 1 != reader.size) {
@@ -606,6 +709,13 @@ static int parseExportSection(struct ParseSectionParams* params) {
 		return WASM_TRAILING_BYTES;
 	}
 
+	params->section->_lookup = createLookup(params->arena, size);
+	if (!params->section->_lookup) 
+		return WASM_OUT_OF_MEMORY;
+
+	for (uint32_t i = 0; i < size; i++) 
+		insertLookup(params->section->_lookup, params->section->exports[i].hashName, i);
+
 	return WASM_SUCCESS;
 }
 
@@ -656,7 +766,8 @@ static int parseGlobalSection(struct ParseSectionParams* params) {
 		return WASM_SUCCESS;
 	} 
 
-	params->section->globals = malloc(sizeof(struct GlobalSectionGlobal) * size);
+	params->section->globals = arenaAlloc(params->arena, sizeof(struct GlobalSectionGlobal) * size);
+	CHECK_IF_ALLOCATED(params->section->globals);
 
 	for (int i = 0; i < size; i++) {
 		params->section->globals[i].valtype = fetchRawU8(&reader);
@@ -690,8 +801,8 @@ static int parseGlobalSection(struct ParseSectionParams* params) {
 
 		reader.offset = offset;
 		params->section->globals[i].exprSize = initSize;
-		params->section->globals[i].expr = malloc(sizeof(uint8_t) * initSize);
-		memcpy(params->section->globals[i].expr, (uint8_t*)reader._data + offset, initSize);
+		params->section->globals[i].expr = copyOrView(params, offset, initSize);
+		CHECK_IF_ALLOCATED(params->section->globals[i].expr);
 		skip(&reader, initSize);
 		CHECK_IF_FILE_TRUNCATED(reader);
 
@@ -729,7 +840,8 @@ static int parseDataSection(struct ParseSectionParams* params) {
 		return WASM_SUCCESS;;
 	}
 
-	params->section->data = malloc(sizeof(struct DataSectionData) * size);
+	params->section->data = arenaAlloc(params->arena, sizeof(struct DataSectionData) * size);
+	CHECK_IF_ALLOCATED(params->section->data);
 	for (int i = 0; i < size; i++) {
 		uint32_t memidx = fetchU32(&reader);
 		CHECK_IF_FILE_TRUNCATED(reader);
@@ -755,21 +867,21 @@ static int parseDataSection(struct ParseSectionParams* params) {
 
 		reader.offset = off;
 		params->section->data[i].exprSize = exprSize;
-		params->section->data[i].expr = malloc(sizeof(uint8_t) * exprSize);
-		memcpy(params->section->data[i].expr, (uint8_t*)reader._data + reader.offset, exprSize);
+		params->section->data[i].expr = copyOrView(params, reader.offset, exprSize);
+		CHECK_IF_ALLOCATED(params->section->data[i].expr);
 		skip(&reader, exprSize);
 		CHECK_IF_FILE_TRUNCATED(reader);
 
 		uint32_t dataSize = fetchU32(&reader);
 		CHECK_IF_FILE_TRUNCATED(reader);
 		params->section->data[i].len = dataSize;
-		params->section->data[i].bytes = malloc(sizeof(uint8_t) * dataSize);
 		if (reader.offset + dataSize >= reader.size) {
 			error("Truncated data section");
 			return WASM_TRUNCATED_SECTION;
 		}
 
-		memcpy(params->section->data[i].bytes, (uint8_t*)reader._data + reader.offset, dataSize);
+		params->section->data[i].bytes = copyOrView(params, reader.offset, dataSize);
+		CHECK_IF_ALLOCATED(params->section->data[i].bytes);
 		skip(&reader, dataSize);
 		CHECK_IF_FILE_TRUNCATED(reader);
 
@@ -785,6 +897,256 @@ static int parseDataSection(struct ParseSectionParams* params) {
 	return WASM_SUCCESS;
 }
 
+// Decodes the body whose size prefix is at reader.offset and leaves
+// the offset just past the body in *next
+static int parseCodeBody(struct WasmModuleReader reader, struct ParseSectionParams* params, struct CodeSectionCode* code, uint32_t i, uint32_t* next) {
+	uint32_t codeSize = fetchU32(&reader); // codesize includes the size of locals and function code
+	uint32_t copySize = codeSize; // Keep a copy of codeSize later used for skipping to the next section
+
+	CHECK_IF_FILE_TRUNCATED(reader);
+	if (!codeSize) {
+		error("Code body %u is empty", i);
+		return WASM_INVALID_EXPR;
+	}
+
+	uint32_t poff = reader.offset;
+	uint32_t paramtypes = fetchU32(&reader);
+	CHECK_IF_FILE_TRUNCATED(reader);
+	if (paramtypes) {
+		uint32_t off = reader.offset;
+		uint64_t paramslen = 0;
+		for (int j = 0; j < paramtypes; j++) {
+			paramslen += fetchU32(&reader);
+			CHECK_IF_FILE_TRUNCATED(reader);
+			fetchRawU8(&reader);
+			CHECK_IF_FILE_TRUNCATED(reader);
+			if (paramslen > MAX_LOCALS) {
+				error("Code body %u declares more than %u locals", i, MAX_LOCALS);
+				return WASM_INVALID_EXPR;
+			}
+		}
+
+		code->localSize = paramslen;
+		reader.offset = off;
+		code->locals = arenaAlloc(params->arena, sizeof(uint8_t) * paramslen);
+		CHECK_IF_ALLOCATED(code->locals);
+		uint32_t cur = 0;
+		for (int j = 0; j < paramtypes; j++) {
+			uint32_t n = fetchU32(&reader);
+			CHECK_IF_FILE_TRUNCATED(reader);
+			uint8_t type = fetchRawU8(&reader);
+			CHECK_IF_FILE_TRUNCATED(reader);
+
+			for (int k = 0; k < n; k++, cur++) {
+				code->locals[cur] = type;
+			}
+		}
+
+	}
+
+	else {
+		code->localSize = 0;
+		code->locals = NULL;
+	}
+
+	// The locals cannot take up the whole body, there is always an end
+	if (reader.offset - poff >= codeSize) {
+		error("Code body %u has no expression", i);
+		return WASM_INVALID_EXPR;
+	}
+
+	codeSize -= (reader.offset - poff);
+
+	code->codeSize = codeSize;
+	if (reader.offset + codeSize >= reader.size) {
+		error("Code section truncated");
+		return WASM_TRUNCATED_SECTION;
+	}
+
+	code->expr = copyOrView(params, reader.offset, codeSize);
+	CHECK_IF_ALLOCATED(code->expr);
+
+	if (code->expr[codeSize - 1] != 0xB) {
+		error("Code body ends with 0x%x instead of 0xB", code->expr[codeSize - 1]);
+		return WASM_INVALID_EXPR;
+	}
+	
+
+	reader.offset = poff;
+	skip(&reader, copySize);
+	CHECK_IF_FILE_TRUNCATED(reader);
+
+	debug("Code[%u]: codeSize = %d localsSize = %d", i, code->codeSize, code->localSize);
+	*next = reader.offset;
+	return WASM_SUCCESS;
+}
+
+// Bodies are handed out to threads in runs of this many
+#define CODE_BODIES_PER_JOB 256
+
+struct code_jobs {
+	struct WasmModuleReader  reader;
+	struct CodeSectionCode*  code;
+	uint32_t*                offsets;    // where each body's size prefix starts
+	int*                     status;
+	uint32_t                 nbodies;
+	uint32_t                 next;       // first body of the next run to hand out
+	uint32_t                 firstError; // lowest body index that failed so far
+};
+
+// Arenas are not thread safe so every worker allocates from its own,
+// these are merged into the module's arena once the workers are done
+struct code_worker {
+	struct code_jobs*         jobs;
+	struct WasmArena          arena;
+	struct ParseSectionParams params; // the section's params but with our arena
+	pthread_t                 thread;
+};
+
+static void* codeWorker(void* arg) {
+	struct code_worker* worker = arg;
+	struct code_jobs* jobs = worker->jobs;
+
+	while (1) {
+		uint32_t lo = __atomic_fetch_add(&jobs->next, CODE_BODIES_PER_JOB, __ATOMIC_RELAXED);
+		if (lo >= jobs->nbodies) 
+			break;
+
+		uint32_t hi = (jobs->nbodies - lo < CODE_BODIES_PER_JOB) ? jobs->nbodies : lo + CODE_BODIES_PER_JOB;
+		for (uint32_t i = lo; i < hi; i++) {
+			// Nothing after a failed body can change the result
+			if (i > __atomic_load_n(&jobs->firstError, __ATOMIC_RELAXED)) 
+				break;
+
+			struct WasmModuleReader reader = jobs->reader;
+			reader.offset = jobs->offsets[i];
+
+			uint32_t next;
+			jobs->status[i] = parseCodeBody(reader, &worker->params, &jobs->code[i], i, &next);
+			if (!jobs->status[i]) 
+				continue;
+
+			uint32_t seen = __atomic_load_n(&jobs->firstError, __ATOMIC_RELAXED);
+			while (i < seen && !__atomic_compare_exchange_n(&jobs->firstError, &seen, i, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) 
+				;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+// Every body is prefixed by its size, so a quick pass over the prefixes finds
+// where each one starts and the bodies can then be decoded independently
+static int parseCodeBodiesParallel(struct WasmModuleReader* reader, struct ParseSectionParams* params, uint32_t size) {
+	struct code_jobs jobs = {
+		.reader = *reader,
+		.code = params->section->code,
+		.nbodies = 0,
+		.next = 0,
+		.firstError = UINT32_MAX
+	};
+
+	jobs.offsets = malloc(sizeof(uint32_t) * size);
+	jobs.status = calloc(size, sizeof(int));
+	if (!jobs.offsets || !jobs.status) {
+		free(jobs.offsets);
+		free(jobs.status);
+		return WASM_OUT_OF_MEMORY;
+	}
+
+	// A bad size prefix is only reported if every body before it decodes, 
+	// just like when the bodies are parsed one by one
+	int scanStatus = WASM_SUCCESS;
+	for (; jobs.nbodies < size; jobs.nbodies++) {
+		jobs.offsets[jobs.nbodies] = reader->offset;
+		uint32_t codeSize = fetchU32(reader);
+		if (reader->offset == UINT32_MAX) {
+			error("Truncated section");
+			scanStatus = WASM_TRUNCATED_SECTION;
+			break;
+		}
+
+		skip(reader, codeSize);
+		if (reader->offset == UINT32_MAX) {
+			// Let the body's own decoding report what is wrong with it
+			jobs.nbodies++;
+			scanStatus = WASM_TRUNCATED_SECTION;
+			break;
+		}
+	}
+
+	uint32_t nthreads = workerCount(params->config, (jobs.nbodies + CODE_BODIES_PER_JOB - 1) / CODE_BODIES_PER_JOB);
+	struct code_worker* workers = malloc(sizeof(struct code_worker) * nthreads);
+	if (!workers) {
+		free(jobs.offsets);
+		free(jobs.status);
+		return WASM_OUT_OF_MEMORY;
+	}
+
+	uint32_t started = 0;
+	for (; started < nthreads; started++) {
+		workers[started].jobs = &jobs;
+		if (createArena(&workers[started].arena, params->arena->blockSize)) 
+			break;
+
+		workers[started].params = *params;
+		workers[started].params.arena = &workers[started].arena;
+
+		// The calling thread is worker 0
+		if (started && pthread_create(&workers[started].thread, NULL, codeWorker, &workers[started])) {
+			destroyArena(&workers[started].arena);
+			break; // Whoever did start picks up the slack
+		}
+	}
+
+	int status = WASM_OUT_OF_MEMORY;
+	if (started) {
+		codeWorker(&workers[0]);
+		for (uint32_t i = 1; i < started; i++) 
+			pthread_join(workers[i].thread, NULL);
+
+		status = (jobs.firstError == UINT32_MAX) ? scanStatus : jobs.status[jobs.firstError];
+	}
+
+	for (uint32_t i = 0; i < started; i++) 
+		mergeArena(params->arena, &workers[i].arena);
+
+	free(workers);
+	free(jobs.offsets);
+	free(jobs.status);
+	return status;
+}
+
+// Under WASM_CONFIG_LAZY_CODE we only check that every body fits and
+// remember where it starts, decoding waits for getFunctionCode()
+static int indexCodeBodies(struct WasmModuleReader* reader, struct ParseSectionParams* params, uint32_t size) {
+	uint32_t* bodies = arenaAlloc(params->arena, sizeof(uint32_t) * size);
+	if (!bodies) 
+		return WASM_OUT_OF_MEMORY;
+
+	for (uint32_t i = 0; i < size; i++) {
+		bodies[i] = reader->offset;
+		uint32_t codeSize = fetchU32(reader);
+		CHECK_IF_FILE_TRUNCATED((*reader));
+		skip(reader, codeSize);
+		CHECK_IF_FILE_TRUNCATED((*reader));
+	}
+
+	params->section->_bodies = bodies;
+	return WASM_SUCCESS;
+}
+
+int parseIndexedCodeBody(struct ParseSectionParams* params, uint32_t i) {
+	struct WasmModuleReader reader;
+	reader._data = params->data;
+	reader.offset = params->section->_bodies[i];
+	reader.size = params->size + params->offset + 1;
+
+	uint32_t next;
+	return parseCodeBody(reader, params, &params->section->code[i], i, &next);
+}
+
 static int parseCodeSection(struct ParseSectionParams* params) {
 	debug("Parsing code section");
 	struct WasmModuleReader reader;
@@ -799,6 +1161,7 @@ static int parseCodeSection(struct ParseSectionParams* params) {
 	params->section->name = "Code";
 	params->section->hash = WASM_HASH_Code;
 	params->section->flags = size;
+	params->section->_bodies = NULL;
 
 	if (!size) {
 		warn("Code section present but empty");
@@ -806,69 +1169,25 @@ static int parseCodeSection(struct ParseSectionParams* params) {
 		return WASM_SUCCESS;
 	}
 
-	params->section->code = malloc(sizeof(struct CodeSectionCode) * size);
-
-	for (int i = 0; i < size; i++) {
-		uint32_t codeSize = fetchU32(&reader); // codesize includes the size of locals and function code
-		uint32_t copySize = codeSize; // Keep a copy of codeSize later used for skipping to the next section
-
-		CHECK_IF_FILE_TRUNCATED(reader);
-		uint32_t poff = reader.offset;
-		uint32_t paramtypes = fetchU32(&reader);
-		if (paramtypes) {
-			uint32_t off = reader.offset;
-			uint32_t paramslen = 0;
-			for (int j = 0; j < paramtypes; j++) {
-				paramslen += fetchU32(&reader);
-				CHECK_IF_FILE_TRUNCATED(reader);
-				fetchRawU8(&reader);
-				CHECK_IF_FILE_TRUNCATED(reader);
-			}
-
-			params->section->code[i].localSize = paramslen;
-			reader.offset = off;
-			params->section->code[i].locals = malloc(sizeof(uint8_t) * paramslen);
-			uint32_t cur = 0;
-			for (int j = 0; j < paramtypes; j++) {
-				uint32_t n = fetchU32(&reader);
-				CHECK_IF_FILE_TRUNCATED(reader);
-				uint8_t type = fetchRawU8(&reader);
-				CHECK_IF_FILE_TRUNCATED(reader);
-
-				for (int k = 0; k < n; k++, cur++) {
-					params->section->code[i].locals[k] = type;
-				}
-			}
-
-			codeSize -= (reader.offset - poff);
-		}
-
-		else {
-			params->section->code[i].localSize = 0;
-			params->section->code[i].locals = NULL;
-			codeSize -= 1; // 0 is always 1 byte long 
-		}
-
-		params->section->code[i].codeSize = codeSize;
-		params->section->code[i].expr = malloc(sizeof(uint8_t) * codeSize);
-		if (reader.offset + codeSize >= reader.size) {
-			error("Code section truncated");
-			return WASM_TRUNCATED_SECTION;
-		}
-
-		memcpy(params->section->code[i].expr, (uint8_t*)reader._data + reader.offset, codeSize);
+	params->section->code = arenaAlloc(params->arena, sizeof(struct CodeSectionCode) * size);
+	CHECK_IF_ALLOCATED(params->section->code);
 
-		if (params->section->code[i].expr[codeSize - 1] != 0xB) {
-			error("Code body ends with 0x%x instead of 0xB", params->section->code[i].expr[codeSize - 1]);
-			return WASM_INVALID_EXPR;
+	if (params->lazyCode) {
+		int n = indexCodeBodies(&reader, params, size);
+		if (n) 
+			return n;
+	}
+	else if (params->config && (params->config->flags & WASM_CONFIG_PARALLEL_CODE)) {
+		int n = parseCodeBodiesParallel(&reader, params, size);
+		if (n) 
+			return n;
+	}
+	else {
+		for (int i = 0; i < size; i++) {
+			int n = parseCodeBody(reader, params, &params->section->code[i], i, &reader.offset);
+			if (n) 
+				return n;
 		}
-		
-
-		reader.offset = poff;
-		skip(&reader, copySize);
-		CHECK_IF_FILE_TRUNCATED(reader);
-
-		debug("Code[%u]: codeSize = %d localsSize = %d", i, params->section->code[i].codeSize, params->section->code[i].localSize);
 	}
 
 	if (reader.offset + 1 != reader.size) {
@@ -901,7 +1220,8 @@ static int parseElementSection(struct ParseSectionParams* params) {
 		return WASM_SUCCESS;
 	}
 
-	params->section->element = malloc(sizeof(struct ElementSectionElement) * size);
+	params->section->element = arenaAlloc(params->arena, sizeof(struct ElementSectionElement) * size);
+	CHECK_IF_ALLOCATED(params->section->element);
 	for (int i = 0; i < size; i++) {
 		uint32_t tabidx = fetchU32(&reader);
 
@@ -928,17 +1248,18 @@ static int parseElementSection(struct ParseSectionParams* params) {
 
 		reader.offset = off;
 		params->section->element[i].exprSize = exprSize;
-		params->section->element[i].expr = malloc(sizeof(uint8_t) * exprSize);
-		memcpy(params->section->element[i].expr, (uint8_t*)reader._data + reader.offset, exprSize);
+		params->section->element[i].expr = copyOrView(params, reader.offset, exprSize);
+		CHECK_IF_ALLOCATED(params->section->element[i].expr);
 		skip(&reader, exprSize);
 		CHECK_IF_FILE_TRUNCATED(reader);
 
 		uint32_t dataSize = fetchU32(&reader);
 		CHECK_IF_FILE_TRUNCATED(reader);
 		params->section->element[i].len = dataSize;
-		params->section->element[i].funcidx = malloc(sizeof(uint32_t) * dataSize); // allocate more than needed
+		params->section->element[i].funcidx = arenaAlloc(params->arena, sizeof(uint32_t) * dataSize); // allocate more than needed
+		CHECK_IF_ALLOCATED(params->section->element[i].funcidx);
 		for (int j = 0; j < dataSize; j++) {
-			params->section->element[j].funcidx[j] = fetchU32(&reader);
+			params->section->element[i].funcidx[j] = fetchU32(&reader);
 			CHECK_IF_FILE_TRUNCATED(reader);
 		}
 
@@ -953,6 +1274,54 @@ static int parseElementSection(struct ParseSectionParams* params) {
 	return WASM_SUCCESS;
 }
 
+static const uint64_t builtinSectionHashes[] = {
+	[WASM_TYPE_SECTION] = WASM_HASH_Type,
+	[WASM_IMPORT_SECTION] = WASM_HASH_Import,
+	[WASM_FUNCTION_SECTION] = WASM_HASH_Function,
+	[WASM_TABLE_SECTION] = WASM_HASH_Table,
+	[WASM_MEMORY_SECTION] = WASM_HASH_Memory,
+	[WASM_GLOBAL_SECTION] = WASM_HASH_Global,
+	[WASM_EXPORT_SECTION] = WASM_HASH_Export,
+	[WASM_START_SECTION] = WASM_HASH_Start,
+	[WASM_ELEMENT_SECTION] = WASM_HASH_Element,
+	[WASM_CODE_SECTION] = WASM_HASH_Code,
+	[WASM_DATA_SECTION] = WASM_HASH_Data
+};
+
+uint8_t builtinSectionId(uint64_t hash) {
+	switch (hash) {
+		case WASM_HASH_Type:     return WASM_TYPE_SECTION;
+		case WASM_HASH_Import:   return WASM_IMPORT_SECTION;
+		case WASM_HASH_Function: return WASM_FUNCTION_SECTION;
+		case WASM_HASH_Table:    return WASM_TABLE_SECTION;
+		case WASM_HASH_Memory:   return WASM_MEMORY_SECTION;
+		case WASM_HASH_Global:   return WASM_GLOBAL_SECTION;
+		case WASM_HASH_Export:   return WASM_EXPORT_SECTION;
+		case WASM_HASH_Start:    return WASM_START_SECTION;
+		case WASM_HASH_Element:  return WASM_ELEMENT_SECTION;
+		case WASM_HASH_Code:     return WASM_CODE_SECTION;
+		case WASM_HASH_Data:     return WASM_DATA_SECTION;
+		default:                 return WASM_CUSTOM_SECTION;
+	}
+}
+
+uint64_t sectionHash(uint8_t* data, struct SectionEntry* entry) {
+	if (entry->id != WASM_CUSTOM_SECTION)
+		return builtinSectionHashes[entry->id];
+
+	struct WasmModuleReader reader;
+	reader._data = data;
+	reader.offset = entry->offset;
+	reader.size = entry->size + entry->offset + 1;
+
+	// A broken name is reported by parseCustomSection()
+	uint32_t nameSize = fetchU32(&reader);
+	if (reader.offset == UINT32_MAX || !nameSize || (uint64_t) nameSize + reader.offset >= reader.size)
+		return NULL_STRING_HASH;
+
+	return hashN((char*)data + reader.offset, nameSize);
+}
+
 const parseFnList parseSectionList[] = {
 	[WASM_CUSTOM_SECTION] = &parseCustomSection,
 	[WASM_TYPE_SECTION] = &parseTypeSection,
@@ -0,0 +1,672 @@
+#include <libwasm.h>
+#include <instance.h>
+#include <decode.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A block open while translating
+struct Block {
+    uint32_t opener;    // instruction index of its block, loop or if, UINT32_MAX for the function
+    uint32_t height;    // operands below its own
+    uint8_t  arity;     // values it leaves behind
+    uint8_t  loop;
+    uint8_t  reachable; // whether the code it was opened in could run
+};
+
+// Where a value on the operand stack is while translating to register
+// code: in its own slot, still in a local or a constant nothing has put
+// anywhere yet
+enum { IN_SLOT, IN_LOCAL, IN_CONST };
+
+struct Value {
+    uint8_t  kind;
+    uint32_t local;
+    uint64_t constant;
+};
+
+struct Translation {
+    struct DecodedCode       decoded;
+    struct CompiledFunction* fn;
+    struct Block*            blocks;
+    uint32_t                 nblocks;
+    uint32_t                 height;
+    uint32_t                 maxHeight;
+    uint32_t                 ntargets;
+    uint32_t*                map;    // op each instruction starts at
+    struct Value*            values; // register code only
+    uint32_t                 last;   // the op that made the top value if it came right before, or UINT32_MAX
+    uint32_t                 nloops; // seen so far, reachable or not
+    int                      jit;    // whether loops count towards compiling to machine code
+};
+
+static void emit(struct Translation* t, uint32_t op, uint32_t a, uint32_t b) {
+    struct Op* o = &t->fn->code[t->fn->nops++];
+    o->handler = (const void*) (uintptr_t) op;
+    o->a = a;
+    o->b = b;
+}
+
+static void push(struct Translation* t, uint32_t n) {
+    t->height += n;
+    if (t->height > t->maxHeight)
+        t->maxHeight = t->height;
+}
+
+// Where a branch to label goes, as an instruction index until
+// compileFunction() maps it to an op, and what it carries there
+static struct BranchTarget branchTarget(struct Translation* t, uint32_t label) {
+    struct Block* block = &t->blocks[t->nblocks - 1 - label];
+    struct BranchTarget target;
+    target.arity = (block->loop) ? 0 : block->arity;
+    target.height = t->fn->nlocals + block->height;
+    if (block->opener == UINT32_MAX)
+        target.op = t->decoded.ninstrs - 1; // the function's end, a return
+    else if (block->loop)
+        target.op = block->opener;
+    else
+        target.op = t->decoded.instrs[block->opener].b >> ((t->decoded.instrs[block->opener].opcode == WASM_OP_IF) ? 32 : 0);
+
+    return target;
+}
+
+static void branch(struct Translation* t, uint32_t label, uint32_t plain, uint32_t move) {
+    struct BranchTarget target = branchTarget(t, label);
+    if (t->fn->nlocals + t->height - target.arity == target.height)
+        emit(t, plain, target.op, 0);
+    else
+        emit(t, move, target.op, (target.height << 1) | target.arity);
+}
+
+static void translateStack(struct WasmInstance* instance, struct Translation* t, uint32_t i) {
+    struct Instruction* instr = &t->decoded.instrs[i];
+    struct Block* top = &t->blocks[t->nblocks - 1];
+    uint32_t op = instr->opcode;
+
+    switch (op) {
+        case WASM_OP_NOP:
+            break;
+
+        case WASM_OP_UNREACHABLE:
+            emit(t, op, 0, 0);
+            break;
+
+        case WASM_OP_IF: {
+            // Jumps past the else, or to the end when there is none
+            uint32_t els = (uint32_t) instr->b, end = instr->b >> 32;
+            t->height--;
+            emit(t, op, (els == end) ? end : els + 1, 0);
+        }
+            // fallthrough
+        case WASM_OP_BLOCK:
+        case WASM_OP_LOOP:
+            t->blocks[t->nblocks++] = (struct Block) { i, t->height, instr->a != 0x40, op == WASM_OP_LOOP, 1 };
+            if (op == WASM_OP_LOOP && t->jit)
+                emit(t, OP_HOT_LOOP, t->nloops, 0);
+            break;
+
+        case WASM_OP_ELSE:
+            emit(t, WASM_OP_BR, instr->b, 0);
+            t->height = top->height;
+            break;
+
+        case WASM_OP_END:
+            if (top->opener == UINT32_MAX)
+                emit(t, WASM_OP_RETURN, 0, 0);
+
+            t->height = top->height + top->arity;
+            t->nblocks--;
+            break;
+
+        case WASM_OP_BR:
+            if (t->blocks[t->nblocks - 1 - instr->a].opener == UINT32_MAX)
+                emit(t, WASM_OP_RETURN, 0, 0);
+            else
+                branch(t, instr->a, WASM_OP_BR, OP_BR_MOVE);
+            break;
+
+        case WASM_OP_BR_IF:
+            t->height--;
+            branch(t, instr->a, WASM_OP_BR_IF, OP_BR_IF_MOVE);
+            break;
+
+        case WASM_OP_BR_TABLE:
+            t->height--;
+            emit(t, op, instr->a, t->ntargets);
+            for (uint32_t j = 0; j <= instr->a; j++)
+                t->fn->targets[t->ntargets++] = branchTarget(t, t->decoded.labels[instr->b + j]);
+            break;
+
+        case WASM_OP_RETURN:
+            emit(t, op, 0, 0);
+            break;
+
+        case WASM_OP_CALL:
+        case WASM_OP_CALL_INDIRECT: {
+            struct TypeSectionType* type = (op == WASM_OP_CALL) ? instance->module->functions[instr->a].signature : &instance->_types[instr->a];
+            t->height -= type->paramsLen + (op == WASM_OP_CALL_INDIRECT);
+            push(t, type->ret != 0);
+            emit(t, op, instr->a, 0);
+            break;
+        }
+
+        case WASM_OP_DROP:
+            t->height--;
+            emit(t, op, 0, 0);
+            break;
+
+        case WASM_OP_SELECT:
+            t->height -= 2;
+            emit(t, op, 0, 0);
+            break;
+
+        case WASM_OP_LOCAL_GET:
+        case WASM_OP_GLOBAL_GET:
+            push(t, 1);
+            emit(t, op, instr->a, 0);
+            break;
+
+        case WASM_OP_LOCAL_SET:
+        case WASM_OP_GLOBAL_SET:
+            t->height--;
+            emit(t, op, instr->a, 0);
+            break;
+
+        case WASM_OP_LOCAL_TEE:
+            emit(t, op, instr->a, 0);
+            break;
+
+        case WASM_OP_MEMORY_SIZE:
+            push(t, 1);
+            emit(t, op, 0, 0);
+            break;
+
+        case WASM_OP_MEMORY_GROW:
+            emit(t, op, 0, 0);
+            break;
+
+        case WASM_OP_I32_LOAD ... WASM_OP_I64_STORE32:
+            // Only the offset matters once validated
+            t->height -= (opcodeSignatures[op].a != 0) + (opcodeSignatures[op].b != 0);
+            push(t, opcodeSignatures[op].result != 0);
+            emit(t, op, instr->b, 0);
+            break;
+
+        case WASM_OP_I64_CONST:
+        case WASM_OP_F64_CONST:
+            push(t, 1);
+            emit(t, op, (uint32_t) instr->b, instr->b >> 32);
+            break;
+
+        default: {
+            const struct Signature* sig = (op >> 8) ? &prefixedSignatures[op & 0xFF] : &opcodeSignatures[op];
+            t->height -= (sig->a != 0) + (sig->b != 0);
+            push(t, sig->result != 0);
+            emit(t, (op >> 8) ? OP_TRUNC_SAT + (op & 0xFF) : op, instr->a, 0);
+            break;
+        }
+    }
+}
+
+static uint32_t slot(struct Translation* t, uint32_t height) {
+    return t->fn->nlocals + height;
+}
+
+static void emitRegister(struct Translation* t, uint32_t op, uint32_t r, uint32_t x, uint32_t y) {
+    struct RegisterOp* o = &t->fn->registerCode[t->fn->nops++];
+    o->handler = (const void*) (uintptr_t) op;
+    o->r = r;
+    o->x = x;
+    o->y = y;
+}
+
+// Puts the value at height h in its own slot
+static void settle(struct Translation* t, uint32_t h) {
+    struct Value* v = &t->values[h];
+    if (v->kind == IN_LOCAL)
+        emitRegister(t, OP_COPY, slot(t, h), v->local, 0);
+    else if (v->kind == IN_CONST)
+        emitRegister(t, WASM_OP_I64_CONST, slot(t, h), (uint32_t) v->constant, v->constant >> 32);
+
+    v->kind = IN_SLOT;
+}
+
+// Register the value at height h can be read from
+static uint32_t operand(struct Translation* t, uint32_t h) {
+    if (t->values[h].kind == IN_LOCAL)
+        return t->values[h].local;
+
+    settle(t, h);
+    return slot(t, h);
+}
+
+// Blocks start and end with their values in their slots, every way into
+// one has to agree on where they are. Values under the innermost block are
+// always in theirs
+static void settleBlock(struct Translation* t) {
+    for (uint32_t h = t->blocks[t->nblocks - 1].height; h < t->height; h++)
+        settle(t, h);
+}
+
+static void pushSlot(struct Translation* t) {
+    t->values[t->height].kind = IN_SLOT;
+    push(t, 1);
+}
+
+// local.set and local.tee. The op that made the value writes the local
+// itself when it came right before
+static void setLocal(struct Translation* t, uint32_t local, uint32_t producer, int tee) {
+    uint32_t h = t->height - 1;
+    struct Value* v = &t->values[h];
+
+    // Values that are the local's old value are copied out first
+    for (uint32_t i = t->blocks[t->nblocks - 1].height; i < h; i++) {
+        if (t->values[i].kind == IN_LOCAL && t->values[i].local == local) {
+            settle(t, i);
+            producer = UINT32_MAX;
+        }
+    }
+
+    if (v->kind == IN_SLOT && producer != UINT32_MAX && producer == t->fn->nops - 1)
+        t->fn->registerCode[producer].r = local;
+    else if (v->kind == IN_SLOT)
+        emitRegister(t, OP_COPY, local, slot(t, h), 0);
+    else if (v->kind == IN_CONST)
+        emitRegister(t, WASM_OP_I64_CONST, local, (uint32_t) v->constant, v->constant >> 32);
+    else if (v->local != local)
+        emitRegister(t, OP_COPY, local, v->local, 0);
+
+    if (tee) {
+        v->kind = IN_LOCAL;
+        v->local = local;
+    }
+    else
+        t->height--;
+}
+
+// Whether op has a form in OP_IMM
+static int hasImmediateForm(uint32_t op) {
+    switch (op) {
+        case WASM_OP_I32_EQ ... WASM_OP_I32_GE_U:
+        case WASM_OP_I64_EQ ... WASM_OP_I64_GE_U:
+        case WASM_OP_I32_ADD ... WASM_OP_I32_MUL:
+        case WASM_OP_I32_AND ... WASM_OP_I32_ROTR:
+        case WASM_OP_I64_ADD ... WASM_OP_I64_MUL:
+        case WASM_OP_I64_AND ... WASM_OP_I64_ROTR:
+            return 1;
+    }
+
+    return 0;
+}
+
+// Register code: local.get and constants only note where the value is, the
+// op that uses it reads it from there
+static void translateRegisters(struct WasmInstance* instance, struct Translation* t, uint32_t i) {
+    struct Instruction* instr = &t->decoded.instrs[i];
+    struct Block* top = &t->blocks[t->nblocks - 1];
+    uint32_t op = instr->opcode;
+    uint32_t h = t->height - 1; // the top value's height, when there is one
+    uint32_t producer = t->last;
+    t->last = UINT32_MAX;
+
+    switch (op) {
+        case WASM_OP_NOP:
+            break;
+
+        case WASM_OP_UNREACHABLE:
+            emitRegister(t, op, 0, 0, 0);
+            break;
+
+        case WASM_OP_BLOCK:
+        case WASM_OP_LOOP:
+            settleBlock(t);
+            t->blocks[t->nblocks++] = (struct Block) { i, t->height, instr->a != 0x40, op == WASM_OP_LOOP, 1 };
+            // Branches back to a loop come in after the copies
+            t->map[i] = t->fn->nops;
+            if (op == WASM_OP_LOOP && t->jit)
+                emitRegister(t, OP_HOT_LOOP, 0, 0, t->nloops);
+            break;
+
+        case WASM_OP_IF: {
+            uint32_t cond = operand(t, h);
+            uint32_t els = (uint32_t) instr->b, end = instr->b >> 32;
+            t->height--;
+            settleBlock(t);
+            emitRegister(t, op, 0, cond, (els == end) ? end : els + 1);
+            t->blocks[t->nblocks++] = (struct Block) { i, t->height, instr->a != 0x40, 0, 1 };
+            break;
+        }
+
+        case WASM_OP_ELSE:
+            settleBlock(t);
+            emitRegister(t, WASM_OP_BR, 0, 0, instr->b);
+            t->height = top->height;
+            break;
+
+        case WASM_OP_END:
+            if (top->opener != UINT32_MAX) {
+                settleBlock(t);
+                t->map[i] = t->fn->nops;
+            }
+            else if (top->arity) {
+                // Falling off the end returns the result from wherever it
+                // is, branches to the end have put it in the first slot
+                emitRegister(t, WASM_OP_RETURN, 0, operand(t, h), 0);
+                t->map[i] = t->fn->nops;
+                emitRegister(t, WASM_OP_RETURN, 0, slot(t, 0), 0);
+            }
+            else
+                emitRegister(t, WASM_OP_RETURN, 0, 0, 0);
+
+            t->height = top->height + top->arity;
+            t->nblocks--;
+            break;
+
+        case WASM_OP_BR: {
+            struct BranchTarget target = branchTarget(t, instr->a);
+            uint32_t from = (target.arity) ? operand(t, h) : 0;
+            if (t->blocks[t->nblocks - 1 - instr->a].opener == UINT32_MAX)
+                emitRegister(t, WASM_OP_RETURN, 0, from, 0);
+            else if (target.arity && from != target.height)
+                emitRegister(t, OP_BR_MOVE, target.height, from, target.op);
+            else
+                emitRegister(t, op, 0, 0, target.op);
+            break;
+        }
+
+        case WASM_OP_BR_IF: {
+            uint32_t cond = operand(t, h);
+            t->height--;
+            struct BranchTarget target = branchTarget(t, instr->a);
+            target.source = (target.arity) ? operand(t, h - 1) : 0;
+            if (target.arity && target.source != target.height) {
+                t->fn->targets[t->ntargets] = target;
+                emitRegister(t, OP_BR_IF_MOVE, 0, cond, t->ntargets++);
+            }
+            else
+                emitRegister(t, op, 0, cond, target.op);
+            break;
+        }
+
+        case WASM_OP_BR_TABLE: {
+            uint32_t index = operand(t, h), first = t->ntargets, from = 0;
+            t->height--;
+            // Every label of one takes the same values
+            if (branchTarget(t, t->decoded.labels[instr->b]).arity)
+                from = operand(t, h - 1);
+
+            for (uint32_t j = 0; j <= instr->a; j++) {
+                struct BranchTarget target = branchTarget(t, t->decoded.labels[instr->b + j]);
+                target.source = from;
+                t->fn->targets[t->ntargets++] = target;
+            }
+
+            emitRegister(t, op, instr->a, index, first);
+            break;
+        }
+
+        case WASM_OP_RETURN:
+            emitRegister(t, op, 0, (t->blocks[0].arity) ? operand(t, h) : 0, 0);
+            break;
+
+        case WASM_OP_CALL:
+        case WASM_OP_CALL_INDIRECT: {
+            struct TypeSectionType* type = (op == WASM_OP_CALL) ? instance->module->functions[instr->a].signature : &instance->_types[instr->a];
+            uint32_t index = 0;
+            if (op == WASM_OP_CALL_INDIRECT) {
+                index = operand(t, h);
+                t->height--;
+            }
+
+            // The callee's frame starts at its arguments
+            uint32_t args = t->height - type->paramsLen;
+            for (uint32_t j = args; j < t->height; j++)
+                settle(t, j);
+
+            emitRegister(t, op, slot(t, args), index, instr->a);
+            t->height = args;
+            if (type->ret)
+                pushSlot(t);
+            break;
+        }
+
+        case WASM_OP_DROP:
+            t->height--;
+            break;
+
+        case WASM_OP_SELECT: {
+            uint32_t cond = operand(t, h), other = operand(t, h - 1);
+            settle(t, h - 2);
+            emitRegister(t, op, slot(t, h - 2), other, cond);
+            t->height -= 2;
+            break;
+        }
+
+        case WASM_OP_LOCAL_GET:
+            t->values[t->height] = (struct Value) { IN_LOCAL, instr->a, 0 };
+            push(t, 1);
+            break;
+
+        case WASM_OP_LOCAL_SET:
+        case WASM_OP_LOCAL_TEE:
+            setLocal(t, instr->a, producer, op == WASM_OP_LOCAL_TEE);
+            break;
+
+        case WASM_OP_GLOBAL_GET:
+        case WASM_OP_MEMORY_SIZE:
+            emitRegister(t, op, slot(t, t->height), 0, instr->a);
+            pushSlot(t);
+            t->last = t->fn->nops - 1;
+            break;
+
+        case WASM_OP_GLOBAL_SET:
+            emitRegister(t, op, 0, operand(t, h), instr->a);
+            t->height--;
+            break;
+
+        case WASM_OP_MEMORY_GROW:
+            emitRegister(t, op, slot(t, h), operand(t, h), 0);
+            t->values[h].kind = IN_SLOT;
+            t->last = t->fn->nops - 1;
+            break;
+
+        case WASM_OP_I32_LOAD ... WASM_OP_I64_LOAD32_U:
+            emitRegister(t, op, slot(t, h), operand(t, h), instr->b);
+            t->values[h].kind = IN_SLOT;
+            t->last = t->fn->nops - 1;
+            break;
+
+        case WASM_OP_I32_STORE ... WASM_OP_I64_STORE32:
+            emitRegister(t, op, operand(t, h), operand(t, h - 1), instr->b);
+            t->height -= 2;
+            break;
+
+        case WASM_OP_I32_CONST:
+        case WASM_OP_F32_CONST:
+            t->values[t->height] = (struct Value) { IN_CONST, 0, (uint32_t) instr->a };
+            push(t, 1);
+            break;
+
+        case WASM_OP_I64_CONST:
+        case WASM_OP_F64_CONST:
+            t->values[t->height] = (struct Value) { IN_CONST, 0, instr->b };
+            push(t, 1);
+            break;
+
+        default: {
+            const struct Signature* sig = (op >> 8) ? &prefixedSignatures[op & 0xFF] : &opcodeSignatures[op];
+            if (sig->b) {
+                // Constants that fit take the immediate form, any i32 (0x7F) does
+                struct Value* y = &t->values[h];
+                uint32_t x = operand(t, h - 1);
+                int fits = sig->a == 0x7F || (int64_t) y->constant == (int32_t) y->constant;
+                if (y->kind == IN_CONST && hasImmediateForm(op) && fits)
+                    emitRegister(t, OP_IMM + op - WASM_OP_I32_EQ, slot(t, h - 1), x, (uint32_t) y->constant);
+                else
+                    emitRegister(t, op, slot(t, h - 1), x, operand(t, h));
+                t->height--;
+            }
+            else
+                emitRegister(t, (op >> 8) ? OP_TRUNC_SAT + (op & 0xFF) : op, slot(t, h), operand(t, h), 0);
+
+            t->values[t->height - 1].kind = IN_SLOT;
+            t->last = t->fn->nops - 1;
+            break;
+        }
+    }
+}
+
+// Whether the code after instruction i can run, it cannot after anything
+// that always branches until the block around it ends
+static int reachableAfter(struct Translation* t, uint32_t i) {
+    switch (t->decoded.instrs[i].opcode) {
+        case WASM_OP_UNREACHABLE:
+        case WASM_OP_BR:
+        case WASM_OP_BR_TABLE:
+        case WASM_OP_RETURN:
+            return 0;
+    }
+
+    return 1;
+}
+
+int compileFunction(struct WasmInstance* instance, uint32_t idx, struct CompiledFunction** compiled) {
+    struct WasmModule* module = instance->module;
+    struct CodeSectionCode* code;
+    int status = getFunctionCode(module, idx, &code);
+    if (status)
+        return status;
+
+    if (!code)
+        return WASM_TRAP_UNBOUND_IMPORT;
+
+    resetArena(&instance->_scratch);
+    struct Translation t = {0};
+    status = decodeCode(code, &instance->_scratch, &t.decoded);
+    if (status)
+        return status;
+
+    int registers = instance->flags & WASM_INSTANCE_REGISTERS;
+    struct TypeSectionType* type = module->functions[idx].signature;
+    struct CompiledFunction* fn = arenaAlloc(&instance->_arena, sizeof(struct CompiledFunction));
+    t.map = arenaAlloc(&instance->_scratch, sizeof(uint32_t) * (t.decoded.ninstrs + 1));
+    t.blocks = arenaAlloc(&instance->_scratch, sizeof(struct Block) * t.decoded.maxDepth);
+    t.values = (registers) ? arenaAlloc(&instance->_scratch, sizeof(struct Value) * (t.decoded.ninstrs + 1)) : NULL;
+    if (!fn || !t.map || !t.blocks || (registers && !t.values))
+        return WASM_OUT_OF_MEMORY;
+
+    // Every instruction turns into at most one op of stack code. Register
+    // code can also copy each value it pushes to its slot once and has two
+    // returns at the end. Its br_ifs can need a BranchTarget too
+    uint32_t nops = t.decoded.ninstrs, ntargets = t.decoded.nlabels;
+    if (registers) {
+        nops = nops * 2 + 1;
+        for (uint32_t i = 0; i < t.decoded.ninstrs; i++)
+            ntargets += t.decoded.instrs[i].opcode == WASM_OP_BR_IF;
+    }
+
+    fn->code = arenaAlloc(&instance->_arena, ((registers) ? sizeof(struct RegisterOp) : sizeof(struct Op)) * nops);
+    fn->targets = (ntargets) ? arenaAlloc(&instance->_arena, sizeof(struct BranchTarget) * ntargets) : NULL;
+    if (!fn->code || (ntargets && !fn->targets))
+        return WASM_OUT_OF_MEMORY;
+
+    fn->type = type;
+    fn->nops = 0;
+    fn->nlocals = type->paramsLen + code->localSize;
+    fn->index = idx;
+    fn->hotness = 0;
+    fn->machine = NULL;
+    fn->loops = NULL;
+    t.fn = fn;
+    t.last = UINT32_MAX;
+    t.jit = instance->_jit != NULL;
+    t.blocks[t.nblocks++] = (struct Block) { UINT32_MAX, 0, type->ret != 0, 0, 1 };
+
+    // Code after a branch is never run, only the blocks in it are kept
+    // track of to know where it ends
+    int reachable = 1;
+    for (uint32_t i = 0; i < t.decoded.ninstrs; i++) {
+        struct Instruction* instr = &t.decoded.instrs[i];
+        t.map[i] = fn->nops;
+        if (reachable) {
+            if (registers)
+                translateRegisters(instance, &t, i);
+            else
+                translateStack(instance, &t, i);
+            reachable = reachableAfter(&t, i);
+            t.nloops += instr->opcode == WASM_OP_LOOP;
+            continue;
+        }
+
+        switch (instr->opcode) {
+            case WASM_OP_BLOCK:
+            case WASM_OP_LOOP:
+            case WASM_OP_IF:
+                t.blocks[t.nblocks++] = (struct Block) { i, 0, 0, 0, 0 };
+                t.nloops += instr->opcode == WASM_OP_LOOP;
+                break;
+
+            case WASM_OP_ELSE:
+            case WASM_OP_END: {
+                struct Block* top = &t.blocks[t.nblocks - 1];
+                reachable = top->reachable;
+                t.height = top->height;
+                t.last = UINT32_MAX;
+                if (instr->opcode == WASM_OP_END) {
+                    // Whatever branched here left the values in their slots
+                    for (uint32_t h = t.height; registers && h < t.height + top->arity; h++)
+                        t.values[h].kind = IN_SLOT;
+
+                    t.height += top->arity;
+                    t.nblocks--;
+                    if (top->opener == UINT32_MAX && registers)
+                        emitRegister(&t, WASM_OP_RETURN, 0, slot(&t, 0), 0);
+                    else if (top->opener == UINT32_MAX)
+                        emit(&t, WASM_OP_RETURN, 0, 0);
+                }
+                break;
+            }
+        }
+    }
+
+    t.map[t.decoded.ninstrs] = fn->nops;
+
+    // Branches were made with instruction indexes
+    for (uint32_t i = 0; i < fn->nops && !registers; i++) {
+        struct Op* op = &fn->code[i];
+        switch ((uintptr_t) op->handler) {
+            case WASM_OP_IF:
+            case WASM_OP_BR:
+            case WASM_OP_BR_IF:
+            case OP_BR_MOVE:
+            case OP_BR_IF_MOVE:
+                op->a = t.map[op->a];
+                break;
+        }
+
+        if (instance->_handlers)
+            op->handler = instance->_handlers[(uintptr_t) op->handler];
+    }
+
+    for (uint32_t i = 0; i < fn->nops && registers; i++) {
+        struct RegisterOp* op = &fn->registerCode[i];
+        switch ((uintptr_t) op->handler) {
+            case WASM_OP_IF:
+            case WASM_OP_BR:
+            case WASM_OP_BR_IF:
+            case OP_BR_MOVE:
+                op->y = t.map[op->y];
+                break;
+        }
+
+        if (instance->_handlers)
+            op->handler = instance->_handlers[(uintptr_t) op->handler];
+    }
+
+    for (uint32_t i = 0; i < t.ntargets; i++)
+        fn->targets[i].op = t.map[fn->targets[i].op];
+
+    fn->frameSize = fn->nlocals + t.maxHeight;
+    instance->_compiled[idx] = fn;
+    *compiled = fn;
+    return WASM_SUCCESS;
+}
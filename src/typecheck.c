@@ -0,0 +1,746 @@
+#include "precompiled-hashes.h"
+#include <libwasm.h>
+#include <section.h>
+#include <decode.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+// Types of values on the validator's stack
+enum {
+    NONE    = 0,    // no value, for operands and results of Signature
+    UNKNOWN = 1,    // popped in unreachable code, matches any type
+    EMPTY   = 0x40, // block type of blocks without a result
+    F64     = 0x7C,
+    F32     = 0x7D,
+    I64     = 0x7E,
+    I32     = 0x7F,
+};
+
+#define CONST(r)        { NONE, NONE, r, 0 }
+#define UNARY(t, r)     { t, NONE, r, 0 }
+#define BINARY(t, r)    { t, t, r, 0 }
+#define LOAD(r, align)  { I32, NONE, r, align }
+#define STORE(t, align) { I32, t, NONE, align }
+
+const struct Signature opcodeSignatures[256] = {
+    [WASM_OP_I32_LOAD]                                = LOAD(I32, 2),
+    [WASM_OP_I64_LOAD]                                = LOAD(I64, 3),
+    [WASM_OP_F32_LOAD]                                = LOAD(F32, 2),
+    [WASM_OP_F64_LOAD]                                = LOAD(F64, 3),
+    [WASM_OP_I32_LOAD8_S ... WASM_OP_I32_LOAD8_U]     = LOAD(I32, 0),
+    [WASM_OP_I32_LOAD16_S ... WASM_OP_I32_LOAD16_U]   = LOAD(I32, 1),
+    [WASM_OP_I64_LOAD8_S ... WASM_OP_I64_LOAD8_U]     = LOAD(I64, 0),
+    [WASM_OP_I64_LOAD16_S ... WASM_OP_I64_LOAD16_U]   = LOAD(I64, 1),
+    [WASM_OP_I64_LOAD32_S ... WASM_OP_I64_LOAD32_U]   = LOAD(I64, 2),
+    [WASM_OP_I32_STORE]                               = STORE(I32, 2),
+    [WASM_OP_I64_STORE]                               = STORE(I64, 3),
+    [WASM_OP_F32_STORE]                               = STORE(F32, 2),
+    [WASM_OP_F64_STORE]                               = STORE(F64, 3),
+    [WASM_OP_I32_STORE8]                              = STORE(I32, 0),
+    [WASM_OP_I32_STORE16]                             = STORE(I32, 1),
+    [WASM_OP_I64_STORE8]                              = STORE(I64, 0),
+    [WASM_OP_I64_STORE16]                             = STORE(I64, 1),
+    [WASM_OP_I64_STORE32]                             = STORE(I64, 2),
+    [WASM_OP_I32_CONST]                               = CONST(I32),
+    [WASM_OP_I64_CONST]                               = CONST(I64),
+    [WASM_OP_F32_CONST]                               = CONST(F32),
+    [WASM_OP_F64_CONST]                               = CONST(F64),
+    [WASM_OP_I32_EQZ]                                 = UNARY(I32, I32),
+    [WASM_OP_I32_EQ ... WASM_OP_I32_GE_U]             = BINARY(I32, I32),
+    [WASM_OP_I64_EQZ]                                 = UNARY(I64, I32),
+    [WASM_OP_I64_EQ ... WASM_OP_I64_GE_U]             = BINARY(I64, I32),
+    [WASM_OP_F32_EQ ... WASM_OP_F32_GE]               = BINARY(F32, I32),
+    [WASM_OP_F64_EQ ... WASM_OP_F64_GE]               = BINARY(F64, I32),
+    [WASM_OP_I32_CLZ ... WASM_OP_I32_POPCNT]          = UNARY(I32, I32),
+    [WASM_OP_I32_ADD ... WASM_OP_I32_ROTR]            = BINARY(I32, I32),
+    [WASM_OP_I64_CLZ ... WASM_OP_I64_POPCNT]          = UNARY(I64, I64),
+    [WASM_OP_I64_ADD ... WASM_OP_I64_ROTR]            = BINARY(I64, I64),
+    [WASM_OP_F32_ABS ... WASM_OP_F32_SQRT]            = UNARY(F32, F32),
+    [WASM_OP_F32_ADD ... WASM_OP_F32_COPYSIGN]        = BINARY(F32, F32),
+    [WASM_OP_F64_ABS ... WASM_OP_F64_SQRT]            = UNARY(F64, F64),
+    [WASM_OP_F64_ADD ... WASM_OP_F64_COPYSIGN]        = BINARY(F64, F64),
+    [WASM_OP_I32_WRAP_I64]                            = UNARY(I64, I32),
+    [WASM_OP_I32_TRUNC_F32_S ... WASM_OP_I32_TRUNC_F32_U] = UNARY(F32, I32),
+    [WASM_OP_I32_TRUNC_F64_S ... WASM_OP_I32_TRUNC_F64_U] = UNARY(F64, I32),
+    [WASM_OP_I64_EXTEND_I32_S ... WASM_OP_I64_EXTEND_I32_U] = UNARY(I32, I64),
+    [WASM_OP_I64_TRUNC_F32_S ... WASM_OP_I64_TRUNC_F32_U] = UNARY(F32, I64),
+    [WASM_OP_I64_TRUNC_F64_S ... WASM_OP_I64_TRUNC_F64_U] = UNARY(F64, I64),
+    [WASM_OP_F32_CONVERT_I32_S ... WASM_OP_F32_CONVERT_I32_U] = UNARY(I32, F32),
+    [WASM_OP_F32_CONVERT_I64_S ... WASM_OP_F32_CONVERT_I64_U] = UNARY(I64, F32),
+    [WASM_OP_F32_DEMOTE_F64]                          = UNARY(F64, F32),
+    [WASM_OP_F64_CONVERT_I32_S ... WASM_OP_F64_CONVERT_I32_U] = UNARY(I32, F64),
+    [WASM_OP_F64_CONVERT_I64_S ... WASM_OP_F64_CONVERT_I64_U] = UNARY(I64, F64),
+    [WASM_OP_F64_PROMOTE_F32]                         = UNARY(F32, F64),
+    [WASM_OP_I32_REINTERPRET_F32]                     = UNARY(F32, I32),
+    [WASM_OP_I64_REINTERPRET_F64]                     = UNARY(F64, I64),
+    [WASM_OP_F32_REINTERPRET_I32]                     = UNARY(I32, F32),
+    [WASM_OP_F64_REINTERPRET_I64]                     = UNARY(I64, F64),
+    [WASM_OP_I32_EXTEND8_S ... WASM_OP_I32_EXTEND16_S] = UNARY(I32, I32),
+    [WASM_OP_I64_EXTEND8_S ... WASM_OP_I64_EXTEND32_S] = UNARY(I64, I64),
+};
+
+// 0xFC prefixed opcodes, by their second byte
+const struct Signature prefixedSignatures[PREFIXED_OPCODES] = {
+    [WASM_OP_I32_TRUNC_SAT_F32_S & 0xFF] = UNARY(F32, I32),
+    [WASM_OP_I32_TRUNC_SAT_F32_U & 0xFF] = UNARY(F32, I32),
+    [WASM_OP_I32_TRUNC_SAT_F64_S & 0xFF] = UNARY(F64, I32),
+    [WASM_OP_I32_TRUNC_SAT_F64_U & 0xFF] = UNARY(F64, I32),
+    [WASM_OP_I64_TRUNC_SAT_F32_S & 0xFF] = UNARY(F32, I64),
+    [WASM_OP_I64_TRUNC_SAT_F32_U & 0xFF] = UNARY(F32, I64),
+    [WASM_OP_I64_TRUNC_SAT_F64_S & 0xFF] = UNARY(F64, I64),
+    [WASM_OP_I64_TRUNC_SAT_F64_U & 0xFF] = UNARY(F64, I64),
+};
+
+// A block that is open while checking a body
+struct Frame {
+    uint32_t height;      // values on the stack when it was entered
+    uint8_t  opcode;      // block, loop, if, or else once the else has been seen
+    uint8_t  type;        // its result, EMPTY if there is none
+    uint8_t  unreachable; // the rest of the block can never run
+};
+
+// Stacks every body checked on a thread reuses, they only grow when a
+// body needs more than any before it did
+struct Scratch {
+    uint8_t*      values;
+    struct Frame* frames;
+    uint32_t      nvalues;
+    uint32_t      nframes;
+};
+
+// What a thread starts out with, enough for all but very large bodies
+#define INITIAL_VALUES 4096
+#define INITIAL_FRAMES 256
+
+static pthread_key_t  scratchKey;
+static pthread_once_t scratchOnce = PTHREAD_ONCE_INIT;
+static int            scratchKeyStatus;
+
+static void freeScratch(void* p) {
+    struct Scratch* scratch = p;
+    free(scratch->values);
+    free(scratch->frames);
+    free(scratch);
+}
+
+static void createScratchKey() {
+    scratchKeyStatus = pthread_key_create(&scratchKey, freeScratch);
+}
+
+static struct Scratch* getScratch() {
+    pthread_once(&scratchOnce, createScratchKey);
+    if (scratchKeyStatus)
+        return NULL;
+
+    struct Scratch* scratch = pthread_getspecific(scratchKey);
+    if (scratch)
+        return scratch;
+
+    scratch = calloc(1, sizeof(struct Scratch));
+    if (!scratch)
+        return NULL;
+
+    scratch->values = malloc(INITIAL_VALUES);
+    scratch->frames = malloc(sizeof(struct Frame) * INITIAL_FRAMES);
+    if (!scratch->values || !scratch->frames || pthread_setspecific(scratchKey, scratch)) {
+        freeScratch(scratch);
+        return NULL;
+    }
+
+    scratch->nvalues = INITIAL_VALUES;
+    scratch->nframes = INITIAL_FRAMES;
+    return scratch;
+}
+
+static int growScratch(void** p, uint32_t* capacity, uint64_t need, size_t size) {
+    uint64_t n = *capacity;
+    while (n < need)
+        n *= 2;
+
+    if (n > UINT32_MAX)
+        return WASM_OUT_OF_MEMORY;
+
+    void* grown = realloc(*p, n * size);
+    if (!grown)
+        return WASM_OUT_OF_MEMORY;
+
+    *p = grown;
+    *capacity = n;
+    return WASM_SUCCESS;
+}
+
+// Everything about the module a body may refer to. validateCode() builds
+// it once per module and keeps it for the bodies decoded later on
+struct CheckContext {
+    struct WasmModule*           module;
+    struct TypeSectionType*      types;
+    uint32_t                     ntypes;
+    uint32_t                     importedGlobals;
+    struct ImportSectionImport** globalImports; // the import behind each imported global, by index
+    uint8_t                      memory;
+    uint8_t                      table;
+};
+
+// globalImports comes from arena, or from malloc() for a context that is
+// thrown away after a single body without one
+static int createContext(struct WasmModule* module, struct CheckContext* ctx, struct WasmArena* arena) {
+    int typeidx = findSectionByHash(module, WASM_HASH_Type);
+    ctx->module = module;
+    ctx->types = (typeidx == -1) ? NULL : module->sections[typeidx].types;
+    ctx->ntypes = (typeidx == -1) ? 0 : module->sections[typeidx].flags;
+    ctx->importedGlobals = 0;
+    ctx->globalImports = NULL;
+    ctx->memory = module->memories && module->memories->memory;
+    ctx->table = module->tables && module->tables->table;
+
+    int impidx = findSectionByHash(module, WASM_HASH_Import);
+    if (impidx == -1)
+        return WASM_SUCCESS;
+
+    struct Section* imports = &module->sections[impidx];
+    for (uint32_t i = 0; i < imports->flags; i++) {
+        switch (imports->imports[i].type) {
+            case WASM_GLOBALTYPE: ctx->importedGlobals++; break;
+            case WASM_MEMTYPE:    ctx->memory = 1; break;
+            case WASM_TABLETYPE:  ctx->table = 1; break;
+        }
+    }
+
+    if (!ctx->importedGlobals)
+        return WASM_SUCCESS;
+
+    size_t size = sizeof(struct ImportSectionImport*) * ctx->importedGlobals;
+    ctx->globalImports = (arena) ? arenaAlloc(arena, size) : malloc(size);
+    if (!ctx->globalImports)
+        return WASM_OUT_OF_MEMORY;
+
+    for (uint32_t i = 0, g = 0; i < imports->flags; i++) {
+        if (imports->imports[i].type == WASM_GLOBALTYPE)
+            ctx->globalImports[g++] = &imports->imports[i];
+    }
+
+    return WASM_SUCCESS;
+}
+
+// The stack is only ever touched through these, they bail out to the
+// error labels at the end of checkBody()
+#define PUSH(t) (values[nvalues++] = (t))
+
+#define POP(t)                                       \
+    do {                                             \
+        if (nvalues == frames[nframes - 1].height) { \
+            if (!frames[nframes - 1].unreachable)    \
+                goto underflow;                      \
+            (t) = UNKNOWN;                           \
+        }                                            \
+        else                                         \
+            (t) = values[--nvalues];                 \
+    } while (0)
+
+#define EXPECT(t)                                    \
+    do {                                             \
+        uint8_t _got;                                \
+        POP(_got);                                   \
+        if (_got != (t) && _got != UNKNOWN)          \
+            goto mismatch;                           \
+    } while (0)
+
+// Pops the operands of sig and pushes its result
+#define APPLY(sig)                                   \
+    do {                                             \
+        if ((sig)->b)                                \
+            EXPECT((sig)->b);                        \
+        if ((sig)->a)                                \
+            EXPECT((sig)->a);                        \
+        if ((sig)->result)                           \
+            PUSH((sig)->result);                     \
+    } while (0)
+
+// Values a branch to a block carries, loops are entered again without any
+#define LABEL_TYPE(f) (((f)->opcode == WASM_OP_LOOP) ? EMPTY : (f)->type)
+
+#define MARK_UNREACHABLE()                           \
+    do {                                             \
+        nvalues = frames[nframes - 1].height;        \
+        frames[nframes - 1].unreachable = 1;         \
+    } while (0)
+
+// One pass over the body, every instruction is decoded and checked
+// against the operand stack and the blocks open around it
+static int checkBody(struct CheckContext* ctx, struct Scratch* scratch, uint32_t idx, struct TypeSectionType* type, struct CodeSectionCode* code) {
+    struct WasmModule* module = ctx->module;
+    uint64_t nlocals = (uint64_t) type->paramsLen + code->localSize;
+    for (uint32_t i = 0; i < code->localSize; i++) {
+        if (code->locals[i] < F64 || code->locals[i] > I32) {
+            error("Function %u: local %u has type 0x%x", idx, i + type->paramsLen, code->locals[i]);
+            return WASM_INVALID_TYPEVAL;
+        }
+    }
+
+    // Every instruction pushes at most one value and takes up at least
+    // a byte, so the stack can never outgrow the body
+    if (code->codeSize >= scratch->nvalues) {
+        if (growScratch((void**) &scratch->values, &scratch->nvalues, (uint64_t) code->codeSize + 1, 1))
+            return WASM_OUT_OF_MEMORY;
+    }
+
+    uint8_t* values = scratch->values;
+    struct Frame* frames = scratch->frames;
+    uint32_t nvalues = 0;
+    uint32_t nframes = 1;
+    frames[0] = (struct Frame) { 0, WASM_OP_BLOCK, (type->ret) ? type->ret : EMPTY, 0 };
+
+    struct WasmModuleReader reader;
+    codeReader(&reader, code->expr, 0, code->codeSize);
+
+    struct Instruction instr;
+    while (nframes) {
+        if (reader.offset >= code->codeSize) {
+            error("Function %u: code expression ends inside a block", idx);
+            return WASM_INVALID_EXPR;
+        }
+
+        // Numeric instructions make up most of any body and are a single
+        // byte, they are checked without going through decodeInstruction()
+        uint8_t op = code->expr[reader.offset];
+        if (op >= WASM_OP_I32_EQZ && op <= WASM_OP_I64_EXTEND32_S) {
+            instr.opcode = op;
+            reader.offset++;
+            APPLY(&opcodeSignatures[op]);
+            continue;
+        }
+
+        // So are local accesses and small constants, with an immediate
+        // that fits in the byte after them
+        if ((uint64_t) reader.offset + 2 < code->codeSize && !(code->expr[reader.offset + 1] & 0x80)) {
+            if (op >= WASM_OP_LOCAL_GET && op <= WASM_OP_LOCAL_TEE) {
+                instr.opcode = op;
+                instr.a = code->expr[reader.offset + 1];
+                reader.offset += 2;
+                if (instr.a >= nlocals)
+                    goto local;
+
+                uint8_t t = (instr.a < type->paramsLen) ? type->params[instr.a] : code->locals[instr.a - type->paramsLen];
+                if (op != WASM_OP_LOCAL_GET)
+                    EXPECT(t);
+                if (op != WASM_OP_LOCAL_SET)
+                    PUSH(t);
+                continue;
+            }
+
+            if (op == WASM_OP_I32_CONST) {
+                instr.opcode = op;
+                reader.offset += 2;
+                PUSH(I32);
+                continue;
+            }
+        }
+
+        int status = decodeInstruction(&reader, &instr);
+        if (status)
+            return status;
+
+        struct Frame* top = &frames[nframes - 1];
+        switch (instr.opcode) {
+            case WASM_OP_UNREACHABLE:
+                MARK_UNREACHABLE();
+                break;
+
+            case WASM_OP_NOP:
+                break;
+
+            case WASM_OP_IF:
+                EXPECT(I32);
+                // fallthrough
+            case WASM_OP_BLOCK:
+            case WASM_OP_LOOP:
+                if (nframes == scratch->nframes) {
+                    if (growScratch((void**) &scratch->frames, &scratch->nframes, nframes + 1, sizeof(struct Frame)))
+                        return WASM_OUT_OF_MEMORY;
+                    frames = scratch->frames;
+                }
+
+                frames[nframes++] = (struct Frame) { nvalues, instr.opcode, instr.a, 0 };
+                break;
+
+            case WASM_OP_ELSE:
+                if (top->opcode != WASM_OP_IF) {
+                    error("Function %u: else without an if", idx);
+                    return WASM_UNBALANCED_BLOCK;
+                }
+
+                if (top->type != EMPTY)
+                    EXPECT(top->type);
+                if (nvalues != top->height)
+                    goto unused;
+
+                top->opcode = WASM_OP_ELSE;
+                top->unreachable = 0;
+                break;
+
+            case WASM_OP_END:
+                if (top->type != EMPTY)
+                    EXPECT(top->type);
+                if (nvalues != top->height)
+                    goto unused;
+
+                // Without an else the block gives back nothing
+                if (top->opcode == WASM_OP_IF && top->type != EMPTY)
+                    goto mismatch;
+
+                nframes--;
+                if (top->type != EMPTY)
+                    PUSH(top->type);
+                break;
+
+            case WASM_OP_BR:
+            case WASM_OP_BR_IF: {
+                if (instr.opcode == WASM_OP_BR_IF)
+                    EXPECT(I32);
+
+                if (instr.a >= nframes)
+                    goto label;
+
+                uint8_t t = LABEL_TYPE(&frames[nframes - 1 - instr.a]);
+                if (t != EMPTY)
+                    EXPECT(t);
+
+                if (instr.opcode == WASM_OP_BR)
+                    MARK_UNREACHABLE();
+                else if (t != EMPTY)
+                    PUSH(t);
+                break;
+            }
+
+            case WASM_OP_BR_TABLE: {
+                EXPECT(I32);
+
+                // Every label has to carry the same values as the default, the last one
+                struct WasmModuleReader labels;
+                codeReader(&labels, code->expr, instr.b, code->codeSize);
+                uint8_t t = NONE;
+                for (uint64_t i = 0; i <= instr.a; i++) {
+                    uint32_t label = fetchIndex(&labels);
+                    if (label >= nframes)
+                        goto label;
+
+                    uint8_t lt = LABEL_TYPE(&frames[nframes - 1 - label]);
+                    if (t != NONE && lt != t)
+                        goto mismatch;
+                    t = lt;
+                }
+
+                if (t != EMPTY)
+                    EXPECT(t);
+
+                MARK_UNREACHABLE();
+                break;
+            }
+
+            case WASM_OP_RETURN:
+                if (frames[0].type != EMPTY)
+                    EXPECT(frames[0].type);
+
+                MARK_UNREACHABLE();
+                break;
+
+            case WASM_OP_CALL_INDIRECT:
+                if (!ctx->table || instr.b) {
+                    error("Function %u: call_indirect through table %lu which does not exist", idx, instr.b);
+                    return WASM_NO_TABLE;
+                }
+
+                if (instr.a >= ctx->ntypes) {
+                    error("Function %u: call_indirect with type %u which does not exist", idx, instr.a);
+                    return WASM_INVALID_TYPE_INDEX;
+                }
+
+                EXPECT(I32);
+                // fallthrough
+            case WASM_OP_CALL: {
+                struct TypeSectionType* callee;
+                if (instr.opcode == WASM_OP_CALL_INDIRECT)
+                    callee = &ctx->types[instr.a];
+                else if (instr.a < module->nfuncs)
+                    callee = module->functions[instr.a].signature;
+                else {
+                    error("Function %u: call to function %u which does not exist", idx, instr.a);
+                    return WASM_INVALID_FUNCTION_INDEX;
+                }
+
+                for (uint32_t j = callee->paramsLen; j-- > 0;)
+                    EXPECT(callee->params[j]);
+
+                if (callee->ret)
+                    PUSH(callee->ret);
+                break;
+            }
+
+            case WASM_OP_DROP: {
+                uint8_t t;
+                POP(t);
+                (void) t;
+                break;
+            }
+
+            case WASM_OP_SELECT: {
+                uint8_t t1, t2;
+                EXPECT(I32);
+                POP(t1);
+                POP(t2);
+                if (t1 != t2 && t1 != UNKNOWN && t2 != UNKNOWN)
+                    goto mismatch;
+
+                PUSH((t1 == UNKNOWN) ? t2 : t1);
+                break;
+            }
+
+            case WASM_OP_LOCAL_GET:
+            case WASM_OP_LOCAL_SET:
+            case WASM_OP_LOCAL_TEE: {
+                if (instr.a >= nlocals)
+                    goto local;
+
+                uint8_t t = (instr.a < type->paramsLen) ? type->params[instr.a] : code->locals[instr.a - type->paramsLen];
+                if (instr.opcode != WASM_OP_LOCAL_GET)
+                    EXPECT(t);
+                if (instr.opcode != WASM_OP_LOCAL_SET)
+                    PUSH(t);
+                break;
+            }
+
+            case WASM_OP_GLOBAL_GET:
+            case WASM_OP_GLOBAL_SET: {
+                // Imported globals come first in the index space
+                uint8_t t, mut;
+                if (instr.a < ctx->importedGlobals) {
+                    t = ctx->globalImports[instr.a]->valtype;
+                    mut = ctx->globalImports[instr.a]->mut;
+                }
+                else {
+                    uint64_t g = instr.a - ctx->importedGlobals;
+                    if (g >= module->nglobals) {
+                        error("Function %u: global %u does not exist", idx, instr.a);
+                        return WASM_INVALID_GLOBAL_INDEX;
+                    }
+
+                    t = module->globals[g].valtype;
+                    mut = module->globals[g].mut;
+                }
+
+                if (instr.opcode == WASM_OP_GLOBAL_GET)
+                    PUSH(t);
+                else if (!mut) {
+                    error("Function %u: global.set of immutable global %u", idx, instr.a);
+                    return WASM_IMMUTABLE_GLOBAL;
+                }
+                else
+                    EXPECT(t);
+                break;
+            }
+
+            case WASM_OP_MEMORY_SIZE:
+            case WASM_OP_MEMORY_GROW:
+                if (!ctx->memory || instr.a)
+                    goto memory;
+
+                if (instr.opcode == WASM_OP_MEMORY_GROW)
+                    EXPECT(I32);
+
+                PUSH(I32);
+                break;
+
+            case WASM_OP_I32_LOAD ... WASM_OP_I64_STORE32:
+                if (!ctx->memory)
+                    goto memory;
+
+                if (instr.a > opcodeSignatures[instr.opcode].align) {
+                    error("Function %u: alignment 2^%u is larger than the access", idx, instr.a);
+                    return WASM_INVALID_ALIGNMENT;
+                }
+                // fallthrough
+            default: {
+                const struct Signature* sig = (instr.opcode >> 8) ? &prefixedSignatures[instr.opcode & 0xFF] : &opcodeSignatures[instr.opcode];
+                APPLY(sig);
+                break;
+            }
+        }
+    }
+
+    if (reader.offset != code->codeSize) {
+        error("Function %u: code expression goes on after the function's end", idx);
+        return WASM_UNBALANCED_BLOCK;
+    }
+
+    return WASM_SUCCESS;
+
+underflow:
+    error("Function %u: instruction 0x%x at %u pops from an empty stack", idx, instr.opcode, reader.offset);
+    return WASM_STACK_UNDERFLOW;
+
+mismatch:
+    error("Function %u: instruction 0x%x at %u has operands or results of the wrong type", idx, instr.opcode, reader.offset);
+    return WASM_TYPE_MISMATCH;
+
+unused:
+    error("Function %u: block ends at %u with %u values left over", idx, reader.offset, nvalues - frames[nframes - 1].height);
+    return WASM_UNUSED_VALUES;
+
+label:
+    error("Function %u: branch at %u to a label that is not open", idx, reader.offset);
+    return WASM_INVALID_LABEL;
+
+local:
+    error("Function %u: local %u does not exist, there are %lu", idx, instr.a, nlocals);
+    return WASM_INVALID_LOCAL_INDEX;
+
+memory:
+    error("Function %u: instruction 0x%x at %u needs a memory", idx, instr.opcode, reader.offset);
+    return WASM_NO_MEMORY;
+}
+
+// Globals and the offsets of segments are a single constant, or the value
+// of an imported global that cannot change, then the end
+static int checkConst(struct CheckContext* ctx, const char* what, uint32_t idx, uint8_t* expr, uint32_t size, uint8_t type) {
+    struct WasmModuleReader reader;
+    struct Instruction instr;
+    codeReader(&reader, expr, 0, size);
+
+    int status = decodeInstruction(&reader, &instr);
+    if (status)
+        return status;
+
+    uint8_t t;
+    switch (instr.opcode) {
+        case WASM_OP_I32_CONST: t = I32; break;
+        case WASM_OP_I64_CONST: t = I64; break;
+        case WASM_OP_F32_CONST: t = F32; break;
+        case WASM_OP_F64_CONST: t = F64; break;
+
+        case WASM_OP_GLOBAL_GET:
+            if (instr.a >= ctx->importedGlobals || ctx->globalImports[instr.a]->mut) {
+                error("%s %u: global %u is not an immutable imported global", what, idx, instr.a);
+                return WASM_INVALID_GLOBAL_INDEX;
+            }
+
+            t = ctx->globalImports[instr.a]->valtype;
+            break;
+
+        default:
+            error("%s %u: opcode 0x%x is not allowed in a constant expression", what, idx, instr.opcode);
+            return WASM_INVALID_EXPR;
+    }
+
+    if (reader.offset != size - 1 || expr[size - 1] != WASM_OP_END) {
+        error("%s %u: constant expression has more than one instruction", what, idx);
+        return WASM_INVALID_EXPR;
+    }
+
+    if (t != type) {
+        error("%s %u: constant expression is of type 0x%x instead of 0x%x", what, idx, t, type);
+        return WASM_TYPE_MISMATCH;
+    }
+
+    return WASM_SUCCESS;
+}
+
+// Everything outside the bodies that is an expression
+static int checkInitializers(struct CheckContext* ctx) {
+    struct WasmModule* module = ctx->module;
+    for (uint32_t i = 0; i < module->nglobals; i++) {
+        struct GlobalSectionGlobal* global = &module->globals[i];
+        int status = checkConst(ctx, "Global", i + ctx->importedGlobals, global->expr, global->exprSize, global->valtype);
+        if (status)
+            return status;
+    }
+
+    for (uint32_t i = 0; module->memories && i < module->memories->nData; i++) {
+        if (!ctx->memory) {
+            error("Data segment %u: there is no memory to put it in", i);
+            return WASM_NO_MEMORY;
+        }
+
+        struct DataSectionData* data = &module->memories->init[i];
+        int status = checkConst(ctx, "Data segment", i, data->expr, data->exprSize, I32);
+        if (status)
+            return status;
+    }
+
+    for (uint32_t i = 0; module->tables && i < module->tables->nElement; i++) {
+        if (!ctx->table) {
+            error("Element segment %u: there is no table to put it in", i);
+            return WASM_NO_TABLE;
+        }
+
+        struct ElementSectionElement* element = &module->tables->init[i];
+        int status = checkConst(ctx, "Element segment", i, element->expr, element->exprSize, I32);
+        if (status)
+            return status;
+    }
+
+    return WASM_SUCCESS;
+}
+
+int validateFunctionCode(struct WasmModule* module, uint32_t idx, struct CodeSectionCode* code) {
+    struct Scratch* scratch = getScratch();
+    if (!scratch)
+        return WASM_OUT_OF_MEMORY;
+
+    // Only modules validateCode() has not seen yet need one made up
+    struct CheckContext* ctx = module->_check;
+    if (ctx)
+        return checkBody(ctx, scratch, idx, module->functions[idx].signature, code);
+
+    struct CheckContext local;
+    int status = createContext(module, &local, NULL);
+    if (!status)
+        status = checkBody(&local, scratch, idx, module->functions[idx].signature, code);
+
+    free(local.globalImports);
+    return status;
+}
+
+int validateCode(struct WasmModule* module) {
+    struct Scratch* scratch = getScratch();
+    if (!scratch)
+        return WASM_OUT_OF_MEMORY;
+
+    struct CheckContext* ctx = arenaAlloc(module->arena, sizeof(struct CheckContext));
+    if (!ctx)
+        return WASM_OUT_OF_MEMORY;
+
+    int status = createContext(module, ctx, module->arena);
+    if (!status)
+        status = checkInitializers(ctx);
+    if (status)
+        return status;
+
+    module->_check = ctx;
+    for (uint32_t i = 0; i < module->nfuncs; i++) {
+        // Imports and bodies that are yet to be decoded
+        struct CodeSectionCode* code = __atomic_load_n(&module->functions[i].code, __ATOMIC_ACQUIRE);
+        if (!code)
+            continue;
+
+        status = checkBody(ctx, scratch, i, module->functions[i].signature, code);
+        if (status)
+            return status;
+    }
+
+    return WASM_SUCCESS;
+}
+
+int validateFunction(struct WasmModule* module, uint32_t idx) {
+    if (!module)
+        return WASM_ARGUMENT_NULL;
+
+    if (idx >= module->nfuncs)
+        return WASM_INVALID_ARG;
+
+    // Lazily decoded bodies are checked on their way in
+    struct CodeSectionCode* code = __atomic_load_n(&module->functions[idx].code, __ATOMIC_ACQUIRE);
+    if (!code)
+        return getFunctionCode(module, idx, &code);
+
+    return validateFunctionCode(module, idx, code);
+}
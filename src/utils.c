@@ -1,12 +1,258 @@
 #include <libwasm.h>
+#include <section.h>
+#include <unistd.h>
+#include <string.h>
+
+#define  INITIAL_CUSTOM_INDEX_SIZE 8 // Must be a power of 2
+
+// All sections with one custom section name
+struct CustomSectionSlot {
+    uint64_t hash;
+    int32_t  first; // -1 marks a free slot
+    int32_t  last;
+};
+
+// Builtin sections are found by their id, custom sections through an open
+// addressing table keyed by their name hash. Both know the first and last
+// section of each kind and SectionEntry.next chains the rest together
+struct SectionIndex {
+    int32_t                   first[WASM_MAX_SECTION];
+    int32_t                   last[WASM_MAX_SECTION];
+    struct CustomSectionSlot* custom;
+    uint32_t                  capacity;
+    uint32_t                  used;
+};
+
+static struct CustomSectionSlot* findSlot(struct SectionIndex* index, uint64_t hash) {
+    uint32_t mask = index->capacity - 1;
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        if (index->custom[i].first == -1 || index->custom[i].hash == hash) 
+            return &index->custom[i];
+    }
+}
+
+static int growCustomIndex(struct WasmModule* module, struct SectionIndex* index) {
+    uint32_t capacity = (index->capacity) ? index->capacity * 2 : INITIAL_CUSTOM_INDEX_SIZE;
+    struct CustomSectionSlot* slots = arenaAlloc(module->arena, sizeof(struct CustomSectionSlot) * capacity);
+    if (!slots) 
+        return WASM_OUT_OF_MEMORY;
+
+    for (uint32_t i = 0; i < capacity; i++) 
+        slots[i].first = -1;
+
+    // The old table is released along with the rest of the arena
+    struct CustomSectionSlot* old = index->custom;
+    uint32_t oldCapacity = index->capacity;
+    index->custom = slots;
+    index->capacity = capacity;
+    for (uint32_t i = 0; i < oldCapacity; i++) {
+        if (old[i].first != -1) 
+            *findSlot(index, old[i].hash) = old[i];
+    }
+
+    return WASM_SUCCESS;
+}
+
+int indexSection(struct WasmModule* module, uint32_t i) {
+    struct SectionIndex* index = module->_index;
+    if (!index) {
+        index = arenaAlloc(module->arena, sizeof(struct SectionIndex));
+        if (!index) 
+            return WASM_OUT_OF_MEMORY;
+
+        for (int id = 0; id < WASM_MAX_SECTION; id++) 
+            index->first[id] = index->last[id] = -1;
+
+        index->custom = NULL;
+        index->capacity = 0;
+        index->used = 0;
+        module->_index = index;
+    }
+
+    struct SectionEntry* entry = &module->directory[i];
+    entry->next = -1;
+
+    int32_t* first;
+    int32_t* last;
+    if (entry->id != WASM_CUSTOM_SECTION) {
+        first = &index->first[entry->id];
+        last = &index->last[entry->id];
+    }
+    else {
+        // Staying at most half full keeps probe sequences short
+        if ((index->used + 1) * 2 > index->capacity && growCustomIndex(module, index)) 
+            return WASM_OUT_OF_MEMORY;
+
+        struct CustomSectionSlot* slot = findSlot(index, entry->hash);
+        if (slot->first == -1) {
+            slot->hash = entry->hash;
+            index->used++;
+        }
+
+        first = &slot->first;
+        last = &slot->last;
+    }
+
+    if (*first == -1) 
+        *first = i;
+    else 
+        module->directory[*last].next = i;
+
+    *last = i;
+    return WASM_SUCCESS;
+}
+
+// Sections past mod->flags have been found but not parsed yet by a
+// stream reader
+static int lookupSection(struct WasmModule* mod, const uint64_t hash) {
+    struct SectionIndex* index = mod->_index;
+    if (!mod->sections || !index) 
+        return -1;
+
+    int32_t i;
+    uint8_t id = builtinSectionId(hash);
+    if (id != WASM_CUSTOM_SECTION) 
+        i = index->first[id];
+    else if (index->capacity) 
+        i = findSlot(index, hash)->first;
+    else 
+        i = -1;
+
+    return (i != -1 && (uint64_t) i < mod->flags) ? i : -1;
+}
+
 int findSectionByHash(struct WasmModule* mod, const uint64_t hash) {
-    if (!mod->sections) 
+    int i = lookupSection(mod, hash);
+    if (i == -1 || loadSection(mod, i)) 
+        return -1;
+
+    return i;
+}
+
+int findNextSectionByHash(struct WasmModule* mod, int prev) {
+    if (prev < 0 || (uint64_t) prev >= mod->flags) 
         return -1;
 
-    for (int i = 0; i < mod->flags; i++) {
-        if (mod->sections[i].hash == hash) 
-            return i;
+    int i = mod->directory[prev].next;
+    if (i == -1 || (uint64_t) i >= mod->flags || loadSection(mod, i)) 
+        return -1;
+
+    return i;
+}
+
+int getSection(struct WasmModule* mod, const uint64_t hash, struct Section** section) {
+    if (!mod || !section) 
+        return WASM_ARGUMENT_NULL;
+
+    *section = NULL;
+    int i = lookupSection(mod, hash);
+    if (i == -1) 
+        return WASM_SUCCESS;
+
+    int n = loadSection(mod, i);
+    if (n) 
+        return n;
+
+    *section = &mod->sections[i];
+    return WASM_SUCCESS;
+}
+
+uint32_t workerCount(struct WasmConfig* config, uint32_t njobs) {
+    uint32_t n = config->threads;
+    if (!n) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = (cpus > 0) ? cpus : 1;
+    }
+
+    if (!njobs) 
+        return 1;
+
+    return (n > njobs) ? njobs : n;
+}
+
+struct NameLookup* createLookup(struct WasmArena* arena, uint32_t n) {
+    // At most half full so that a miss ends quickly
+    uint32_t capacity = 2;
+    while (capacity < (uint64_t) n * 2) 
+        capacity *= 2;
+
+    struct NameLookup* lookup = arenaAlloc(arena, sizeof(struct NameLookup));
+    if (!lookup) 
+        return NULL;
+
+    lookup->slots = arenaAlloc(arena, sizeof(uint32_t) * capacity);
+    if (!lookup->slots) 
+        return NULL;
+
+    memset(lookup->slots, 0, sizeof(uint32_t) * capacity);
+    lookup->mask = capacity - 1;
+    return lookup;
+}
+
+void insertLookup(struct NameLookup* lookup, uint64_t key, uint32_t i) {
+    uint32_t slot = key & lookup->mask;
+    while (lookup->slots[slot]) 
+        slot = (slot + 1) & lookup->mask;
+
+    lookup->slots[slot] = i + 1;
+}
+
+uint64_t importKey(uint64_t hashModule, uint64_t hashName) {
+    // Mix the two so that the same name from different modules spreads out
+    return (hashModule * 0x100000001b3UL) ^ hashName;
+}
+
+// Names are not NUL terminated in view mode so compare lengths first
+static int sameName(const char* a, uint32_t alen, const char* b, uint32_t blen) {
+    return alen == blen && !memcmp(a, b, alen);
+}
+
+struct ExportSectionExport* findExport(struct WasmModule* mod, const char* name, uint8_t kind) {
+    if (!mod || !name) 
+        return NULL;
+
+    int idx = findSectionByHash(mod, WASM_HASH_Export);
+    if (idx == -1 || !mod->sections[idx]._lookup) 
+        return NULL;
+
+    struct Section* section = &mod->sections[idx];
+    uint32_t len = strlen(name);
+    uint64_t key = hashN(name, len);
+    struct NameLookup* lookup = section->_lookup;
+    for (uint32_t slot = key & lookup->mask; lookup->slots[slot]; slot = (slot + 1) & lookup->mask) {
+        struct ExportSectionExport* export = &section->exports[lookup->slots[slot] - 1];
+        if (export->hashName == key && export->type == kind && sameName(export->name, export->nameLen, name, len)) 
+            return export;
+    }
+
+    return NULL;
+}
+
+struct ImportSectionImport* findImport(struct WasmModule* mod, const char* moduleName, const char* name) {
+    if (!mod || !moduleName || !name) 
+        return NULL;
+
+    int idx = findSectionByHash(mod, WASM_HASH_Import);
+    if (idx == -1 || !mod->sections[idx]._lookup) 
+        return NULL;
+
+    struct Section* section = &mod->sections[idx];
+    uint32_t moduleLen = strlen(moduleName);
+    uint32_t len = strlen(name);
+    uint64_t hashModule = hashN(moduleName, moduleLen);
+    uint64_t hashName = hashN(name, len);
+    uint64_t key = importKey(hashModule, hashName);
+    struct NameLookup* lookup = section->_lookup;
+
+    // Entries sit in the order they were inserted, so the first match is
+    // the first such import in the section
+    for (uint32_t slot = key & lookup->mask; lookup->slots[slot]; slot = (slot + 1) & lookup->mask) {
+        struct ImportSectionImport* import = &section->imports[lookup->slots[slot] - 1];
+        if (import->hashModule == hashModule && import->hashName == hashName &&
+            sameName(import->module, import->moduleLen, moduleName, moduleLen) &&
+            sameName(import->name, import->nameLen, name, len)) 
+            return import;
     }
 
-    return -1;
+    return NULL;
 }
@@ -1,5 +1,6 @@
 #include "precompiled-hashes.h"
 #include <libwasm.h>
+#include <section.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -8,7 +9,60 @@ static int compactIntoTable();
 static int compactIntoImport();
 static int prepareValidatedModule();
 
+static int linkModule(struct WasmModule *module);
+
 int validateModule(struct WasmModule *module) {
+    // Linking again would allocate everything over, and a module others
+    // may already be running must not turn invalid meanwhile
+    if (__atomic_load_n(&module->_validated, __ATOMIC_ACQUIRE))
+        return WASM_SUCCESS;
+
+    // Modules loaded from a dump have their functions but none of the
+    // sections to check them against
+    if (!module->sections && module->functions)
+        return WASM_INVALID_ARG;
+
+    // Lazily parsed sections are loaded, and allocate from the module's 
+    // arena, under this lock
+    if (!module->_lazy) {
+        // Whatever failed part of the way through leaves the module unusable
+        module->_check = NULL;
+        int status = (module->_linked) ? WASM_SUCCESS : linkModule(module);
+        module->_linked = !status;
+        if (!status)
+            status = validateCode(module);
+
+        module->_validated = !status;
+        return status;
+    }
+
+    // Linking needs nearly every section anyway, loading them all up front
+    // reports the same error an eager parse would have. Whoever gets the
+    // lock first validates, everybody after that sees the result
+    pthread_mutex_lock(&module->_lazy->lock);
+    if (module->_validated) {
+        pthread_mutex_unlock(&module->_lazy->lock);
+        return WASM_SUCCESS;
+    }
+
+    module->_check = NULL;
+    int status = WASM_SUCCESS;
+    for (uint32_t i = 0; i < module->nsections && !status; i++) 
+        status = loadSection(module, i);
+
+    if (!status && !module->_linked) 
+        status = linkModule(module);
+
+    module->_linked = !status;
+    if (!status) 
+        status = validateCode(module);
+
+    __atomic_store_n(&module->_validated, !status, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&module->_lazy->lock);
+    return status;
+}
+
+static int linkModule(struct WasmModule *module) {
     int typeidx = findSectionByHash(module, WASM_HASH_Type);
     int fnidx = findSectionByHash(module, WASM_HASH_Function);
     int codeidx = findSectionByHash(module, WASM_HASH_Code);
@@ -25,10 +79,13 @@ int validateModule(struct WasmModule *module) {
 		    return WASM_NO_TYPE;
     }
 
-    // Now we know all our code, type and function sections are present
+    // Now we know the type section is present. A module can still have
+    // types and no functions of its own, so missing function and code
+    // sections count as empty ones
     // Now see if function and code sections are equal in length
-    struct Section function = module->sections[fnidx];
-    struct Section code = module->sections[codeidx];
+    struct Section empty = {0};
+    struct Section function = (fnidx == -1) ? empty : module->sections[fnidx];
+    struct Section code = (codeidx == -1) ? empty : module->sections[codeidx];
     struct Section type = module->sections[typeidx];
 
     if (function.flags != code.flags)
@@ -49,25 +106,43 @@ int validateModule(struct WasmModule *module) {
     // To make it easier to access the function as a whole entity,
     // we will group all the units of a function into one structure
 
-    // We also need to include the imports as functions
+    // We also need to include the imported functions as functions
     int impidx = findSectionByHash(module, WASM_HASH_Import);
     int imported = 0;
-    if (impidx != -1) 
-        imported = module->sections[impidx].flags;
+    if (impidx != -1) {
+        for (uint32_t i = 0; i < module->sections[impidx].flags; i++) {
+            if (module->sections[impidx].imports[i].type == WASM_TYPEIDX) 
+                imported++;
+        }
+    }
+
+    module->functions = arenaAlloc(module->arena, sizeof(Function) * (function.flags + imported + 1));
+    if (!module->functions)
+        return WASM_OUT_OF_MEMORY;
+
+    for (int i = 0, j = 0; i < imported; j++) {
+        struct ImportSectionImport* import = &module->sections[impidx].imports[j];
+        if (import->type != WASM_TYPEIDX) 
+            continue;
 
-    module->functions = malloc(sizeof(Function) * (function.flags + imported));
-    for (int i = 0; i < imported; i++) {
-        module->functions[i].signature = &module->sections[typeidx].types[i];
+        if (import->index >= tysize) 
+            return WASM_INVALID_TYPE_INDEX;
+
+        module->functions[i].signature = &module->sections[typeidx].types[import->index];
         module->functions[i].code = NULL;
         module->functions[i].hash = 0;
         module->functions[i].name = NULL;
+        module->functions[i].nameLen = 0;
+        i++;
     }
 
     for (int i = imported; i < function.flags + imported; i++) {
-	    module->functions[i].signature = &module->sections[typeidx].types[i];
-	    module->functions[i].code = &module->sections[codeidx].code[i];
+	    module->functions[i].signature = &module->sections[typeidx].types[function.functions[i - imported]];
+	    // Lazily decoded bodies are filled in by getFunctionCode()
+	    module->functions[i].code = (code._bodies) ? NULL : &code.code[i - imported];
         module->functions[i].hash = 0;
         module->functions[i].name = NULL;
+        module->functions[i].nameLen = 0;
     }
 
     module->nfuncs = function.flags + imported;
@@ -77,7 +152,7 @@ int validateModule(struct WasmModule *module) {
         struct Section n = module->sections[nameidx];
         if (n.names->moduleName) {
             module->name = n.names->moduleName;
-            module->hash = hash(n.names->moduleName);
+            module->hash = hashN(n.names->moduleName, n.names->moduleNameLen);
         }
 
         int valid = 1;
@@ -91,8 +166,9 @@ int validateModule(struct WasmModule *module) {
         }
 
         if (valid) {
-            for (int i = 0; i < (function.flags + imported); i++) {
-                module->functions[i].name = n.names->functionNames[i];
+            for (uint32_t i = 0; i < n.flags; i++) {
+                module->functions[n.names->indexes[i]].name = n.names->functionNames[i];
+                module->functions[n.names->indexes[i]].nameLen = n.names->functionNameLens[i];
             }
             
         }
@@ -105,14 +181,20 @@ int validateModule(struct WasmModule *module) {
 
     int tabidx = findSectionByHash(module, WASM_HASH_Table);
     int elementidx = findSectionByHash(module, WASM_HASH_Element);
-    module->tables = malloc(sizeof(struct Table) * 1);
+    module->tables = arenaAlloc(module->arena, sizeof(struct Table) * 1);
+    if (!module->tables)
+        return WASM_OUT_OF_MEMORY;
+
     module->tables->table = (tabidx == -1) ? NULL : module->sections[tabidx].table;
     module->tables->init = (elementidx == -1) ? NULL : module->sections[elementidx].element;
     module->tables->nElement =  (elementidx == -1) ? 0 : module->sections[elementidx].flags;
 
     int memidx = findSectionByHash(module, WASM_HASH_Memory);
     int dataidx = findSectionByHash(module, WASM_HASH_Data);
-    module->memories = malloc(sizeof(struct Memory) * 1);
+    module->memories = arenaAlloc(module->arena, sizeof(struct Memory) * 1);
+    if (!module->memories)
+        return WASM_OUT_OF_MEMORY;
+
     module->memories->memory = (memidx == -1) ? NULL : module->sections[memidx].memory;
     module->memories->init = (dataidx == -1) ? NULL : module->sections[dataidx].data;
     module->memories->nData =  (dataidx == -1) ? 0 : module->sections[dataidx].flags;
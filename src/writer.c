@@ -0,0 +1,426 @@
+#include <libwasm.h>
+#include <section.h>
+#include <log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Size of the magic number and version in front of the first section
+#define WASM_HEADER_SIZE 8
+
+// Sections are encoded twice, first without a buffer to find out their
+// exact size, which goes in front of them, and then for real
+struct Encoder {
+    uint8_t* buf;
+    uint64_t size;
+};
+
+static inline void putByte(struct Encoder* enc, uint8_t b) {
+    if (enc->buf)
+        enc->buf[enc->size] = b;
+
+    enc->size++;
+}
+
+static inline void putBytes(struct Encoder* enc, const void* src, uint32_t n) {
+    if (enc->buf && n)
+        memcpy(enc->buf + enc->size, src, n);
+
+    enc->size += n;
+}
+
+// Number of bytes v takes up as unsigned leb128
+static inline uint32_t lebSize(uint32_t v) {
+    return (v) ? (31 - __builtin_clz(v)) / 7 + 1 : 1;
+}
+
+static inline void putLEB(struct Encoder* enc, uint32_t v) {
+    if (!enc->buf) {
+        enc->size += lebSize(v);
+        return;
+    }
+
+    uint8_t* p = enc->buf + enc->size;
+    while (v >= 0x80) {
+        *p++ = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+
+    *p++ = v;
+    enc->size = p - enc->buf;
+}
+
+static inline void putName(struct Encoder* enc, const char* name, uint32_t len) {
+    putLEB(enc, len);
+    putBytes(enc, name, len);
+}
+
+// Limits without a maximum are parsed with max = UINT32_MAX
+static void putLimits(struct Encoder* enc, struct TableSectionTable* limits) {
+    putByte(enc, limits->max != UINT32_MAX);
+    putLEB(enc, limits->min);
+    if (limits->max != UINT32_MAX)
+        putLEB(enc, limits->max);
+}
+
+// Locals are kept one type per local, they go back as runs of the same type
+static uint32_t localRuns(struct CodeSectionCode* code) {
+    uint32_t runs = 0;
+    for (uint32_t i = 0; i < code->localSize; i++)
+        runs += (!i || code->locals[i] != code->locals[i - 1]);
+
+    return runs;
+}
+
+static void putLocals(struct Encoder* enc, struct CodeSectionCode* code) {
+    putLEB(enc, localRuns(code));
+    for (uint32_t i = 0; i < code->localSize;) {
+        uint32_t j = i + 1;
+        while (j < code->localSize && code->locals[j] == code->locals[i])
+            j++;
+
+        putLEB(enc, j - i);
+        putByte(enc, code->locals[i]);
+        i = j;
+    }
+}
+
+static int putCode(struct WasmModule* module, struct Section* section, struct Encoder* enc) {
+    uint32_t n = section->flags;
+    uint32_t imported = module->nfuncs - n;
+    putLEB(enc, n);
+
+    for (uint32_t i = 0; i < n; i++) {
+        struct CodeSectionCode* code = &section->code[i];
+
+        // Bodies that were only indexed have to be decoded first
+        if (section->_bodies) {
+            if (!module->functions || module->nfuncs < n) {
+                error("Lazily decoded code can only be written once the module is validated");
+                return WASM_INVALID_ARG;
+            }
+
+            int status = getFunctionCode(module, imported + i, &code);
+            if (status)
+                return status;
+        }
+
+        struct Encoder body = { .buf = NULL, .size = 0 };
+        putLocals(&body, code);
+        putLEB(enc, body.size + code->codeSize);
+        putLocals(enc, code);
+        putBytes(enc, code->expr, code->codeSize);
+    }
+
+    return WASM_SUCCESS;
+}
+
+// Encodes the contents of a builtin section, everything but its id and size
+static int encodeSection(struct WasmModule* module, uint32_t i, struct Encoder* enc) {
+    struct Section* section = &module->sections[i];
+    uint32_t n = section->flags;
+
+    switch (module->directory[i].id) {
+        case WASM_TYPE_SECTION:
+            putLEB(enc, n);
+            for (uint32_t j = 0; j < n; j++) {
+                struct TypeSectionType* type = &section->types[j];
+                putByte(enc, 0x60);
+                putLEB(enc, type->paramsLen);
+                putBytes(enc, type->params, type->paramsLen);
+                putLEB(enc, type->ret != 0);
+                if (type->ret)
+                    putByte(enc, type->ret);
+            }
+            break;
+
+        case WASM_IMPORT_SECTION:
+            putLEB(enc, n);
+            for (uint32_t j = 0; j < n; j++) {
+                struct ImportSectionImport* import = &section->imports[j];
+
+                // Imported tables and memories lose their limits
+                if (import->type != WASM_TYPEIDX && import->type != WASM_GLOBALTYPE) {
+                    error("Only function and global imports can be encoded");
+                    return WASM_INVALID_IMPORT_TYPE;
+                }
+
+                putName(enc, import->module, import->moduleLen);
+                putName(enc, import->name, import->nameLen);
+                putByte(enc, import->type);
+                if (import->type == WASM_TYPEIDX)
+                    putLEB(enc, import->index);
+                else {
+                    putByte(enc, import->valtype);
+                    putByte(enc, import->mut);
+                }
+            }
+            break;
+
+        case WASM_FUNCTION_SECTION:
+            putLEB(enc, n);
+            for (uint32_t j = 0; j < n; j++)
+                putLEB(enc, section->functions[j]);
+            break;
+
+        case WASM_TABLE_SECTION:
+            putLEB(enc, 1);
+            putByte(enc, 0x70);
+            putLimits(enc, section->table);
+            break;
+
+        case WASM_MEMORY_SECTION:
+            putLEB(enc, 1);
+            putLimits(enc, section->memory);
+            break;
+
+        case WASM_GLOBAL_SECTION:
+            putLEB(enc, n);
+            for (uint32_t j = 0; j < n; j++) {
+                putByte(enc, section->globals[j].valtype);
+                putByte(enc, section->globals[j].mut);
+                putBytes(enc, section->globals[j].expr, section->globals[j].exprSize);
+            }
+            break;
+
+        case WASM_EXPORT_SECTION:
+            putLEB(enc, n);
+            for (uint32_t j = 0; j < n; j++) {
+                putName(enc, section->exports[j].name, section->exports[j].nameLen);
+                putByte(enc, section->exports[j].type);
+                putLEB(enc, section->exports[j].index);
+            }
+            break;
+
+        case WASM_START_SECTION:
+            putLEB(enc, section->start);
+            break;
+
+        case WASM_ELEMENT_SECTION:
+            putLEB(enc, n);
+            for (uint32_t j = 0; j < n; j++) {
+                struct ElementSectionElement* element = &section->element[j];
+                putLEB(enc, 0); // table index
+                putBytes(enc, element->expr, element->exprSize);
+                putLEB(enc, element->len);
+                for (uint32_t k = 0; k < element->len; k++)
+                    putLEB(enc, element->funcidx[k]);
+            }
+            break;
+
+        case WASM_CODE_SECTION:
+            return putCode(module, section, enc);
+
+        case WASM_DATA_SECTION:
+            putLEB(enc, n);
+            for (uint32_t j = 0; j < n; j++) {
+                struct DataSectionData* data = &section->data[j];
+                putLEB(enc, 0); // memory index
+                putBytes(enc, data->expr, data->exprSize);
+                putLEB(enc, data->len);
+                putBytes(enc, data->bytes, data->len);
+            }
+            break;
+
+        // Their bytes are all there is to them, there is nothing parsed
+        // that an edit could have gone into
+        case WASM_CUSTOM_SECTION:
+            error("Custom sections cannot be marked changed");
+            return WASM_INVALID_ARG;
+
+        default:
+            return WASM_INTERNAL_ERROR;
+    }
+
+    return WASM_SUCCESS;
+}
+
+static int reencode(struct WasmModuleWriter* writer, struct SectionEntry* entry) {
+    if (entry->edit == WASM_SECTION_CHANGED)
+        return 1;
+
+    // Nothing but the bytes of a custom section is kept
+    return (writer->config->flags & WASM_CONFIG_REENCODE) && entry->id != WASM_CUSTOM_SECTION;
+}
+
+// Where section i starts in the module's bytes, header included. Sections
+// follow each other without gaps so that is where the one before it ends
+static uint32_t sectionStart(struct WasmModule* module, uint32_t i) {
+    if (!i)
+        return WASM_HEADER_SIZE;
+
+    return module->directory[i - 1].offset + module->directory[i - 1].size;
+}
+
+static int writeFile(const char* fname, const uint8_t* buf, uint32_t size) {
+    int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error("Failed to open %s for writing", fname);
+        return WASM_FILE_ACCESS_ERROR;
+    }
+
+    int status = WASM_SUCCESS;
+    while (size) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            status = WASM_FILE_ACCESS_ERROR;
+            break;
+        }
+
+        buf += n;
+        size -= n;
+    }
+
+    if (close(fd) && !status)
+        status = WASM_FILE_ACCESS_ERROR;
+
+    if (status)
+        error("Writing %s failed: %s", fname, strerror(errno));
+
+    return status;
+}
+
+int createWriter(struct WasmModuleWriter* init, struct WasmConfig* config) {
+    if (!init)
+        return WASM_ARGUMENT_NULL;
+
+    if (!config)
+        return WASM_INVALID_ARG;
+
+    init->thisModule = NULL;
+    init->config = config;
+    init->size = 0;
+    init->offset = 0;
+    init->_data = NULL;
+    return WASM_SUCCESS;
+}
+
+int writeModule(struct WasmModuleWriter* writer, struct WasmModule* module) {
+    if (!writer || !module)
+        return WASM_ARGUMENT_NULL;
+
+    if (!module->_source || !module->sections) {
+        error("Module has no sections to write");
+        return WASM_INVALID_ARG;
+    }
+
+    uint32_t* sizes = malloc(sizeof(uint32_t) * (module->nsections ? module->nsections : 1));
+    if (!sizes)
+        return WASM_OUT_OF_MEMORY;
+
+    // First find out how large everything is
+    uint64_t total = WASM_HEADER_SIZE;
+    int status = WASM_SUCCESS;
+    for (uint32_t i = 0; i < module->nsections && !status; i++) {
+        struct SectionEntry* entry = &module->directory[i];
+        if (entry->edit == WASM_SECTION_REMOVED)
+            continue;
+
+        if (!reencode(writer, entry)) {
+            total += entry->offset + entry->size - sectionStart(module, i);
+            continue;
+        }
+
+        status = loadSection(module, i);
+        struct Encoder enc = { .buf = NULL, .size = 0 };
+        if (!status)
+            status = encodeSection(module, i, &enc);
+
+        if (!status && enc.size > UINT32_MAX)
+            status = WASM_SECTION_TOO_LARGE;
+
+        sizes[i] = enc.size;
+        total += 1 + lebSize(sizes[i]) + enc.size;
+    }
+
+    if (!status && total > UINT32_MAX)
+        status = WASM_MODULE_TOO_LARGE;
+
+    uint8_t* buf = (status) ? NULL : malloc(total);
+    if (!status && !buf)
+        status = WASM_OUT_OF_MEMORY;
+
+    if (status) {
+        free(sizes);
+        return status;
+    }
+
+    struct Encoder enc = { .buf = buf, .size = 0 };
+    // Both are little endian in the file, whatever the host is
+    for (uint32_t shift = 0; shift < 32; shift += 8)
+        putByte(&enc, (uint8_t) (WASM_MAGIC >> shift));
+    for (uint32_t shift = 0; shift < 32; shift += 8)
+        putByte(&enc, (uint8_t) (WASM_VERSION >> shift));
+
+    // Unchanged sections next to each other are copied together, so an
+    // unchanged module is a single copy
+    const uint8_t* source = module->_source;
+    uint32_t runStart = 0, runEnd = 0;
+    for (uint32_t i = 0; i < module->nsections && !status; i++) {
+        struct SectionEntry* entry = &module->directory[i];
+        if (entry->edit == WASM_SECTION_REMOVED)
+            continue;
+
+        if (!reencode(writer, entry)) {
+            if (runEnd != sectionStart(module, i)) {
+                putBytes(&enc, source + runStart, runEnd - runStart);
+                runStart = sectionStart(module, i);
+            }
+
+            runEnd = entry->offset + entry->size;
+            continue;
+        }
+
+        putBytes(&enc, source + runStart, runEnd - runStart);
+        runStart = runEnd = 0;
+
+        putByte(&enc, entry->id);
+        putLEB(&enc, sizes[i]);
+        status = encodeSection(module, i, &enc);
+    }
+
+    putBytes(&enc, source + runStart, runEnd - runStart);
+    free(sizes);
+
+    // Both passes have to agree on every byte
+    if (!status && enc.size != total) {
+        error("Encoded module is %lu bytes instead of %lu", enc.size, total);
+        status = WASM_INTERNAL_ERROR;
+    }
+
+    if (!status && writer->config->name)
+        status = writeFile(writer->config->name, buf, total);
+
+    if (status) {
+        free(buf);
+        return status;
+    }
+
+    free(writer->_data);
+    writer->_data = buf;
+    writer->size = total;
+    writer->offset = total;
+    writer->thisModule = module;
+    return WASM_SUCCESS;
+}
+
+struct WasmModule* getModuleFromWriter(struct WasmModuleWriter* init) {
+    return init->thisModule;
+}
+
+const void* getDataFromWriter(struct WasmModuleWriter* writer) {
+    return writer->_data;
+}
+
+void destroyWriter(struct WasmModuleWriter* obj) {
+    free(obj->_data);
+    obj->_data = NULL;
+    obj->thisModule = NULL;
+    obj->size = 0;
+    obj->offset = 0;
+}
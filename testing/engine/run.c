@@ -0,0 +1,118 @@
+#include <libwasm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Loads a module, calls one of its exports and prints what came of it:
+//   load <error>    the module did not parse or validate
+//   create <error>  createInstance() failed
+//   trap <error>    the call trapped
+//   ok <bits> <f64> the result as an integer and as a double
+// Arguments with a '.' in them are doubles, the rest integers in any base.
+// Every line ends with a newline so test.py can compare whole lines
+
+// env.add: the sum of two i32s
+static int hostAdd(Instance* instance, uint64_t* slots, void* data) {
+    (void) instance;
+    (void) data;
+    slots[0] = (uint32_t) (slots[0] + slots[1]);
+    return WASM_SUCCESS;
+}
+
+// env.back: calls the module's export "inner" with its argument and
+// returns ten times what that gives back
+static int hostBack(Instance* instance, uint64_t* slots, void* data) {
+    (void) data;
+    Export* inner = findExport(instance->module, "inner", WASM_TYPEIDX);
+    if (!inner)
+        return WASM_INVALID_ARG;
+
+    uint64_t args[2] = { slots[0] };
+    int s = callFunction(instance, inner->index, args);
+    slots[0] = args[0] * 10;
+    return s;
+}
+
+static const char* message(int s) {
+    static char line[256];
+    snprintf(line, sizeof(line), "%s", errString(s));
+    line[strcspn(line, "\n")] = 0;
+    return line;
+}
+
+int main(int argc, const char* argv[]) {
+    struct WasmHostImport imports[] = { { "env", "add", hostAdd, NULL }, { "env", "back", hostBack, NULL } };
+    struct WasmGlobalImport globals[] = { { "env", "g", 100 } };
+    struct WasmInstanceConfig ic = { .nimports = 2, .imports = imports, .nglobals = 1, .globals = globals };
+
+    argv++;
+    argc--;
+    while (argc > 1 && (!strcmp(*argv, "-j") || !strcmp(*argv, "-s"))) {
+        if (!strcmp(*argv, "-j"))
+            ic.jitThreshold = atoi(argv[1]);
+        else
+            ic.stackSlots = atoi(argv[1]);
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc < 3) {
+        printf("Usage: run [-j jitThreshold] [-s stackSlots] flags file export args...\n");
+        return 1;
+    }
+
+    ic.flags = strtoul(argv[0], NULL, 0);
+
+    Config config = {0};
+    Reader reader = {0};
+    config.name = argv[1];
+    int s = createReader(&reader, &config);
+    if (!s)
+        s = parseModule(&reader);
+    if (!s)
+        s = validateModule(getModuleFromReader(&reader));
+    if (s) {
+        printf("load %s\n", message(s));
+        destroyReader(&reader);
+        return 0;
+    }
+
+    Module* mod = getModuleFromReader(&reader);
+    Export* e = findExport(mod, argv[2], WASM_TYPEIDX);
+    if (!e) {
+        printf("load no export %s\n", argv[2]);
+        destroyReader(&reader);
+        return 0;
+    }
+
+    Instance instance;
+    s = createInstance(&instance, mod, &ic);
+    if (s) {
+        printf("create %s\n", message(s));
+        destroyReader(&reader);
+        return 0;
+    }
+
+    uint64_t slots[16] = {0};
+    for (int i = 3; i < argc && i < 19; i++) {
+        if (strchr(argv[i], '.')) {
+            double d = atof(argv[i]);
+            memcpy(&slots[i - 3], &d, sizeof(d));
+        }
+        else
+            slots[i - 3] = strtoull(argv[i], NULL, 0);
+    }
+
+    s = callFunction(&instance, e->index, slots);
+    if (s)
+        printf("trap %s\n", message(s));
+    else {
+        double d;
+        memcpy(&d, slots, sizeof(d));
+        printf("ok %llu %g\n", (unsigned long long) slots[0], d);
+    }
+
+    destroyInstance(&instance);
+    destroyReader(&reader);
+    return 0;
+}
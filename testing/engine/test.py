@@ -0,0 +1,360 @@
+# Runs small modules under every engine and checks each gives the expected
+# result or trap, then runs random programs and checks they all agree.
+# Invalid modules have to be turned away before anything runs.
+#
+#   python3 testing/engine/test.py path/to/run [--fuzz count] [--seed n]
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from wasmgen import *
+
+# What run is given ahead of the file for each engine, see WASM_INSTANCE_*
+ENGINES = [
+    ('threaded', ['0']),
+    ('switch',   ['1']),
+    ('registers', ['2']),
+    ('registers-switch', ['3']),
+    # Every function compiled before its first call
+    ('jit',       ['-j', '1', '6']),
+    ('jit-stack', ['-j', '1', '4']),
+    # Compiled on the fifth call or the fifth time around a loop, which
+    # then goes on in machine code from the loop's start
+    ('tiered',    ['-j', '5', '6']),
+    # Memory on the heap with every access checked, instead of guard pages
+    ('checked',           ['8']),
+    ('jit-checked',       ['-j', '1', '14']),
+    ('jit-stack-checked', ['-j', '1', '12']),
+]
+
+# Types the cases pick from by index
+T = [([I32, I32], [I32]), ([], []), ([I32], [I32]), ([], [I32]), ([F64], [I32]), ([F64], [I64]),
+     ([F32], [I32]), ([F64], [F64]), ([I64], [I64])]
+
+cases = []    # name, module, args, what the output line starts with
+invalid = []  # name, module, what the load error says
+
+
+def case(name, funcs, args, expect, **kw):
+    """The first function after the imported ones is exported as run"""
+    imported = [what for _, _, what in kw.get('imports', ()) if not isinstance(what, tuple)]
+    exports = [('run', 0, len(imported))] + kw.pop('exports', [])
+    cases.append((name, module(T, funcs, exports=exports, **kw), args, expect))
+
+
+def bad(name, funcs, expect, **kw):
+    invalid.append((name, module(T, funcs, **kw), expect))
+
+
+# Traps
+case('div_zero',     [(0, [], 'local.get 0\nlocal.get 1\ni32.div_s')], ['1', '0'], 'trap Trap: integer divide by zero')
+case('divu_zero',    [(0, [], 'local.get 0\nlocal.get 1\ni32.rem_u')], ['1', '0'], 'trap Trap: integer divide by zero')
+case('div_overflow', [(0, [], 'local.get 0\nlocal.get 1\ni32.div_s')], ['0x80000000', '0xffffffff'], 'trap Trap: integer overflow')
+case('rem_overflow', [(0, [], 'local.get 0\nlocal.get 1\ni32.rem_s')], ['0x80000000', '0xffffffff'], 'ok 0 ')
+case('div_s',        [(0, [], 'local.get 0\nlocal.get 1\ni32.div_s')], ['0xfffffff9', '2'], 'ok 4294967293 ')
+case('i64_div_zero', [(8, [], 'local.get 0\ni64.const 0\ni64.div_u')], ['1'], 'trap Trap: integer divide by zero')
+case('i64_div_overflow', [(8, [], 'local.get 0\ni64.const -1\ni64.div_s')], ['0x8000000000000000'], 'trap Trap: integer overflow')
+case('unreachable',  [(1, [], 'unreachable')], [], 'trap Trap: unreachable')
+case('oob',          [(2, [], 'local.get 0\ni32.load 2 0')], ['65533'], 'trap Trap: memory access out of bounds', memory=1)
+case('in_bounds',    [(2, [], 'local.get 0\ni32.load 2 0')], ['65532'], 'ok 0 ', memory=1)
+case('oob_offset',   [(2, [], 'local.get 0\ni32.load 2 4294967295')], ['1'], 'trap Trap: memory access out of bounds', memory=1)
+case('oob_store',    [(2, [], 'local.get 0\ni32.const 1\ni32.store 2 0\ni32.const 0')], ['65535'], 'trap Trap: memory access out of bounds', memory=1)
+
+# Accesses that machine code leaves to fault on the guard pages, from
+# calls nested in machine code, from loops, across the end of memory,
+# after memory.grow and with no memory pages at all
+OOB = 'trap Trap: memory access out of bounds'
+nested = [(2, [], 'local.get 0\ncall 1\ni32.const 1\ni32.add'), (2, [], 'local.get 0\ncall 2'), (2, [], 'local.get 0\ni32.load 2 0')]
+case('guard_deep',     nested, ['65536'], OOB, memory=1)
+case('guard_deep_ok',  nested, ['8'], 'ok 1 ', memory=1)
+case('guard_loop',     [(2, [I32], 'loop\nlocal.get 1\ni32.load 2 0\ndrop\nlocal.get 1\ni32.const 4096\ni32.add\nlocal.tee 1\n'
+                                 'local.get 0\ni32.lt_u\nbr_if 0\nend\nlocal.get 1')], ['200000'], OOB, memory=1)
+case('guard_straddle', [(2, [], 'i32.const 65528\ni64.const -1\ni64.store 3 4\ni32.const 65528\ni32.load 2 0')], ['0'], OOB, memory=1)
+case('guard_huge_ofs', [(2, [], 'local.get 0\ni64.load 3 4294967295\ni32.wrap_i64')], ['0xffffffff'], OOB, memory=1)
+case('guard_grown',    [(2, [], 'i32.const 1\nmemory.grow\ndrop\nlocal.get 0\ni32.const 9\ni32.store 2 0\nlocal.get 0\ni32.load 2 0')],
+     ['131068'], 'ok 9 ', memory=1)
+case('guard_grown_oob', [(2, [], 'i32.const 1\nmemory.grow\ndrop\nlocal.get 0\ni32.load 2 0')], ['131069'], OOB, memory=1)
+case('guard_no_pages', [(2, [], 'local.get 0\ni32.load8_u 0 0')], ['0'], OOB, memory=0)
+case('guard_reenter',  [(2, [I32, I32, I32], 'local.get 0\ncall 0\ni32.const 1\ni32.add'), (2, [], 'local.get 0\ni32.load 2 0')],
+     ['70000'], OOB, memory=1, imports=[('env', 'back', 2)], exports=[('inner', 0, 2)])
+
+case('recursion',    [(2, [], 'local.get 0\ncall 0')], ['1'], 'trap Trap: call stack exhausted')
+case('trunc_big',    [(4, [], 'local.get 0\ni32.trunc_f64_s')], ['3000000000.0'], 'trap Trap: integer overflow')
+case('trunc_negu',   [(4, [], 'local.get 0\ni32.trunc_f64_u')], ['-1.0'], 'trap Trap: integer overflow')
+case('trunc_neg',    [(4, [], 'local.get 0\ni32.trunc_f64_u')], ['-0.9'], 'ok 0 ')
+case('trunc_min',    [(4, [], 'local.get 0\ni32.trunc_f64_s')], ['-2147483648.9'], 'ok 2147483648 ')
+case('trunc_sat',    [(4, [], 'local.get 0\ni32.trunc_sat_f64_s')], ['1.0e20'], 'ok 2147483647 ')
+case('trunc_sat_u',  [(5, [], 'local.get 0\ni64.trunc_sat_f64_u')], ['-5.0'], 'ok 0 ')
+
+# Memory
+case('grow',      [(3, [], 'i32.const 2\nmemory.grow\ndrop\ni32.const 131068\ni32.const 7\ni32.store 2 0\n'
+                           'i32.const 131068\ni32.load 2 0\nmemory.size\ni32.add')], [], 'ok 10 ', memory=1)
+case('grow_fail', [(3, [], 'i32.const 70000\nmemory.grow')], [], 'ok 4294967295 ', memory=1)
+case('load8_s',   [(2, [], 'i32.const 0\nlocal.get 0\ni32.store8 0 0\ni32.const 0\ni32.load8_s 0 0')], ['0xff'], 'ok 4294967295 ', memory=1)
+case('data',      [(3, [], 'i32.const 0\ni32.load 2 16')], [], 'ok 67305985 ', memory=1, data=[(16, [1, 2, 3, 4])])
+
+# Numbers
+case('min_zero',  [(7, [], 'f64.const -0.0\nlocal.get 0\nf64.min')], ['0.0'], 'ok 9223372036854775808 ')
+case('max_zero',  [(7, [], 'f64.const -0.0\nlocal.get 0\nf64.max')], ['0.0'], 'ok 0 ')
+case('nearest',   [(7, [], 'local.get 0\nf64.nearest')], ['2.5'], 'ok 4611686018427387904 ')
+case('demote',    [(7, [], 'local.get 0\nf32.demote_f64\nf32.const 2.25\nf32.add\nf64.promote_f32')], ['1.5'], 'ok 4615626668101337088 ')
+case('rotl',      [(0, [], 'local.get 0\nlocal.get 1\ni32.rotl')], ['0x80000001', '33'], 'ok 3 ')
+case('clz',       [(2, [], 'local.get 0\ni32.clz')], ['0'], 'ok 32 ')
+case('shr_s',     [(0, [], 'local.get 0\nlocal.get 1\ni32.shr_s')], ['0x80000000', '35'], 'ok 4026531840 ')
+case('extend8',   [(2, [], 'local.get 0\ni32.extend8_s')], ['0x80'], 'ok 4294967168 ')
+
+# Control
+case('br_value',   [(2, [], 'block i32\ni32.const 5\ni32.const 6\nlocal.get 0\nbr_if 0\ndrop\ndrop\ni32.const 9\nend')], ['1'], 'ok 6 ')
+case('br_value0',  [(2, [], 'block i32\ni32.const 5\ni32.const 6\nlocal.get 0\nbr_if 0\ndrop\ndrop\ni32.const 9\nend')], ['0'], 'ok 9 ')
+case('br_table',   [(2, [], 'block i32\nblock i32\ni32.const 1\ni32.const 2\ni32.const 3\nlocal.get 0\nbr_table 0 1 1\nend\n'
+                            'i32.const 100\ni32.add\nend')], ['0'], 'ok 103 ')
+case('br_table_default', [(2, [], 'block i32\nblock i32\ni32.const 1\ni32.const 2\ni32.const 3\nlocal.get 0\nbr_table 0 1 1\nend\n'
+                                  'i32.const 100\ni32.add\nend')], ['7'], 'ok 3 ')
+case('br_return',  [(2, [], 'i32.const 1\ni32.const 4\nlocal.get 0\nbr_table 0 0\ni32.const 5')], ['0'], 'ok 4 ')
+case('return_deep', [(2, [], 'block\nloop\ni32.const 8\ni32.const 42\nreturn\nend\nend\ni32.const 1')], ['0'], 'ok 42 ')
+case('if_else',    [(2, [], 'local.get 0\nif i32\ni32.const 10\nelse\ni32.const 20\nend')], ['0'], 'ok 20 ')
+case('if_then',    [(2, [], 'local.get 0\nif i32\ni32.const 10\nelse\ni32.const 20\nend')], ['3'], 'ok 10 ')
+case('if_no_else', [(2, [I32], 'local.get 0\nif\ni32.const 3\nlocal.set 1\nend\nlocal.get 1')], ['3'], 'ok 3 ')
+case('dead_code',  [(2, [], 'block i32\ni32.const 7\nbr 0\nblock\nloop\nbr 0\nend\nend\ni32.const 1\nend')], ['0'], 'ok 7 ')
+case('select',     [(0, [], 'i32.const 11\ni32.const 22\nlocal.get 0\nselect')], ['0', '0'], 'ok 22 ')
+case('global',     [(2, [], 'global.get 0\nlocal.get 0\ni32.add\nglobal.set 0\nglobal.get 0')], ['5'], 'ok 105 ',
+     globals_=[(I32, 1, 'i32.const 100')])
+
+# Imports and tables. env.g is 100, see run.c
+case('host',       [(0, [], 'local.get 0\nlocal.get 1\ncall 0\ni32.const 1\ni32.add')], ['3', '4'], 'ok 8 ', imports=[('env', 'add', 0)])
+case('unbound',    [(0, [], 'local.get 0\nlocal.get 1\ncall 0')], ['3', '4'], 'trap Trap: call to an import nothing was bound to',
+     imports=[('env', 'nope', 0)])
+case('reenter',    [(2, [I32], 'i32.const 1000\nlocal.set 1\nlocal.get 0\ncall 0\nlocal.get 1\ni32.add'),
+                    (2, [], 'local.get 0\ni32.const 2\ni32.mul')], ['4'], 'ok 1080 ',
+     imports=[('env', 'back', 2)], exports=[('inner', 0, 2)])
+case('import_global', [(3, [], 'global.get 0\nglobal.get 1\ni32.add')], [], 'ok 200 ',
+     imports=[('env', 'g', ('global', I32, 0))], globals_=[(I32, 0, 'global.get 0')])
+case('indirect',   [(2, [], 'local.get 0\ni32.const 0\ncall_indirect 2'), (2, [], 'local.get 0\ni32.const 3\ni32.mul')],
+     ['5'], 'ok 15 ', table=1, elems=[1])
+case('indirect_undefined', [(2, [], 'local.get 0\ni32.const 5\ncall_indirect 2'), (2, [], 'local.get 0')],
+     ['1'], 'trap Trap: call_indirect to an undefined table element', table=4, elems=[1])
+case('indirect_oob', [(2, [], 'local.get 0\ni32.const 1\ncall_indirect 2'), (2, [], 'local.get 0')],
+     ['1'], 'trap Trap: call_indirect to an undefined table element', table=1, elems=[1])
+case('indirect_type', [(2, [], 'local.get 0\ni32.const 0\ncall_indirect 2'), (3, [], 'i32.const 1')],
+     ['1'], 'trap Trap: call_indirect to a function of another type', table=1, elems=[1])
+case('start_trap', [(3, [], 'i32.const 1'), (1, [], 'unreachable')], [], 'create Trap: unreachable', start=1)
+
+# Register code names operands by their slot, these catch a read of a
+# slot that something in between has already written over
+case('reg_set',     [(2, [], 'local.get 0\nlocal.get 0\ni32.const 1\ni32.add\nlocal.set 0\nlocal.get 0\ni32.add')], ['5'], 'ok 11 ')
+case('reg_tee',     [(2, [], 'local.get 0\ni32.const 3\nlocal.tee 0\ni32.add\nlocal.get 0\ni32.add')], ['5'], 'ok 11 ')
+case('reg_block',   [(2, [], 'local.get 0\nblock\ni32.const 9\nlocal.set 0\nend\nlocal.get 0\ni32.add')], ['5'], 'ok 14 ')
+case('reg_loop',    [(2, [], 'local.get 0\nloop\nlocal.get 0\ni32.const 1\ni32.sub\nlocal.tee 0\nbr_if 0\nend\nlocal.get 0\ni32.add')],
+     ['5'], 'ok 5 ')
+case('reg_loop_sum', [(2, [I32], 'loop\nlocal.get 1\nlocal.get 0\ni32.add\nlocal.set 1\nlocal.get 0\ni32.const 1\ni32.sub\n'
+                               'local.tee 0\nbr_if 0\nend\nlocal.get 1')], ['5'], 'ok 15 ')
+case('reg_select',  [(0, [], 'local.get 0\nlocal.get 1\nlocal.get 0\nselect')], ['0', '9'], 'ok 9 ')
+case('reg_select2', [(0, [], 'i32.const 4\nlocal.get 1\nlocal.get 0\nselect')], ['1', '9'], 'ok 4 ')
+case('reg_br',      [(2, [], 'block i32\nlocal.get 0\nbr 0\nend')], ['5'], 'ok 5 ')
+case('reg_br_if0',  [(0, [], 'block i32\nlocal.get 0\nlocal.get 1\nbr_if 0\ni32.const 1\ni32.add\nend')], ['5', '0'], 'ok 6 ')
+case('reg_br_if1',  [(0, [], 'block i32\nlocal.get 0\nlocal.get 1\nbr_if 0\ni32.const 1\ni32.add\nend')], ['5', '1'], 'ok 5 ')
+case('reg_br_table0', [(2, [], 'block i32\nblock i32\ni32.const 7\nlocal.get 0\nbr_table 0 1\nend\ni32.const 100\ni32.add\nend')],
+     ['0'], 'ok 107 ')
+case('reg_br_table1', [(2, [], 'block i32\nblock i32\ni32.const 7\nlocal.get 0\nbr_table 0 1\nend\ni32.const 100\ni32.add\nend')],
+     ['1'], 'ok 7 ')
+case('reg_br_table_fn', [(2, [], 'i32.const 7\nlocal.get 0\nbr_table 0')], ['0'], 'ok 7 ')
+case('reg_i64_imm', [(8, [], 'local.get 0\ni64.const -5\ni64.add\ni64.const 4294967296\ni64.add')], ['10'], 'ok 4294967301 ')
+case('reg_i64_big', [(8, [], 'local.get 0\ni64.const 4294967296\ni64.mul')], ['3'], 'ok 12884901888 ')
+case('reg_br_if_ret1', [(0, [], 'local.get 0\nlocal.get 1\nbr_if 0\ndrop\ni32.const 3')], ['7', '1'], 'ok 7 ')
+case('reg_br_if_ret0', [(0, [], 'local.get 0\nlocal.get 1\nbr_if 0\ndrop\ni32.const 3')], ['7', '0'], 'ok 3 ')
+case('reg_fuse',    [(0, [I32], 'local.get 0\ni32.const 1\ni32.shl\nlocal.set 2\nlocal.get 2\nlocal.get 1\ni32.sub\n'
+                              'local.tee 2\nlocal.get 2\ni32.mul')], ['5', '1'], 'ok 81 ')
+case('reg_fuse_ref', [(0, [], 'local.get 1\nlocal.get 0\nlocal.get 1\ni32.add\nlocal.set 1\nlocal.get 1\ni32.sub')],
+     ['5', '2'], 'ok 4294967291 ')
+case('reg_if_value', [(0, [], 'local.get 0\nif i32\nlocal.get 1\nelse\ni32.const 3\nend\nlocal.get 1\ni32.add')], ['1', '2'], 'ok 4 ')
+case('reg_call',    [(0, [], 'local.get 0\nlocal.get 1\ncall 1\nlocal.get 0\ni32.add\ni32.add'),
+                     (2, [I32], 'local.get 0\ni32.const 10\ni32.add\nlocal.set 1\nlocal.get 1')], ['5', '2'], 'ok 22 ')
+case('reg_memory',  [(2, [I32], 'i32.const 8\nlocal.get 0\ni32.store 2 0\ni32.const 8\ni32.load 2 0\nlocal.set 1\nglobal.get 0\n'
+                              'local.set 0\nlocal.get 1\nlocal.get 0\ni32.add')], ['5'], 'ok 105 ',
+     memory=1, globals_=[(I32, 1, 'i32.const 100')])
+case('reg_grow',    [(3, [I32], 'i32.const 1\nmemory.grow\nlocal.set 0\nmemory.size\nlocal.get 0\ni32.add')], [], 'ok 3 ', memory=1)
+case('reg_dead_value', [(2, [], 'block i32\nlocal.get 0\nbr 0\ni32.const 5\nend\ni32.const 1\ni32.add')], ['5'], 'ok 6 ')
+case('reg_return',  [(2, [], 'local.get 0\nif\nlocal.get 0\nreturn\nend\ni32.const 42')], ['5'], 'ok 5 ')
+
+# Loops that go on long enough for the tiered engine to switch over to
+# machine code halfway through, with what the interpreter left in
+# locals, on the operand stack and in memory
+harmonic = 0.0
+for i in range(100, 0, -1):
+    harmonic += 1.0 / i
+
+case('osr_sum',     [(2, [I32, I32], 'loop\nlocal.get 1\nlocal.get 2\ni32.add\nlocal.set 1\nlocal.get 2\ni32.const 1\ni32.add\n'
+                                   'local.tee 2\nlocal.get 0\ni32.le_u\nbr_if 0\nend\nlocal.get 1')], ['1000'], 'ok 500500 ')
+case('osr_nested',  [(3, [I32, I32, I32], 'loop\ni32.const 0\nlocal.set 1\nloop\nlocal.get 2\nlocal.get 0\nlocal.get 1\ni32.mul\n'
+                                        'i32.add\nlocal.set 2\nlocal.get 1\ni32.const 1\ni32.add\nlocal.tee 1\ni32.const 20\n'
+                                        'i32.lt_u\nbr_if 0\nend\nlocal.get 0\ni32.const 1\ni32.add\nlocal.tee 0\ni32.const 20\n'
+                                        'i32.lt_u\nbr_if 0\nend\nlocal.get 2')], [], 'ok 36100 ')
+case('osr_stack',   [(2, [], 'i32.const 1000\nloop\nlocal.get 0\ni32.const 1\ni32.sub\nlocal.tee 0\nbr_if 0\nend\nlocal.get 0\ni32.add')],
+     ['50'], 'ok 1000 ')
+case('osr_trap',    [(2, [I32], 'loop\ni32.const 100\nlocal.get 0\ni32.const 3\ni32.sub\ni32.div_s\nlocal.get 1\ni32.add\nlocal.set 1\n'
+                              'local.get 0\ni32.const 1\ni32.sub\nlocal.tee 0\nbr_if 0\nend\nlocal.get 1')],
+     ['50'], 'trap Trap: integer divide by zero')
+case('osr_memory',  [(2, [I32, I32], 'loop\nlocal.get 1\ni32.const 2\ni32.shl\nlocal.get 1\ni32.store 2 0\nlocal.get 1\ni32.const 1\n'
+                                   'i32.add\nlocal.tee 1\nlocal.get 0\ni32.lt_u\nbr_if 0\nend\nloop\nlocal.get 1\ni32.const 1\n'
+                                   'i32.sub\nlocal.tee 1\ni32.const 2\ni32.shl\ni32.load 2 0\nlocal.get 2\ni32.add\nlocal.set 2\n'
+                                   'local.get 1\nbr_if 0\nend\nlocal.get 2')], ['1000'], 'ok 499500 ', memory=1)
+case('osr_call',    [(2, [I32], 'loop\nlocal.get 1\nlocal.get 0\ncall 1\ni32.add\nlocal.set 1\nlocal.get 0\ni32.const 1\ni32.sub\n'
+                              'local.tee 0\nbr_if 0\nend\nlocal.get 1'), (2, [], 'local.get 0\ni32.const 1\ni32.shl')],
+     ['100'], 'ok 10100 ')
+case('osr_f64',     [(7, [F64], 'loop\nlocal.get 1\nf64.const 1\nlocal.get 0\nf64.div\nf64.add\nlocal.set 1\nlocal.get 0\n'
+                              'f64.const 1\nf64.sub\nlocal.tee 0\nf64.const 0\nf64.gt\nbr_if 0\nend\nlocal.get 1')],
+     ['100.0'], 'ok %d ' % struct.unpack('<Q', struct.pack('<d', harmonic))[0])
+case('jit_fib',     [(2, [], 'local.get 0\ni32.const 2\ni32.lt_u\nif i32\nlocal.get 0\nelse\nlocal.get 0\ni32.const 1\ni32.sub\ncall 0\n'
+                              'local.get 0\ni32.const 2\ni32.sub\ncall 0\ni32.add\nend')], ['20'], 'ok 6765 ')
+case('jit_reenter', [(2, [I32], 'loop\nlocal.get 1\nlocal.get 0\ncall 0\ni32.add\nlocal.set 1\nlocal.get 0\ni32.const 1\ni32.sub\n'
+                              'local.tee 0\nbr_if 0\nend\nlocal.get 1'),
+                     (2, [], 'local.get 0\ni32.const 2\ni32.mul')], ['20'], 'ok 4200 ',
+     imports=[('env', 'back', 2)], exports=[('inner', 0, 2)])
+
+# Modules validateModule() has to turn away
+bad('type_mismatch',   [(3, [], 'i64.const 1')], 'wrong type')
+bad('operand_type',    [(3, [], 'i32.const 1\ni64.const 2\ni32.add')], 'wrong type')
+bad('underflow',       [(3, [], 'i32.add')], 'pops more values')
+bad('left_over',       [(1, [], 'i32.const 1')], 'values left over')
+bad('unbalanced',      [(1, [], 'block\nblock\nend')], 'expression')
+bad('else_alone',      [(1, [], 'else\nend')], 'not properly nested')
+bad('if_no_else_value', [(3, [], 'i32.const 1\nif i32\ni32.const 2\nend')], 'wrong type')
+bad('label',           [(1, [], 'block\nbr 2\nend')], 'label that is not open')
+bad('local',           [(3, [], 'local.get 3')], 'locals is invalid')
+bad('global',          [(3, [], 'global.get 0')], 'globals is invalid')
+bad('immutable',       [(1, [], 'i32.const 1\nglobal.set 0')], 'not mutable', globals_=[(I32, 0, 'i32.const 0')])
+bad('immutable_import', [(1, [], 'i32.const 1\nglobal.set 0')], 'not mutable', imports=[('env', 'g', ('global', I32, 0))])
+bad('import_type',     [(3, [], 'global.get 0')], 'wrong type', imports=[('env', 'g', ('global', I64, 0))])
+bad('function',        [(1, [], 'call 5')], 'function index')
+bad('no_memory',       [(3, [], 'i32.const 0\ni32.load 2 0')], 'without a memory')
+bad('alignment',       [(3, [], 'i32.const 0\ni32.load 3 0')], 'alignment', memory=1)
+bad('memory_reserved', [(3, [], 'memory.size 1')], 'memory index 0', memory=1)
+bad('no_table',        [(1, [], 'i32.const 0\ncall_indirect 1')], 'without a table')
+bad('const_type',      [(1, [], '')], 'wrong type', globals_=[(I32, 0, 'i64.const 1')])
+bad('const_op',        [(1, [], '')], 'expression', globals_=[(I32, 0, 'i32.const 1\ni32.const 2\ni32.add')])
+bad('const_global',    [(1, [], '')], 'globals is invalid', globals_=[(I32, 0, 'i32.const 1'), (I32, 0, 'global.get 0')])
+bad('data_no_memory',  [(1, [], '')], 'without a memory', data=[(0, [1])])
+bad('elem_no_table',   [(1, [], '')], 'without a table', elems=[0])
+
+# Hand-built: a body of zero bytes, and types with neither function nor
+# code sections, which has nothing to export
+HEADER = b'\0asm' + bytes([1, 0, 0, 0])
+TYPES = section(1, vec([b'\x60' + vec([]) + vec([])]))
+invalid.append(('empty_body', HEADER + TYPES + section(3, vec([uleb(0)])) + section(10, vec([uleb(0)])), 'Code expression'))
+invalid.append(('types_only', HEADER + TYPES, 'run'))
+
+
+# Random programs: nested blocks, loops, branches and i32 arithmetic over
+# four locals, the kind of code every engine translates differently
+BINARY = ['i32.add', 'i32.sub', 'i32.mul', 'i32.and', 'i32.or', 'i32.xor', 'i32.shl', 'i32.shr_u', 'i32.shr_s',
+          'i32.rotl', 'i32.eq', 'i32.lt_s', 'i32.gt_u', 'i32.ne']
+
+
+def expr(r, d):
+    x = r.random()
+    if d <= 0 or x < 0.25:
+        if r.random() < 0.6:
+            return ['local.get %d' % r.randrange(4)]
+        return ['i32.const %d' % r.choice([0, 1, 2, -1, 7, 100, 0x7FFFFFFF, -5])]
+    if x < 0.55:
+        return expr(r, d - 1) + expr(r, d - 1) + [r.choice(BINARY)]
+    if x < 0.65:
+        return expr(r, d - 1) + ['local.tee %d' % r.randrange(4)]
+    if x < 0.72:
+        return expr(r, d - 1) + expr(r, d - 1) + expr(r, d - 1) + ['select']
+    if x < 0.80:
+        return ['block i32'] + expr(r, d - 1) + expr(r, d - 1) + ['br_if 0', 'drop'] + expr(r, d - 1) + ['end']
+    if x < 0.86:
+        return (['block i32', 'block i32'] + expr(r, d - 1) + expr(r, d - 1) +
+                ['i32.const 3', 'i32.and', 'br_table 0 1 0 1', 'end'] + expr(r, d - 1) + ['i32.add', 'end'])
+    if x < 0.93:
+        return expr(r, d - 1) + ['if i32'] + expr(r, d - 1) + ['else'] + expr(r, d - 1) + ['end']
+    return ['local.get %d' % r.randrange(4)] + stmts(r, d - 1, 3) + ['local.get %d' % r.randrange(4), r.choice(BINARY)]
+
+
+def stmts(r, d, loops):
+    out = []
+    for _ in range(r.randrange(1, 4)):
+        x = r.random()
+        if d <= 0 or x < 0.4:
+            out += expr(r, d) + ['local.set %d' % r.randrange(4)]
+        elif x < 0.6 and loops < 3:
+            # Counted down in a local of its own so every loop ends
+            c = 4 + loops
+            out += ['i32.const %d' % r.randrange(1, 5), 'local.set %d' % c, 'loop'] + stmts(r, d - 1, loops + 1)
+            out += ['local.get %d' % c, 'i32.const 1', 'i32.sub', 'local.tee %d' % c, 'br_if 0', 'end']
+        elif x < 0.75:
+            out += ['block'] + stmts(r, d - 1, loops) + expr(r, d - 1) + ['br_if 0'] + stmts(r, d - 1, loops) + ['end']
+        elif x < 0.85:
+            out += expr(r, d - 1) + ['if'] + stmts(r, d - 1, loops) + ['else'] + stmts(r, d - 1, loops) + ['end']
+        elif x < 0.9:
+            out += expr(r, d - 1) + ['if'] + expr(r, d - 1) + ['return', 'end']
+        else:
+            out += expr(r, d - 1) + ['drop']
+    return out
+
+
+def run(runner, engine, path, args):
+    out = subprocess.run([runner] + engine + [path, 'run'] + args, capture_output=True, text=True)
+    lines = [l for l in out.stdout.split('\n') if l.split(' ')[0] in ('ok', 'trap', 'load', 'create')]
+    # Sanitizers report on stderr, undefined behaviour without failing
+    if out.returncode or not lines or 'runtime error' in out.stderr:
+        return 'exit %d: %s' % (out.returncode, (out.stdout + out.stderr)[-300:])
+    return lines[-1] + '\n'
+
+
+def main():
+    runner = os.path.abspath(sys.argv[1])
+    opts = dict(zip(sys.argv[2::2], sys.argv[3::2]))
+    nfuzz = int(opts.get('--fuzz', 100))
+    seed = int(opts.get('--seed', 1))
+
+    tmp = tempfile.mkdtemp()
+    failures = 0
+    try:
+        for name, m, args, expect in cases:
+            path = os.path.join(tmp, name + '.wasm')
+            with open(path, 'wb') as f:
+                f.write(m)
+            for engine, flags in ENGINES:
+                got = run(runner, flags, path, args)
+                if not got.startswith(expect):
+                    failures += 1
+                    print('FAIL %s under %s: expected %r, got %r' % (name, engine, expect, got))
+
+        for name, m, expect in invalid:
+            path = os.path.join(tmp, name + '.wasm')
+            with open(path, 'wb') as f:
+                f.write(m)
+            got = run(runner, ENGINES[0][1], path, [])
+            if not got.startswith('load') or expect not in got:
+                failures += 1
+                print('FAIL invalid %s: expected a load error about %r, got %r' % (name, expect, got))
+
+        r = random.Random(seed)
+        path = os.path.join(tmp, 'fuzz.wasm')
+        for n in range(nfuzz):
+            body = '\n'.join(stmts(r, 3, 0) + expr(r, 3))
+            with open(path, 'wb') as f:
+                f.write(module([([I32, I32], [I32])], [(0, [I32] * 5, body)], exports=[('run', 0, 0)]))
+            for args in (['3', '5'], ['0xffffffff', '1'], ['100', '0']):
+                got = [(engine, run(runner, flags, path, args)) for engine, flags in ENGINES]
+                if len(set(g for _, g in got)) != 1 or not got[0][1].startswith('ok'):
+                    failures += 1
+                    print('FAIL random program %d (seed %d) with %s:\n%s\n%s' % (n, seed, args, body, got))
+                    break
+    finally:
+        shutil.rmtree(tmp)
+
+    print('%d cases, %d invalid modules, %d random programs under %d engines: %d failures' %
+          (len(cases), len(invalid), nfuzz, len(ENGINES), failures))
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,331 @@
+#include <libwasm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Loads each module given through every way the library has of loading
+// one and compares what comes out with a plain parseModule() of it:
+// parallel and lazy parsing, the stream reader fed in small chunks, the
+// writer, batches, the cache and .wd dumps
+
+static int checks, failures;
+
+// Also called from batch threads
+static void check(int ok, const char* file, const char* what) {
+    __atomic_add_fetch(&checks, 1, __ATOMIC_RELAXED);
+    if (!ok) {
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+        printf("%s: %s\n", file, what);
+    }
+}
+
+static int same(const void* a, const void* b, uint32_t len) {
+    return len == 0 || (a && b && !memcmp(a, b, len));
+}
+
+// Everything a module has besides its sections, which dumps don't keep
+static void compareModules(const char* file, const char* how, Module* mod, Module* other) {
+    char what[128];
+    snprintf(what, sizeof(what), "%s: module differs", how);
+    if (!other) {
+        check(0, file, what);
+        return;
+    }
+
+    int ok = mod->nfuncs == other->nfuncs && mod->nglobals == other->nglobals;
+    for (uint32_t i = 0; ok && i < mod->nfuncs; i++) {
+        struct TypeSectionType* s = mod->functions[i].signature;
+        struct TypeSectionType* t = other->functions[i].signature;
+        ok = s && t && s->ret == t->ret && s->paramsLen == t->paramsLen && same(s->params, t->params, s->paramsLen);
+
+        // Lazily decoded bodies are decoded here
+        Code* a;
+        Code* b;
+        ok = ok && !getFunctionCode(mod, i, &a) && !getFunctionCode(other, i, &b) && !a == !b;
+        if (ok && a)
+            ok = a->codeSize == b->codeSize && same(a->expr, b->expr, a->codeSize) &&
+                 a->localSize == b->localSize && same(a->locals, b->locals, a->localSize);
+    }
+
+    for (uint32_t i = 0; ok && i < mod->nglobals; i++) {
+        Global* a = &mod->globals[i];
+        Global* b = &other->globals[i];
+        ok = a->valtype == b->valtype && a->mut == b->mut && a->exprSize == b->exprSize && same(a->expr, b->expr, a->exprSize);
+    }
+
+    Memory* m = mod->memories;
+    Memory* n = other->memories;
+    ok = ok && (m && m->memory) == (n && n->memory) && (m ? m->nData : 0) == (n ? n->nData : 0);
+    for (uint32_t i = 0; ok && m && i < m->nData; i++)
+        ok = m->init[i].len == n->init[i].len && same(m->init[i].bytes, n->init[i].bytes, m->init[i].len);
+
+    Table* t = mod->tables;
+    Table* u = other->tables;
+    ok = ok && (t && t->table) == (u && u->table) && (t ? t->nElement : 0) == (u ? u->nElement : 0);
+    for (uint32_t i = 0; ok && t && i < t->nElement; i++)
+        ok = t->init[i].len == u->init[i].len && same(t->init[i].funcidx, u->init[i].funcidx, t->init[i].len * sizeof(uint32_t));
+
+    check(ok, file, what);
+}
+
+// Parses data under flags and compares the result with mod
+static void checkParse(const char* file, Module* mod, const uint8_t* data, uint32_t size, uint32_t flags, const char* how) {
+    Config config = {0};
+    Reader reader = {0};
+    config.flags = flags;
+    config.threads = 4;
+
+    int s = createReaderFromBuffer(&reader, &config, data, size);
+    if (!s)
+        s = parseModule(&reader);
+    if (!s)
+        s = validateModule(getModuleFromReader(&reader));
+
+    char what[128];
+    snprintf(what, sizeof(what), "%s: does not load", how);
+    check(!s, file, what);
+    if (!s)
+        compareModules(file, how, mod, getModuleFromReader(&reader));
+
+    if (reader.thisModule)
+        destroyReader(&reader);
+}
+
+static void checkStream(const char* file, Module* mod, const uint8_t* data, uint32_t size, uint32_t chunk) {
+    Config config = {0};
+    StreamReader stream = {0};
+    int s = createStreamReader(&stream, &config);
+    for (uint32_t off = 0; !s && off < size; off += chunk)
+        s = feedStreamReader(&stream, data + off, (size - off < chunk) ? size - off : chunk);
+    if (!s)
+        s = finishStreamReader(&stream);
+
+    char how[64];
+    snprintf(how, sizeof(how), "stream in %u byte chunks", chunk);
+    check(!s, file, how);
+    if (!s)
+        compareModules(file, how, mod, getModuleFromReader(&stream.reader));
+
+    destroyStreamReader(&stream);
+}
+
+// Unchanged modules are copied byte for byte, encoded again they must
+// still parse into the same module
+static void checkWriter(const char* file, Module* mod, const uint8_t* data, uint32_t size) {
+    Config config = {0};
+    Writer writer;
+    createWriter(&writer, &config);
+    int s = writeModule(&writer, mod);
+    check(!s && writer.size == size && same(getDataFromWriter(&writer), data, size), file, "writer: copy differs");
+
+    config.flags = WASM_CONFIG_REENCODE;
+    s = writeModule(&writer, mod);
+    check(!s, file, "writer: cannot encode again");
+    if (!s)
+        checkParse(file, mod, getDataFromWriter(&writer), writer.size, 0, "writer: encoded again");
+
+    destroyWriter(&writer);
+}
+
+#define BATCH_ITEMS 8
+
+static Module* batchBaseline;
+static const char* batchFile;
+
+// Discarding batches only have their modules while done() runs
+static void batchDone(struct WasmBatch* batch, struct WasmBatchItem* item) {
+    __atomic_add_fetch((int*) batch->userdata, 1, __ATOMIC_RELAXED);
+    check(!item->status, batchFile, "batch: item does not load");
+    if (!item->status)
+        compareModules(batchFile, "batch, discarding", batchBaseline, getModuleFromReader(&item->reader));
+}
+
+static void checkBatch(const char* file, Module* mod, const uint8_t* data, uint32_t size, uint32_t flags, uint8_t discard) {
+    Config config = {0};
+    config.flags = flags;
+    config.threads = 3;
+
+    struct WasmBatchItem items[BATCH_ITEMS];
+    memset(items, 0, sizeof(items));
+    for (uint32_t i = 0; i < BATCH_ITEMS; i++) {
+        items[i].name = file;
+        items[i].data = data;
+        items[i].size = size;
+    }
+
+    int done = 0;
+    struct WasmBatch batch = { .userdata = &done, .discard = discard };
+    batch.done = (discard) ? batchDone : NULL;
+    batchBaseline = mod;
+    batchFile = file;
+
+    int s = createBatch(&batch, &config, items, BATCH_ITEMS);
+    if (!s)
+        s = loadBatch(&batch);
+    check(!s, file, "batch: does not load");
+
+    for (uint32_t i = 0; !s && !discard && i < BATCH_ITEMS; i++) {
+        Module* other = getModuleFromReader(&items[i].reader);
+        if (other && (flags & WASM_CONFIG_LAZY))
+            check(!validateModule(other), file, "batch: lazy module does not validate");
+        compareModules(file, "batch", mod, other);
+    }
+
+    check(!discard || done == BATCH_ITEMS, file, "batch: done() not called for every item");
+    if (!s)
+        destroyBatch(&batch);
+}
+
+static void checkCache(const char* file, Module* mod, const uint8_t* data, uint32_t size, uint32_t flags) {
+    Config config = {0};
+    config.flags = flags;
+
+    // Large enough to keep everything
+    ModuleCache cache;
+    createModuleCache(&cache, &config, (size_t) 1 << 30);
+    Module* a = NULL;
+    Module* b = NULL;
+    int s = loadCachedModule(&cache, data, size, &a);
+    if (!s)
+        s = loadCachedModule(&cache, data, size, &b);
+
+    check(!s && a == b && a->_validated, file, "cache: same bytes give a different or unvalidated module");
+    if (!s)
+        compareModules(file, "cache", mod, a);
+
+    struct WasmCacheStats stats;
+    getCacheStats(&cache, &stats);
+    check(stats.hits == 1 && stats.misses == 1 && stats.modules == 1 && stats.bytes > size, file, "cache: stats");
+
+    if (a)
+        releaseCachedModule(&cache, a);
+    if (b)
+        releaseCachedModule(&cache, b);
+
+    getCacheStats(&cache, &stats);
+    check(stats.modules == 1 && !stats.evictions, file, "cache: module within the budget evicted");
+    destroyModuleCache(&cache);
+
+    // Nothing fits, modules go as soon as nobody uses them
+    createModuleCache(&cache, &config, 0);
+    s = loadCachedModule(&cache, data, size, &a);
+    check(!s, file, "cache: does not load");
+    if (!s)
+        releaseCachedModule(&cache, a);
+
+    getCacheStats(&cache, &stats);
+    check(stats.modules == 0 && stats.evictions == 1 && stats.bytes == 0, file, "cache: unused module over the budget kept");
+    destroyModuleCache(&cache);
+}
+
+// A dump loads in place of parsing, one made from other bytes is passed over
+static void checkDump(const char* file, Module* mod, const uint8_t* data, uint32_t size) {
+    char dump[256];
+    snprintf(dump, sizeof(dump), "%s.features.wd", file);
+    check(!dumpModuleTo(mod, dump), file, "dump: cannot write");
+
+    Config config = {0};
+    Reader reader = {0};
+    int s = createReaderFromBuffer(&reader, &config, data, size);
+    if (!s)
+        s = loadDump(&reader, dump);
+    check(!s && !getModuleFromReader(&reader)->sections, file, "dump: not loaded from the dump");
+    if (!s)
+        compareModules(file, "dump", mod, getModuleFromReader(&reader));
+    if (reader.thisModule)
+        destroyReader(&reader);
+
+    // The same module with a custom section "x" at the end
+    uint8_t* other = malloc(size + 4);
+    memcpy(other, data, size);
+    memcpy(other + size, "\0\2\1x", 4);
+    memset(&reader, 0, sizeof(reader));
+    s = createReaderFromBuffer(&reader, &config, other, size + 4);
+    if (!s)
+        s = loadDump(&reader, dump);
+    check(!s && getModuleFromReader(&reader)->sections, file, "dump: stale dump used");
+    if (!s)
+        compareModules(file, "stale dump", mod, getModuleFromReader(&reader));
+    if (reader.thisModule)
+        destroyReader(&reader);
+
+    free(other);
+    remove(dump);
+}
+
+static uint8_t* readFile(const char* file, uint32_t* size) {
+    FILE* f = fopen(file, "rb");
+    if (!f)
+        return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    rewind(f);
+    uint8_t* data = (len > 0) ? malloc(len) : NULL;
+    if (data && fread(data, 1, len, f) != (size_t) len) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(f);
+    *size = len;
+    return data;
+}
+
+static void checkFile(const char* file) {
+    uint32_t size;
+    uint8_t* data = readFile(file, &size);
+    if (!data) {
+        check(0, file, "cannot be read");
+        return;
+    }
+
+    Config config = {0};
+    Reader reader = {0};
+    int s = createReaderFromBuffer(&reader, &config, data, size);
+    if (!s)
+        s = parseModule(&reader);
+    if (s) {
+        check(0, file, "does not parse");
+        if (reader.thisModule)
+            destroyReader(&reader);
+        free(data);
+        return;
+    }
+
+    Module* mod = getModuleFromReader(&reader);
+    checkParse(file, mod, data, size, WASM_CONFIG_PARALLEL_SECTIONS, "parallel sections");
+    checkParse(file, mod, data, size, WASM_CONFIG_PARALLEL_CODE, "parallel code");
+    checkParse(file, mod, data, size, WASM_CONFIG_PARALLEL_SECTIONS | WASM_CONFIG_PARALLEL_CODE, "parallel sections and code");
+    checkParse(file, mod, data, size, WASM_CONFIG_LAZY, "lazy");
+    checkParse(file, mod, data, size, WASM_CONFIG_LAZY_CODE, "lazy code");
+    checkParse(file, mod, data, size, WASM_CONFIG_LAZY | WASM_CONFIG_LAZY_CODE, "lazy sections and code");
+
+    uint32_t chunks[] = { 1, 3, 7, 64 };
+    for (uint32_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+        checkStream(file, mod, data, size, chunks[i]);
+
+    checkWriter(file, mod, data, size);
+    checkBatch(file, mod, data, size, 0, 0);
+    checkBatch(file, mod, data, size, WASM_CONFIG_LAZY | WASM_CONFIG_LAZY_CODE, 0);
+    checkBatch(file, mod, data, size, 0, 1);
+    checkCache(file, mod, data, size, 0);
+    checkCache(file, mod, data, size, WASM_CONFIG_LAZY | WASM_CONFIG_LAZY_CODE);
+    checkDump(file, mod, data, size);
+
+    destroyReader(&reader);
+    free(data);
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: check file1 file2 ... fileN\n");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++)
+        checkFile(argv[i]);
+
+    printf("%d feature checks: %d failures\n", checks, failures);
+    return failures != 0;
+}
@@ -0,0 +1,200 @@
+#include <libwasm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Writes an image of each module given, reads it back through
+// moduleFromImage() and compares that with the parsed module, then runs
+// every export that takes nothing on both. Then checks that images are 
+// turned away when they were made from other bytes, are cut short or are
+// not images at all
+
+static int checks, failures;
+
+static void check(int ok, const char* file, const char* what) {
+    checks++;
+    if (!ok) {
+        failures++;
+        printf("%s: %s\n", file, what);
+    }
+}
+
+static int same(const void* a, const void* b, uint32_t len) {
+    return len == 0 || (a && b && !memcmp(a, b, len));
+}
+
+static void compareModules(const char* file, Module* mod, Module* view) {
+    check(mod->nfuncs == view->nfuncs, file, "function count");
+    check(mod->nglobals == view->nglobals, file, "global count");
+    check((!mod->name && !view->name) || (mod->name && view->name && !strcmp(mod->name, view->name)), file, "module name");
+
+    for (uint32_t i = 0; i < mod->nfuncs && i < view->nfuncs; i++) {
+        struct Function* f = &mod->functions[i];
+        struct Function* g = &view->functions[i];
+        check(f->hash == g->hash && f->nameLen == g->nameLen && same(f->name, g->name, f->nameLen), file, "function name");
+        check(f->signature->idx == g->signature->idx && f->signature->ret == g->signature->ret &&
+              f->signature->paramsLen == g->signature->paramsLen &&
+              same(f->signature->params, g->signature->params, f->signature->paramsLen), file, "signature");
+
+        Code* code;
+        getFunctionCode(mod, i, &code);
+        check(!code == !g->code, file, "body");
+        if (code && g->code)
+            check(code->codeSize == g->code->codeSize && same(code->expr, g->code->expr, code->codeSize) &&
+                  code->localSize == g->code->localSize && same(code->locals, g->code->locals, code->localSize), file, "body");
+    }
+
+    for (uint32_t i = 0; i < mod->nglobals && i < view->nglobals; i++) {
+        Global* a = &mod->globals[i];
+        Global* b = &view->globals[i];
+        check(a->valtype == b->valtype && a->mut == b->mut && a->exprSize == b->exprSize &&
+              same(a->expr, b->expr, a->exprSize), file, "global");
+    }
+
+    Memory* m = mod->memories;
+    Memory* n = view->memories;
+    int hasMemory = m && m->memory;
+    check(hasMemory == (n->memory != NULL), file, "memory");
+    if (hasMemory && n->memory) {
+        check(m->memory->min == n->memory->min && m->memory->max == n->memory->max, file, "memory limits");
+        check(m->nData == n->nData, file, "data count");
+        for (uint32_t i = 0; i < m->nData && i < n->nData; i++)
+            check(m->init[i].len == n->init[i].len && same(m->init[i].bytes, n->init[i].bytes, m->init[i].len) &&
+                  same(m->init[i].expr, n->init[i].expr, m->init[i].exprSize), file, "data");
+    }
+
+    Table* t = mod->tables;
+    Table* u = view->tables;
+    int hasTable = t && t->table;
+    check(hasTable == (u->table != NULL), file, "table");
+    if (hasTable && u->table) {
+        check(t->nElement == u->nElement, file, "element count");
+        for (uint32_t i = 0; i < t->nElement && i < u->nElement; i++)
+            check(t->init[i].len == u->init[i].len &&
+                  same(t->init[i].funcidx, u->init[i].funcidx, t->init[i].len * sizeof(uint32_t)), file, "elements");
+    }
+}
+
+// Instantiates module and calls function idx, which takes nothing
+static int runExport(Module* module, uint32_t idx, uint64_t* result) {
+    Instance instance;
+    int s = createInstance(&instance, module, NULL);
+    if (s)
+        return s;
+
+    uint64_t slots[1] = {0};
+    s = callFunction(&instance, idx, slots);
+    *result = slots[0];
+    destroyInstance(&instance);
+    return s;
+}
+
+static void runModules(const char* file, Module* mod, Module* view) {
+    check(!validateModule(view), file, "image module does not validate");
+    if (!view->_validated)
+        return;
+
+    int idx = findSectionByHash(mod, WASM_HASH_Export);
+    for (uint32_t i = 0; idx != -1 && i < mod->sections[idx].flags; i++) {
+        Export* e = &mod->sections[idx].exports[i];
+        if (e->type != WASM_TYPEIDX || mod->functions[e->index].signature->paramsLen)
+            continue;
+
+        check(findExport(view, e->name, WASM_TYPEIDX) && findExport(view, e->name, WASM_TYPEIDX)->index == e->index, file, "export");
+
+        uint64_t a = 0, b = 0;
+        int s = runExport(mod, e->index, &a);
+        int t = runExport(view, e->index, &b);
+        check(s == t && a == b, file, "image module runs differently");
+    }
+}
+
+// Copies the first size bytes of from to to, with the first byte flipped
+// when bad is set
+static int copyImage(const char* from, const char* to, long size, int bad) {
+    FILE* in = fopen(from, "rb");
+    FILE* out = fopen(to, "wb");
+    int ok = in && out;
+    for (long i = 0; ok && i < size; i++) {
+        int c = fgetc(in);
+        if (c == EOF)
+            break;
+        fputc((i == 0 && bad) ? c ^ 0xFF : c, out);
+    }
+
+    if (in)
+        fclose(in);
+    if (out)
+        fclose(out);
+    return ok;
+}
+
+static void checkFile(const char* file) {
+    Config config = {0};
+    Reader reader = {0};
+    config.name = file;
+    int s = createReader(&reader, &config);
+    if (!s)
+        s = parseModule(&reader);
+    if (s) {
+        check(0, file, "does not parse");
+        destroyReader(&reader);
+        return;
+    }
+
+    Module* mod = getModuleFromReader(&reader);
+    uint64_t sourceHash = hashBytes(mod->_source, mod->_sourceSize);
+    uint32_t sourceSize = mod->_sourceSize;
+
+    char image[256], broken[256];
+    snprintf(image, sizeof(image), "%s.wi", file);
+    snprintf(broken, sizeof(broken), "%s.broken.wi", file);
+    check(!writeImage(mod, image), file, "writeImage");
+
+    Image img;
+    s = openImage(&img, image, sourceHash, sourceSize);
+    check(!s, file, "openImage");
+    if (!s) {
+        Arena arena;
+        Module view;
+        createArena(&arena, 0);
+        s = moduleFromImage(&view, &img, &arena);
+        check(!s, file, "moduleFromImage");
+        if (!s) {
+            compareModules(file, mod, &view);
+            runModules(file, mod, &view);
+        }
+
+        destroyArena(&arena);
+        closeImage(&img);
+    }
+
+    // Made from other bytes
+    check(openImage(&img, image, sourceHash + 1, sourceSize) == WASM_STALE_DUMP, file, "stale hash accepted");
+    check(openImage(&img, image, sourceHash, sourceSize + 1) == WASM_STALE_DUMP, file, "stale size accepted");
+    check(!openImage(&img, image, 0, 0), file, "unchecked open");
+    closeImage(&img);
+
+    // Cut short, and not an image
+    check(copyImage(image, broken, sizeof(struct WasmImageHeader) + 8, 0) &&
+          openImage(&img, broken, sourceHash, sourceSize) == WASM_INVALID_DUMP, file, "short image accepted");
+    check(copyImage(image, broken, 1 << 30, 1) &&
+          openImage(&img, broken, sourceHash, sourceSize) == WASM_FILE_INVALID_MAGIC, file, "bad magic accepted");
+
+    remove(image);
+    remove(broken);
+    destroyReader(&reader);
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: check file1 file2 ... fileN\n");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++)
+        checkFile(argv[i]);
+
+    printf("%d image checks: %d failures\n", checks, failures);
+    return failures != 0;
+}
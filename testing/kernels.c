@@ -0,0 +1,142 @@
+// Compute kernels for "bench interp", every bench_ export takes nothing
+// and returns a checksum. Nothing here calls into libc, there is none
+#define N 64
+
+static double a[N][N], b[N][N], c[N][N];
+static int sieve[20000];
+static int sorted[4096];
+static unsigned char buffer[16384];
+
+static int fib(int n) {
+	return (n < 2) ? n : fib(n - 1) + fib(n - 2);
+}
+
+static unsigned add(unsigned x, unsigned y) { return x + y; }
+static unsigned sub(unsigned x, unsigned y) { return x - y; }
+static unsigned mul(unsigned x, unsigned y) { return x * y; }
+static unsigned eor(unsigned x, unsigned y) { return x ^ y; }
+static unsigned (*ops[4])(unsigned, unsigned) = { add, sub, mul, eor };
+
+int bench_fib() __attribute__((export_name("bench_fib"))) {
+	return fib(25);
+}
+
+int bench_sieve() __attribute__((export_name("bench_sieve"))) {
+	int count = 0;
+	for (int i = 0; i < 20000; i++)
+		sieve[i] = 1;
+
+	for (int i = 2; i < 20000; i++) {
+		if (!sieve[i])
+			continue;
+
+		count++;
+		for (int j = i * 2; j < 20000; j += i)
+			sieve[j] = 0;
+	}
+
+	return count;
+}
+
+int bench_matmul() __attribute__((export_name("bench_matmul"))) {
+	for (int i = 0; i < N; i++) {
+		for (int j = 0; j < N; j++) {
+			a[i][j] = i + j;
+			b[i][j] = (i * j) % 7;
+		}
+	}
+
+	for (int i = 0; i < N; i++) {
+		for (int j = 0; j < N; j++) {
+			double sum = 0;
+			for (int k = 0; k < N; k++)
+				sum += a[i][k] * b[k][j];
+			c[i][j] = sum;
+		}
+	}
+
+	double trace = 0;
+	for (int i = 0; i < N; i++)
+		trace += c[i][i];
+
+	return (int) trace;
+}
+
+unsigned bench_crc32() __attribute__((export_name("bench_crc32"))) {
+	for (int i = 0; i < 16384; i++)
+		buffer[i] = i * 7;
+
+	unsigned crc = 0xFFFFFFFF;
+	for (int i = 0; i < 16384; i++) {
+		crc ^= buffer[i];
+		for (int k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+int bench_sort() __attribute__((export_name("bench_sort"))) {
+	unsigned seed = 12345;
+	for (int i = 0; i < 4096; i++) {
+		seed = seed * 1103515245 + 12345;
+		sorted[i] = seed >> 8;
+	}
+
+	// Shell sort, gaps from Ciura
+	static const int gaps[8] = { 701, 301, 132, 57, 23, 10, 4, 1 };
+	for (int g = 0; g < 8; g++) {
+		int gap = gaps[g];
+		for (int i = gap; i < 4096; i++) {
+			int v = sorted[i], j = i;
+			for (; j >= gap && sorted[j - gap] > v; j -= gap)
+				sorted[j] = sorted[j - gap];
+			sorted[j] = v;
+		}
+	}
+
+	return sorted[0] ^ sorted[2048] ^ sorted[4095];
+}
+
+int bench_mandelbrot() __attribute__((export_name("bench_mandelbrot"))) {
+	int inside = 0;
+	for (int y = 0; y < 64; y++) {
+		for (int x = 0; x < 64; x++) {
+			float cr = x / 32.0f - 1.5f, ci = y / 32.0f - 1.0f;
+			float zr = 0, zi = 0;
+			int i = 0;
+			for (; i < 100 && zr * zr + zi * zi < 4.0f; i++) {
+				float t = zr * zr - zi * zi + cr;
+				zi = 2 * zr * zi + ci;
+				zr = t;
+			}
+			inside += i == 100;
+		}
+	}
+
+	return inside;
+}
+
+long long bench_i64() __attribute__((export_name("bench_i64"))) {
+	unsigned long long x = 88172645463325252ULL, sum = 0;
+	for (int i = 0; i < 100000; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		sum += x % 1000003;
+	}
+
+	return sum;
+}
+
+unsigned bench_indirect() __attribute__((export_name("bench_indirect"))) {
+	unsigned acc = 1;
+	for (unsigned i = 0; i < 100000; i++)
+		acc = ops[i & 3](acc, i);
+
+	return acc;
+}
+
+void _start() __attribute__((export_name("_start"))) {
+	bench_fib();
+}
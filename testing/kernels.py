@@ -0,0 +1,237 @@
+# Writes kernels.wasm, the module the "bench interp" numbers in the log
+# are taken from. Simpler kernels than kernels.c's, assembled by hand for
+# machines without clang to build that with. With a count and a file name
+# it also writes count copies of the loops for "bench validate"
+#
+#   python3 testing/kernels.py [out.wasm [count big.wasm]]
+import os
+import sys
+from wasmgen import *
+
+types = [([I32], [I32]), ([I32, I32], [I32]), ([], []), ([I64], [I64]), ([I32], [F64]), ([], [I32]),
+         ([], [I32]), ([], [I64]), ([], [F64])]
+
+fib="""local.get 0
+i32.const 2
+i32.lt_u
+if i32
+local.get 0
+else
+local.get 0
+i32.const 1
+i32.sub
+call 0
+local.get 0
+i32.const 2
+i32.sub
+call 0
+i32.add
+end"""
+# sum of i*i for i < n
+loopsum="""i32.const 0
+local.set 1
+i32.const 0
+local.set 2
+block
+loop
+local.get 2
+local.get 0
+i32.ge_u
+br_if 1
+local.get 1
+local.get 2
+local.get 2
+i32.mul
+i32.add
+local.set 1
+local.get 2
+i32.const 1
+i32.add
+local.set 2
+br 0
+end
+end
+local.get 1"""
+# fills memory with i and sums it back
+memsum="""i32.const 0
+local.set 1
+block
+loop
+local.get 1
+local.get 0
+i32.ge_u
+br_if 1
+local.get 1
+i32.const 2
+i32.shl
+local.get 1
+i32.store 2 0
+local.get 1
+i32.const 1
+i32.add
+local.set 1
+br 0
+end
+end
+i32.const 0
+local.set 2
+i32.const 0
+local.set 1
+block
+loop
+local.get 1
+local.get 0
+i32.ge_u
+br_if 1
+local.get 2
+local.get 1
+i32.const 2
+i32.shl
+i32.load 2 0
+i32.add
+local.set 2
+local.get 1
+i32.const 1
+i32.add
+local.set 1
+br 0
+end
+end
+local.get 2"""
+# a br_table on i % 4 in a loop
+switch="""i32.const 0
+local.set 1
+i32.const 0
+local.set 2
+block
+loop
+local.get 1
+local.get 0
+i32.ge_u
+br_if 1
+block
+block
+block
+block
+local.get 1
+i32.const 3
+i32.and
+br_table 0 1 2 3
+end
+local.get 2
+i32.const 1
+i32.add
+local.set 2
+br 2
+end
+local.get 2
+i32.const 3
+i32.add
+local.set 2
+br 1
+end
+local.get 2
+i32.const 5
+i32.add
+local.set 2
+end
+local.get 1
+i32.const 1
+i32.add
+local.set 1
+br 0
+end
+end
+local.get 2"""
+# n! mod 1000000007
+i64loop="""i64.const 1
+local.set 1
+block
+loop
+local.get 0
+i64.eqz
+br_if 1
+local.get 1
+local.get 0
+i64.mul
+i64.const 1000000007
+i64.rem_u
+local.set 1
+local.get 0
+i64.const 1
+i64.sub
+local.set 0
+br 0
+end
+end
+local.get 1"""
+# sum of 1/i
+f64loop="""f64.const 0
+local.set 1
+block
+loop
+local.get 0
+i32.eqz
+br_if 1
+local.get 1
+f64.const 1
+local.get 0
+f64.convert_i32_u
+f64.div
+f64.add
+local.set 1
+local.get 0
+i32.const 1
+i32.sub
+local.set 0
+br 0
+end
+end
+local.get 1"""
+# sum of f(i), f alternating between add1 and dbl through the table
+indirect="""i32.const 0
+local.set 1
+i32.const 0
+local.set 2
+block
+loop
+local.get 1
+local.get 0
+i32.ge_u
+br_if 1
+local.get 2
+local.get 1
+local.get 1
+i32.const 1
+i32.and
+call_indirect 0
+i32.add
+local.set 2
+local.get 1
+i32.const 1
+i32.add
+local.set 1
+br 0
+end
+end
+local.get 2"""
+add1="local.get 0\ni32.const 1\ni32.add"
+dbl="local.get 0\ni32.const 1\ni32.shl"
+kernels = [(0, [], fib), (0, [I32, I32], loopsum), (0, [I32, I32], memsum), (0, [I32, I32], switch),
+           (3, [I64], i64loop), (4, [F64], f64loop), (0, [I32, I32], indirect), (0, [], add1), (0, [], dbl)]
+names = ['fib', 'loopsum', 'memsum', 'switch', 'i64loop', 'f64loop', 'indirect']
+
+# bench_ exports take nothing, like kernels.c's
+wrappers = [(6, [], 'i32.const 27\ncall 0'), (6, [], 'i32.const 1000000\ncall 1'), (6, [], 'i32.const 60000\ncall 2'),
+            (6, [], 'i32.const 1000000\ncall 3'), (7, [], 'i64.const 1000000\ncall 4'), (8, [], 'i32.const 1000000\ncall 5'),
+            (6, [], 'i32.const 300000\ncall 6')]
+exports = [('bench_' + n, 0, len(kernels) + i) for i, n in enumerate(names)]
+
+out = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(os.path.abspath(__file__)), 'kernels.wasm')
+with open(out, 'wb') as f:
+    f.write(module(types, kernels + wrappers, exports=exports, memory=4, table=2, elems=[7, 8]))
+
+if len(sys.argv) > 3:
+    copies = [(t, l, b) for _ in range(int(sys.argv[2])) for t, l, b in kernels[1:7]]
+    with open(sys.argv[3], 'wb') as f:
+        f.write(module(types, copies, memory=4, table=2))
@@ -0,0 +1,136 @@
+# Builds small wasm modules by hand, for what clang cannot be asked to
+# produce and for machines that have no clang. Bodies are written one
+# instruction per line with integer immediates, see asm()
+import os
+import struct
+
+I32, I64, F32, F64 = 0x7F, 0x7E, 0x7D, 0x7C
+
+# Opcode numbers come straight from the library's own list
+OPCODES = {}
+with open(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'include', 'opcodes.h')) as f:
+    for line in f:
+        line = line.strip()
+        if line.startswith('WASM_OP_'):
+            name, value = line.rstrip(',').split('=')
+            OPCODES[name.strip()[len('WASM_OP_'):].lower()] = int(value, 16)
+
+BLOCKTYPES = {'': 0x40, 'i32': I32, 'i64': I64, 'f32': F32, 'f64': F64}
+
+
+def uleb(n):
+    out = b''
+    while True:
+        b = n & 0x7F
+        n >>= 7
+        if not n:
+            return out + bytes([b])
+        out += bytes([b | 0x80])
+
+
+def sleb(n):
+    out = b''
+    while True:
+        b = n & 0x7F
+        n >>= 7
+        if (n == 0 and not b & 0x40) or (n == -1 and b & 0x40):
+            return out + bytes([b])
+        out += bytes([b | 0x80])
+
+
+def name(s):
+    s = s.encode()
+    return uleb(len(s)) + s
+
+
+def section(id, body):
+    return bytes([id]) + uleb(len(body)) + body
+
+
+def vec(items):
+    return uleb(len(items)) + b''.join(items)
+
+
+def asm(text):
+    """One instruction per line, ';' starts a comment. Immediates are
+    integers except for the float constants and blocktypes"""
+    out = b''
+    for line in text.split('\n'):
+        line = line.split(';')[0].strip()
+        if not line:
+            continue
+
+        words = line.split()
+        op = words[0].replace('.', '_')
+        args = words[1:]
+        code = OPCODES[op]
+        out += bytes([0xFC]) + uleb(code & 0xFF) if code > 0xFF else bytes([code])
+
+        if op in ('block', 'loop', 'if'):
+            out += bytes([BLOCKTYPES[args[0] if args else '']])
+        elif op in ('br', 'br_if', 'call', 'local_get', 'local_set', 'local_tee', 'global_get', 'global_set'):
+            out += uleb(int(args[0]))
+        elif op == 'br_table':
+            out += uleb(len(args) - 1) + b''.join(uleb(int(x)) for x in args)
+        elif op == 'call_indirect':
+            out += uleb(int(args[0])) + b'\x00'
+        elif 'load' in op or 'store' in op:
+            out += uleb(int(args[0])) + uleb(int(args[1]))
+        elif op in ('memory_size', 'memory_grow'):
+            out += bytes([int(args[0]) if args else 0])
+        elif op in ('i32_const', 'i64_const'):
+            out += sleb(int(args[0], 0))
+        elif op == 'f32_const':
+            out += struct.pack('<f', float(args[0]))
+        elif op == 'f64_const':
+            out += struct.pack('<d', float(args[0]))
+    return out
+
+
+def module(types, funcs, imports=(), exports=(), memory=None, table=None, elems=(), globals_=(), data=(), start=None):
+    """types:    (params, results) pairs
+    funcs:    (type index, extra locals, body) triples
+    imports:  (module, name, what), what is a type index for a function
+              and ('global', valtype, mutable) for a global
+    exports:  (name, kind, index), kind 0 is a function
+    memory and table are their minimum size, elems go in the table from 0
+    globals_: (valtype, mutable, initializer)
+    data:     (offset, bytes)"""
+    def describe(what):
+        if isinstance(what, tuple):
+            return b'\x03' + bytes([what[1], what[2]])
+        return b'\x00' + uleb(what)
+
+    m = b'\0asm' + struct.pack('<I', 1)
+    m += section(1, vec([b'\x60' + vec([bytes([p]) for p in ps]) + vec([bytes([r]) for r in rs]) for ps, rs in types]))
+    if imports:
+        m += section(2, vec([name(mod) + name(n) + describe(what) for mod, n, what in imports]))
+    m += section(3, vec([uleb(t) for t, _, _ in funcs]))
+    if table is not None:
+        m += section(4, vec([b'\x70\x00' + uleb(table)]))
+    if memory is not None:
+        m += section(5, vec([b'\x00' + uleb(memory)]))
+    if globals_:
+        m += section(6, vec([bytes([t, mut]) + asm(init) + b'\x0b' for t, mut, init in globals_]))
+    if exports:
+        m += section(7, vec([name(n) + bytes([kind]) + uleb(i) for n, kind, i in exports]))
+    if start is not None:
+        m += section(8, uleb(start))
+    if elems:
+        m += section(9, vec([uleb(0) + b'\x41\x00\x0b' + vec([uleb(f) for f in elems])]))
+
+    bodies = []
+    for _, locals_, text in funcs:
+        runs = []
+        for l in locals_:
+            if runs and runs[-1][1] == l:
+                runs[-1][0] += 1
+            else:
+                runs.append([1, l])
+        body = vec([uleb(n) + bytes([l]) for n, l in runs]) + asm(text) + b'\x0b'
+        bodies.append(uleb(len(body)) + body)
+    m += section(10, vec(bodies))
+
+    if data:
+        m += section(11, vec([uleb(0) + b'\x41' + sleb(offset) + b'\x0b' + vec([bytes([x]) for x in bs]) for offset, bs in data]))
+    return m